@@ -65,6 +65,7 @@ t_instruction *newInstruction(int opcode)
   result->label = NULL;
   result->addressParam = NULL;
   result->comment = NULL;
+  result->location = nullFileLocation;
   return result;
 }
 
@@ -318,6 +319,7 @@ void addInstruction(t_program *program, t_instruction *instr)
   program->pendingLabel = NULL;
 
   // Add a comment with the line number.
+  instr->location = curFileLoc;
   if (curFileLoc.row >= 0 &&
       (curFileLoc.file != lastFileLoc.file ||
           curFileLoc.row != lastFileLoc.row)) {
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "list.h"
+#include "errors.h"
 
 /**
  * @defgroup program Program Intermediate Representation
@@ -77,6 +78,9 @@ typedef struct {
   t_label *addressParam; ///< Address argument.
   /// A comment string associated with the instruction, or NULL if none.
   char *comment;
+  /// The source code location the instruction was generated from, or
+  /// nullFileLocation if unknown.
+  t_fileLocation location;
 } t_instruction;
 
 /** A structure that represents the properties of a given symbol in the source
@@ -459,6 +459,42 @@ bool printInstruction(t_instruction *instr, FILE *fp, bool machineRegIDs)
   return true;
 }
 
+/** Prints a .file directive for each new source file and a .loc directive
+ * every time the source line changes, so that the assembler can produce a
+ * line table. Instructions without a location (for example spill code) are
+ * attributed to the last line printed. */
+static bool printSourceLocation(t_instruction *instr, t_listNode **files,
+    t_fileLocation *lastLoc, FILE *fp)
+{
+  t_fileLocation loc = instr->location;
+  if (loc.file == NULL || loc.row < 0)
+    return true;
+  if (loc.file == lastLoc->file && loc.row == lastLoc->row)
+    return true;
+
+  t_listNode *fileNode = listFind(*files, loc.file);
+  if (fileNode == NULL) {
+    *files = listInsert(*files, loc.file, -1);
+    fileNode = listGetLastNode(*files);
+    if (fprintf(fp, "%-8s.file %d \"", "",
+            listNodePosition(*files, fileNode) + 1) < 0)
+      return false;
+    for (char *p = loc.file; *p; p++) {
+      if (*p == '"' && fputc('\\', fp) == EOF)
+        return false;
+      if (fputc(*p, fp) == EOF)
+        return false;
+    }
+    if (fprintf(fp, "\"\n") < 0)
+      return false;
+  }
+  if (fprintf(fp, "%-8s.loc %d %d\n", "",
+          listNodePosition(*files, fileNode) + 1, loc.row + 1) < 0)
+    return false;
+  *lastLoc = loc;
+  return true;
+}
+
 bool translateCodeSegment(t_program *program, FILE *fp)
 {
   if (!program->instructions)
@@ -468,19 +504,27 @@ bool translateCodeSegment(t_program *program, FILE *fp)
   if (fprintf(fp, "%-8s.text\n", "") < 0)
     return false;
 
+  t_listNode *files = NULL;
+  t_fileLocation lastLoc = nullFileLocation;
   t_listNode *curNode = program->instructions;
   while (curNode != NULL) {
     t_instruction *curInstr = (t_instruction *)curNode->data;
     if (curInstr == NULL)
       fatalError("bug: NULL instruction found in the program");
 
-    if (!printInstruction(curInstr, fp, true))
+    if (!printSourceLocation(curInstr, &files, &lastLoc, fp)) {
+      deleteList(files);
       return false;
-    if (fprintf(fp, "\n") < 0)
+    }
+
+    if (!printInstruction(curInstr, fp, true) || fprintf(fp, "\n") < 0) {
+      deleteList(files);
       return false;
+    }
 
     curNode = curNode->next;
   }
+  deleteList(files);
   return true;
 }
 
@@ -161,6 +161,9 @@ bool encPhysicalInstruction(t_instruction instr, uint32_t pc, t_data *res)
       {  INSTR_OPC_BGEU, 'B', ENC_OPCODE_BRANCH,  7,         0},
       { INSTR_OPC_ECALL, 'I', ENC_OPCODE_SYSTEM,  0,         0},
       {INSTR_OPC_EBREAK, 'I', ENC_OPCODE_SYSTEM,  0,         1},
+      { INSTR_OPC_CSRRW, 'I', ENC_OPCODE_SYSTEM,  1,         0},
+      { INSTR_OPC_CSRRS, 'I', ENC_OPCODE_SYSTEM,  2,         0},
+      { INSTR_OPC_CSRRC, 'I', ENC_OPCODE_SYSTEM,  3,         0},
       {              -1,  -1,                -1, -1,        -1}
   };
   const t_encInstrData *info;
@@ -350,6 +353,41 @@ int encExpandPseudoInstruction(
       mInstSz++;
       break;
 
+    case INSTR_OPC_CSRR:
+      mInstBuf[mInstSz].opcode = INSTR_OPC_CSRRS;
+      mInstBuf[mInstSz].dest = instr.dest;
+      mInstBuf[mInstSz].src1 = 0;
+      mInstBuf[mInstSz].immMode = INSTR_IMM_CONST;
+      mInstBuf[mInstSz].constant = instr.constant;
+      mInstSz++;
+      break;
+
+    case INSTR_OPC_CSRW:
+      mInstBuf[mInstSz].opcode = INSTR_OPC_CSRRW;
+      mInstBuf[mInstSz].dest = 0;
+      mInstBuf[mInstSz].src1 = instr.src1;
+      mInstBuf[mInstSz].immMode = INSTR_IMM_CONST;
+      mInstBuf[mInstSz].constant = instr.constant;
+      mInstSz++;
+      break;
+
+    case INSTR_OPC_RDCYCLE:
+    case INSTR_OPC_RDTIME:
+    case INSTR_OPC_RDINSTRET:
+      mInstBuf[mInstSz].constant = 0xC00 + instr.opcode - INSTR_OPC_RDCYCLE;
+      goto all_counter_reads;
+    case INSTR_OPC_RDCYCLEH:
+    case INSTR_OPC_RDTIMEH:
+    case INSTR_OPC_RDINSTRETH:
+      mInstBuf[mInstSz].constant = 0xC80 + instr.opcode - INSTR_OPC_RDCYCLEH;
+    all_counter_reads:
+      mInstBuf[mInstSz].opcode = INSTR_OPC_CSRRS;
+      mInstBuf[mInstSz].dest = instr.dest;
+      mInstBuf[mInstSz].src1 = 0;
+      mInstBuf[mInstSz].immMode = INSTR_IMM_CONST;
+      mInstSz++;
+      break;
+
     case INSTR_OPC_J:
       mInstBuf[mInstSz].opcode = INSTR_OPC_JAL;
       mInstBuf[mInstSz].dest = 0;
@@ -362,8 +400,11 @@ int encExpandPseudoInstruction(
       mInstBuf[mInstSz++] = instr;
   }
 
-  for (int i = 0; i < mInstSz; i++)
+  for (int i = 0; i < mInstSz; i++) {
     mInstBuf[i].location = instr.location;
+    mInstBuf[i].srcFile = instr.srcFile;
+    mInstBuf[i].srcLine = instr.srcLine;
+  }
   return mInstSz;
 }
 
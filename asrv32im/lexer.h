@@ -30,6 +30,8 @@ enum {
   TOK_ALIGN,
   TOK_BALIGN,
   TOK_GLOBAL,
+  TOK_FILE,
+  TOK_LOC,
   TOK_HI,
   TOK_LO,
   TOK_PCREL_HI,
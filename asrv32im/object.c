@@ -23,6 +23,11 @@ struct t_object {
   t_objSection *data;
   t_objSection *text;
   t_objLabel *labelList;
+  /* source file names indexed by the .file number minus one */
+  char **srcFiles;
+  int32_t numSrcFiles;
+  t_objLineEntry *lineTable;
+  size_t lineTableSize;
 };
 
 
@@ -68,6 +73,10 @@ t_object *newObject(void)
   obj->data = newSection(OBJ_SECTION_DATA);
   obj->text = newSection(OBJ_SECTION_TEXT);
   obj->labelList = NULL;
+  obj->srcFiles = NULL;
+  obj->numSrcFiles = 0;
+  obj->lineTable = NULL;
+  obj->lineTableSize = 0;
   return obj;
 }
 
@@ -88,6 +97,10 @@ void deleteObject(t_object *obj)
     free(lbl);
   }
 
+  for (int32_t i = 0; i < obj->numSrcFiles; i++)
+    free(obj->srcFiles[i]);
+  free(obj->srcFiles);
+  free(obj->lineTable);
   free(obj);
 }
 
@@ -121,6 +134,51 @@ t_objLabel *objGetLabel(t_object *obj, const char *name)
 }
 
 
+bool objSetSourceFile(t_object *obj, int32_t id, const char *name)
+{
+  if (id < 1)
+    return false;
+  if (id > obj->numSrcFiles) {
+    char **newFiles = realloc(obj->srcFiles, sizeof(char *) * (size_t)id);
+    if (!newFiles)
+      fatalError("out of memory");
+    for (int32_t i = obj->numSrcFiles; i < id; i++)
+      newFiles[i] = NULL;
+    obj->srcFiles = newFiles;
+    obj->numSrcFiles = id;
+  }
+  if (obj->srcFiles[id - 1])
+    return strcmp(obj->srcFiles[id - 1], name) == 0;
+  obj->srcFiles[id - 1] = strdup(name);
+  if (!obj->srcFiles[id - 1])
+    fatalError("out of memory");
+  return true;
+}
+
+bool objIsSourceFileDeclared(t_object *obj, int32_t id)
+{
+  return id >= 1 && id <= obj->numSrcFiles && obj->srcFiles[id - 1];
+}
+
+int32_t objGetSourceFileCount(t_object *obj)
+{
+  return obj->numSrcFiles;
+}
+
+const char *objGetSourceFile(t_object *obj, int32_t id)
+{
+  if (!objIsSourceFileDeclared(obj, id))
+    return "";
+  return obj->srcFiles[id - 1];
+}
+
+t_objLineEntry *objGetLineTable(t_object *obj, size_t *count)
+{
+  *count = obj->lineTableSize;
+  return obj->lineTable;
+}
+
+
 t_objSection *objGetSection(t_object *obj, t_objSectionID id)
 {
   if (id == OBJ_SECTION_TEXT)
@@ -348,6 +406,37 @@ static bool objSecResolveImmediates(t_objSection *sec)
   return true;
 }
 
+static void objBuildLineTable(t_object *obj)
+{
+  size_t capacity = 0;
+  t_objLineEntry last = {0};
+
+  if (obj->numSrcFiles == 0)
+    return;
+  for (t_objSecItem *itm = obj->text->items; itm != NULL; itm = itm->next) {
+    if (itm->class != OBJ_SEC_ITM_CLASS_INSTR)
+      continue;
+    t_objLineEntry entry = {itm->address, 0, 0};
+    if (itm->body.instr.srcLine > 0) {
+      entry.file = (uint32_t)itm->body.instr.srcFile;
+      entry.line = (uint32_t)itm->body.instr.srcLine;
+    }
+    if (obj->lineTableSize > 0 && entry.file == last.file &&
+        entry.line == last.line)
+      continue;
+    if (obj->lineTableSize == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      t_objLineEntry *newTable =
+          realloc(obj->lineTable, sizeof(t_objLineEntry) * capacity);
+      if (!newTable)
+        fatalError("out of memory");
+      obj->lineTable = newTable;
+    }
+    obj->lineTable[obj->lineTableSize++] = entry;
+    last = entry;
+  }
+}
+
 static bool objSecMaterializeInstructions(t_objSection *sec)
 {
   t_objSecItem *itm;
@@ -387,6 +476,9 @@ bool objMaterialize(t_object *obj)
   if (!objSecResolveImmediates(obj->data))
     return false;
 
+  // Record the source lines of the instructions
+  objBuildLineTable(obj);
+
   // Transform instructions into data
   if (!objSecMaterializeInstructions(obj->text))
     return false;
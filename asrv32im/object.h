@@ -67,6 +67,9 @@ enum {
   INSTR_OPC_BGE,
   INSTR_OPC_BLTU,
   INSTR_OPC_BGEU,
+  INSTR_OPC_CSRRW,
+  INSTR_OPC_CSRRS,
+  INSTR_OPC_CSRRC,
   /* pseudo-instructions */
   INSTR_OPC_NOP,
   INSTR_OPC_LI,
@@ -89,7 +92,15 @@ enum {
   INSTR_OPC_BLEZ,
   INSTR_OPC_BGEZ,
   INSTR_OPC_BLTZ,
-  INSTR_OPC_BGTZ
+  INSTR_OPC_BGTZ,
+  INSTR_OPC_CSRR,
+  INSTR_OPC_CSRW,
+  INSTR_OPC_RDCYCLE, // keep the counter reads in the same order as their CSRs
+  INSTR_OPC_RDTIME,
+  INSTR_OPC_RDINSTRET,
+  INSTR_OPC_RDCYCLEH,
+  INSTR_OPC_RDTIMEH,
+  INSTR_OPC_RDINSTRETH
 };
 
 typedef int t_instrImmMode;
@@ -112,6 +123,9 @@ typedef struct t_instruction {
   int32_t constant;
   t_objLabel *label;
   t_fileLocation location;
+  /* source line set by the last .loc directive, 0 if none */
+  int32_t srcFile;
+  int32_t srcLine;
 } t_instruction;
 
 #define DATA_MAX 16
@@ -130,6 +144,14 @@ typedef struct t_alignData {
   t_fileLocation location;
 } t_alignData;
 
+/* Entry of the line table. Each entry covers the instructions from its
+ * address up to the address of the next entry. */
+typedef struct t_objLineEntry {
+  uint32_t address;
+  uint32_t file;
+  uint32_t line; /* 0 if the instructions have no source line */
+} t_objLineEntry;
+
 typedef int t_objSecItemClass;
 enum {
   OBJ_SEC_ITM_CLASS_INSTR,
@@ -157,6 +179,12 @@ t_objLabel *objFindLabel(t_object *obj, const char *name);
 t_objLabel *objGetLabel(t_object *obj, const char *name);
 void objDump(t_object *obj);
 
+bool objSetSourceFile(t_object *obj, int32_t id, const char *name);
+bool objIsSourceFileDeclared(t_object *obj, int32_t id);
+int32_t objGetSourceFileCount(t_object *obj);
+const char *objGetSourceFile(t_object *obj, int32_t id);
+t_objLineEntry *objGetLineTable(t_object *obj, size_t *count);
+
 t_objSection *objGetSection(t_object *obj, t_objSectionID id);
 t_objSectionID objSecGetID(t_objSection *sec);
 void objSecAppendData(t_objSection *sec, t_data data);
@@ -239,6 +239,54 @@ t_outError outputSecContentToFile(FILE *fp, off_t whence, t_objSection *sec)
 }
 
 
+/* The line table section starts with the number of source files and of
+ * entries (32 bit each), followed by the null-terminated file names padded to
+ * a multiple of 4 bytes, and by the entries: address, file number (1 for the
+ * first file name) and line, 32 bit each. All values are little-endian. */
+#define LINES_SECTION_NAME ".acse.lines"
+
+static void outputPutWord(uint8_t *p, uint32_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = (v >> 24) & 0xFF;
+}
+
+static uint8_t *outputLineTable(t_object *obj, size_t *outSize)
+{
+  size_t numEntries;
+  t_objLineEntry *entries = objGetLineTable(obj, &numEntries);
+  int32_t numFiles = objGetSourceFileCount(obj);
+
+  size_t namesSize = 0;
+  for (int32_t i = 1; i <= numFiles; i++)
+    namesSize += strlen(objGetSourceFile(obj, i)) + 1;
+  namesSize = (namesSize + 3) & ~(size_t)3;
+  size_t size = 8 + namesSize + numEntries * 12;
+
+  uint8_t *buf = calloc(size, sizeof(uint8_t));
+  if (!buf)
+    fatalError("out of memory");
+  outputPutWord(buf, (uint32_t)numFiles);
+  outputPutWord(buf + 4, (uint32_t)numEntries);
+  char *name = (char *)buf + 8;
+  for (int32_t i = 1; i <= numFiles; i++) {
+    strcpy(name, objGetSourceFile(obj, i));
+    name += strlen(name) + 1;
+  }
+  uint8_t *entry = buf + 8 + namesSize;
+  for (size_t i = 0; i < numEntries; i++, entry += 12) {
+    outputPutWord(entry, entries[i].address);
+    outputPutWord(entry + 4, entries[i].file);
+    outputPutWord(entry + 8, entries[i].line);
+  }
+
+  *outSize = size;
+  return buf;
+}
+
+
 enum {
   PRG_ID_TEXT = 0,
   PRG_ID_DATA,
@@ -250,6 +298,7 @@ enum {
   SEC_ID_TEXT,
   SEC_ID_DATA,
   SEC_ID_SYMTAB,
+  SEC_ID_LINES, // only present with line information
   SEC_NUM
 };
 
@@ -285,6 +334,16 @@ t_outError outputToELF(t_object *obj, const char *fname)
   head.e.e_phnum = PRG_NUM;
   head.e.e_shentsize = sizeof(Elf32_Shdr);
   head.e.e_shnum = SEC_NUM;
+
+  uint8_t *lines = NULL;
+  size_t linesSize = 0;
+  size_t headSize = sizeof(t_outputELFHead);
+  if (objGetSourceFileCount(obj) > 0) {
+    lines = outputLineTable(obj, &linesSize);
+  } else {
+    head.e.e_shnum = SEC_NUM - 1;
+    headSize -= sizeof(Elf32_Shdr);
+  }
   head.e.e_shstrndx = SEC_ID_SYMTAB;
 
   t_objLabel *l_entry = objFindLabel(obj, "_start");
@@ -296,7 +355,7 @@ t_outError outputToELF(t_object *obj, const char *fname)
     head.e.e_entry = objLabelGetPointer(l_entry);
   }
 
-  Elf32_Addr textAddr = sizeof(t_outputELFHead);
+  Elf32_Addr textAddr = (Elf32_Addr)headSize;
   Elf32_Addr dataAddr = textAddr + objSecGetSize(text);
   Elf32_Addr strtabAddr = dataAddr + objSecGetSize(data);
 
@@ -306,6 +365,10 @@ t_outError outputToELF(t_object *obj, const char *fname)
   outStrTblAddString(&strTbl, ".text", &textSecName);
   outStrTblAddString(&strTbl, ".data", &dataSecName);
   outStrTblAddString(&strTbl, ".strtab", &strtabSecName);
+  Elf32_Word linesSecName = 0;
+  if (lines)
+    outStrTblAddString(&strTbl, LINES_SECTION_NAME, &linesSecName);
+  Elf32_Addr linesAddr = strtabAddr + (Elf32_Addr)strTbl.tail;
 
   head.p[PRG_ID_TEXT] = outputSecToELFPHdr(text, textAddr, PF_R + PF_X);
   head.p[PRG_ID_DATA] = outputSecToELFPHdr(data, dataAddr, PF_R + PF_W);
@@ -316,13 +379,19 @@ t_outError outputToELF(t_object *obj, const char *fname)
       outputSecToELFSHdr(data, dataAddr, dataSecName, SHF_ALLOC + SHF_WRITE);
   head.s[SEC_ID_SYMTAB] =
       outputStrTabToELFSHdr(&strTbl, strtabAddr, strtabSecName);
+  if (lines) {
+    head.s[SEC_ID_LINES].sh_name = linesSecName;
+    head.s[SEC_ID_LINES].sh_type = SHT_PROGBITS;
+    head.s[SEC_ID_LINES].sh_offset = linesAddr;
+    head.s[SEC_ID_LINES].sh_size = (Elf32_Word)linesSize;
+  }
 
   FILE *fp = fopen(fname, "wb");
   if (fp == NULL) {
     res = OUT_FILE_ERROR;
     goto exit;
   }
-  if (fwrite(&head, sizeof(t_outputELFHead), 1, fp) < 1) {
+  if (fwrite(&head, headSize, 1, fp) < 1) {
     res = OUT_FILE_ERROR;
     goto exit;
   }
@@ -335,8 +404,16 @@ t_outError outputToELF(t_object *obj, const char *fname)
   res = outputStrTabContentToFile(fp, strtabAddr, &strTbl);
   if (res != OUT_NO_ERROR)
     goto exit;
+  if (lines) {
+    if (fseeko(fp, linesAddr, SEEK_SET) < 0 ||
+        fwrite(lines, linesSize, 1, fp) < 1) {
+      res = OUT_FILE_ERROR;
+      goto exit;
+    }
+  }
 
 exit:
+  free(lines);
   deinitOutStrTbl(&strTbl);
   if (fp)
     fclose(fp);
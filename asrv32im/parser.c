@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <string.h>
 #include "parser.h"
 #include "errors.h"
 
@@ -29,6 +30,8 @@ typedef struct t_parserState {
   int numErrors;
   t_localLabel *backLabels;
   t_localLabel *forwardLabels;
+  int32_t srcFile;
+  int32_t srcLine;
 } t_parserState;
 
 
@@ -188,6 +191,74 @@ static t_parserError expectLabel(t_parserState *state, t_instruction *instr)
   return P_ACCEPT;
 }
 
+/* Parses names in the form <prefix>N and <prefix>Nh where 3 <= N <= 31 */
+static bool parseCounterName(
+    const char *id, const char *prefix, int32_t base, int32_t *res)
+{
+  size_t len = strlen(prefix);
+  if (strncmp(id, prefix, len) != 0 || !isdigit(id[len]))
+    return false;
+  char *end;
+  long n = strtol(id + len, &end, 10);
+  if (n < 3 || n > 31)
+    return false;
+  if (strcmp(end, "h") == 0)
+    base += 0x80;
+  else if (*end != '\0')
+    return false;
+  *res = base + (int32_t)n;
+  return true;
+}
+
+static t_parserError expectCSR(t_parserState *state, int32_t *res, bool last)
+{
+  static const struct {
+    const char *name;
+    int32_t number;
+  } names[] = {
+      {    "cycle", 0xC00},
+      {     "time", 0xC01},
+      {  "instret", 0xC02},
+      {   "cycleh", 0xC80},
+      {    "timeh", 0xC81},
+      { "instreth", 0xC82},
+      {   "mcycle", 0xB00},
+      { "minstret", 0xB02},
+      {  "mcycleh", 0xB80},
+      {"minstreth", 0xB82},
+      {       NULL,     0}
+  };
+
+  if (state->lookaheadToken->id == TOK_NUMBER) {
+    if (expectNumber(state, res, 0, 0xFFF) != P_ACCEPT)
+      return P_SYN_ERROR;
+  } else if (parserAccept(state, TOK_ID) == P_ACCEPT) {
+    const char *id = state->curToken->value.id;
+    int i;
+    for (i = 0; names[i].name != NULL; i++) {
+      if (strcmp(id, names[i].name) == 0)
+        break;
+    }
+    if (names[i].name != NULL) {
+      *res = names[i].number;
+    } else if (!parseCounterName(id, "hpmcounter", 0xC00, res) &&
+        !parseCounterName(id, "mhpmcounter", 0xB00, res)) {
+      emitError(state->curToken->location, "unknown CSR \"%s\"", id);
+      state->numErrors++;
+      return P_SYN_ERROR;
+    }
+  } else {
+    parserEmitError(state, "expected a CSR name or number");
+    return P_SYN_ERROR;
+  }
+
+  if (!last &&
+      parserExpect(state, TOK_COMMA, "CSR must be followed by a comma") !=
+          P_ACCEPT)
+    return P_SYN_ERROR;
+  return P_ACCEPT;
+}
+
 typedef int t_immSizeClass;
 enum {
   IMM_SIZE_5,
@@ -266,7 +337,11 @@ enum {
   FORMAT_BRANCH,   // mnemonic rs1, rs2, label
   FORMAT_BRANCH_Z, // mnemonic rs1, label
   FORMAT_JUMP,     // mnemonic label
-  FORMAT_SYSTEM    // mnemonic
+  FORMAT_SYSTEM,   // mnemonic
+  FORMAT_CSR,      // mnemonic rd, csr, rs1
+  FORMAT_CSRR,     // mnemonic rd, csr
+  FORMAT_CSRW,     // mnemonic csr, rs1
+  FORMAT_COUNTER   // mnemonic rd
 };
 
 static t_instrFormat instrOpcodeToFormat(t_instrOpcode opcode)
@@ -346,6 +421,21 @@ static t_instrFormat instrOpcodeToFormat(t_instrOpcode opcode)
     case INSTR_OPC_ECALL:
     case INSTR_OPC_EBREAK:
       return FORMAT_SYSTEM;
+    case INSTR_OPC_CSRRW:
+    case INSTR_OPC_CSRRS:
+    case INSTR_OPC_CSRRC:
+      return FORMAT_CSR;
+    case INSTR_OPC_CSRR:
+      return FORMAT_CSRR;
+    case INSTR_OPC_CSRW:
+      return FORMAT_CSRW;
+    case INSTR_OPC_RDCYCLE:
+    case INSTR_OPC_RDTIME:
+    case INSTR_OPC_RDINSTRET:
+    case INSTR_OPC_RDCYCLEH:
+    case INSTR_OPC_RDTIMEH:
+    case INSTR_OPC_RDINSTRETH:
+      return FORMAT_COUNTER;
   }
   return -1;
 }
@@ -356,6 +446,8 @@ static t_parserError expectInstruction(t_parserState *state)
   t_immSizeClass immSize;
   t_instruction instr = {0};
   instr.location = state->lookaheadToken->location;
+  instr.srcFile = state->srcFile;
+  instr.srcLine = state->srcLine;
 
   parserExpect(state, TOK_MNEMONIC, NULL);
   instr.opcode = state->curToken->value.mnemonic;
@@ -505,6 +597,34 @@ static t_parserError expectInstruction(t_parserState *state)
     case FORMAT_SYSTEM:
       break;
 
+    case FORMAT_CSR:
+      if (expectRegister(state, &instr.dest, false) != P_ACCEPT)
+        return P_SYN_ERROR;
+      if (expectCSR(state, &instr.constant, false) != P_ACCEPT)
+        return P_SYN_ERROR;
+      if (expectRegister(state, &instr.src1, true) != P_ACCEPT)
+        return P_SYN_ERROR;
+      break;
+
+    case FORMAT_CSRR:
+      if (expectRegister(state, &instr.dest, false) != P_ACCEPT)
+        return P_SYN_ERROR;
+      if (expectCSR(state, &instr.constant, true) != P_ACCEPT)
+        return P_SYN_ERROR;
+      break;
+
+    case FORMAT_CSRW:
+      if (expectCSR(state, &instr.constant, false) != P_ACCEPT)
+        return P_SYN_ERROR;
+      if (expectRegister(state, &instr.src1, true) != P_ACCEPT)
+        return P_SYN_ERROR;
+      break;
+
+    case FORMAT_COUNTER:
+      if (expectRegister(state, &instr.dest, true) != P_ACCEPT)
+        return P_SYN_ERROR;
+      break;
+
     default:
       return P_SYN_ERROR;
   }
@@ -748,6 +868,58 @@ static t_parserError expectAlign(t_parserState *state)
 }
 
 
+static t_parserError expectFile(t_parserState *state)
+{
+  int32_t id;
+
+  if (parserExpect(state, TOK_FILE, NULL) != P_ACCEPT)
+    return P_SYN_ERROR;
+  if (state->lookaheadToken->id != TOK_NUMBER) {
+    parserEmitError(state, "expected a file number");
+    return P_SYN_ERROR;
+  }
+  if (expectNumber(state, &id, 1, INT32_MAX) != P_ACCEPT)
+    return P_SYN_ERROR;
+  if (parserExpect(state, TOK_STRING, "expected a file name") != P_ACCEPT)
+    return P_SYN_ERROR;
+  char *bufBegin = state->curToken->value.string;
+  char *bufEnd = performStringEscapes(state->curToken->location, bufBegin);
+  *bufEnd = '\0';
+  if (!objSetSourceFile(state->object, id, bufBegin)) {
+    emitError(state->curToken->location, "file number already declared");
+    state->numErrors++;
+    return P_SYN_ERROR;
+  }
+  return parserExpect(state, TOK_NEWLINE, "expected end of the line");
+}
+
+static t_parserError expectLoc(t_parserState *state)
+{
+  int32_t id, line, column;
+
+  if (parserExpect(state, TOK_LOC, NULL) != P_ACCEPT)
+    return P_SYN_ERROR;
+  if (!objIsSourceFileDeclared(state->object,
+          state->lookaheadToken->id == TOK_NUMBER
+              ? state->lookaheadToken->value.number
+              : 0)) {
+    parserEmitError(state, "expected the number of a file declared by .file");
+    return P_SYN_ERROR;
+  }
+  if (expectNumber(state, &id, 1, INT32_MAX) != P_ACCEPT)
+    return P_SYN_ERROR;
+  if (expectNumber(state, &line, 0, INT32_MAX) != P_ACCEPT)
+    return P_SYN_ERROR;
+  // the column is accepted for compatibility but not recorded
+  if (state->lookaheadToken->id == TOK_NUMBER &&
+      expectNumber(state, &column, 0, INT32_MAX) != P_ACCEPT)
+    return P_SYN_ERROR;
+  state->srcFile = id;
+  state->srcLine = line;
+  return parserExpect(state, TOK_NEWLINE, "expected end of the line");
+}
+
+
 static t_parserError expectLineContent(t_parserState *state)
 {
   if (state->lookaheadToken->id == TOK_MNEMONIC)
@@ -787,6 +959,11 @@ static t_parserError expectLine(t_parserState *state)
         state, TOK_NEWLINE, ".global cannot have more than one argument");
   }
 
+  if (state->lookaheadToken->id == TOK_FILE)
+    return expectFile(state);
+  if (state->lookaheadToken->id == TOK_LOC)
+    return expectLoc(state);
+
   if (state->lookaheadToken->id == TOK_NUMBER) {
     int n = state->lookaheadToken->value.number;
     if (n < 0) {
@@ -828,6 +1005,8 @@ t_object *parseObject(t_lexer *lex)
   state.lookaheadToken = lexNextToken(lex);
   state.backLabels = NULL;
   state.forwardLabels = NULL;
+  state.srcFile = 0;
+  state.srcLine = 0;
 
   while (parserAccept(&state, TOK_EOF) != P_ACCEPT) {
     t_parserError err = expectLine(&state);
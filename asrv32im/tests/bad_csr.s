@@ -0,0 +1,9 @@
+csrr a0, cycles
+csrr a0, hpmcounter2
+csrr a0, hpmcounter32
+csrr a0, hpmcounter3x
+csrr a0, 0x1000
+csrr a0
+csrrs a0, cycle
+csrw a0, cycle
+rdcycle
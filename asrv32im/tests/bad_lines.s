@@ -0,0 +1,8 @@
+.file 0 "zero.src"
+.file 1 "main.src"
+.file 1 "other.src"
+.file 2
+.loc 3 1
+.loc 1
+.loc 1 5 1 1
+addi t0, zero, 10
@@ -0,0 +1,20 @@
+# Counter CSRs and their pseudo-instructions
+.text
+_start:
+  rdcycle a0
+  rdcycleh a1
+  rdtime t0
+  rdtimeh t1
+  rdinstret s0
+  rdinstreth s1
+  csrr a2, instret
+  csrr a3, hpmcounter3
+  csrr a4, mhpmcounter31h
+  csrr a5, 0xC1F
+  csrrs a6, cycle, zero
+  csrrw zero, mcycle, t2
+  csrrc a7, minstret, x0
+  csrw 0x7C0, a0
+  csrr t3, hpmcounter31
+  csrr t4, mhpmcounter3h
+  csrrs t5, 0, x1
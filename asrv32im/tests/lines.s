@@ -0,0 +1,17 @@
+.file 1 "main.src"
+.file 2 "lib.src"
+_start:
+.loc 1 3
+addi t0, zero, 10
+li t1, 0x12345
+.loc 2 10 5
+addi t0, t0, -1
+.loc 2 10
+addi t1, t1, 1
+.loc 1 4
+la t2, value
+lw t2, 0(t2)
+
+.data
+value:
+.word 42
@@ -0,0 +1,412 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include "batch.h"
+#include "vm.h"
+#include "loader.h"
+#include "supervisor.h"
+
+typedef int t_batchResult;
+enum {
+  BATCH_CASE_PASSED,
+  BATCH_CASE_WRONG_OUTPUT,
+  BATCH_CASE_WRONG_EXIT_CODE,
+  BATCH_CASE_MEMORY_FAULT,
+  BATCH_CASE_ILL_INST_FAULT,
+  BATCH_CASE_INVALID_SYSCALL,
+  BATCH_CASE_INST_LIMIT,
+  BATCH_CASE_TIMEOUT,
+  BATCH_CASE_LOAD_ERROR,
+  BATCH_CASE_FILE_ERROR,
+  BATCH_CASE_INTERNAL_ERROR
+};
+
+typedef struct {
+  char *path;
+  t_ldrImage *image; /* NULL if it could not be loaded */
+} t_batchExec;
+
+typedef struct {
+  unsigned line;
+  t_batchExec *exec;
+  char *input; /* NULL for no input */
+  char *expected; /* NULL if the output is not checked */
+  t_isaInt expectedExitCode;
+  t_batchResult result;
+  t_isaInt exitCode;
+  t_memAddress faultAddress;
+  size_t diffOffset; /* first byte of the output which differs */
+} t_batchCase;
+
+typedef struct {
+  const t_batchConfig *config;
+  t_batchCase *cases;
+  unsigned numCases;
+  /* the threads take the next case to run from a shared counter, so that
+   * they are all busy until the last cases */
+  pthread_mutex_t lock;
+  unsigned next;
+} t_batchQueue;
+
+
+static double batchGetTime(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static char *batchReadFile(const char *path, size_t *size)
+{
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return NULL;
+  size_t cap = 4096, len = 0;
+  char *buf = malloc(cap);
+  while (buf) {
+    len += fread(buf + len, 1, cap - len, fp);
+    if (len < cap)
+      break;
+    char *newBuf = realloc(buf, cap * 2);
+    if (newBuf == NULL) {
+      free(buf);
+      buf = NULL;
+    } else {
+      buf = newBuf;
+      cap *= 2;
+    }
+  }
+  if (buf && ferror(fp)) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+  *size = len;
+  return buf;
+}
+
+static void batchRunCase(const t_batchConfig *config, t_batchCase *test)
+{
+  if (test->exec->image == NULL) {
+    test->result = BATCH_CASE_LOAD_ERROR;
+    return;
+  }
+
+  size_t inputSize = 0, expectedSize = 0;
+  char *input = NULL, *expected = NULL;
+  if (test->input && !(input = batchReadFile(test->input, &inputSize))) {
+    test->result = BATCH_CASE_FILE_ERROR;
+    return;
+  }
+  if (test->expected &&
+      !(expected = batchReadFile(test->expected, &expectedSize))) {
+    free(input);
+    test->result = BATCH_CASE_FILE_ERROR;
+    return;
+  }
+
+  char *output = NULL;
+  size_t outputSize = 0;
+  FILE *in = NULL, *out = NULL;
+  t_vm *vm = vmNew();
+  test->result = BATCH_CASE_INTERNAL_ERROR;
+  if (vm == NULL)
+    goto cleanup;
+  if (inputSize > 0)
+    in = fmemopen(input, inputSize, "r");
+  else
+    in = fopen("/dev/null", "r");
+  out = open_memstream(&output, &outputSize);
+  if (in == NULL || out == NULL)
+    goto cleanup;
+
+  if (!cpuSetExecMode(vm, config->execMode))
+    cpuSetExecMode(vm, CPU_EXEC_INTERPRETER);
+  if (ldrLoadImage(vm, test->exec->image) != LDR_NO_ERROR ||
+      initSupervisor(vm, config->stackSize) != SV_NO_ERROR)
+    goto cleanup;
+  svSetIO(vm, in, out);
+  svSetInstructionLimit(vm, config->maxInstructions);
+  svSetTimeout(vm, config->timeout);
+
+  t_svStatus status = SV_STATUS_RUNNING;
+  while (status == SV_STATUS_RUNNING)
+    status = svVMTick(vm);
+  fclose(out);
+  out = NULL;
+
+  test->exitCode = svGetExitCode(vm);
+  if (status == SV_STATUS_MEMORY_FAULT) {
+    test->result = BATCH_CASE_MEMORY_FAULT;
+    test->faultAddress = memGetLastFaultAddress(vm);
+  } else if (status == SV_STATUS_ILL_INST_FAULT) {
+    test->result = BATCH_CASE_ILL_INST_FAULT;
+    test->faultAddress = cpuGetRegister(vm, CPU_REG_PC);
+  } else if (status == SV_STATUS_INVALID_SYSCALL) {
+    test->result = BATCH_CASE_INVALID_SYSCALL;
+    test->faultAddress = cpuGetRegister(vm, CPU_REG_PC);
+  } else if (status == SV_STATUS_INST_LIMIT || status == SV_STATUS_TIMEOUT) {
+    test->result = status == SV_STATUS_TIMEOUT ? BATCH_CASE_TIMEOUT
+                                               : BATCH_CASE_INST_LIMIT;
+    t_svHotPC hot;
+    if (svGetHotPCs(vm, &hot, 1, NULL) > 0)
+      test->faultAddress = hot.pc;
+  } else if (test->exitCode != test->expectedExitCode) {
+    test->result = BATCH_CASE_WRONG_EXIT_CODE;
+  } else if (expected && (outputSize != expectedSize ||
+                             memcmp(output, expected, outputSize) != 0)) {
+    test->result = BATCH_CASE_WRONG_OUTPUT;
+    size_t i = 0;
+    while (i < outputSize && i < expectedSize && output[i] == expected[i])
+      i++;
+    test->diffOffset = i;
+  } else {
+    test->result = BATCH_CASE_PASSED;
+  }
+
+cleanup:
+  if (out)
+    fclose(out);
+  if (in)
+    fclose(in);
+  vmFree(vm);
+  free(output);
+  free(expected);
+  free(input);
+}
+
+static void *batchWorkerMain(void *arg)
+{
+  t_batchQueue *queue = arg;
+  for (;;) {
+    pthread_mutex_lock(&queue->lock);
+    unsigned i = queue->next;
+    if (i < queue->numCases)
+      queue->next++;
+    pthread_mutex_unlock(&queue->lock);
+    if (i >= queue->numCases)
+      break;
+    batchRunCase(queue->config, &queue->cases[i]);
+  }
+  return NULL;
+}
+
+static void batchRunCases(
+    const t_batchConfig *config, t_batchCase *cases, unsigned numCases)
+{
+  t_batchQueue queue;
+  queue.config = config;
+  queue.cases = cases;
+  queue.numCases = numCases;
+  queue.next = 0;
+  pthread_mutex_init(&queue.lock, NULL);
+
+  /* the calling thread is one of the workers */
+  unsigned jobs = config->jobs ? config->jobs : 1;
+  if (jobs > numCases)
+    jobs = numCases;
+  pthread_t *threads = malloc(sizeof(pthread_t) * (jobs ? jobs : 1));
+  unsigned started = 0;
+  while (threads && started + 1 < jobs &&
+      pthread_create(&threads[started], NULL, batchWorkerMain, &queue) == 0)
+    started++;
+  batchWorkerMain(&queue);
+  for (unsigned t = 0; t < started; t++)
+    pthread_join(threads[t], NULL);
+
+  free(threads);
+  pthread_mutex_destroy(&queue.lock);
+}
+
+
+/* Prefixes the relative paths with the first dirLen characters of dir.
+ * Returns NULL for "-". */
+static char *batchPath(const char *dir, size_t dirLen, const char *path)
+{
+  if (strcmp(path, "-") == 0)
+    return NULL;
+  if (path[0] == '/')
+    dirLen = 0;
+  char *res = malloc(dirLen + strlen(path) + 1);
+  if (res) {
+    memcpy(res, dir, dirLen);
+    strcpy(res + dirLen, path);
+  }
+  return res;
+}
+
+static t_batchExec *batchGetExec(
+    t_batchExec **execs, unsigned *numExecs, char *path)
+{
+  for (unsigned i = 0; i < *numExecs; i++) {
+    if (strcmp(execs[i]->path, path) == 0) {
+      free(path);
+      return execs[i];
+    }
+  }
+  t_batchExec *exec = malloc(sizeof(t_batchExec));
+  if (exec == NULL) {
+    free(path);
+    return NULL;
+  }
+  exec->path = path;
+  if (ldrOpenELF(path, &exec->image) != LDR_NO_ERROR)
+    exec->image = NULL;
+  execs[(*numExecs)++] = exec;
+  return exec;
+}
+
+static const char *batchResultString(t_batchResult result)
+{
+  switch (result) {
+    case BATCH_CASE_WRONG_OUTPUT:
+      return "wrong output";
+    case BATCH_CASE_WRONG_EXIT_CODE:
+      return "wrong exit code";
+    case BATCH_CASE_MEMORY_FAULT:
+      return "memory fault";
+    case BATCH_CASE_ILL_INST_FAULT:
+      return "illegal instruction";
+    case BATCH_CASE_INVALID_SYSCALL:
+      return "invalid system call";
+    case BATCH_CASE_INST_LIMIT:
+      return "instruction limit reached";
+    case BATCH_CASE_TIMEOUT:
+      return "timeout";
+    case BATCH_CASE_LOAD_ERROR:
+      return "could not load the executable";
+    case BATCH_CASE_FILE_ERROR:
+      return "could not read the input or the expected output";
+    case BATCH_CASE_INTERNAL_ERROR:
+      return "could not create the VM";
+  }
+  return "passed";
+}
+
+static void batchPrintCase(FILE *fp, const t_batchCase *test)
+{
+  fprintf(fp, "FAIL line %u: %s < %s: %s", test->line, test->exec->path,
+      test->input ? test->input : "-", batchResultString(test->result));
+  if (test->result == BATCH_CASE_WRONG_OUTPUT)
+    fprintf(fp, " (first difference at byte %zu)", test->diffOffset);
+  else if (test->result == BATCH_CASE_WRONG_EXIT_CODE)
+    fprintf(fp, " (%" PRId32 ", expected %" PRId32 ")", test->exitCode,
+        test->expectedExitCode);
+  else if (test->result == BATCH_CASE_MEMORY_FAULT ||
+      test->result == BATCH_CASE_ILL_INST_FAULT ||
+      test->result == BATCH_CASE_INVALID_SYSCALL)
+    fprintf(fp, " at address 0x%08" PRIx32, test->faultAddress);
+  else if (test->result == BATCH_CASE_INST_LIMIT ||
+      test->result == BATCH_CASE_TIMEOUT)
+    fprintf(fp, ", looping at 0x%08" PRIx32, test->faultAddress);
+  fputc('\n', fp);
+}
+
+
+t_batchError batchRun(const char *manifest, const t_batchConfig *config,
+    FILE *fp, unsigned *failed)
+{
+  t_batchError err = BATCH_NO_ERROR;
+  FILE *mfp = fopen(manifest, "r");
+  if (mfp == NULL)
+    return BATCH_FILE_ERROR;
+  const char *slash = strrchr(manifest, '/');
+  size_t dirLen = slash ? (size_t)(slash - manifest) + 1 : 0;
+
+  t_batchCase *cases = NULL;
+  t_batchExec **execs = NULL;
+  unsigned numCases = 0, numExecs = 0, cap = 0;
+  char *line = NULL;
+  size_t lineCap = 0;
+  for (unsigned lineNum = 1; getline(&line, &lineCap, mfp) >= 0; lineNum++) {
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+    char *fields[5];
+    unsigned numFields = 0;
+    char *save;
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok && numFields < 5;
+         tok = strtok_r(NULL, " \t\r\n", &save))
+      fields[numFields++] = tok;
+    if (numFields == 0)
+      continue;
+    if (numFields < 3 || numFields > 4) {
+      err = BATCH_INVALID_FORMAT;
+      break;
+    }
+
+    if (numCases == cap) {
+      cap = cap ? cap * 2 : 64;
+      t_batchCase *newCases = realloc(cases, sizeof(t_batchCase) * cap);
+      t_batchExec **newExecs = realloc(execs, sizeof(t_batchExec *) * cap);
+      if (newCases)
+        cases = newCases;
+      if (newExecs)
+        execs = newExecs;
+      if (!newCases || !newExecs) {
+        err = BATCH_OUT_OF_MEMORY;
+        break;
+      }
+    }
+    t_batchCase *test = &cases[numCases];
+    memset(test, 0, sizeof(t_batchCase));
+    test->line = lineNum;
+    if (numFields == 4) {
+      char *end;
+      test->expectedExitCode = (t_isaInt)strtol(fields[3], &end, 0);
+      if (*end != '\0') {
+        err = BATCH_INVALID_FORMAT;
+        break;
+      }
+    }
+    char *execPath = batchPath(manifest, dirLen, fields[0]);
+    test->input = batchPath(manifest, dirLen, fields[1]);
+    test->expected = batchPath(manifest, dirLen, fields[2]);
+    if (execPath == NULL) {
+      free(test->input);
+      free(test->expected);
+      err = strcmp(fields[0], "-") == 0 ? BATCH_INVALID_FORMAT
+                                        : BATCH_OUT_OF_MEMORY;
+      break;
+    }
+    test->exec = batchGetExec(execs, &numExecs, execPath);
+    numCases++;
+    if (test->exec == NULL) {
+      err = BATCH_OUT_OF_MEMORY;
+      break;
+    }
+  }
+  free(line);
+  fclose(mfp);
+
+  if (err == BATCH_NO_ERROR) {
+    double startTime = batchGetTime();
+    batchRunCases(config, cases, numCases);
+    double wallTime = batchGetTime() - startTime;
+
+    *failed = 0;
+    for (unsigned i = 0; i < numCases; i++) {
+      if (cases[i].result == BATCH_CASE_PASSED)
+        continue;
+      batchPrintCase(fp, &cases[i]);
+      (*failed)++;
+    }
+    fprintf(fp, "%u of %u cases passed, %u executables, %.3f s\n",
+        numCases - *failed, numCases, numExecs, wallTime);
+  }
+
+  for (unsigned i = 0; i < numCases; i++) {
+    free(cases[i].input);
+    free(cases[i].expected);
+  }
+  for (unsigned i = 0; i < numExecs; i++) {
+    ldrCloseImage(execs[i]->image);
+    free(execs[i]->path);
+    free(execs[i]);
+  }
+  free(cases);
+  free(execs);
+  return err;
+}
@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+typedef int t_batchError;
+enum {
+  BATCH_NO_ERROR = 0,
+  BATCH_OUT_OF_MEMORY = -1,
+  BATCH_FILE_ERROR = -2,
+  BATCH_INVALID_FORMAT = -3
+};
+
+typedef struct {
+  unsigned jobs; /* threads running the cases */
+  /* falls back to the interpreter if the mode is not supported */
+  t_cpuExecMode execMode;
+  t_memSize stackSize;
+  uint64_t maxInstructions; /* 0 for no limit */
+  double timeout; /* seconds, 0 for no limit */
+} t_batchConfig;
+
+/* Runs every case of the manifest and prints the failed cases and a
+ * summary to fp. Each line of the manifest is a case in the format
+ *   EXECUTABLE INPUT EXPECTED [EXIT-CODE]
+ * where INPUT is the standard input of the program and EXPECTED is the
+ * output it must produce, or - for an empty input or an output which is
+ * not checked. The exit code is 0 by default. Relative paths are relative
+ * to the directory of the manifest, and # starts a comment.
+ * Each executable is loaded once, then the cases are run in their own VM
+ * by a pool of threads, with the input and output kept in memory. */
+t_batchError batchRun(const char *manifest, const t_batchConfig *config,
+    FILE *fp, unsigned *failed);
+
+#endif
@@ -0,0 +1,22 @@
+# Arithmetic and memory access loop
+# instructions: 140000008
+
+.text
+
+_start: li s0,20000000
+        li s1,0
+        la s2,buf
+1:      addi s1,s1,3
+        xor t0,s1,s0
+        sw t0,0(s2)
+        lw t1,0(s2)
+        mul t2,t1,s1
+        addi s0,s0,-1
+        bnez s0,1b
+        li a7,93
+        li a0,0
+        ecall
+
+.data
+
+buf:    .word 0
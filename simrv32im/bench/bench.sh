@@ -0,0 +1,30 @@
+#!/usr/bin/env bash
+# usage: bench.sh simulator... -- program...
+# Runs every program with every simulator and prints the execution speed in
+# millions of instructions per second (MIPS). The number of instructions
+# executed by each program is read from its "# instructions:" header comment.
+
+sims=()
+while [[ $# -gt 0 && $1 != -- ]]; do
+  sims+=("$1")
+  shift
+done
+shift
+
+TIMEFORMAT=%R
+printf '%-16s' 'program'
+for sim in "${sims[@]}"; do
+  printf '%24s' "$sim"
+done
+printf '\n'
+
+for prg in "$@"; do
+  insts=$(sed -n 's/^# instructions: *\([0-9]*\).*/\1/p' "${prg%.o}.s")
+  printf '%-16s' "${prg%.o}"
+  for sim in "${sims[@]}"; do
+    secs=$( { time ./"$sim" "$prg" > /dev/null 2>&1; } 2>&1 )
+    printf '%24s' "$(awk -v n="$insts" -v t="$secs" \
+        'BEGIN { if (t > 0) printf "%.1f MIPS", n / t / 1e6; else print "-" }')"
+  done
+  printf '\n'
+done
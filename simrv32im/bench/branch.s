@@ -0,0 +1,20 @@
+# Loop with a data-dependent branch, multiplications and divisions
+# instructions: 70000007
+
+.text
+
+_start: li s0,10000000
+        li s1,0
+        li s2,7
+1:      andi t0,s0,1
+        beqz t0,2f
+        mul t1,s0,s2
+        j 3f
+2:      rem t1,s0,s2
+        nop
+3:      add s1,s1,t1
+        addi s0,s0,-1
+        bnez s0,1b
+        li a7,93
+        li a0,0
+        ecall
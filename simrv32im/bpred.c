@@ -0,0 +1,422 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "bpred.h"
+#include "cpu.h"
+#include "isa.h"
+
+
+#define BP_COUNTER_BITS 12
+#define BP_COUNTER_COUNT (1 << BP_COUNTER_BITS)
+#define BP_BTB_SIZE 512
+#define BP_RAS_SIZE 16
+#define BP_TOP_PC_COUNT 20
+
+#define BP_TAGE_TABLES 4
+#define BP_TAGE_INDEX_BITS 10
+#define BP_TAGE_TAG_BITS 9
+/* branches between two agings of the useful counters */
+#define BP_TAGE_AGING_PERIOD (1 << 18)
+
+typedef struct {
+  const char *name;
+  bool (*predict)(t_memAddress pc, t_memAddress target);
+  void (*update)(t_memAddress pc, bool taken);
+} t_bpPredictor;
+
+typedef struct {
+  int8_t ctr; /* three-bit signed counter, taken if >= 0 */
+  uint16_t tag;
+  uint8_t useful;
+} t_bpTageEntry;
+
+typedef struct {
+  uint64_t branches;
+  uint64_t branchMisses;
+  uint64_t directJumps;
+  uint64_t indirectJumps;
+  uint64_t indirectMisses;
+  uint64_t returns;
+  uint64_t returnMisses;
+} t_bpStats;
+
+
+const t_bpPredictor *bpPredictor;
+/* outcomes of the last branches, the most recent in bit zero */
+uint64_t bpHistory;
+/* two-bit saturating counters, shared by the bimodal, gshare and TAGE
+ * predictors as only one of them is in use */
+uint8_t bpCounters[BP_COUNTER_COUNT];
+
+t_bpTageEntry bpTage[BP_TAGE_TABLES][1 << BP_TAGE_INDEX_BITS];
+static const int bpTageHistLength[BP_TAGE_TABLES] = {5, 12, 24, 48};
+/* lookup of the branch being predicted, reused by the update */
+uint32_t bpTageIndex[BP_TAGE_TABLES];
+uint16_t bpTageTag[BP_TAGE_TABLES];
+int bpTageProvider;
+bool bpTageAltPred;
+bool bpTagePred;
+uint32_t bpTageAging;
+
+struct {
+  t_memAddress pc;
+  t_memAddress target;
+} bpBTB[BP_BTB_SIZE];
+t_memAddress bpRAS[BP_RAS_SIZE];
+int bpRASTop;
+int bpRASCount;
+
+t_bpStats bpStats;
+bool bpLastMispredicted;
+/* Per-instruction counters of the code area, indexed by (pc - base) >> 2 */
+/* VM the model is attached to */
+t_vm *bpVM;
+t_memAddress bpPCBase;
+uint32_t bpPCCount;
+uint64_t *bpExecutions;
+uint64_t *bpMispredictions;
+
+
+/*
+ * Direction predictors
+ */
+
+static void bpUpdateCounter(uint8_t *ctr, bool taken)
+{
+  if (taken && *ctr < 3)
+    (*ctr)++;
+  else if (!taken && *ctr > 0)
+    (*ctr)--;
+}
+
+static bool bpPredictBTFN(t_memAddress pc, t_memAddress target)
+{
+  return target <= pc;
+}
+
+static void bpUpdateBTFN(t_memAddress pc, bool taken)
+{
+}
+
+static uint32_t bpBimodalIndex(t_memAddress pc)
+{
+  return (pc >> 2) & (BP_COUNTER_COUNT - 1);
+}
+
+static bool bpPredictBimodal(t_memAddress pc, t_memAddress target)
+{
+  return bpCounters[bpBimodalIndex(pc)] >= 2;
+}
+
+static void bpUpdateBimodal(t_memAddress pc, bool taken)
+{
+  bpUpdateCounter(&bpCounters[bpBimodalIndex(pc)], taken);
+}
+
+static uint32_t bpGshareIndex(t_memAddress pc)
+{
+  return ((pc >> 2) ^ (uint32_t)bpHistory) & (BP_COUNTER_COUNT - 1);
+}
+
+static bool bpPredictGshare(t_memAddress pc, t_memAddress target)
+{
+  return bpCounters[bpGshareIndex(pc)] >= 2;
+}
+
+static void bpUpdateGshare(t_memAddress pc, bool taken)
+{
+  bpUpdateCounter(&bpCounters[bpGshareIndex(pc)], taken);
+}
+
+/* Compresses the last length outcomes to the given number of bits */
+static uint32_t bpFoldHistory(int length, int bits)
+{
+  uint64_t hist = bpHistory;
+  if (length < 64)
+    hist &= ((uint64_t)1 << length) - 1;
+  uint32_t res = 0;
+  while (hist) {
+    res ^= (uint32_t)hist & ((1 << bits) - 1);
+    hist >>= bits;
+  }
+  return res;
+}
+
+static bool bpPredictTAGE(t_memAddress pc, t_memAddress target)
+{
+  uint32_t pcBits = pc >> 2;
+  bool basePred = bpPredictBimodal(pc, target);
+  int alt = -1;
+
+  bpTageProvider = -1;
+  for (int t = BP_TAGE_TABLES - 1; t >= 0; t--) {
+    int length = bpTageHistLength[t];
+    bpTageIndex[t] = (pcBits ^ (pcBits >> BP_TAGE_INDEX_BITS) ^
+                         bpFoldHistory(length, BP_TAGE_INDEX_BITS)) &
+        ((1 << BP_TAGE_INDEX_BITS) - 1);
+    bpTageTag[t] = (uint16_t)((pcBits ^
+                                  (bpFoldHistory(length, BP_TAGE_TAG_BITS) ^
+                                      (bpFoldHistory(length,
+                                           BP_TAGE_TAG_BITS - 1) << 1))) &
+        ((1 << BP_TAGE_TAG_BITS) - 1));
+    if (bpTage[t][bpTageIndex[t]].tag != bpTageTag[t])
+      continue;
+    if (bpTageProvider < 0)
+      bpTageProvider = t;
+    else if (alt < 0)
+      alt = t;
+  }
+
+  bpTageAltPred = basePred;
+  if (alt >= 0)
+    bpTageAltPred = bpTage[alt][bpTageIndex[alt]].ctr >= 0;
+  bpTagePred = bpTageAltPred;
+  if (bpTageProvider >= 0)
+    bpTagePred = bpTage[bpTageProvider][bpTageIndex[bpTageProvider]].ctr >= 0;
+  return bpTagePred;
+}
+
+static void bpUpdateTAGE(t_memAddress pc, bool taken)
+{
+  int provider = bpTageProvider;
+
+  if (provider >= 0) {
+    t_bpTageEntry *entry = &bpTage[provider][bpTageIndex[provider]];
+    if (bpTagePred != bpTageAltPred) {
+      if (bpTagePred == taken && entry->useful < 3)
+        entry->useful++;
+      else if (bpTagePred != taken && entry->useful > 0)
+        entry->useful--;
+    }
+    if (taken && entry->ctr < 3)
+      entry->ctr++;
+    else if (!taken && entry->ctr > -4)
+      entry->ctr--;
+  } else {
+    bpUpdateBimodal(pc, taken);
+  }
+
+  /* on a misprediction, allocate an entry with a longer history */
+  if (bpTagePred != taken) {
+    bool allocated = false;
+    for (int t = provider + 1; t < BP_TAGE_TABLES && !allocated; t++) {
+      t_bpTageEntry *entry = &bpTage[t][bpTageIndex[t]];
+      if (entry->useful == 0) {
+        entry->tag = bpTageTag[t];
+        entry->ctr = taken ? 0 : -1;
+        allocated = true;
+      }
+    }
+    for (int t = provider + 1; t < BP_TAGE_TABLES && !allocated; t++) {
+      t_bpTageEntry *entry = &bpTage[t][bpTageIndex[t]];
+      if (entry->useful > 0)
+        entry->useful--;
+    }
+  }
+
+  if (++bpTageAging == BP_TAGE_AGING_PERIOD) {
+    bpTageAging = 0;
+    for (int t = 0; t < BP_TAGE_TABLES; t++) {
+      for (int i = 0; i < (1 << BP_TAGE_INDEX_BITS); i++)
+        bpTage[t][i].useful >>= 1;
+    }
+  }
+}
+
+static const t_bpPredictor bpPredictors[] = {
+    [BP_BTFN] = {"btfn", bpPredictBTFN, bpUpdateBTFN},
+    [BP_BIMODAL] = {"bimodal", bpPredictBimodal, bpUpdateBimodal},
+    [BP_GSHARE] = {"gshare", bpPredictGshare, bpUpdateGshare},
+    [BP_TAGE] = {"tage", bpPredictTAGE, bpUpdateTAGE}};
+
+bool bpParseKind(const char *str, t_bpKind *out)
+{
+  for (t_bpKind k = BP_BTFN; k <= BP_TAGE; k++) {
+    if (strcmp(str, bpPredictors[k].name) == 0) {
+      *out = k;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/*
+ * Jump targets
+ */
+
+static bool bpIsLink(t_cpuRegID reg)
+{
+  return reg == CPU_REG_RA || reg == CPU_REG_T0;
+}
+
+static void bpPushReturn(t_memAddress addr)
+{
+  bpRASTop = (bpRASTop + 1) % BP_RAS_SIZE;
+  bpRAS[bpRASTop] = addr;
+  if (bpRASCount < BP_RAS_SIZE)
+    bpRASCount++;
+}
+
+static bool bpPopReturn(t_memAddress *addr)
+{
+  if (bpRASCount == 0)
+    return false;
+  *addr = bpRAS[bpRASTop];
+  bpRASTop = (bpRASTop + BP_RAS_SIZE - 1) % BP_RAS_SIZE;
+  bpRASCount--;
+  return true;
+}
+
+/* Returns true if the target of the jump was predicted correctly */
+static bool bpPredictJALR(const t_cpuRetireInfo *info)
+{
+  bool pop = bpIsLink(info->rs1) && info->rs1 != info->rd;
+  bool push = bpIsLink(info->rd);
+  t_memAddress predicted;
+  bool hit;
+
+  if (pop) {
+    bpStats.returns++;
+    hit = bpPopReturn(&predicted) && predicted == info->nextPC;
+    if (!hit)
+      bpStats.returnMisses++;
+  } else {
+    uint32_t i = (info->pc >> 2) % BP_BTB_SIZE;
+    bpStats.indirectJumps++;
+    hit = bpBTB[i].pc == info->pc && bpBTB[i].target == info->nextPC;
+    if (!hit)
+      bpStats.indirectMisses++;
+    bpBTB[i].pc = info->pc;
+    bpBTB[i].target = info->nextPC;
+  }
+  if (push)
+    bpPushReturn(info->pc + 4);
+  return hit;
+}
+
+
+/*
+ * Model attached to the CPU
+ */
+
+static void bpModelRetire(t_vm *vm, const t_cpuRetireInfo *info)
+{
+  bool hit;
+
+  if (info->instClass == CPU_CLASS_BRANCH) {
+    bool pred = bpPredictor->predict(info->pc, info->target);
+    bpPredictor->update(info->pc, info->taken);
+    bpHistory = (bpHistory << 1) | info->taken;
+    bpStats.branches++;
+    hit = pred == info->taken;
+    if (!hit)
+      bpStats.branchMisses++;
+  } else if (info->instClass == CPU_CLASS_JAL) {
+    /* the target is known at decode */
+    bpStats.directJumps++;
+    if (bpIsLink(info->rd))
+      bpPushReturn(info->pc + 4);
+    hit = true;
+  } else if (info->instClass == CPU_CLASS_JALR) {
+    hit = bpPredictJALR(info);
+  } else {
+    bpLastMispredicted = false;
+    return;
+  }
+
+  bpLastMispredicted = !hit;
+  uint32_t index = (info->pc - bpPCBase) >> 2;
+  if (info->pc - bpPCBase < bpPCCount * 4) {
+    bpExecutions[index]++;
+    if (!hit)
+      bpMispredictions[index]++;
+  }
+}
+
+static uint64_t bpMispredictionCount(t_vm *vm)
+{
+  return bpStats.branchMisses + bpStats.indirectMisses + bpStats.returnMisses;
+}
+
+bool bpModelInit(t_vm *vm, t_bpKind kind)
+{
+  if (bpVM && bpVM != vm)
+    return false;
+  bpVM = vm;
+  bpPredictor = &bpPredictors[kind];
+  memset(bpCounters, 1, sizeof(bpCounters));
+  /* no tag computed by the lookup is all ones */
+  for (int t = 0; t < BP_TAGE_TABLES; t++) {
+    for (int i = 0; i < (1 << BP_TAGE_INDEX_BITS); i++)
+      bpTage[t][i].tag = UINT16_MAX;
+  }
+
+  t_memSize codeSize;
+  cpuGetCodeArea(bpVM, &bpPCBase, &codeSize);
+  bpPCCount = codeSize / 4;
+  bpExecutions = calloc(bpPCCount + 1, sizeof(uint64_t));
+  bpMispredictions = calloc(bpPCCount + 1, sizeof(uint64_t));
+  if (!bpExecutions || !bpMispredictions)
+    return false;
+  cpuSetCounterSource(bpVM, ISA_CSR_HPMCOUNTER3, bpMispredictionCount);
+  return cpuAddObserver(bpVM, bpModelRetire);
+}
+
+bool bpModelLastMispredicted(void)
+{
+  return bpLastMispredicted;
+}
+
+
+static void bpPrintCount(
+    FILE *fp, const char *name, uint64_t count, uint64_t misses)
+{
+  fprintf(fp, "  %-18s %14" PRIu64 "\n", name, count);
+  if (misses != UINT64_MAX)
+    fprintf(fp, "    %-16s %14" PRIu64 " (%.2f%%)\n", "mispredicted", misses,
+        count ? 100.0 * (double)misses / (double)count : 0.0);
+}
+
+static int bpComparePCs(const void *a, const void *b)
+{
+  uint32_t ia = *(const uint32_t *)a, ib = *(const uint32_t *)b;
+  if (bpMispredictions[ia] != bpMispredictions[ib])
+    return bpMispredictions[ia] < bpMispredictions[ib] ? 1 : -1;
+  return ia < ib ? -1 : 1;
+}
+
+void bpModelPrint(FILE *fp)
+{
+  fprintf(fp, "Branch prediction statistics (%s):\n", bpPredictor->name);
+  bpPrintCount(fp, "branches", bpStats.branches, bpStats.branchMisses);
+  bpPrintCount(fp, "direct jumps", bpStats.directJumps, UINT64_MAX);
+  bpPrintCount(
+      fp, "indirect jumps", bpStats.indirectJumps, bpStats.indirectMisses);
+  bpPrintCount(fp, "returns", bpStats.returns, bpStats.returnMisses);
+
+  uint32_t *order = malloc(sizeof(uint32_t) * (bpPCCount + 1));
+  if (order == NULL)
+    return;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < bpPCCount; i++) {
+    if (bpMispredictions[i] > 0)
+      order[n++] = i;
+  }
+  qsort(order, n, sizeof(uint32_t), bpComparePCs);
+
+  fprintf(fp, "  Instructions with the most mispredictions:\n");
+  fprintf(fp, "    %12s %12s %8s  %-9s  %s\n", "executed", "mispredicted",
+      "rate", "address", "instruction");
+  for (uint32_t j = 0; j < n && j < BP_TOP_PC_COUNT; j++) {
+    char buffer[80];
+    uint32_t i = order[j];
+    t_memAddress pc = bpPCBase + i * 4;
+    isaDisassemble(memDebugRead32(bpVM, pc, NULL), buffer, 80);
+    fprintf(fp, "    %12" PRIu64 " %12" PRIu64 " %7.2f%%  %08" PRIx32 ":  %s\n",
+        bpExecutions[i], bpMispredictions[i],
+        100.0 * (double)bpMispredictions[i] / (double)bpExecutions[i], pc,
+        buffer);
+  }
+  free(order);
+}
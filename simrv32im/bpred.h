@@ -0,0 +1,28 @@
+#ifndef BPRED_H
+#define BPRED_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "vm.h"
+
+typedef int t_bpKind;
+enum {
+  BP_BTFN,    /* static, backward taken and forward not taken */
+  BP_BIMODAL, /* per-PC two-bit counters */
+  BP_GSHARE,  /* two-bit counters indexed by PC xor global history */
+  BP_TAGE     /* bimodal base with four tagged global history tables */
+};
+
+/* Parses btfn, bimodal, gshare or tage */
+bool bpParseKind(const char *str, t_bpKind *out);
+
+/* Attaches a direction predictor, a branch target buffer for indirect jumps
+ * and a return address stack to the CPU. The mispredictions are exposed as
+ * hpmcounter3. Returns false if the model is attached to another VM. */
+bool bpModelInit(t_vm *vm, t_bpKind kind);
+/* Returns true if the last instruction retired was a mispredicted branch or
+ * jump */
+bool bpModelLastMispredicted(void);
+void bpModelPrint(FILE *fp);
+
+#endif
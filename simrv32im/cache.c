@@ -0,0 +1,454 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "cache.h"
+#include "cpu.h"
+#include "isa.h"
+
+
+struct t_cache {
+  t_cacheConfig config;
+  t_cacheLevel level;
+  t_cache *next;
+  uint32_t sets;
+  uint32_t lineShift;
+  /* per line, indexed by set * ways + way */
+  uint32_t *tags;
+  uint8_t *valid;
+  uint8_t *dirty;
+  uint64_t *lastUse;
+  /* per set, for the tree pseudo-LRU policy */
+  uint64_t *plruBits;
+  uint64_t clock;
+  uint32_t randomState;
+  t_cacheStats stats;
+};
+
+
+static bool cacheIsPowerOf2(uint32_t x)
+{
+  return x != 0 && (x & (x - 1)) == 0;
+}
+
+static uint32_t cacheLog2(uint32_t x)
+{
+  uint32_t res = 0;
+  while (x > 1) {
+    x >>= 1;
+    res++;
+  }
+  return res;
+}
+
+
+bool cacheParseConfig(const char *str, t_cacheConfig *out)
+{
+  char *end;
+  unsigned long values[3];
+
+  for (int i = 0; i < 3; i++) {
+    values[i] = strtoul(str, &end, 0);
+    if (end == str)
+      return false;
+    if (*end == 'k' || *end == 'K') {
+      values[i] *= 1024;
+      end++;
+    } else if (*end == 'm' || *end == 'M') {
+      values[i] *= 1024 * 1024;
+      end++;
+    }
+    if (values[i] == 0 || values[i] > 0x40000000)
+      return false;
+    if (i < 2 && *end++ != ':')
+      return false;
+    str = end;
+  }
+  out->size = (uint32_t)values[0];
+  out->lineSize = (uint32_t)values[1];
+  out->ways = (uint32_t)values[2];
+  out->repl = CACHE_REPL_LRU;
+  out->write = CACHE_WRITE_BACK;
+
+  if (*str == ':') {
+    str++;
+    if (strncmp(str, "lru", 3) == 0) {
+      str += 3;
+    } else if (strncmp(str, "plru", 4) == 0) {
+      out->repl = CACHE_REPL_PLRU;
+      str += 4;
+    } else if (strncmp(str, "random", 6) == 0) {
+      out->repl = CACHE_REPL_RANDOM;
+      str += 6;
+    } else {
+      return false;
+    }
+  }
+  if (*str == ':') {
+    str++;
+    if (strcmp(str, "wb") == 0)
+      out->write = CACHE_WRITE_BACK;
+    else if (strcmp(str, "wt") == 0)
+      out->write = CACHE_WRITE_THROUGH;
+    else
+      return false;
+    str += 2;
+  }
+  if (*str != '\0')
+    return false;
+
+  if (!cacheIsPowerOf2(out->size) || !cacheIsPowerOf2(out->lineSize) ||
+      !cacheIsPowerOf2(out->ways) || out->lineSize < 4 ||
+      out->size < out->lineSize * out->ways)
+    return false;
+  if (out->repl == CACHE_REPL_PLRU && out->ways > 64)
+    return false;
+  return true;
+}
+
+
+t_cache *newCache(const t_cacheConfig *config, t_cacheLevel level,
+    t_cache *next)
+{
+  t_cache *cache = calloc(1, sizeof(t_cache));
+  if (cache == NULL)
+    return NULL;
+  cache->config = *config;
+  cache->level = level;
+  cache->next = next;
+  cache->sets = config->size / (config->lineSize * config->ways);
+  cache->lineShift = cacheLog2(config->lineSize);
+  cache->randomState = 0x2545F491;
+
+  size_t lines = (size_t)cache->sets * config->ways;
+  cache->tags = calloc(lines, sizeof(uint32_t));
+  cache->valid = calloc(lines, sizeof(uint8_t));
+  cache->dirty = calloc(lines, sizeof(uint8_t));
+  cache->lastUse = calloc(lines, sizeof(uint64_t));
+  cache->plruBits = calloc(cache->sets, sizeof(uint64_t));
+  if (!cache->tags || !cache->valid || !cache->dirty || !cache->lastUse ||
+      !cache->plruBits) {
+    deleteCache(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void deleteCache(t_cache *cache)
+{
+  if (cache == NULL)
+    return;
+  free(cache->tags);
+  free(cache->valid);
+  free(cache->dirty);
+  free(cache->lastUse);
+  free(cache->plruBits);
+  free(cache);
+}
+
+
+/* The tree has ways - 1 nodes numbered from 1 like a binary heap. Each bit
+ * points to the half of the subtree which holds the next victim. */
+static void cachePLRUTouch(t_cache *cache, uint32_t set, uint32_t way)
+{
+  uint64_t *bits = &cache->plruBits[set];
+  uint32_t node = 1;
+  for (uint32_t half = cache->config.ways / 2; half > 0; half /= 2) {
+    uint32_t right = (way & half) ? 1 : 0;
+    if (right)
+      *bits &= ~((uint64_t)1 << node);
+    else
+      *bits |= (uint64_t)1 << node;
+    node = node * 2 + right;
+  }
+}
+
+static uint32_t cachePLRUVictim(t_cache *cache, uint32_t set)
+{
+  uint64_t bits = cache->plruBits[set];
+  uint32_t node = 1, way = 0;
+  for (uint32_t half = cache->config.ways / 2; half > 0; half /= 2) {
+    uint32_t right = (bits >> node) & 1;
+    if (right)
+      way |= half;
+    node = node * 2 + right;
+  }
+  return way;
+}
+
+static uint32_t cacheChooseVictim(t_cache *cache, uint32_t set)
+{
+  uint32_t ways = cache->config.ways;
+  uint32_t first = set * ways;
+  for (uint32_t w = 0; w < ways; w++) {
+    if (!cache->valid[first + w])
+      return w;
+  }
+
+  if (cache->config.repl == CACHE_REPL_PLRU)
+    return cachePLRUVictim(cache, set);
+  if (cache->config.repl == CACHE_REPL_RANDOM) {
+    uint32_t x = cache->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    cache->randomState = x;
+    return x & (ways - 1);
+  }
+  uint32_t victim = 0;
+  for (uint32_t w = 1; w < ways; w++) {
+    if (cache->lastUse[first + w] < cache->lastUse[first + victim])
+      victim = w;
+  }
+  return victim;
+}
+
+static void cacheTouch(t_cache *cache, uint32_t set, uint32_t way)
+{
+  cache->lastUse[set * cache->config.ways + way] = ++cache->clock;
+  if (cache->config.repl == CACHE_REPL_PLRU)
+    cachePLRUTouch(cache, set, way);
+}
+
+static t_cacheLevel cacheForward(t_cache *cache, t_memAddress addr, bool write)
+{
+  if (cache->next)
+    return cacheAccess(cache->next, addr, write);
+  return CACHE_LEVEL_MEMORY;
+}
+
+t_cacheLevel cacheAccess(t_cache *cache, t_memAddress addr, bool write)
+{
+  uint32_t lineAddr = addr >> cache->lineShift;
+  uint32_t set = lineAddr & (cache->sets - 1);
+  uint32_t ways = cache->config.ways;
+  uint32_t first = set * ways;
+  bool writeThrough = cache->config.write == CACHE_WRITE_THROUGH;
+
+  if (write)
+    cache->stats.writes++;
+  else
+    cache->stats.reads++;
+
+  for (uint32_t w = 0; w < ways; w++) {
+    if (cache->valid[first + w] && cache->tags[first + w] == lineAddr) {
+      cacheTouch(cache, set, w);
+      if (write && writeThrough)
+        cacheForward(cache, addr, true);
+      else if (write)
+        cache->dirty[first + w] = 1;
+      return cache->level;
+    }
+  }
+
+  if (write)
+    cache->stats.writeMisses++;
+  else
+    cache->stats.readMisses++;
+  if (write && writeThrough)
+    return cacheForward(cache, addr, true);
+
+  uint32_t way = cacheChooseVictim(cache, set);
+  uint32_t line = first + way;
+  if (cache->valid[line]) {
+    cache->stats.evictions++;
+    if (cache->dirty[line]) {
+      cache->stats.writeBacks++;
+      cacheForward(cache, cache->tags[line] << cache->lineShift, true);
+    }
+  }
+  t_cacheLevel res = cacheForward(cache, addr, false);
+  cache->valid[line] = 1;
+  cache->tags[line] = lineAddr;
+  cache->dirty[line] = write;
+  cacheTouch(cache, set, way);
+  return res;
+}
+
+void cacheGetStats(t_cache *cache, t_cacheStats *out)
+{
+  *out = cache->stats;
+}
+
+
+/*
+ * Cache hierarchy attached to the CPU
+ */
+
+t_cache *cacheL1I, *cacheL1D, *cacheL2;
+t_cacheLevel cacheLastFetch, cacheLastData;
+/* Per-instruction counters of the code area, indexed by (pc - base) >> 2 */
+/* VM the model is attached to */
+t_vm *cacheVM;
+t_memAddress cachePCBase;
+uint32_t cachePCCount;
+uint64_t *cacheFetchMisses;
+uint64_t *cacheDataAccesses;
+uint64_t *cacheDataMisses;
+
+#define CACHE_TOP_PC_COUNT 20
+
+
+static t_cacheLevel cacheModelAccess(
+    t_cache *cache, t_memAddress addr, uint32_t size, bool write)
+{
+  t_cacheLevel res = cacheAccess(cache, addr, write);
+  /* accesses spanning two lines */
+  t_memAddress last = addr + size - 1;
+  if ((last >> cache->lineShift) != (addr >> cache->lineShift)) {
+    t_cacheLevel res2 = cacheAccess(cache, last, write);
+    if (res2 > res)
+      res = res2;
+  }
+  return res;
+}
+
+static void cacheModelRetire(t_vm *vm, const t_cpuRetireInfo *info)
+{
+  t_cache *fetchCache = cacheL1I ? cacheL1I : cacheL2;
+  t_cache *dataCache = cacheL1D ? cacheL1D : cacheL2;
+  uint32_t index = (info->pc - cachePCBase) >> 2;
+  bool inCode = info->pc - cachePCBase < cachePCCount * 4;
+
+  cacheLastFetch = CACHE_LEVEL_L1;
+  if (fetchCache) {
+    cacheLastFetch = cacheModelAccess(fetchCache, info->pc, 4, false);
+    if (cacheLastFetch != fetchCache->level && inCode)
+      cacheFetchMisses[index]++;
+  }
+
+  cacheLastData = 0;
+  if (dataCache && (info->instClass == CPU_CLASS_LOAD ||
+                       info->instClass == CPU_CLASS_STORE)) {
+    cacheLastData = cacheModelAccess(dataCache, info->memAddress,
+        info->memSize, info->instClass == CPU_CLASS_STORE);
+    if (inCode) {
+      cacheDataAccesses[index]++;
+      if (cacheLastData != dataCache->level)
+        cacheDataMisses[index]++;
+    }
+  }
+}
+
+static uint64_t cacheMisses(t_cache *cache)
+{
+  if (cache == NULL)
+    return 0;
+  return cache->stats.readMisses + cache->stats.writeMisses;
+}
+
+static uint64_t cacheL1IMisses(t_vm *vm)
+{
+  return cacheMisses(cacheL1I);
+}
+
+static uint64_t cacheL1DMisses(t_vm *vm)
+{
+  return cacheMisses(cacheL1D);
+}
+
+static uint64_t cacheL2Misses(t_vm *vm)
+{
+  return cacheMisses(cacheL2);
+}
+
+bool cacheModelInit(t_vm *vm, const t_cacheConfig *l1i,
+    const t_cacheConfig *l1d, const t_cacheConfig *l2)
+{
+  if (cacheVM && cacheVM != vm)
+    return false;
+  cacheVM = vm;
+  if (l2 && !(cacheL2 = newCache(l2, CACHE_LEVEL_L2, NULL)))
+    return false;
+  if (l1i && !(cacheL1I = newCache(l1i, CACHE_LEVEL_L1, cacheL2)))
+    return false;
+  if (l1d && !(cacheL1D = newCache(l1d, CACHE_LEVEL_L1, cacheL2)))
+    return false;
+  if (!l1i && !l1d && cacheL2)
+    cacheL2->level = CACHE_LEVEL_L1;
+
+  t_memSize codeSize;
+  cpuGetCodeArea(cacheVM, &cachePCBase, &codeSize);
+  cachePCCount = codeSize / 4;
+  cacheFetchMisses = calloc(cachePCCount + 1, sizeof(uint64_t));
+  cacheDataAccesses = calloc(cachePCCount + 1, sizeof(uint64_t));
+  cacheDataMisses = calloc(cachePCCount + 1, sizeof(uint64_t));
+  if (!cacheFetchMisses || !cacheDataAccesses || !cacheDataMisses)
+    return false;
+  cpuSetCounterSource(cacheVM, ISA_CSR_HPMCOUNTER3 + 1, cacheL1IMisses);
+  cpuSetCounterSource(cacheVM, ISA_CSR_HPMCOUNTER3 + 2, cacheL1DMisses);
+  cpuSetCounterSource(cacheVM, ISA_CSR_HPMCOUNTER3 + 3, cacheL2Misses);
+  return cpuAddObserver(cacheVM, cacheModelRetire);
+}
+
+void cacheModelGetLastLevels(t_cacheLevel *fetch, t_cacheLevel *data)
+{
+  *fetch = cacheLastFetch;
+  *data = cacheLastData;
+}
+
+
+static void cacheModelPrintCache(FILE *fp, const char *name, t_cache *cache)
+{
+  static const char *replNames[] = {"lru", "plru", "random"};
+  if (cache == NULL)
+    return;
+
+  t_cacheStats *s = &cache->stats;
+  uint64_t accesses = s->reads + s->writes;
+  uint64_t misses = s->readMisses + s->writeMisses;
+  fprintf(fp, "  %s: %" PRIu32 " bytes, %" PRIu32 " byte lines, %" PRIu32
+      "-way, %s, %s\n", name, cache->config.size, cache->config.lineSize,
+      cache->config.ways, replNames[cache->config.repl],
+      cache->config.write == CACHE_WRITE_BACK ? "write-back" :
+                                                "write-through");
+  fprintf(fp, "    %-14s %14" PRIu64 "\n", "reads", s->reads);
+  fprintf(fp, "    %-14s %14" PRIu64 "\n", "read misses", s->readMisses);
+  fprintf(fp, "    %-14s %14" PRIu64 "\n", "writes", s->writes);
+  fprintf(fp, "    %-14s %14" PRIu64 "\n", "write misses", s->writeMisses);
+  fprintf(fp, "    %-14s %14" PRIu64 "\n", "evictions", s->evictions);
+  fprintf(fp, "    %-14s %14" PRIu64 "\n", "write-backs", s->writeBacks);
+  fprintf(fp, "    %-14s %13.2f%%\n", "miss rate",
+      accesses ? 100.0 * (double)misses / (double)accesses : 0.0);
+}
+
+static int cacheComparePCs(const void *a, const void *b)
+{
+  uint32_t ia = *(const uint32_t *)a, ib = *(const uint32_t *)b;
+  uint64_t ma = cacheFetchMisses[ia] + cacheDataMisses[ia];
+  uint64_t mb = cacheFetchMisses[ib] + cacheDataMisses[ib];
+  if (ma != mb)
+    return ma < mb ? 1 : -1;
+  return ia < ib ? -1 : 1;
+}
+
+void cacheModelPrint(FILE *fp)
+{
+  fprintf(fp, "Cache statistics:\n");
+  cacheModelPrintCache(fp, "L1I", cacheL1I);
+  cacheModelPrintCache(fp, "L1D", cacheL1D);
+  cacheModelPrintCache(fp, cacheL1I || cacheL1D ? "L2" : "L1", cacheL2);
+
+  uint32_t *order = malloc(sizeof(uint32_t) * (cachePCCount + 1));
+  if (order == NULL)
+    return;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < cachePCCount; i++) {
+    if (cacheFetchMisses[i] + cacheDataMisses[i] > 0)
+      order[n++] = i;
+  }
+  qsort(order, n, sizeof(uint32_t), cacheComparePCs);
+
+  fprintf(fp, "  Instructions with the most misses:\n");
+  fprintf(fp, "    %12s %12s %12s  %-9s  %s\n", "fetch miss", "data access",
+      "data miss", "address", "instruction");
+  for (uint32_t j = 0; j < n && j < CACHE_TOP_PC_COUNT; j++) {
+    char buffer[80];
+    uint32_t i = order[j];
+    t_memAddress pc = cachePCBase + i * 4;
+    isaDisassemble(memDebugRead32(cacheVM, pc, NULL), buffer, 80);
+    fprintf(fp, "    %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "  %08" PRIx32
+        ":  %s\n", cacheFetchMisses[i], cacheDataAccesses[i],
+        cacheDataMisses[i], pc, buffer);
+  }
+  free(order);
+}
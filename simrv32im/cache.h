@@ -0,0 +1,71 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "memory.h"
+
+typedef int t_cacheRepl;
+enum {
+  CACHE_REPL_LRU,
+  CACHE_REPL_PLRU, /* tree pseudo-LRU */
+  CACHE_REPL_RANDOM
+};
+
+typedef int t_cacheWrite;
+enum {
+  CACHE_WRITE_BACK,   /* allocates lines on write misses */
+  CACHE_WRITE_THROUGH /* does not allocate lines on write misses */
+};
+
+typedef struct {
+  uint32_t size;
+  uint32_t lineSize;
+  uint32_t ways;
+  t_cacheRepl repl;
+  t_cacheWrite write;
+} t_cacheConfig;
+
+typedef struct {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t readMisses;
+  uint64_t writeMisses;
+  uint64_t evictions;
+  uint64_t writeBacks;
+} t_cacheStats;
+
+/* Level of the hierarchy which served an access */
+typedef int t_cacheLevel;
+enum {
+  CACHE_LEVEL_L1 = 1,
+  CACHE_LEVEL_L2 = 2,
+  CACHE_LEVEL_MEMORY = 3
+};
+
+typedef struct t_cache t_cache;
+
+/* Parses a configuration in the SIZE:LINE:WAYS[:REPL[:WRITE]] format, where
+ * REPL is lru, plru or random and WRITE is wb or wt. */
+bool cacheParseConfig(const char *str, t_cacheConfig *out);
+
+/* Misses are forwarded to the next cache, or to the memory if NULL */
+t_cache *newCache(const t_cacheConfig *config, t_cacheLevel level,
+    t_cache *next);
+void deleteCache(t_cache *cache);
+t_cacheLevel cacheAccess(t_cache *cache, t_memAddress addr, bool write);
+void cacheGetStats(t_cache *cache, t_cacheStats *out);
+
+/* Attaches the given caches to the CPU. Each configuration can be NULL; the
+ * accesses of a stream without a L1 cache go to the L2 cache. The misses of
+ * the L1I, L1D and L2 caches are exposed as hpmcounter4, 5 and 6. Returns
+ * false if the model is attached to another VM. */
+bool cacheModelInit(t_vm *vm, const t_cacheConfig *l1i,
+    const t_cacheConfig *l1d, const t_cacheConfig *l2);
+/* Levels which served the fetch and the data access of the last instruction
+ * retired (0 if there was no data access) */
+void cacheModelGetLastLevels(t_cacheLevel *fetch, t_cacheLevel *data);
+void cacheModelPrint(FILE *fp);
+
+#endif
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "callgraph.h"
+
+
+/* Called function, with the counts of all its activations */
+typedef struct {
+  t_memAddress addr;
+  uint32_t active;    /* activations on the shadow stack */
+  uint64_t calls;
+  uint64_t inclusive; /* only counted for the outermost activation */
+  uint64_t exclusive;
+} t_cgFunction;
+
+/* Node of the calling context tree */
+typedef struct {
+  uint32_t func;
+  uint32_t parent;
+  uint32_t firstChild;
+  uint32_t nextSibling;
+  uint64_t exclusive;
+} t_cgNode;
+
+/* Frame of the shadow call stack */
+typedef struct {
+  uint32_t node;
+  uint32_t callerNode;
+  t_memAddress retAddr;
+  t_memAddress sp; /* stack pointer of the caller */
+  uint64_t start;  /* instruction count at the time of the call */
+} t_cgFrame;
+
+#define CG_NONE UINT32_MAX
+
+/* The profiler state is per-thread, so that each thread can profile the VM
+ * it runs */
+_Thread_local bool cgFailed = true;
+_Thread_local uint64_t cgInstructions;
+
+_Thread_local t_cgFunction *cgFuncs;
+_Thread_local uint32_t cgFuncCount, cgFuncCapacity;
+/* Open addressing hash table from function address to cgFuncs index */
+_Thread_local uint32_t *cgFuncHash;
+_Thread_local uint32_t cgFuncHashSize;
+
+_Thread_local t_cgNode *cgNodes;
+_Thread_local uint32_t cgNodeCount, cgNodeCapacity;
+
+_Thread_local t_cgFrame *cgStack;
+_Thread_local uint32_t cgStackDepth, cgStackCapacity;
+/* Calling context of the code being executed */
+_Thread_local uint32_t cgCurNode;
+
+
+static bool cgGrow(void **array, uint32_t *capacity, size_t itemSize)
+{
+  uint32_t newCapacity = *capacity ? *capacity * 2 : 256;
+  void *newArray = realloc(*array, newCapacity * itemSize);
+  if (newArray == NULL)
+    return false;
+  *array = newArray;
+  *capacity = newCapacity;
+  return true;
+}
+
+static uint32_t cgHashAddress(t_memAddress addr)
+{
+  return (addr >> 2) * 2654435761u;
+}
+
+static bool cgRehash(void)
+{
+  uint32_t newSize = cgFuncHashSize ? cgFuncHashSize * 2 : 256;
+  uint32_t *newHash = malloc(newSize * sizeof(uint32_t));
+  if (newHash == NULL)
+    return false;
+  for (uint32_t i = 0; i < newSize; i++)
+    newHash[i] = CG_NONE;
+  for (uint32_t f = 0; f < cgFuncCount; f++) {
+    uint32_t i = cgHashAddress(cgFuncs[f].addr) & (newSize - 1);
+    while (newHash[i] != CG_NONE)
+      i = (i + 1) & (newSize - 1);
+    newHash[i] = f;
+  }
+  free(cgFuncHash);
+  cgFuncHash = newHash;
+  cgFuncHashSize = newSize;
+  return true;
+}
+
+static uint32_t cgGetFunction(t_memAddress addr)
+{
+  if (cgFuncHashSize > 0) {
+    uint32_t i = cgHashAddress(addr) & (cgFuncHashSize - 1);
+    while (cgFuncHash[i] != CG_NONE) {
+      if (cgFuncs[cgFuncHash[i]].addr == addr)
+        return cgFuncHash[i];
+      i = (i + 1) & (cgFuncHashSize - 1);
+    }
+  }
+
+  if (cgFuncCount == cgFuncCapacity &&
+      !cgGrow((void **)&cgFuncs, &cgFuncCapacity, sizeof(t_cgFunction)))
+    return CG_NONE;
+  if ((cgFuncCount + 1) * 2 > cgFuncHashSize && !cgRehash())
+    return CG_NONE;
+  uint32_t f = cgFuncCount++;
+  cgFuncs[f] = (t_cgFunction){.addr = addr};
+  uint32_t i = cgHashAddress(addr) & (cgFuncHashSize - 1);
+  while (cgFuncHash[i] != CG_NONE)
+    i = (i + 1) & (cgFuncHashSize - 1);
+  cgFuncHash[i] = f;
+  return f;
+}
+
+static uint32_t cgGetChild(uint32_t parent, t_memAddress addr)
+{
+  uint32_t func = cgGetFunction(addr);
+  if (func == CG_NONE)
+    return CG_NONE;
+  if (parent != CG_NONE) {
+    /* direct recursion is folded into a single context, to keep the stacks
+     * short */
+    if (cgNodes[parent].func == func)
+      return parent;
+    for (uint32_t n = cgNodes[parent].firstChild; n != CG_NONE;
+         n = cgNodes[n].nextSibling) {
+      if (cgNodes[n].func == func)
+        return n;
+    }
+  }
+
+  if (cgNodeCount == cgNodeCapacity &&
+      !cgGrow((void **)&cgNodes, &cgNodeCapacity, sizeof(t_cgNode)))
+    return CG_NONE;
+  uint32_t n = cgNodeCount++;
+  cgNodes[n] = (t_cgNode){.func = func,
+      .parent = parent,
+      .firstChild = CG_NONE,
+      .nextSibling = CG_NONE};
+  if (parent != CG_NONE) {
+    cgNodes[n].nextSibling = cgNodes[parent].firstChild;
+    cgNodes[parent].firstChild = n;
+  }
+  return n;
+}
+
+
+t_cgError cgInit(t_memAddress entry)
+{
+  cgFailed = false;
+  cgCurNode = cgGetChild(CG_NONE, entry);
+  if (cgCurNode == CG_NONE) {
+    cgFailed = true;
+    return CG_OUT_OF_MEMORY;
+  }
+  cgFuncs[cgNodes[cgCurNode].func].calls = 1;
+  cgFuncs[cgNodes[cgCurNode].func].active = 1;
+  return CG_NO_ERROR;
+}
+
+
+void cgRetire(uint32_t count)
+{
+  if (cgFailed)
+    return;
+  cgInstructions += count;
+  cgNodes[cgCurNode].exclusive += count;
+}
+
+
+static void cgPop(void)
+{
+  t_cgFrame *frame = &cgStack[--cgStackDepth];
+  t_cgFunction *func = &cgFuncs[cgNodes[frame->node].func];
+  if (--func->active == 0)
+    func->inclusive += cgInstructions - frame->start;
+  cgCurNode = frame->callerNode;
+}
+
+void cgCall(t_memAddress target, t_memAddress retAddr, t_memAddress sp)
+{
+  if (cgFailed)
+    return;
+  /* frames whose caller had a lower stack pointer have been left without
+   * returning, for example by a longjmp */
+  while (cgStackDepth > 0 && cgStack[cgStackDepth - 1].sp < sp)
+    cgPop();
+
+  if (cgStackDepth == cgStackCapacity &&
+      !cgGrow((void **)&cgStack, &cgStackCapacity, sizeof(t_cgFrame))) {
+    cgFailed = true;
+    return;
+  }
+  uint32_t node = cgGetChild(cgCurNode, target);
+  if (node == CG_NONE) {
+    cgFailed = true;
+    return;
+  }
+  cgStack[cgStackDepth++] =
+      (t_cgFrame){.node = node, .callerNode = cgCurNode, .retAddr = retAddr, .sp = sp,
+          .start = cgInstructions};
+  t_cgFunction *func = &cgFuncs[cgNodes[node].func];
+  func->calls++;
+  func->active++;
+  cgCurNode = node;
+}
+
+void cgReturn(t_memAddress target, t_memAddress sp)
+{
+  if (cgFailed)
+    return;
+  /* the return may skip frames, e.g. after a tail call through a jump */
+  uint32_t depth = cgStackDepth;
+  while (depth > 0 && cgStack[depth - 1].retAddr != target)
+    depth--;
+  if (depth == 0) {
+    /* not a return to a known caller, only resync on the stack pointer */
+    while (cgStackDepth > 0 && cgStack[cgStackDepth - 1].sp < sp)
+      cgPop();
+    return;
+  }
+  while (cgStackDepth >= depth)
+    cgPop();
+}
+
+
+static void cgWriteStack(FILE *fp, uint32_t node, uint32_t *path)
+{
+  uint32_t depth = 0;
+  for (uint32_t n = node; n != CG_NONE; n = cgNodes[n].parent)
+    path[depth++] = n;
+  while (depth > 0) {
+    fprintf(fp, "0x%08" PRIx32, cgFuncs[cgNodes[path[--depth]].func].addr);
+    fputc(depth > 0 ? ';' : ' ', fp);
+  }
+}
+
+static int cgCompareFunctions(const void *a, const void *b)
+{
+  const t_cgFunction *fa = a, *fb = b;
+  if (fa->inclusive != fb->inclusive)
+    return fa->inclusive < fb->inclusive ? 1 : -1;
+  return fa->addr < fb->addr ? -1 : 1;
+}
+
+t_cgError cgWrite(const char *path, const char *reportPath)
+{
+  if (cgFuncCount == 0)
+    return CG_OUT_OF_MEMORY;
+
+  /* functions still running are accounted until now */
+  while (cgStackDepth > 0)
+    cgPop();
+  t_cgFunction *root = &cgFuncs[cgNodes[0].func];
+  if (root->active > 0) {
+    root->active = 0;
+    root->inclusive += cgInstructions;
+  }
+  for (uint32_t n = 0; n < cgNodeCount; n++)
+    cgFuncs[cgNodes[n].func].exclusive += cgNodes[n].exclusive;
+
+  uint32_t *stackPath = malloc(cgNodeCount * sizeof(uint32_t));
+  if (stackPath == NULL)
+    return CG_OUT_OF_MEMORY;
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    free(stackPath);
+    return CG_FILE_ERROR;
+  }
+  for (uint32_t n = 0; n < cgNodeCount; n++) {
+    if (cgNodes[n].exclusive == 0)
+      continue;
+    cgWriteStack(fp, n, stackPath);
+    fprintf(fp, "%" PRIu64 "\n", cgNodes[n].exclusive);
+  }
+  free(stackPath);
+  if (fclose(fp) != 0)
+    return CG_FILE_ERROR;
+
+  fp = fopen(reportPath, "w");
+  if (fp == NULL)
+    return CG_FILE_ERROR;
+  qsort(cgFuncs, cgFuncCount, sizeof(t_cgFunction), cgCompareFunctions);
+  if (cgFailed)
+    fprintf(fp, "Out of memory, the call graph is incomplete\n");
+  fprintf(fp, "%-10s  %12s  %14s  %14s\n", "function", "calls", "inclusive",
+      "exclusive");
+  for (uint32_t f = 0; f < cgFuncCount; f++)
+    fprintf(fp, "0x%08" PRIx32 "  %12" PRIu64 "  %14" PRIu64 "  %14" PRIu64
+        "\n", cgFuncs[f].addr, cgFuncs[f].calls, cgFuncs[f].inclusive,
+        cgFuncs[f].exclusive);
+  if (fclose(fp) != 0)
+    return CG_FILE_ERROR;
+  return CG_NO_ERROR;
+}
@@ -0,0 +1,29 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <stdint.h>
+#include "memory.h"
+
+typedef int t_cgError;
+enum {
+  CG_NO_ERROR = 0,
+  CG_OUT_OF_MEMORY = -1,
+  CG_FILE_ERROR = -2
+};
+
+/* Starts tracking the calls, with the function at entry as the root. Each
+ * thread has its own profiler, which the CPU reports to when the call graph
+ * is enabled on the VM that the thread runs, see cpuSetCallGraphEnabled() */
+t_cgError cgInit(t_memAddress entry);
+
+/* Events reported by the CPU, in execution order */
+void cgRetire(uint32_t count);
+void cgCall(t_memAddress target, t_memAddress retAddr, t_memAddress sp);
+void cgReturn(t_memAddress target, t_memAddress sp);
+
+/* Writes the instruction counts per call stack in collapsed-stack format to
+ * the file at path, and the inclusive and exclusive counts per function to
+ * the file at reportPath. */
+t_cgError cgWrite(const char *path, const char *reportPath);
+
+#endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "checkpoint.h"
+#include "cpu.h"
+#include "memory.h"
+#include "supervisor.h"
+
+/* The checkpoint is a sequence of little-endian fields:
+ *   magic "RVCK", version,
+ *   registers x0 to x31, pc, last status, retired instructions (64 bit),
+ *   stack bottom, exit code, stdin offset (64 bit),
+ *   code area base and size,
+ *   number of mapped areas, then base and size of each area,
+ *   the contents of the areas as blocks made of address, size and data,
+ *   terminated by a block of size zero.
+ * Blocks are at most one page long and the pages which only contain zeros
+ * are not saved. */
+#define CKPT_MAGIC "RVCK"
+#define CKPT_VERSION 1
+#define CKPT_PAGE_SIZE 4096
+
+
+static void ckptPutU32(FILE *fp, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    fputc((v >> (8 * i)) & 0xFF, fp);
+}
+
+static void ckptPutU64(FILE *fp, uint64_t v)
+{
+  for (int i = 0; i < 8; i++)
+    fputc((int)((v >> (8 * i)) & 0xFF), fp);
+}
+
+static bool ckptGetU32(FILE *fp, uint32_t *out)
+{
+  uint8_t buf[4];
+  if (fread(buf, 4, 1, fp) != 1)
+    return false;
+  *out = (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+      ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+  return true;
+}
+
+static bool ckptGetU64(FILE *fp, uint64_t *out)
+{
+  uint32_t lo, hi;
+  if (!ckptGetU32(fp, &lo) || !ckptGetU32(fp, &hi))
+    return false;
+  *out = (uint64_t)lo | ((uint64_t)hi << 32);
+  return true;
+}
+
+static bool ckptIsZero(const uint8_t *buf, uint32_t size)
+{
+  for (uint32_t i = 0; i < size; i++) {
+    if (buf[i])
+      return false;
+  }
+  return true;
+}
+
+
+static t_ckptError ckptWriteMemory(t_vm *vm, FILE *fp)
+{
+  uint8_t page[CKPT_PAGE_SIZE];
+  t_memAddress base;
+  t_memSize extent;
+
+  unsigned count = 0;
+  while (memGetArea(vm, count, &base, &extent))
+    count++;
+  ckptPutU32(fp, count);
+  for (unsigned i = 0; i < count; i++) {
+    memGetArea(vm, i, &base, &extent);
+    ckptPutU32(fp, base);
+    ckptPutU32(fp, extent);
+  }
+
+  for (unsigned i = 0; i < count; i++) {
+    memGetArea(vm, i, &base, &extent);
+    uint64_t end = (uint64_t)base + extent;
+    for (uint64_t addr = base; addr < end;) {
+      uint64_t next = (addr & ~(uint64_t)(CKPT_PAGE_SIZE - 1)) + CKPT_PAGE_SIZE;
+      uint32_t size = (uint32_t)((next < end ? next : end) - addr);
+      if (memDebugReadBlock(vm, (t_memAddress)addr, size, page) !=
+          MEM_NO_ERROR)
+        return CKPT_MEMORY_ERROR;
+      if (!ckptIsZero(page, size)) {
+        ckptPutU32(fp, (uint32_t)addr);
+        ckptPutU32(fp, size);
+        fwrite(page, size, 1, fp);
+      }
+      addr += size;
+    }
+  }
+  ckptPutU32(fp, 0);
+  ckptPutU32(fp, 0);
+  return CKPT_NO_ERROR;
+}
+
+t_ckptError ckptWrite(t_vm *vm, const char *path)
+{
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL)
+    return CKPT_FILE_ERROR;
+
+  t_cpuState cpu;
+  t_svState sv;
+  t_memAddress codeBase;
+  t_memSize codeSize;
+  cpuGetState(vm, &cpu);
+  svGetState(vm, &sv);
+  cpuGetCodeArea(vm, &codeBase, &codeSize);
+  /* reading the whole stack makes it look used */
+  svSaveStackDepth(vm);
+
+  fputs(CKPT_MAGIC, fp);
+  ckptPutU32(fp, CKPT_VERSION);
+  for (int i = 0; i <= CPU_REG_X31; i++)
+    ckptPutU32(fp, cpu.regs[i]);
+  ckptPutU32(fp, cpu.pc);
+  ckptPutU32(fp, (uint32_t)cpu.lastStatus);
+  ckptPutU64(fp, cpu.instret);
+  ckptPutU32(fp, sv.stackBottom);
+  ckptPutU32(fp, (uint32_t)sv.exitCode);
+  ckptPutU64(fp, sv.stdinOffset);
+  ckptPutU32(fp, codeBase);
+  ckptPutU32(fp, codeSize);
+
+  t_ckptError err = ckptWriteMemory(vm, fp);
+  if (fclose(fp) != 0 && err == CKPT_NO_ERROR)
+    err = CKPT_FILE_ERROR;
+  return err;
+}
+
+
+static t_ckptError ckptReadMemory(t_vm *vm, FILE *fp)
+{
+  uint8_t page[CKPT_PAGE_SIZE];
+  uint32_t count, base, extent;
+
+  if (!ckptGetU32(fp, &count))
+    return CKPT_INVALID_FORMAT;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!ckptGetU32(fp, &base) || !ckptGetU32(fp, &extent))
+      return CKPT_INVALID_FORMAT;
+    if (memMapArea(vm, base, extent) != MEM_NO_ERROR)
+      return CKPT_MEMORY_ERROR;
+  }
+
+  for (;;) {
+    uint32_t addr, size;
+    if (!ckptGetU32(fp, &addr) || !ckptGetU32(fp, &size) ||
+        size > CKPT_PAGE_SIZE)
+      return CKPT_INVALID_FORMAT;
+    if (size == 0)
+      break;
+    if (fread(page, size, 1, fp) != 1)
+      return CKPT_INVALID_FORMAT;
+    if (memDebugWriteBlock(vm, addr, size, page) != MEM_NO_ERROR)
+      return CKPT_INVALID_FORMAT;
+  }
+  return CKPT_NO_ERROR;
+}
+
+/* Skips the bytes that the program had already read when the checkpoint was
+ * taken, counting from where the input was when it was set */
+static bool ckptSkipInput(t_vm *vm, uint64_t offset)
+{
+  FILE *in = svGetInput(vm);
+  off_t start = svGetInputStart(vm);
+  if (offset == 0)
+    return true;
+  if (start >= 0 && fseeko(in, start + (off_t)offset, SEEK_SET) == 0)
+    return true;
+  for (uint64_t i = 0; i < offset; i++) {
+    if (getc(in) == EOF)
+      return false;
+  }
+  return true;
+}
+
+t_ckptError ckptRestore(t_vm *vm, const char *path)
+{
+  char magic[4];
+  uint32_t version, lastStatus, exitCode, codeBase, codeSize;
+  t_cpuState cpu;
+  t_svState sv;
+
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return CKPT_FILE_ERROR;
+
+  bool ok = fread(magic, 4, 1, fp) == 1 &&
+      memcmp(magic, CKPT_MAGIC, 4) == 0 && ckptGetU32(fp, &version) &&
+      version == CKPT_VERSION;
+  for (int i = 0; ok && i <= CPU_REG_X31; i++)
+    ok = ckptGetU32(fp, &cpu.regs[i]);
+  ok = ok && ckptGetU32(fp, &cpu.pc) && ckptGetU32(fp, &lastStatus);
+  ok = ok && ckptGetU64(fp, &cpu.instret) && ckptGetU32(fp, &sv.stackBottom) &&
+      ckptGetU32(fp, &exitCode);
+  ok = ok && ckptGetU64(fp, &sv.stdinOffset) && ckptGetU32(fp, &codeBase) &&
+      ckptGetU32(fp, &codeSize);
+  if (!ok) {
+    fclose(fp);
+    return CKPT_INVALID_FORMAT;
+  }
+  cpu.lastStatus = (t_cpuStatus)lastStatus;
+  sv.exitCode = (t_isaInt)exitCode;
+
+  t_ckptError err = ckptReadMemory(vm, fp);
+  fclose(fp);
+  if (err != CKPT_NO_ERROR)
+    return err;
+
+  cpuReset(vm, cpu.pc);
+  cpuSetCodeArea(vm, codeBase, codeSize);
+  cpuSetState(vm, &cpu);
+  svSetState(vm, &sv);
+  if (!ckptSkipInput(vm, sv.stdinOffset))
+    return CKPT_FILE_ERROR;
+  return CKPT_NO_ERROR;
+}
@@ -0,0 +1,23 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "vm.h"
+
+typedef int t_ckptError;
+enum {
+  CKPT_NO_ERROR = 0,
+  CKPT_FILE_ERROR = -1,
+  CKPT_INVALID_FORMAT = -2,
+  CKPT_MEMORY_ERROR = -3
+};
+
+/* Saves the state of the CPU, of the supervisor and all the mapped memory */
+t_ckptError ckptWrite(t_vm *vm, const char *path);
+/* Restores a checkpoint in place of loading an executable. The program
+ * input (see svSetIO()) is skipped up to the point where the checkpoint was
+ * taken. The input must not have been read since it was set, and it must
+ * start where the input of the checkpointed program started: the bytes are
+ * skipped from the position of the stream when it was set. */
+t_ckptError ckptRestore(t_vm *vm, const char *path);
+
+#endif
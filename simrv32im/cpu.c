@@ -1,430 +1,1998 @@
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
 #include "cpu.h"
 #include "memory.h"
+#include "jit.h"
+#include "callgraph.h"
+
+#if defined(CPU_THREADED_CORE) && !defined(__GNUC__)
+#error "the threaded interpreter core requires GCC or Clang"
+#endif
 
 #define CPU_N_REGS 32
+/* Extra register slot which absorbs all writes to X0 performed by decoded
+ * instructions, so that X0 does not have to be reset after every tick. */
+#define CPU_REG_SINK CPU_N_REGS
+
+
+typedef uint8_t t_cpuOp;
+enum {
+  CPU_OP_NONE = 0, /* not decoded yet */
+  CPU_OP_ILLEGAL,
+  CPU_OP_LB,
+  CPU_OP_LH,
+  CPU_OP_LW,
+  CPU_OP_LBU,
+  CPU_OP_LHU,
+  CPU_OP_ADDI,
+  CPU_OP_SLLI,
+  CPU_OP_SLTI,
+  CPU_OP_SLTIU,
+  CPU_OP_XORI,
+  CPU_OP_SRLI,
+  CPU_OP_SRAI,
+  CPU_OP_ORI,
+  CPU_OP_ANDI,
+  CPU_OP_AUIPC,
+  CPU_OP_SB,
+  CPU_OP_SH,
+  CPU_OP_SW,
+  CPU_OP_ADD,
+  CPU_OP_SLL,
+  CPU_OP_SLT,
+  CPU_OP_SLTU,
+  CPU_OP_XOR,
+  CPU_OP_SRL,
+  CPU_OP_OR,
+  CPU_OP_AND,
+  CPU_OP_SUB,
+  CPU_OP_SRA,
+  CPU_OP_MUL,
+  CPU_OP_MULH,
+  CPU_OP_MULHSU,
+  CPU_OP_MULHU,
+  CPU_OP_DIV,
+  CPU_OP_DIVU,
+  CPU_OP_REM,
+  CPU_OP_REMU,
+  CPU_OP_LUI,
+  CPU_OP_BEQ,
+  CPU_OP_BNE,
+  CPU_OP_BLT,
+  CPU_OP_BGE,
+  CPU_OP_BLTU,
+  CPU_OP_BGEU,
+  CPU_OP_JALR,
+  CPU_OP_JAL,
+  CPU_OP_ECALL,
+  CPU_OP_EBREAK,
+  CPU_OP_CSR, /* all CSR instructions, rs2 holds funct3 */
+  CPU_OP_BLOCK_END, /* sentinel terminating every translated block */
+  CPU_OP_COUNT
+};
+
+/* Internal statuses returned by the instruction handlers, never returned by
+ * cpuTick() or cpuRun() */
+#define CPU_STATUS_BLOCK_END JIT_STATUS_BLOCK_END
+#define CPU_STATUS_CODE_CHANGED JIT_STATUS_CODE_CHANGED
+/* cpu->pc is a CSR instruction, executed by cpuRun() once the run loop has
+ * stopped and the number of retired instructions is known */
+#define CPU_STATUS_CSR_ACCESS JIT_STATUS_CSR_ACCESS
+
+typedef struct cpuDecodedInst t_cpuDecodedInst;
+typedef struct cpu t_cpu;
+typedef t_cpuStatus (*t_cpuInstHandler)(
+    t_cpu *cpu, const t_cpuDecodedInst *inst);
+
+struct cpuDecodedInst {
+#ifdef CPU_THREADED_CORE
+  const void *target; /* label of the op implementation inside cpuRun() */
+#else
+  t_cpuInstHandler handler;
+#endif
+  t_cpuOp op;
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  t_cpuURegValue imm;
+};
+
+#define CPU_BLOCK_MAX_LENGTH JIT_MAX_BLOCK_LENGTH
+_Static_assert(CPU_BLOCK_MAX_LENGTH <= UINT8_MAX,
+    "the block coverage counters are 8 bit");
+/* Number of executions after which a block is compiled to native code */
+#define CPU_JIT_THRESHOLD 32
+
+/* Basic block translated to an array of decoded instructions. Blocks end
+ * with a branch, a jump, a trap or after CPU_BLOCK_MAX_LENGTH instructions,
+ * and are chained to the blocks that were executed after them. */
+typedef struct cpuBlock {
+  struct cpuBlock *nextInList;
+  t_memAddress start;
+  uint32_t length;
+  bool valid;
+  /* the block is never compiled, e.g. because verification failed */
+  bool noJit;
+  uint32_t hotness;
+  t_jitBlock native;
+  /* complete executions of the block, and how many ended with a taken
+   * branch, not yet added to cpu->stats */
+  uint64_t execCount;
+  uint64_t takenCount;
+  /* successors: [0] is the jump target, [1] the fall-through path */
+  t_memAddress exitPC[2];
+  struct cpuBlock *exit[2];
+  t_cpuDecodedInst insts[];
+} t_cpuBlock;
+
+#define CPU_MAX_OBSERVERS 4
+
+typedef struct cpu {
+  t_cpuURegValue regs[CPU_N_REGS + 1];
+  t_cpuURegValue pc;
+  t_cpuStatus lastStatus;
+  t_vm *vm;
+
+  /* Cache of decoded instructions covering the code area, one entry per
+   * aligned 32 bit word. */
+  t_memAddress codeBase;
+  t_memSize codeSize;
+  t_cpuDecodedInst *codeCache;
+
+  /* Translated blocks indexed by start address, one entry per word of the
+   * code area, and number of translated blocks containing each word, which
+   * is at most CPU_BLOCK_MAX_LENGTH. */
+  t_cpuBlock **blockMap;
+  uint8_t *blockCoverage;
+  t_cpuBlock *blockList;
+  /* Invalidated blocks that may still be executing */
+  t_cpuBlock *retiredBlockList;
+
+  t_cpuExecMode execMode;
+#ifdef CPU_THREADED_CORE
+  /* Table of the op labels inside cpuRunBlocks(cpu), indexed by t_cpuOp */
+  const void *const *threadedTargets;
+#endif
+
+  /* Retired instructions, updated when the run loops return */
+  uint64_t instret;
+#ifdef MEM_FLAT_ADDRESS_SPACE
+  /* Memory faults do not return to the run loops, which record here the
+   * instructions they retired and the block they entered at runStart */
+  uint32_t runRetired;
+  t_memAddress runStart;
+  t_cpuBlock *runBlock;
+#endif
+  struct timespec resetTime;
+  t_cpuCounterSource cycleSource;
+  t_cpuCounterSource hpmCounterSources[ISA_CSR_HPMCOUNTER31 -
+      ISA_CSR_HPMCOUNTER3 + 1];
+
+  t_cpuObserver observers[CPU_MAX_OBSERVERS];
+  int numObservers;
+
+  bool statsEnabled;
+  t_cpuStats stats;
+  /* Per-word execution and taken branch counts of the code area */
+  bool profileEnabled;
+  uint64_t *profileCounts;
+  uint64_t *profileTaken;
+  bool callGraphEnabled;
+} t_cpu;
+
+/* The call graph profiler is per-thread, see callgraph.h */
+static _Thread_local t_vm *cpuCallGraphVM;
+
+
+bool cpuCreate(t_vm *vm)
+{
+  vm->cpu = calloc(1, sizeof(t_cpu));
+  if (vm->cpu == NULL)
+    return false;
+  vm->cpu->vm = vm;
+  vm->cpu->execMode = CPU_EXEC_INTERPRETER;
+  return true;
+}
+
+
+t_cpuURegValue cpuGetRegister(t_vm *vm, t_cpuRegID reg)
+{
+  t_cpu *cpu = vm->cpu;
+  if (reg == CPU_REG_X0)
+    return 0;
+  if (reg == CPU_REG_PC)
+    return cpu->pc;
+  return cpu->regs[reg];
+}
+
+
+void cpuSetRegister(t_vm *vm, t_cpuRegID reg, t_cpuURegValue value)
+{
+  t_cpu *cpu = vm->cpu;
+  if (reg == CPU_REG_PC)
+    cpu->pc = value;
+  else if (reg != CPU_REG_ZERO)
+    cpu->regs[reg] = value;
+}
+
+
+void cpuReset(t_vm *vm, t_cpuURegValue pcValue)
+{
+  t_cpu *cpu = vm->cpu;
+  cpu->lastStatus = CPU_STATUS_OK;
+  cpu->pc = pcValue;
+  for (int i = 0; i < CPU_N_REGS; i++) {
+    cpu->regs[i] = 0;
+  }
+  cpu->instret = 0;
+  clock_gettime(CLOCK_MONOTONIC, &cpu->resetTime);
+}
+
+
+uint64_t cpuGetInstret(t_vm *vm)
+{
+  t_cpu *cpu = vm->cpu;
+  return cpu->instret;
+}
+
+
+void cpuGetState(t_vm *vm, t_cpuState *out)
+{
+  t_cpu *cpu = vm->cpu;
+  out->regs[0] = 0;
+  for (int i = 1; i < CPU_N_REGS; i++)
+    out->regs[i] = cpu->regs[i];
+  out->pc = cpu->pc;
+  out->lastStatus = cpu->lastStatus;
+  out->instret = cpu->instret;
+}
+
+
+void cpuSetState(t_vm *vm, const t_cpuState *state)
+{
+  t_cpu *cpu = vm->cpu;
+  for (int i = 1; i < CPU_N_REGS; i++)
+    cpu->regs[i] = state->regs[i];
+  cpu->pc = state->pc;
+  cpu->lastStatus = state->lastStatus;
+  cpu->instret = state->instret;
+}
+
+
+static void cpuStatsFoldBlocks(t_cpu *cpu, t_cpuBlock *list);
+
+static void cpuFreeBlockList(t_cpu *cpu, t_cpuBlock *list)
+{
+  cpuStatsFoldBlocks(cpu, list);
+  while (list) {
+    t_cpuBlock *next = list->nextInList;
+    free(list);
+    list = next;
+  }
+}
+
+
+void cpuGetCodeArea(t_vm *vm, t_memAddress *base, t_memSize *size)
+{
+  t_cpu *cpu = vm->cpu;
+  *base = cpu->codeBase;
+  *size = cpu->codeSize;
+}
+
+
+void cpuSetCodeArea(t_vm *vm, t_memAddress base, t_memSize size)
+{
+  t_cpu *cpu = vm->cpu;
+  cpuFreeBlockList(cpu, cpu->blockList);
+  cpuFreeBlockList(cpu, cpu->retiredBlockList);
+  cpu->blockList = cpu->retiredBlockList = NULL;
+  free(cpu->codeCache);
+  free(cpu->blockMap);
+  free(cpu->blockCoverage);
+  free(cpu->profileCounts);
+  free(cpu->profileTaken);
+  cpu->profileCounts = cpu->profileTaken = NULL;
+  jitReset(cpu->vm);
+
+  cpu->codeBase = base;
+  cpu->codeSize = size & ~(t_memSize)3;
+  cpu->codeCache = calloc(cpu->codeSize / 4, sizeof(t_cpuDecodedInst));
+  cpu->blockMap = calloc(cpu->codeSize / 4, sizeof(t_cpuBlock *));
+  cpu->blockCoverage = calloc(cpu->codeSize / 4, sizeof(uint8_t));
+  if (!cpu->codeCache || !cpu->blockMap || !cpu->blockCoverage)
+    cpu->codeSize = 0;
+  if (cpu->profileEnabled) {
+    cpu->profileCounts = calloc(cpu->codeSize / 4, sizeof(uint64_t));
+    cpu->profileTaken = calloc(cpu->codeSize / 4, sizeof(uint64_t));
+  }
+  jitSetCodeArea(cpu->vm, cpu->codeBase, cpu->codeSize);
+}
+
+
+void cpuDestroy(t_vm *vm)
+{
+  t_cpu *cpu = vm->cpu;
+  if (cpu == NULL)
+    return;
+  cpuFreeBlockList(cpu, cpu->blockList);
+  cpuFreeBlockList(cpu, cpu->retiredBlockList);
+  free(cpu->codeCache);
+  free(cpu->blockMap);
+  free(cpu->blockCoverage);
+  free(cpu->profileCounts);
+  free(cpu->profileTaken);
+  free(cpu);
+  vm->cpu = NULL;
+}
+
+
+static void cpuInvalidateBlocks(t_cpu *cpu, uint64_t start, uint64_t end)
+{
+  t_cpuBlock **prev = &cpu->blockList;
+  t_cpuBlock *blk = cpu->blockList;
+  while (blk) {
+    t_cpuBlock *next = blk->nextInList;
+    uint64_t blkEnd = (uint64_t)blk->start + blk->length * 4;
+    if (blk->start < end && start < blkEnd) {
+      blk->valid = false;
+      cpu->blockMap[(blk->start - cpu->codeBase) / 4] = NULL;
+      for (uint64_t i = (blk->start - cpu->codeBase) / 4;
+           i < (blkEnd - cpu->codeBase) / 4; i++)
+        cpu->blockCoverage[i]--;
+      *prev = next;
+      blk->nextInList = cpu->retiredBlockList;
+      cpu->retiredBlockList = blk;
+    } else {
+      prev = &blk->nextInList;
+    }
+    blk = next;
+  }
+
+  for (blk = cpu->blockList; blk; blk = blk->nextInList) {
+    for (int i = 0; i < 2; i++) {
+      if (blk->exit[i] && !blk->exit[i]->valid)
+        blk->exit[i] = NULL;
+    }
+  }
+}
+
+
+bool cpuInvalidateCode(t_vm *vm, t_memAddress addr, t_memSize size)
+{
+  t_cpu *cpu = vm->cpu;
+  uint64_t start = (uint64_t)addr;
+  uint64_t end = start + size;
+  uint64_t codeEnd = (uint64_t)cpu->codeBase + cpu->codeSize;
+  if (end <= cpu->codeBase || start >= codeEnd)
+    return false;
+  if (start < cpu->codeBase)
+    start = cpu->codeBase;
+  if (end > codeEnd)
+    end = codeEnd;
+
+  bool translated = false;
+  for (uint64_t i = (start - cpu->codeBase) / 4;
+       i <= (end - 1 - cpu->codeBase) / 4; i++) {
+    cpu->codeCache[i].op = CPU_OP_NONE;
+    translated |= cpu->blockCoverage[i] > 0;
+  }
+  if (translated)
+    cpuInvalidateBlocks(cpu, start, end);
+  return true;
+}
+
+
+t_cpuStatus cpuClearLastFault(t_vm *vm)
+{
+  t_cpu *cpu = vm->cpu;
+  if (cpu->lastStatus == CPU_STATUS_ILL_INST_FAULT ||
+      cpu->lastStatus == CPU_STATUS_EBREAK_TRAP ||
+      cpu->lastStatus == CPU_STATUS_ECALL_TRAP)
+    cpu->pc += 4;
+  cpu->lastStatus = CPU_STATUS_OK;
+  return cpu->lastStatus;
+}
+
+
+/*
+ * Instruction handlers
+ */
+
+static inline t_cpuStatus cpuExecuteILLEGAL(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  return CPU_STATUS_ILL_INST_FAULT;
+}
+
+static inline t_cpuStatus cpuExecuteLB(t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  uint8_t tmp;
+  if (memRead8(cpu->vm, cpu->regs[inst->rs1] + inst->imm, &tmp) != MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  cpu->regs[inst->rd] = (t_cpuURegValue)((t_cpuSRegValue)((int8_t)tmp));
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteLH(t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  uint16_t tmp;
+  if (memRead16(cpu->vm, cpu->regs[inst->rs1] + inst->imm, &tmp) !=
+      MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  cpu->regs[inst->rd] = (t_cpuURegValue)((t_cpuSRegValue)((int16_t)tmp));
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteLW(t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  uint32_t tmp;
+  if (memRead32(cpu->vm, cpu->regs[inst->rs1] + inst->imm, &tmp) !=
+      MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  cpu->regs[inst->rd] = tmp;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteLBU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  uint8_t tmp;
+  if (memRead8(cpu->vm, cpu->regs[inst->rs1] + inst->imm, &tmp) != MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  cpu->regs[inst->rd] = (t_cpuURegValue)tmp;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteLHU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  uint16_t tmp;
+  if (memRead16(cpu->vm, cpu->regs[inst->rs1] + inst->imm, &tmp) !=
+      MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  cpu->regs[inst->rd] = (t_cpuURegValue)tmp;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteADDI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] + inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSLLI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] << inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSLTI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] =
+      ((t_cpuSRegValue)cpu->regs[inst->rs1]) < ((t_cpuSRegValue)inst->imm);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSLTIU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] < inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteXORI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] ^ inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSRLI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] >> inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSRAI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = SRA(cpu->regs[inst->rs1], inst->imm);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteORI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] | inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteANDI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] & inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteAUIPC(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->pc + inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSB(t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  t_memAddress addr = cpu->regs[inst->rs1] + inst->imm;
+  if (memWrite8(cpu->vm, addr, cpu->regs[inst->rs2] & 0xFF) != MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  cpu->pc += 4;
+  if (cpuInvalidateCode(cpu->vm, addr, 1))
+    return CPU_STATUS_CODE_CHANGED;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSH(t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  t_memAddress addr = cpu->regs[inst->rs1] + inst->imm;
+  if (memWrite16(cpu->vm, addr, cpu->regs[inst->rs2] & 0xFFFF) != MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  cpu->pc += 4;
+  if (cpuInvalidateCode(cpu->vm, addr, 2))
+    return CPU_STATUS_CODE_CHANGED;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSW(t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  t_memAddress addr = cpu->regs[inst->rs1] + inst->imm;
+  if (memWrite32(cpu->vm, addr, cpu->regs[inst->rs2]) != MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  cpu->pc += 4;
+  if (cpuInvalidateCode(cpu->vm, addr, 4))
+    return CPU_STATUS_CODE_CHANGED;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteADD(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] + cpu->regs[inst->rs2];
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSLL(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] << (cpu->regs[inst->rs2] & 0x1F);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSLT(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = ((t_cpuSRegValue)cpu->regs[inst->rs1]) <
+      ((t_cpuSRegValue)cpu->regs[inst->rs2]);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSLTU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] < cpu->regs[inst->rs2];
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteXOR(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] ^ cpu->regs[inst->rs2];
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSRL(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] >> (cpu->regs[inst->rs2] & 0x1F);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteOR(t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] | cpu->regs[inst->rs2];
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteAND(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] & cpu->regs[inst->rs2];
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSUB(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] - cpu->regs[inst->rs2];
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteSRA(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] =
+      SRA(cpu->regs[inst->rs1], (cpu->regs[inst->rs2] & 0x1F));
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteMUL(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->regs[inst->rs1] * cpu->regs[inst->rs2];
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteMULH(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  int64_t a = (int32_t)cpu->regs[inst->rs1];
+  int64_t b = (int32_t)cpu->regs[inst->rs2];
+  cpu->regs[inst->rd] = (uint32_t)((a * b) >> 32);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteMULHSU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = (uint32_t)(((int64_t)((int32_t)cpu->regs[inst->rs1]) *
+                                     (int64_t)(cpu->regs[inst->rs2])) >>
+      32);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteMULHU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = (t_cpuURegValue)(((uint64_t)(cpu->regs[inst->rs1]) *
+                                           (uint64_t)(cpu->regs[inst->rs2])) >>
+      32);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteDIV(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  t_cpuURegValue a = cpu->regs[inst->rs1], b = cpu->regs[inst->rs2];
+  if (b == 0)
+    cpu->regs[inst->rd] = 0xFFFFFFFF;
+  else if (a == 0x80000000 && b == 0xFFFFFFFF)
+    cpu->regs[inst->rd] = 0x80000000;
+  else
+    cpu->regs[inst->rd] =
+        (t_cpuURegValue)((t_cpuSRegValue)a / (t_cpuSRegValue)b);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteDIVU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  t_cpuURegValue a = cpu->regs[inst->rs1], b = cpu->regs[inst->rs2];
+  if (b == 0)
+    cpu->regs[inst->rd] = 0xFFFFFFFF;
+  else
+    cpu->regs[inst->rd] = a / b;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteREM(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  t_cpuURegValue a = cpu->regs[inst->rs1], b = cpu->regs[inst->rs2];
+  if (b == 0)
+    cpu->regs[inst->rd] = a;
+  else if (a == 0x80000000 && b == 0xFFFFFFFF)
+    cpu->regs[inst->rd] = 0;
+  else
+    cpu->regs[inst->rd] =
+        (t_cpuURegValue)((t_cpuSRegValue)a % (t_cpuSRegValue)b);
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteREMU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  t_cpuURegValue a = cpu->regs[inst->rs1], b = cpu->regs[inst->rs2];
+  if (b == 0)
+    cpu->regs[inst->rd] = a;
+  else
+    cpu->regs[inst->rd] = a % b;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteLUI(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = inst->imm;
+  cpu->pc += 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteBEQ(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  bool taken = cpu->regs[inst->rs1] == cpu->regs[inst->rs2];
+  cpu->pc += taken ? inst->imm : 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteBNE(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  bool taken = cpu->regs[inst->rs1] != cpu->regs[inst->rs2];
+  cpu->pc += taken ? inst->imm : 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteBLT(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  bool taken = (t_cpuSRegValue)cpu->regs[inst->rs1] <
+      (t_cpuSRegValue)cpu->regs[inst->rs2];
+  cpu->pc += taken ? inst->imm : 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteBGE(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  bool taken = (t_cpuSRegValue)cpu->regs[inst->rs1] >=
+      (t_cpuSRegValue)cpu->regs[inst->rs2];
+  cpu->pc += taken ? inst->imm : 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteBLTU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  bool taken = cpu->regs[inst->rs1] < cpu->regs[inst->rs2];
+  cpu->pc += taken ? inst->imm : 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteBGEU(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  bool taken = cpu->regs[inst->rs1] >= cpu->regs[inst->rs2];
+  cpu->pc += taken ? inst->imm : 4;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteJALR(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->pc + 4;
+  // clear bit zero as suggested by the spec
+  cpu->pc = (cpu->regs[inst->rs1] + inst->imm) & ~(t_cpuURegValue)1;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteJAL(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  cpu->regs[inst->rd] = cpu->pc + 4;
+  cpu->pc += inst->imm;
+  return CPU_STATUS_OK;
+}
+
+static inline t_cpuStatus cpuExecuteECALL(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  return CPU_STATUS_ECALL_TRAP;
+}
 
-t_cpuURegValue cpuRegs[CPU_N_REGS];
-t_cpuURegValue cpuPC;
-t_cpuStatus lastStatus;
+static inline t_cpuStatus cpuExecuteEBREAK(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  return CPU_STATUS_EBREAK_TRAP;
+}
 
+static inline t_cpuStatus cpuExecuteCSR(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
+{
+  return CPU_STATUS_CSR_ACCESS;
+}
 
-t_cpuURegValue cpuGetRegister(t_cpuRegID reg)
+static inline t_cpuStatus cpuExecuteBLOCK_END(
+    t_cpu *cpu, const t_cpuDecodedInst *inst)
 {
-  if (reg == CPU_REG_X0)
-    return 0;
-  if (reg == CPU_REG_PC)
-    return cpuPC;
-  return cpuRegs[reg];
+  return CPU_STATUS_BLOCK_END;
 }
 
 
-void cpuSetRegister(t_cpuRegID reg, t_cpuURegValue value)
+/* The threaded core only uses the handlers in the observed execution mode */
+static const t_cpuInstHandler cpuHandlers[CPU_OP_COUNT] = {
+    [CPU_OP_ILLEGAL] = cpuExecuteILLEGAL,
+    [CPU_OP_LB] = cpuExecuteLB,
+    [CPU_OP_LH] = cpuExecuteLH,
+    [CPU_OP_LW] = cpuExecuteLW,
+    [CPU_OP_LBU] = cpuExecuteLBU,
+    [CPU_OP_LHU] = cpuExecuteLHU,
+    [CPU_OP_ADDI] = cpuExecuteADDI,
+    [CPU_OP_SLLI] = cpuExecuteSLLI,
+    [CPU_OP_SLTI] = cpuExecuteSLTI,
+    [CPU_OP_SLTIU] = cpuExecuteSLTIU,
+    [CPU_OP_XORI] = cpuExecuteXORI,
+    [CPU_OP_SRLI] = cpuExecuteSRLI,
+    [CPU_OP_SRAI] = cpuExecuteSRAI,
+    [CPU_OP_ORI] = cpuExecuteORI,
+    [CPU_OP_ANDI] = cpuExecuteANDI,
+    [CPU_OP_AUIPC] = cpuExecuteAUIPC,
+    [CPU_OP_SB] = cpuExecuteSB,
+    [CPU_OP_SH] = cpuExecuteSH,
+    [CPU_OP_SW] = cpuExecuteSW,
+    [CPU_OP_ADD] = cpuExecuteADD,
+    [CPU_OP_SLL] = cpuExecuteSLL,
+    [CPU_OP_SLT] = cpuExecuteSLT,
+    [CPU_OP_SLTU] = cpuExecuteSLTU,
+    [CPU_OP_XOR] = cpuExecuteXOR,
+    [CPU_OP_SRL] = cpuExecuteSRL,
+    [CPU_OP_OR] = cpuExecuteOR,
+    [CPU_OP_AND] = cpuExecuteAND,
+    [CPU_OP_SUB] = cpuExecuteSUB,
+    [CPU_OP_SRA] = cpuExecuteSRA,
+    [CPU_OP_MUL] = cpuExecuteMUL,
+    [CPU_OP_MULH] = cpuExecuteMULH,
+    [CPU_OP_MULHSU] = cpuExecuteMULHSU,
+    [CPU_OP_MULHU] = cpuExecuteMULHU,
+    [CPU_OP_DIV] = cpuExecuteDIV,
+    [CPU_OP_DIVU] = cpuExecuteDIVU,
+    [CPU_OP_REM] = cpuExecuteREM,
+    [CPU_OP_REMU] = cpuExecuteREMU,
+    [CPU_OP_LUI] = cpuExecuteLUI,
+    [CPU_OP_BEQ] = cpuExecuteBEQ,
+    [CPU_OP_BNE] = cpuExecuteBNE,
+    [CPU_OP_BLT] = cpuExecuteBLT,
+    [CPU_OP_BGE] = cpuExecuteBGE,
+    [CPU_OP_BLTU] = cpuExecuteBLTU,
+    [CPU_OP_BGEU] = cpuExecuteBGEU,
+    [CPU_OP_JALR] = cpuExecuteJALR,
+    [CPU_OP_JAL] = cpuExecuteJAL,
+    [CPU_OP_ECALL] = cpuExecuteECALL,
+    [CPU_OP_EBREAK] = cpuExecuteEBREAK,
+    [CPU_OP_CSR] = cpuExecuteCSR,
+    [CPU_OP_BLOCK_END] = cpuExecuteBLOCK_END};
+
+
+/*
+ * Instruction decoder
+ */
+
+static void cpuBindOp(t_cpu *cpu, t_cpuDecodedInst *inst, t_cpuOp op)
 {
-  if (reg == CPU_REG_PC)
-    cpuPC = value;
-  if (reg != CPU_REG_ZERO)
-    cpuRegs[reg] = value;
+  inst->op = op;
+#ifdef CPU_THREADED_CORE
+  inst->target = cpu->threadedTargets[op];
+#else
+  inst->handler = cpuHandlers[op];
+#endif
 }
 
+static t_cpuOp cpuDecodeLOAD(uint32_t instr, t_cpuDecodedInst *out)
+{
+  static const t_cpuOp ops[8] = {CPU_OP_LB, CPU_OP_LH, CPU_OP_LW,
+      CPU_OP_ILLEGAL, CPU_OP_LBU, CPU_OP_LHU, CPU_OP_ILLEGAL, CPU_OP_ILLEGAL};
+  out->imm = ISA_INST_I_IMM12_SEXT(instr);
+  return ops[ISA_INST_FUNCT3(instr)];
+}
 
-void cpuReset(t_cpuURegValue pcValue)
+static t_cpuOp cpuDecodeOPIMM(uint32_t instr, t_cpuDecodedInst *out)
 {
-  lastStatus = CPU_STATUS_OK;
-  cpuPC = pcValue;
-  for (int i = 0; i < CPU_N_REGS; i++) {
-    cpuRegs[i] = 0;
+  static const t_cpuOp ops[8] = {CPU_OP_ADDI, CPU_OP_SLLI, CPU_OP_SLTI,
+      CPU_OP_SLTIU, CPU_OP_XORI, CPU_OP_SRLI, CPU_OP_ORI, CPU_OP_ANDI};
+
+  switch (ISA_INST_FUNCT3(instr)) {
+    case 1: /* SLLI */
+      out->imm = ISA_INST_I_IMM12(instr) & 0x1F;
+      if (ISA_INST_FUNCT7(instr) != 0x00)
+        return CPU_OP_ILLEGAL;
+      break;
+    case 3: /* SLTIU */
+      out->imm = ISA_INST_I_IMM12(instr);
+      break;
+    case 5: /* SRLI / SRAI */
+      out->imm = ISA_INST_I_IMM12(instr) & 0x1F;
+      if (ISA_INST_FUNCT7(instr) == 0x20)
+        return CPU_OP_SRAI;
+      if (ISA_INST_FUNCT7(instr) != 0x00)
+        return CPU_OP_ILLEGAL;
+      break;
+    default:
+      out->imm = ISA_INST_I_IMM12_SEXT(instr);
   }
+  return ops[ISA_INST_FUNCT3(instr)];
 }
 
-
-t_cpuStatus cpuClearLastFault(void)
+static t_cpuOp cpuDecodeSTORE(uint32_t instr, t_cpuDecodedInst *out)
 {
-  if (lastStatus == CPU_STATUS_ILL_INST_FAULT ||
-      lastStatus == CPU_STATUS_EBREAK_TRAP ||
-      lastStatus == CPU_STATUS_ECALL_TRAP)
-    cpuPC += 4;
-  lastStatus = CPU_STATUS_OK;
-  return lastStatus;
+  static const t_cpuOp ops[8] = {CPU_OP_SB, CPU_OP_SH, CPU_OP_SW,
+      CPU_OP_ILLEGAL, CPU_OP_ILLEGAL, CPU_OP_ILLEGAL, CPU_OP_ILLEGAL,
+      CPU_OP_ILLEGAL};
+  out->imm = ISA_INST_S_IMM12_SEXT(instr);
+  return ops[ISA_INST_FUNCT3(instr)];
 }
 
+static t_cpuOp cpuDecodeOP(uint32_t instr, t_cpuDecodedInst *out)
+{
+  static const t_cpuOp ops00[8] = {CPU_OP_ADD, CPU_OP_SLL, CPU_OP_SLT,
+      CPU_OP_SLTU, CPU_OP_XOR, CPU_OP_SRL, CPU_OP_OR, CPU_OP_AND};
+  static const t_cpuOp ops20[8] = {CPU_OP_SUB, CPU_OP_ILLEGAL, CPU_OP_ILLEGAL,
+      CPU_OP_ILLEGAL, CPU_OP_ILLEGAL, CPU_OP_SRA, CPU_OP_ILLEGAL,
+      CPU_OP_ILLEGAL};
+  static const t_cpuOp ops01[8] = {CPU_OP_MUL, CPU_OP_MULH, CPU_OP_MULHSU,
+      CPU_OP_MULHU, CPU_OP_DIV, CPU_OP_DIVU, CPU_OP_REM, CPU_OP_REMU};
 
-t_cpuStatus cpuExecuteLOAD(uint32_t instr);
-t_cpuStatus cpuExecuteOPIMM(uint32_t instr);
-t_cpuStatus cpuExecuteAUIPC(uint32_t instr);
-t_cpuStatus cpuExecuteSTORE(uint32_t instr);
-t_cpuStatus cpuExecuteOP(uint32_t instr);
-t_cpuStatus cpuExecuteLUI(uint32_t instr);
-t_cpuStatus cpuExecuteBRANCH(uint32_t instr);
-t_cpuStatus cpuExecuteJALR(uint32_t instr);
-t_cpuStatus cpuExecuteJAL(uint32_t instr);
-t_cpuStatus cpuExecuteSYSTEM(uint32_t instr);
+  if (ISA_INST_FUNCT7(instr) == 0x00)
+    return ops00[ISA_INST_FUNCT3(instr)];
+  if (ISA_INST_FUNCT7(instr) == 0x20)
+    return ops20[ISA_INST_FUNCT3(instr)];
+  if (ISA_INST_FUNCT7(instr) == 0x01)
+    return ops01[ISA_INST_FUNCT3(instr)];
+  return CPU_OP_ILLEGAL;
+}
 
-t_cpuStatus cpuTick(void)
+static t_cpuOp cpuDecodeBRANCH(uint32_t instr, t_cpuDecodedInst *out)
 {
-  if (lastStatus != CPU_STATUS_OK)
-    return lastStatus;
+  static const t_cpuOp ops[8] = {CPU_OP_BEQ, CPU_OP_BNE, CPU_OP_ILLEGAL,
+      CPU_OP_ILLEGAL, CPU_OP_BLT, CPU_OP_BGE, CPU_OP_BLTU, CPU_OP_BGEU};
+  out->imm = ISA_INST_B_IMM13_SEXT(instr);
+  return ops[ISA_INST_FUNCT3(instr)];
+}
 
-  uint32_t nextInst;
-  t_memError fetchErr = memRead32(cpuPC, &nextInst);
-  if (fetchErr != MEM_NO_ERROR) {
-    lastStatus = CPU_STATUS_MEMORY_FAULT;
-    return lastStatus;
+static t_cpuOp cpuDecodeSYSTEM(uint32_t instr, t_cpuDecodedInst *out)
+{
+  uint32_t funct3 = ISA_INST_FUNCT3(instr);
+  if (funct3 != 0 && funct3 != 4) {
+    out->imm = ISA_INST_I_IMM12(instr);
+    out->rs2 = (uint8_t)funct3;
+    return CPU_OP_CSR;
   }
+  if (funct3 != 0)
+    return CPU_OP_ILLEGAL;
+  if (ISA_INST_I_IMM12(instr) == 0)
+    return CPU_OP_ECALL;
+  if (ISA_INST_I_IMM12(instr) == 1)
+    return CPU_OP_EBREAK;
+  return CPU_OP_ILLEGAL;
+}
 
-  switch (ISA_INST_OPCODE(nextInst)) {
+static void cpuDecode(t_cpu *cpu, uint32_t instr, t_cpuDecodedInst *out)
+{
+  t_cpuOp op = CPU_OP_ILLEGAL;
+
+  out->rd = (uint8_t)ISA_INST_RD(instr);
+  if (out->rd == CPU_REG_ZERO)
+    out->rd = CPU_REG_SINK;
+  out->rs1 = (uint8_t)ISA_INST_RS1(instr);
+  out->rs2 = (uint8_t)ISA_INST_RS2(instr);
+  out->imm = 0;
+
+  switch (ISA_INST_OPCODE(instr)) {
     case ISA_INST_OPCODE_LOAD:
-      lastStatus = cpuExecuteLOAD(nextInst);
+      op = cpuDecodeLOAD(instr, out);
       break;
     case ISA_INST_OPCODE_OPIMM:
-      lastStatus = cpuExecuteOPIMM(nextInst);
+      op = cpuDecodeOPIMM(instr, out);
       break;
     case ISA_INST_OPCODE_AUIPC:
-      lastStatus = cpuExecuteAUIPC(nextInst);
+      out->imm = ISA_INST_U_IMM20(instr) << 12;
+      op = CPU_OP_AUIPC;
       break;
     case ISA_INST_OPCODE_STORE:
-      lastStatus = cpuExecuteSTORE(nextInst);
+      op = cpuDecodeSTORE(instr, out);
       break;
     case ISA_INST_OPCODE_OP:
-      lastStatus = cpuExecuteOP(nextInst);
+      op = cpuDecodeOP(instr, out);
       break;
     case ISA_INST_OPCODE_LUI:
-      lastStatus = cpuExecuteLUI(nextInst);
+      out->imm = ISA_INST_U_IMM20(instr) << 12;
+      op = CPU_OP_LUI;
       break;
     case ISA_INST_OPCODE_BRANCH:
-      lastStatus = cpuExecuteBRANCH(nextInst);
+      op = cpuDecodeBRANCH(instr, out);
       break;
     case ISA_INST_OPCODE_JALR:
-      lastStatus = cpuExecuteJALR(nextInst);
+      out->imm = ISA_INST_I_IMM12_SEXT(instr);
+      if (ISA_INST_FUNCT3(instr) == 0)
+        op = CPU_OP_JALR;
       break;
     case ISA_INST_OPCODE_JAL:
-      lastStatus = cpuExecuteJAL(nextInst);
+      out->imm = ISA_INST_J_IMM21_SEXT(instr);
+      op = CPU_OP_JAL;
       break;
     case ISA_INST_OPCODE_SYSTEM:
-      lastStatus = cpuExecuteSYSTEM(nextInst);
+      op = cpuDecodeSYSTEM(instr, out);
       break;
-    default:
-      lastStatus = CPU_STATUS_ILL_INST_FAULT;
   }
-  cpuRegs[CPU_REG_ZERO] = 0;
-  return lastStatus;
+
+  cpuBindOp(cpu, out, op);
 }
 
-t_cpuStatus cpuExecuteLOAD(uint32_t instr)
+
+
+
+/*
+ * Translation cache
+ */
+
+static inline t_cpuDecodedInst *cpuFetch(t_cpu *cpu, t_cpuDecodedInst *scratch)
 {
-  t_cpuRegID rd = ISA_INST_RD(instr);
-  t_cpuRegID rs1 = ISA_INST_RS1(instr);
-  t_memAddress addr = cpuRegs[rs1] + ISA_INST_I_IMM12_SEXT(instr);
+  uint32_t instr;
+  t_memAddress offs = cpu->pc - cpu->codeBase;
 
-  uint8_t tmp8;
-  uint16_t tmp16;
-  uint32_t tmp32;
-  t_memError memStatus;
-  switch (ISA_INST_FUNCT3(instr)) {
-    case 0: /* LB */
-      memStatus = memRead8(addr, &tmp8);
-      if (memStatus != MEM_NO_ERROR)
-        return CPU_STATUS_MEMORY_FAULT;
-      cpuRegs[rd] = (t_cpuURegValue)((t_cpuSRegValue)((int8_t)tmp8));
-      break;
-    case 1: /* LH */
-      memStatus = memRead16(addr, &tmp16);
-      if (memStatus != MEM_NO_ERROR)
-        return CPU_STATUS_MEMORY_FAULT;
-      cpuRegs[rd] = (t_cpuURegValue)((t_cpuSRegValue)((int16_t)tmp16));
-      break;
-    case 2: /* LW */
-      memStatus = memRead32(addr, &tmp32);
-      if (memStatus != MEM_NO_ERROR)
-        return CPU_STATUS_MEMORY_FAULT;
-      cpuRegs[rd] = tmp32;
-      break;
-    case 4: /* LBU */
-      memStatus = memRead8(addr, &tmp8);
-      if (memStatus != MEM_NO_ERROR)
-        return CPU_STATUS_MEMORY_FAULT;
-      cpuRegs[rd] = (t_cpuURegValue)tmp8;
-      break;
-    case 5: /* LHU */
-      memStatus = memRead16(addr, &tmp16);
-      if (memStatus != MEM_NO_ERROR)
-        return CPU_STATUS_MEMORY_FAULT;
-      cpuRegs[rd] = (t_cpuURegValue)tmp16;
-      break;
-    default:
-      return CPU_STATUS_ILL_INST_FAULT;
+  if (offs < cpu->codeSize && (offs & 3) == 0) {
+    t_cpuDecodedInst *cached = &cpu->codeCache[offs / 4];
+    if (cached->op == CPU_OP_NONE) {
+      if (memRead32(cpu->vm, cpu->pc, &instr) != MEM_NO_ERROR)
+        return NULL;
+      cpuDecode(cpu, instr, cached);
+    }
+    return cached;
   }
 
-  cpuPC += 4;
-  return CPU_STATUS_OK;
+  if (memRead32(cpu->vm, cpu->pc, &instr) != MEM_NO_ERROR)
+    return NULL;
+  cpuDecode(cpu, instr, scratch);
+  return scratch;
 }
 
-t_cpuStatus cpuExecuteOPIMM(uint32_t instr)
+static bool cpuIsBlockTerminator(t_cpuOp op)
 {
-  t_cpuRegID rd = ISA_INST_RD(instr);
-  t_cpuRegID rs1 = ISA_INST_RS1(instr);
+  return (op >= CPU_OP_BEQ && op <= CPU_OP_CSR) || op == CPU_OP_ILLEGAL;
+}
 
-  switch (ISA_INST_FUNCT3(instr)) {
-    case 0: /* ADDI */
-      cpuRegs[rd] = cpuRegs[rs1] + ISA_INST_I_IMM12_SEXT(instr);
-      break;
-    case 1: /* SLLI */
-      if (ISA_INST_FUNCT7(instr) == 0x00)
-        cpuRegs[rd] = cpuRegs[rs1] << (ISA_INST_I_IMM12(instr) & 0x1F);
-      else
-        return CPU_STATUS_ILL_INST_FAULT;
-      break;
-    case 2: /* SLTI */
-      cpuRegs[rd] = ((t_cpuSRegValue)cpuRegs[rs1]) <
-          ((t_cpuSRegValue)ISA_INST_I_IMM12_SEXT(instr));
-      break;
-    case 3: /* SLTIU */
-      cpuRegs[rd] = cpuRegs[rs1] < ISA_INST_I_IMM12(instr);
-      break;
-    case 4: /* XORI */
-      cpuRegs[rd] = cpuRegs[rs1] ^ ISA_INST_I_IMM12_SEXT(instr);
-      break;
-    case 5: /* SRLI / SRAI */
-      if (ISA_INST_FUNCT7(instr) == 0x00)
-        cpuRegs[rd] = cpuRegs[rs1] >> (ISA_INST_I_IMM12(instr) & 0x1F);
-      else if (ISA_INST_FUNCT7(instr) == 0x20)
-        cpuRegs[rd] = SRA(cpuRegs[rs1], (ISA_INST_I_IMM12(instr) & 0x1F));
-      else
-        return CPU_STATUS_ILL_INST_FAULT;
-      break;
-    case 6: /* ORI */
-      cpuRegs[rd] = cpuRegs[rs1] | ISA_INST_I_IMM12_SEXT(instr);
-      break;
-    case 7: /* ANDI */
-      cpuRegs[rd] = cpuRegs[rs1] & ISA_INST_I_IMM12_SEXT(instr);
+static t_cpuBlock *cpuTranslateBlock(t_cpu *cpu, t_memAddress start)
+{
+  uint32_t instr;
+  uint32_t first = (start - cpu->codeBase) / 4;
+  uint32_t length = 0;
+  t_cpuDecodedInst *last = NULL;
+
+  while (length < CPU_BLOCK_MAX_LENGTH &&
+      (first + length) < cpu->codeSize / 4) {
+    t_cpuDecodedInst *inst = &cpu->codeCache[first + length];
+    if (inst->op == CPU_OP_NONE) {
+      if (memRead32(cpu->vm, start + length * 4, &instr) != MEM_NO_ERROR)
+        break;
+      cpuDecode(cpu, instr, inst);
+    }
+    last = inst;
+    length++;
+    if (cpuIsBlockTerminator(inst->op))
       break;
   }
+  if (length == 0)
+    return NULL;
 
-  cpuPC += 4;
-  return CPU_STATUS_OK;
+  t_cpuBlock *blk = malloc(
+      sizeof(t_cpuBlock) + (length + 1) * sizeof(t_cpuDecodedInst));
+  if (!blk)
+    return NULL;
+  blk->start = start;
+  blk->length = length;
+  blk->valid = true;
+  blk->noJit = false;
+  blk->hotness = 0;
+  blk->native = NULL;
+  blk->execCount = blk->takenCount = 0;
+  for (uint32_t i = 0; i < length; i++) {
+    blk->insts[i] = cpu->codeCache[first + i];
+    cpu->blockCoverage[first + i]++;
+  }
+  cpuBindOp(cpu, &blk->insts[length], CPU_OP_BLOCK_END);
+
+  t_memAddress lastPC = start + (length - 1) * 4;
+  blk->exitPC[1] = lastPC + 4;
+  if ((last->op >= CPU_OP_BEQ && last->op <= CPU_OP_BGEU) ||
+      last->op == CPU_OP_JAL)
+    blk->exitPC[0] = lastPC + last->imm;
+  else
+    blk->exitPC[0] = blk->exitPC[1];
+  blk->exit[0] = blk->exit[1] = NULL;
+
+  blk->nextInList = cpu->blockList;
+  cpu->blockList = blk;
+  cpu->blockMap[first] = blk;
+  return blk;
 }
 
-t_cpuStatus cpuExecuteAUIPC(uint32_t instr)
+static inline t_cpuBlock *cpuGetBlock(t_cpu *cpu, t_memAddress pc)
 {
-  t_cpuRegID rd = ISA_INST_RD(instr);
-  cpuRegs[rd] = cpuPC + (ISA_INST_U_IMM20(instr) << 12);
-  cpuPC += 4;
-  return CPU_STATUS_OK;
+  t_memAddress offs = pc - cpu->codeBase;
+  if (offs >= cpu->codeSize || (offs & 3) != 0)
+    return NULL;
+  t_cpuBlock *blk = cpu->blockMap[offs / 4];
+  if (blk)
+    return blk;
+  return cpuTranslateBlock(cpu, pc);
 }
 
-t_cpuStatus cpuExecuteSTORE(uint32_t instr)
+/* Returns the block to be executed after the given one, linking it to the
+ * exits of the block for the next time. The exit taken by a JALR is not
+ * known in advance, so its slot caches the last target. */
+static inline t_cpuBlock *cpuNextBlock(t_cpu *cpu, t_cpuBlock *blk)
 {
-  t_cpuRegID rs1 = ISA_INST_RS1(instr);
-  t_cpuRegID rs2 = ISA_INST_RS2(instr);
-  t_memAddress addr = cpuRegs[rs1] + ISA_INST_S_IMM12_SEXT(instr);
+  if (blk->exit[0] && blk->exitPC[0] == cpu->pc)
+    return blk->exit[0];
+  if (blk->exit[1] && blk->exitPC[1] == cpu->pc)
+    return blk->exit[1];
 
-  t_memError memStatus;
-  switch (ISA_INST_FUNCT3(instr)) {
-    case 0: /* SB */
-      memStatus = memWrite8(addr, cpuRegs[rs2] & 0xFF);
-      if (memStatus != MEM_NO_ERROR)
-        return CPU_STATUS_MEMORY_FAULT;
+  t_cpuBlock *next = cpuGetBlock(cpu, cpu->pc);
+  if (next) {
+    if (blk->exitPC[1] == cpu->pc) {
+      blk->exit[1] = next;
+    } else {
+      blk->exitPC[0] = cpu->pc;
+      blk->exit[0] = next;
+    }
+  }
+  return next;
+}
+
+
+/*
+ * Execution statistics
+ */
+
+static inline bool cpuIsInCodeArea(t_cpu *cpu, t_memAddress pc)
+{
+  return pc - cpu->codeBase < cpu->codeSize;
+}
+
+static void cpuStatsAddInsts(t_cpu *cpu, const t_cpuDecodedInst *insts,
+    t_memAddress pc, uint32_t n, uint64_t times)
+{
+  cpu->stats.instructions += n * times;
+  if (cpu->profileCounts && cpuIsInCodeArea(cpu, pc)) {
+    uint64_t *counts = &cpu->profileCounts[(pc - cpu->codeBase) >> 2];
+    for (uint32_t i = 0; i < n; i++)
+      counts[i] += times;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    t_cpuOp op = insts[i].op;
+    if (op >= CPU_OP_LB && op <= CPU_OP_LHU)
+      cpu->stats.loads += times;
+    else if (op >= CPU_OP_SB && op <= CPU_OP_SW)
+      cpu->stats.stores += times;
+    else if (op >= CPU_OP_MUL && op <= CPU_OP_REMU)
+      cpu->stats.mulDiv += times;
+    else if (op >= CPU_OP_BEQ && op <= CPU_OP_BGEU)
+      cpu->stats.branchesNotTaken += times;
+    else if (op == CPU_OP_JAL || op == CPU_OP_JALR)
+      cpu->stats.jumps += times;
+    else if (op == CPU_OP_ECALL)
+      cpu->stats.ecalls += times;
+    else if (op == CPU_OP_EBREAK)
+      cpu->stats.ebreaks += times;
+    else
+      cpu->stats.alu += times;
+  }
+}
+
+static void cpuStatsAddTaken(t_cpu *cpu, t_memAddress pc, uint64_t times)
+{
+  cpu->stats.branchesNotTaken -= times;
+  cpu->stats.branchesTaken += times;
+  if (cpu->profileTaken && cpuIsInCodeArea(cpu, pc))
+    cpu->profileTaken[(pc - cpu->codeBase) >> 2] += times;
+}
+
+static void cpuStatsFoldBlocks(t_cpu *cpu, t_cpuBlock *list)
+{
+  for (t_cpuBlock *blk = list; blk; blk = blk->nextInList) {
+    if (blk->execCount == 0)
+      continue;
+    cpuStatsAddInsts(cpu, blk->insts, blk->start, blk->length, blk->execCount);
+    if (blk->takenCount > 0)
+      cpuStatsAddTaken(cpu,
+          blk->start + (blk->length - 1) * 4, blk->takenCount);
+    blk->execCount = blk->takenCount = 0;
+  }
+}
+
+/* Reports n retired instructions to the call graph, the last of which is
+ * inst at address pc. Calls and returns are recognized from the use of ra as
+ * the link register. */
+static void cpuCallGraphRetire(
+    t_cpu *cpu, const t_cpuDecodedInst *inst, t_memAddress pc, uint32_t n)
+{
+  cgRetire(n);
+  if (inst->op != CPU_OP_JAL && inst->op != CPU_OP_JALR)
+    return;
+  if (inst->rd == CPU_REG_RA)
+    cgCall(cpu->pc, pc + 4, cpu->regs[CPU_REG_SP]);
+  else if (inst->op == CPU_OP_JALR && inst->rs1 == CPU_REG_RA)
+    cgReturn(cpu->pc, cpu->regs[CPU_REG_SP]);
+}
+
+/* Instructions retired by a block or a single step which started at the given
+ * address and stopped early with the given status. Traps retire the
+ * instruction that raised them. */
+static inline uint32_t cpuRetiredBeforeStop(
+    t_cpu *cpu, t_memAddress start, t_cpuStatus status)
+{
+  uint32_t n = (cpu->pc - start) / 4;
+  if (status == CPU_STATUS_ECALL_TRAP || status == CPU_STATUS_EBREAK_TRAP)
+    n++;
+  return n;
+}
+
+/* Records the execution of a block which ended with the given status */
+static inline void cpuStatsBlockExit(
+    t_cpu *cpu, t_cpuBlock *blk, t_cpuStatus status)
+{
+  if (status == CPU_STATUS_BLOCK_END) {
+    if (cpu->callGraphEnabled)
+      cpuCallGraphRetire(cpu, &blk->insts[blk->length - 1],
+          blk->start + (blk->length - 1) * 4, blk->length);
+    blk->execCount++;
+    t_cpuOp last = blk->insts[blk->length - 1].op;
+    if (last >= CPU_OP_BEQ && last <= CPU_OP_BGEU && cpu->pc != blk->exitPC[1])
+      blk->takenCount++;
+    return;
+  }
+  uint32_t n = cpuRetiredBeforeStop(cpu, blk->start, status);
+  cpuStatsAddInsts(cpu, blk->insts, blk->start, n, 1);
+  if (cpu->callGraphEnabled)
+    cgRetire(n);
+}
+
+/* Records the execution of a single instruction at address pc */
+static void cpuStatsStep(
+    t_cpu *cpu, const t_cpuDecodedInst *inst, t_memAddress pc,
+    t_cpuStatus status)
+{
+  if (status == CPU_STATUS_MEMORY_FAULT || status == CPU_STATUS_ILL_INST_FAULT)
+    return;
+  cpuStatsAddInsts(cpu, inst, pc, 1, 1);
+  if (cpu->callGraphEnabled)
+    cpuCallGraphRetire(cpu, inst, pc, 1);
+  if (inst->op >= CPU_OP_BEQ && inst->op <= CPU_OP_BGEU && cpu->pc != pc + 4)
+    cpuStatsAddTaken(cpu, pc, 1);
+}
+
+void cpuSetStatsEnabled(t_vm *vm, bool enabled)
+{
+  t_cpu *cpu = vm->cpu;
+  cpu->statsEnabled = enabled;
+}
+
+void cpuGetStats(t_vm *vm, t_cpuStats *out)
+{
+  t_cpu *cpu = vm->cpu;
+  cpuStatsFoldBlocks(cpu, cpu->blockList);
+  cpuStatsFoldBlocks(cpu, cpu->retiredBlockList);
+  *out = cpu->stats;
+}
+
+void cpuSetProfileEnabled(t_vm *vm, bool enabled)
+{
+  t_cpu *cpu = vm->cpu;
+  cpu->profileEnabled = enabled;
+  if (enabled)
+    cpu->statsEnabled = true;
+}
+
+bool cpuSetCallGraphEnabled(t_vm *vm, bool enabled)
+{
+  t_cpu *cpu = vm->cpu;
+  if (cpuCallGraphVM && cpuCallGraphVM != vm)
+    return false;
+  cpuCallGraphVM = enabled ? vm : NULL;
+  cpu->callGraphEnabled = enabled;
+  if (enabled)
+    cpu->statsEnabled = true;
+  return true;
+}
+
+bool cpuGetProfile(t_vm *vm, t_cpuProfile *out)
+{
+  t_cpu *cpu = vm->cpu;
+  cpuStatsFoldBlocks(cpu, cpu->blockList);
+  cpuStatsFoldBlocks(cpu, cpu->retiredBlockList);
+  if (!cpu->profileCounts || !cpu->profileTaken)
+    return false;
+  out->base = cpu->codeBase;
+  out->length = cpu->codeSize / 4;
+  out->counts = cpu->profileCounts;
+  out->taken = cpu->profileTaken;
+  return true;
+}
+
+
+static void cpuFreeRetiredBlocks(t_cpu *cpu)
+{
+  cpuFreeBlockList(cpu, cpu->retiredBlockList);
+  cpu->retiredBlockList = NULL;
+}
+
+
+/*
+ * Native code
+ */
+
+bool cpuSetExecMode(t_vm *vm, t_cpuExecMode mode)
+{
+  t_cpu *cpu = vm->cpu;
+#ifdef CPU_THREADED_CORE
+  if (mode != CPU_EXEC_INTERPRETER)
+    return false;
+#else
+  if (mode != CPU_EXEC_INTERPRETER && !jitInit(cpu->vm))
+    return false;
+#endif
+  cpu->execMode = mode;
+  return true;
+}
+
+#ifndef CPU_THREADED_CORE
+
+static void cpuCompileBlock(t_cpu *cpu, t_cpuBlock *blk)
+{
+  blk->native = jitCompileBlock(cpu->vm,
+      blk->start, blk->length, cpu->execMode == CPU_EXEC_JIT_VERIFY);
+  if (blk->native)
+    return;
+
+  /* the code buffer is full: throw away all native code and start over */
+  jitReset(cpu->vm);
+  for (t_cpuBlock *b = cpu->blockList; b; b = b->nextInList)
+    b->native = NULL;
+  for (t_cpuBlock *b = cpu->retiredBlockList; b; b = b->nextInList)
+    b->native = NULL;
+  blk->native = jitCompileBlock(cpu->vm,
+      blk->start, blk->length, cpu->execMode == CPU_EXEC_JIT_VERIFY);
+  if (!blk->native)
+    blk->noJit = true;
+}
+
+static t_cpuStatus cpuInterpretBlock(t_cpu *cpu, const t_cpuBlock *blk)
+{
+  t_cpuStatus status;
+  const t_cpuDecodedInst *inst = blk->insts;
+  do {
+    status = inst->handler(cpu, inst);
+    inst++;
+  } while (status == CPU_STATUS_OK);
+  return status;
+}
+
+/* Runs the native code of a block, then undoes its effects and runs the
+ * block again in the interpreter, comparing the results. */
+static t_cpuStatus cpuVerifyBlock(t_cpu *cpu, t_cpuBlock *blk)
+{
+  t_cpuURegValue savedRegs[CPU_N_REGS], nativeRegs[CPU_N_REGS];
+  t_cpuURegValue savedPC = cpu->pc, nativePC;
+
+  memcpy(savedRegs, cpu->regs, sizeof(savedRegs));
+  jitJournalBegin(cpu->vm);
+  t_cpuStatus nativeStatus = blk->native(cpu->regs, &cpu->pc, cpu->vm);
+  jitJournalEnd(cpu->vm);
+  memcpy(nativeRegs, cpu->regs, sizeof(nativeRegs));
+  nativePC = cpu->pc;
+  jitJournalRollback(cpu->vm);
+  memcpy(cpu->regs, savedRegs, sizeof(savedRegs));
+  cpu->pc = savedPC;
+
+  t_cpuStatus status = cpuInterpretBlock(cpu, blk);
+
+  t_memAddress addr;
+  bool ok = status == nativeStatus && cpu->pc == nativePC;
+  for (int i = 1; i < CPU_N_REGS && ok; i++)
+    ok = cpu->regs[i] == nativeRegs[i];
+  if (ok && !jitJournalCheck(cpu->vm, &addr)) {
+    fprintf(stderr, "jit: block 0x%08x: memory at 0x%08x differs\n",
+        blk->start, addr);
+    ok = false;
+  } else if (!ok) {
+    fprintf(stderr,
+        "jit: block 0x%08x: native code returned status %d, pc 0x%08x; "
+        "interpreter returned status %d, pc 0x%08x\n",
+        blk->start, nativeStatus, nativePC, status, cpu->pc);
+    for (int i = 1; i < CPU_N_REGS; i++) {
+      if (cpu->regs[i] != nativeRegs[i])
+        fprintf(stderr, "jit:   x%d is 0x%08x, expected 0x%08x\n", i,
+            nativeRegs[i], cpu->regs[i]);
+    }
+  }
+  if (!ok) {
+    blk->native = NULL;
+    blk->noJit = true;
+  }
+  return status;
+}
+
+#endif
+
+
+/*
+ * Observed execution
+ */
+
+bool cpuAddObserver(t_vm *vm, t_cpuObserver observer)
+{
+  t_cpu *cpu = vm->cpu;
+  if (cpu->numObservers == CPU_MAX_OBSERVERS)
+    return false;
+  cpu->observers[cpu->numObservers++] = observer;
+  return true;
+}
+
+/* Describes an instruction before its execution */
+static void cpuObserveInst(
+    t_cpu *cpu, const t_cpuDecodedInst *inst, t_cpuRetireInfo *info)
+{
+  t_cpuOp op = inst->op;
+  info->pc = cpu->pc;
+  info->rd = inst->rd == CPU_REG_SINK ? CPU_REG_ZERO : inst->rd;
+  info->rs1 = inst->rs1;
+  info->rs2 = CPU_REG_ZERO;
+  info->taken = false;
+  info->target = 0;
+  info->memAddress = 0;
+  info->memSize = 0;
+  if (op >= CPU_OP_LB && op <= CPU_OP_LHU) {
+    info->instClass = CPU_CLASS_LOAD;
+    info->memAddress = cpu->regs[inst->rs1] + inst->imm;
+    if (op == CPU_OP_LW)
+      info->memSize = 4;
+    else if (op == CPU_OP_LH || op == CPU_OP_LHU)
+      info->memSize = 2;
+    else
+      info->memSize = 1;
+  } else if (op >= CPU_OP_SB && op <= CPU_OP_SW) {
+    info->instClass = CPU_CLASS_STORE;
+    info->rd = CPU_REG_ZERO;
+    info->rs2 = inst->rs2;
+    info->memAddress = cpu->regs[inst->rs1] + inst->imm;
+    if (op == CPU_OP_SW)
+      info->memSize = 4;
+    else if (op == CPU_OP_SH)
+      info->memSize = 2;
+    else
+      info->memSize = 1;
+  } else if (op >= CPU_OP_ADD && op <= CPU_OP_SRA) {
+    info->instClass = CPU_CLASS_ALU;
+    info->rs2 = inst->rs2;
+  } else if (op >= CPU_OP_MUL && op <= CPU_OP_MULHU) {
+    info->instClass = CPU_CLASS_MUL;
+    info->rs2 = inst->rs2;
+  } else if (op >= CPU_OP_DIV && op <= CPU_OP_REMU) {
+    info->instClass = CPU_CLASS_DIV;
+    info->rs2 = inst->rs2;
+  } else if (op >= CPU_OP_BEQ && op <= CPU_OP_BGEU) {
+    info->instClass = CPU_CLASS_BRANCH;
+    info->rd = CPU_REG_ZERO;
+    info->rs2 = inst->rs2;
+    info->target = cpu->pc + inst->imm;
+  } else if (op == CPU_OP_JAL) {
+    info->instClass = CPU_CLASS_JAL;
+    info->rs1 = CPU_REG_ZERO;
+    info->target = cpu->pc + inst->imm;
+  } else if (op == CPU_OP_JALR) {
+    info->instClass = CPU_CLASS_JALR;
+  } else if (op == CPU_OP_ECALL || op == CPU_OP_EBREAK ||
+      op == CPU_OP_ILLEGAL) {
+    info->instClass = CPU_CLASS_SYSTEM;
+    info->rd = info->rs1 = CPU_REG_ZERO;
+  } else if (op == CPU_OP_CSR) {
+    info->instClass = CPU_CLASS_SYSTEM;
+    if (inst->rs2 >= ISA_INST_FUNCT3_CSRRWI)
+      info->rs1 = CPU_REG_ZERO;
+  } else {
+    info->instClass = CPU_CLASS_ALU;
+    if (op == CPU_OP_LUI || op == CPU_OP_AUIPC)
+      info->rs1 = CPU_REG_ZERO;
+  }
+}
+
+static inline void cpuRecordProgress(
+    t_cpu *cpu, uint32_t retired, t_cpuBlock *blk)
+{
+#ifdef MEM_FLAT_ADDRESS_SPACE
+  cpu->runRetired = retired;
+  cpu->runStart = cpu->pc;
+  cpu->runBlock = blk;
+#endif
+}
+
+/* Executes one instruction at a time, reporting each one to the observers.
+ * This loop is only used when an observer is installed, so that the others
+ * do not pay for it. */
+static t_cpuStatus cpuRunObserved(t_cpu *cpu, uint32_t maxInstructions)
+{
+  if (cpu->lastStatus != CPU_STATUS_OK)
+    return cpu->lastStatus;
+
+  t_cpuStatus status = CPU_STATUS_OK;
+  t_cpuDecodedInst scratch;
+  t_cpuRetireInfo info;
+  uint32_t i;
+  for (i = 0; i < maxInstructions; i++) {
+    cpuRecordProgress(cpu, i, NULL);
+    const t_cpuDecodedInst *inst = cpuFetch(cpu, &scratch);
+    if (inst == NULL) {
+      status = CPU_STATUS_MEMORY_FAULT;
       break;
-    case 1: /* SH */
-      memStatus = memWrite16(addr, cpuRegs[rs2] & 0xFFFF);
-      if (memStatus != MEM_NO_ERROR)
-        return CPU_STATUS_MEMORY_FAULT;
+    }
+    cpuObserveInst(cpu, inst, &info);
+    status = cpuHandlers[inst->op](cpu, inst);
+    if (status == CPU_STATUS_MEMORY_FAULT ||
+        status == CPU_STATUS_ILL_INST_FAULT ||
+        status == CPU_STATUS_CSR_ACCESS)
       break;
-    case 2: /* SW */
-      memStatus = memWrite32(addr, cpuRegs[rs2]);
-      if (memStatus != MEM_NO_ERROR)
-        return CPU_STATUS_MEMORY_FAULT;
+
+    info.nextPC = cpu->pc;
+    if (status == CPU_STATUS_ECALL_TRAP || status == CPU_STATUS_EBREAK_TRAP)
+      info.nextPC = info.pc + 4;
+    info.taken = info.instClass == CPU_CLASS_BRANCH && cpu->pc != info.pc + 4;
+    for (int j = 0; j < cpu->numObservers; j++)
+      cpu->observers[j](cpu->vm, &info);
+    if (cpu->statsEnabled)
+      cpuStatsStep(cpu, inst, info.pc, status);
+
+    if (status == CPU_STATUS_CODE_CHANGED)
+      status = CPU_STATUS_OK;
+    if (status != CPU_STATUS_OK) {
+      i++;
       break;
-    default:
-      return CPU_STATUS_ILL_INST_FAULT;
+    }
   }
 
-  cpuPC += 4;
-  return CPU_STATUS_OK;
+  cpu->instret += i;
+  cpuFreeRetiredBlocks(cpu);
+  cpu->lastStatus = status;
+  return status;
 }
 
-t_cpuStatus cpuExecuteOP(uint32_t instr)
+
+/*
+ * Interpreter main loop
+ */
+
+#ifdef CPU_THREADED_CORE
+
+#define CPU_OP_TARGET(name) [CPU_OP_##name] = &&op_##name
+#define CPU_OP_IMPL(name)            \
+  op_##name:                         \
+  status = cpuExecute##name(cpu, inst); \
+  if (status != CPU_STATUS_OK)       \
+    goto leave_block;                \
+  inst++;                            \
+  goto *inst->target
+
+static t_cpuStatus cpuRunBlocks(t_cpu *cpu, uint32_t maxInstructions)
 {
-  t_cpuRegID rd = ISA_INST_RD(instr);
-  t_cpuRegID rs1 = ISA_INST_RS1(instr);
-  t_cpuRegID rs2 = ISA_INST_RS2(instr);
+  static const void *const targets[CPU_OP_COUNT] = {CPU_OP_TARGET(ILLEGAL),
+      CPU_OP_TARGET(LB), CPU_OP_TARGET(LH), CPU_OP_TARGET(LW),
+      CPU_OP_TARGET(LBU), CPU_OP_TARGET(LHU), CPU_OP_TARGET(ADDI),
+      CPU_OP_TARGET(SLLI), CPU_OP_TARGET(SLTI), CPU_OP_TARGET(SLTIU),
+      CPU_OP_TARGET(XORI), CPU_OP_TARGET(SRLI), CPU_OP_TARGET(SRAI),
+      CPU_OP_TARGET(ORI), CPU_OP_TARGET(ANDI), CPU_OP_TARGET(AUIPC),
+      CPU_OP_TARGET(SB), CPU_OP_TARGET(SH), CPU_OP_TARGET(SW),
+      CPU_OP_TARGET(ADD), CPU_OP_TARGET(SLL), CPU_OP_TARGET(SLT),
+      CPU_OP_TARGET(SLTU), CPU_OP_TARGET(XOR), CPU_OP_TARGET(SRL),
+      CPU_OP_TARGET(OR), CPU_OP_TARGET(AND), CPU_OP_TARGET(SUB),
+      CPU_OP_TARGET(SRA), CPU_OP_TARGET(MUL), CPU_OP_TARGET(MULH),
+      CPU_OP_TARGET(MULHSU), CPU_OP_TARGET(MULHU), CPU_OP_TARGET(DIV),
+      CPU_OP_TARGET(DIVU), CPU_OP_TARGET(REM), CPU_OP_TARGET(REMU),
+      CPU_OP_TARGET(LUI), CPU_OP_TARGET(BEQ), CPU_OP_TARGET(BNE),
+      CPU_OP_TARGET(BLT), CPU_OP_TARGET(BGE), CPU_OP_TARGET(BLTU),
+      CPU_OP_TARGET(BGEU), CPU_OP_TARGET(JALR), CPU_OP_TARGET(JAL),
+      CPU_OP_TARGET(ECALL), CPU_OP_TARGET(EBREAK), CPU_OP_TARGET(CSR),
+      CPU_OP_TARGET(BLOCK_END)};
 
-  if (ISA_INST_FUNCT7(instr) == 0x00) {
-    switch (ISA_INST_FUNCT3(instr)) {
-      case 0: /* ADD */
-        cpuRegs[rd] = cpuRegs[rs1] + cpuRegs[rs2];
-        break;
-      case 1: /* SLL */
-        cpuRegs[rd] = cpuRegs[rs1] << (cpuRegs[rs2] & 0x1F);
-        break;
-      case 2: /* SLT */
-        cpuRegs[rd] =
-            ((t_cpuSRegValue)cpuRegs[rs1]) < ((t_cpuSRegValue)cpuRegs[rs2]);
-        break;
-      case 3: /* SLTU */
-        cpuRegs[rd] = cpuRegs[rs1] < cpuRegs[rs2];
-        break;
-      case 4: /* XOR */
-        cpuRegs[rd] = cpuRegs[rs1] ^ cpuRegs[rs2];
-        break;
-      case 5: /* SRL */
-        cpuRegs[rd] = cpuRegs[rs1] >> (cpuRegs[rs2] & 0x1F);
-        break;
-      case 6: /* OR */
-        cpuRegs[rd] = cpuRegs[rs1] | cpuRegs[rs2];
-        break;
-      case 7: /* AND */
-        cpuRegs[rd] = cpuRegs[rs1] & cpuRegs[rs2];
-        break;
+  if (cpu->lastStatus != CPU_STATUS_OK)
+    return cpu->lastStatus;
+
+  /* the decoder cannot see the labels, so it needs to be told about them */
+  cpu->threadedTargets = targets;
+  if (cpu->numObservers > 0)
+    return cpuRunObserved(cpu, maxInstructions);
+
+  t_cpuStatus status = CPU_STATUS_OK;
+  uint32_t remaining = maxInstructions;
+  t_cpuBlock *blk = NULL;
+  const t_cpuDecodedInst *inst;
+  /* single instructions are executed as a block without chaining */
+  t_cpuDecodedInst step[2];
+  t_memAddress stepPC = 0;
+  cpuBindOp(cpu, &step[1], CPU_OP_BLOCK_END);
+
+dispatch:
+  if (remaining == 0)
+    goto exit;
+  blk = cpuGetBlock(cpu, cpu->pc);
+  if (!blk || blk->length > remaining)
+    blk = NULL;
+  cpuRecordProgress(cpu, maxInstructions - remaining, blk);
+  if (!blk) {
+    inst = cpuFetch(cpu, &step[0]);
+    if (inst == NULL) {
+      status = CPU_STATUS_MEMORY_FAULT;
+      goto exit;
     }
-  } else if (ISA_INST_FUNCT7(instr) == 0x20) {
-    switch (ISA_INST_FUNCT3(instr)) {
-      case 0: /* SUB */
-        cpuRegs[rd] = cpuRegs[rs1] - cpuRegs[rs2];
-        break;
-      case 1:
-      case 2:
-      case 3:
-      case 4:
-        return CPU_STATUS_ILL_INST_FAULT;
-      case 5: /* SRA */
-        cpuRegs[rd] = SRA(cpuRegs[rs1], (cpuRegs[rs2] & 0x1F));
+    step[0] = *inst;
+    stepPC = cpu->pc;
+    inst = step;
+  } else {
+    inst = blk->insts;
+  }
+  goto *inst->target;
+
+  CPU_OP_IMPL(ILLEGAL);
+  CPU_OP_IMPL(LB);
+  CPU_OP_IMPL(LH);
+  CPU_OP_IMPL(LW);
+  CPU_OP_IMPL(LBU);
+  CPU_OP_IMPL(LHU);
+  CPU_OP_IMPL(ADDI);
+  CPU_OP_IMPL(SLLI);
+  CPU_OP_IMPL(SLTI);
+  CPU_OP_IMPL(SLTIU);
+  CPU_OP_IMPL(XORI);
+  CPU_OP_IMPL(SRLI);
+  CPU_OP_IMPL(SRAI);
+  CPU_OP_IMPL(ORI);
+  CPU_OP_IMPL(ANDI);
+  CPU_OP_IMPL(AUIPC);
+  CPU_OP_IMPL(SB);
+  CPU_OP_IMPL(SH);
+  CPU_OP_IMPL(SW);
+  CPU_OP_IMPL(ADD);
+  CPU_OP_IMPL(SLL);
+  CPU_OP_IMPL(SLT);
+  CPU_OP_IMPL(SLTU);
+  CPU_OP_IMPL(XOR);
+  CPU_OP_IMPL(SRL);
+  CPU_OP_IMPL(OR);
+  CPU_OP_IMPL(AND);
+  CPU_OP_IMPL(SUB);
+  CPU_OP_IMPL(SRA);
+  CPU_OP_IMPL(MUL);
+  CPU_OP_IMPL(MULH);
+  CPU_OP_IMPL(MULHSU);
+  CPU_OP_IMPL(MULHU);
+  CPU_OP_IMPL(DIV);
+  CPU_OP_IMPL(DIVU);
+  CPU_OP_IMPL(REM);
+  CPU_OP_IMPL(REMU);
+  CPU_OP_IMPL(LUI);
+  CPU_OP_IMPL(BEQ);
+  CPU_OP_IMPL(BNE);
+  CPU_OP_IMPL(BLT);
+  CPU_OP_IMPL(BGE);
+  CPU_OP_IMPL(BLTU);
+  CPU_OP_IMPL(BGEU);
+  CPU_OP_IMPL(JALR);
+  CPU_OP_IMPL(JAL);
+  CPU_OP_IMPL(ECALL);
+  CPU_OP_IMPL(EBREAK);
+  CPU_OP_IMPL(CSR);
+
+op_BLOCK_END:
+  /* the threaded core cannot be specialized, so statistics are collected
+   * at block granularity behind a flag */
+  if (!blk) {
+    if (cpu->statsEnabled)
+      cpuStatsStep(cpu, step, stepPC, CPU_STATUS_OK);
+    remaining--;
+    goto dispatch;
+  }
+  if (cpu->statsEnabled)
+    cpuStatsBlockExit(cpu, blk, CPU_STATUS_BLOCK_END);
+  remaining -= blk->length;
+  blk = cpuNextBlock(cpu, blk);
+  if (!blk || blk->length > remaining)
+    goto dispatch;
+  cpuRecordProgress(cpu, maxInstructions - remaining, blk);
+  inst = blk->insts;
+  goto *inst->target;
+
+leave_block:
+  if (cpu->statsEnabled) {
+    if (blk)
+      cpuStatsBlockExit(cpu, blk, status);
+    else
+      cpuStatsStep(cpu, step, stepPC, status);
+  }
+  if (status == CPU_STATUS_CODE_CHANGED) {
+    status = CPU_STATUS_OK;
+    remaining -= blk ? (uint32_t)(inst - blk->insts) + 1 : 1;
+    goto dispatch;
+  }
+  remaining -= cpuRetiredBeforeStop(cpu, blk ? blk->start : stepPC, status);
+
+exit:
+  cpu->instret += maxInstructions - remaining;
+  cpuFreeRetiredBlocks(cpu);
+  cpu->lastStatus = status;
+  return status;
+}
+
+#else
+
+#ifdef __GNUC__
+#define CPU_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define CPU_ALWAYS_INLINE inline
+#endif
+
+static CPU_ALWAYS_INLINE t_cpuStatus cpuStep(t_cpu *cpu, const bool stats)
+{
+  t_cpuDecodedInst scratch;
+  t_memAddress pc = cpu->pc;
+  const t_cpuDecodedInst *inst = cpuFetch(cpu, &scratch);
+  if (inst == NULL)
+    return CPU_STATUS_MEMORY_FAULT;
+  t_cpuStatus status = inst->handler(cpu, inst);
+  if (stats)
+    cpuStatsStep(cpu, inst, pc, status);
+  if (status == CPU_STATUS_CODE_CHANGED)
+    return CPU_STATUS_OK;
+  return status;
+}
+
+/* The main loop is compiled twice, with and without statistics, so that
+ * they cost nothing when disabled */
+static CPU_ALWAYS_INLINE t_cpuStatus cpuRunBlocksImpl(
+    t_cpu *cpu, uint32_t maxInstructions, const bool stats)
+{
+  if (cpu->lastStatus != CPU_STATUS_OK)
+    return cpu->lastStatus;
+
+  t_cpuStatus status = CPU_STATUS_OK;
+  uint32_t remaining = maxInstructions;
+  t_cpuBlock *blk = cpuGetBlock(cpu, cpu->pc);
+  while (remaining > 0) {
+    if (!blk || blk->length > remaining) {
+      t_memAddress pc = cpu->pc;
+      cpuRecordProgress(cpu, maxInstructions - remaining, NULL);
+      status = cpuStep(cpu, stats);
+      if (status != CPU_STATUS_OK) {
+        remaining -= cpuRetiredBeforeStop(cpu, pc, status);
         break;
-      case 6:
-      case 7:
-        return CPU_STATUS_ILL_INST_FAULT;
+      }
+      remaining--;
+      blk = cpuGetBlock(cpu, cpu->pc);
+      continue;
     }
-  } else if (ISA_INST_FUNCT7(instr) == 0x01) {
-    switch (ISA_INST_FUNCT3(instr)) {
-      case 0: /* MUL */
-        cpuRegs[rd] = cpuRegs[rs1] * cpuRegs[rs2];
-        break;
-      case 1: /* MULH */
-        cpuRegs[rd] = (uint32_t)(((int64_t)((int32_t)cpuRegs[rs1]) *
-                                     (int64_t)((int32_t)cpuRegs[rs2])) >>
-            32);
-        break;
-      case 2: /* MULHSU */
-        cpuRegs[rd] = (uint32_t)(((int64_t)((int32_t)cpuRegs[rs1]) *
-                                     (int64_t)(cpuRegs[rs2])) >>
-            32);
-        break;
-      case 3: /* MULHU */
-        cpuRegs[rd] = (t_cpuURegValue)(((uint64_t)(cpuRegs[rs1]) *
-                                           (uint64_t)(cpuRegs[rs2])) >>
-            32);
-        break;
-      case 4: /* DIV */
-        if (cpuRegs[rs2] == 0)
-          cpuRegs[rd] = 0xFFFFFFFF;
-        else if (cpuRegs[rs1] == 0x80000000 && cpuRegs[rs2] == 0xFFFFFFFF)
-          cpuRegs[rd] = 0x80000000;
-        else
-          cpuRegs[rd] = (t_cpuURegValue)((t_cpuSRegValue)cpuRegs[rs1] /
-              (t_cpuSRegValue)cpuRegs[rs2]);
-        break;
-      case 5: /* DIVU */
-        if (cpuRegs[rs2] == 0)
-          cpuRegs[rd] = 0xFFFFFFFF;
-        else
-          cpuRegs[rd] = cpuRegs[rs1] / cpuRegs[rs2];
-        break;
-      case 6: /* REM */
-        if (cpuRegs[rs2] == 0)
-          cpuRegs[rd] = cpuRegs[rs1];
-        else if (cpuRegs[rs1] == 0x80000000 && cpuRegs[rs2] == 0xFFFFFFFF)
-          cpuRegs[rd] = 0;
-        else
-          cpuRegs[rd] = (t_cpuURegValue)((t_cpuSRegValue)cpuRegs[rs1] %
-              (t_cpuSRegValue)cpuRegs[rs2]);
-        break;
-      case 7: /* REMU */
-        if (cpuRegs[rs2] == 0)
-          cpuRegs[rd] = cpuRegs[rs1];
-        else
-          cpuRegs[rd] = cpuRegs[rs1] % cpuRegs[rs2];
-        break;
+
+    if (cpu->execMode != CPU_EXEC_INTERPRETER && !blk->native && !blk->noJit &&
+        ++blk->hotness >= CPU_JIT_THRESHOLD)
+      cpuCompileBlock(cpu, blk);
+
+    t_memAddress start = blk->start;
+    cpuRecordProgress(cpu, maxInstructions - remaining, blk);
+    if (!blk->native)
+      status = cpuInterpretBlock(cpu, blk);
+    else if (cpu->execMode == CPU_EXEC_JIT_VERIFY)
+      status = cpuVerifyBlock(cpu, blk);
+    else
+      status = blk->native(cpu->regs, &cpu->pc, cpu->vm);
+    if (stats)
+      cpuStatsBlockExit(cpu, blk, status);
+
+    if (status == CPU_STATUS_BLOCK_END) {
+      remaining -= blk->length;
+      blk = cpuNextBlock(cpu, blk);
+    } else if (status == CPU_STATUS_CODE_CHANGED) {
+      /* the store is the last instruction executed */
+      remaining -= (cpu->pc - start) / 4;
+      blk = cpuGetBlock(cpu, cpu->pc);
+    } else {
+      remaining -= cpuRetiredBeforeStop(cpu, start, status);
+      break;
     }
-  } else {
-    return CPU_STATUS_ILL_INST_FAULT;
+    status = CPU_STATUS_OK;
   }
 
-  cpuPC += 4;
-  return CPU_STATUS_OK;
+  cpu->instret += maxInstructions - remaining;
+  cpuFreeRetiredBlocks(cpu);
+  cpu->lastStatus = status;
+  return status;
 }
 
-t_cpuStatus cpuExecuteLUI(uint32_t instr)
+static t_cpuStatus cpuRunBlocks(t_cpu *cpu, uint32_t maxInstructions)
 {
-  t_cpuRegID rd = ISA_INST_RD(instr);
-  cpuRegs[rd] = ISA_INST_U_IMM20(instr) << 12;
-  cpuPC += 4;
-  return CPU_STATUS_OK;
+  if (cpu->numObservers > 0)
+    return cpuRunObserved(cpu, maxInstructions);
+  if (cpu->statsEnabled)
+    return cpuRunBlocksImpl(cpu, maxInstructions, true);
+  return cpuRunBlocksImpl(cpu, maxInstructions, false);
+}
+
+#endif
+
+/*
+ * Counters
+ */
+
+bool cpuSetCounterSource(t_vm *vm, uint32_t csr, t_cpuCounterSource source)
+{
+  t_cpu *cpu = vm->cpu;
+  if (csr == ISA_CSR_CYCLE) {
+    cpu->cycleSource = source;
+    return true;
+  }
+  if (csr >= ISA_CSR_HPMCOUNTER3 && csr <= ISA_CSR_HPMCOUNTER31) {
+    cpu->hpmCounterSources[csr - ISA_CSR_HPMCOUNTER3] = source;
+    return true;
+  }
+  return false;
 }
 
-t_cpuStatus cpuExecuteBRANCH(uint32_t instr)
+static bool cpuReadCounter(t_cpu *cpu, uint32_t csr, uint64_t *out)
 {
-  t_cpuRegID rs1 = ISA_INST_RS1(instr);
-  t_cpuRegID rs2 = ISA_INST_RS2(instr);
-  t_cpuSRegValue offs = (t_cpuSRegValue)ISA_INST_B_IMM13_SEXT(instr);
-  bool taken = 0;
+  uint32_t counter = csr & ~(uint32_t)ISA_CSR_HIGH;
+  uint64_t value;
 
-  switch (ISA_INST_FUNCT3(instr)) {
-    case 0: /* BEQ */
-      taken = cpuRegs[rs1] == cpuRegs[rs2];
-      break;
-    case 1: /* BNE */
-      taken = cpuRegs[rs1] != cpuRegs[rs2];
-      break;
-    case 4: /* BLT */
-      taken = (t_cpuSRegValue)cpuRegs[rs1] < (t_cpuSRegValue)cpuRegs[rs2];
-      break;
-    case 5: /* BGE */
-      taken = (t_cpuSRegValue)cpuRegs[rs1] >= (t_cpuSRegValue)cpuRegs[rs2];
-      break;
-    case 6: /* BLTU */
-      taken = cpuRegs[rs1] < cpuRegs[rs2];
-      break;
-    case 7: /* BGEU */
-      taken = cpuRegs[rs1] >= cpuRegs[rs2];
-      break;
-    default:
-      return CPU_STATUS_ILL_INST_FAULT;
+  /* the machine mode counters are aliases, but there is no mtime CSR */
+  if (counter >= ISA_CSR_MCYCLE && counter <= ISA_CSR_MHPMCOUNTER31) {
+    counter += ISA_CSR_CYCLE - ISA_CSR_MCYCLE;
+    if (counter == ISA_CSR_TIME)
+      return false;
+  }
+  if (counter == ISA_CSR_TIME) {
+    /* microseconds since reset */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t usec = (int64_t)(now.tv_sec - cpu->resetTime.tv_sec) * 1000000 +
+        (now.tv_nsec - cpu->resetTime.tv_nsec) / 1000;
+    value = (uint64_t)usec;
+  } else if (counter == ISA_CSR_CYCLE) {
+    value = cpu->cycleSource ? cpu->cycleSource(cpu->vm) : cpu->instret;
+  } else if (counter == ISA_CSR_INSTRET) {
+    value = cpu->instret;
+  } else if (counter >= ISA_CSR_HPMCOUNTER3 &&
+      counter <= ISA_CSR_HPMCOUNTER31) {
+    t_cpuCounterSource source =
+        cpu->hpmCounterSources[counter - ISA_CSR_HPMCOUNTER3];
+    value = source ? source(cpu->vm) : 0;
+  } else {
+    return false;
   }
 
-  cpuPC += taken ? (t_cpuURegValue)offs : 4;
-  return CPU_STATUS_OK;
+  *out = csr & ISA_CSR_HIGH ? value >> 32 : value;
+  return true;
+}
+
+bool cpuGetCounter(t_vm *vm, uint32_t csr, uint64_t *out)
+{
+  t_cpu *cpu = vm->cpu;
+  if (csr & ISA_CSR_HIGH)
+    return false;
+  return cpuReadCounter(cpu, csr, out);
 }
 
-t_cpuStatus cpuExecuteJALR(uint32_t instr)
+/* Executes the CSR instruction at cpu->pc. Only counters are implemented, and
+ * they are read-only. */
+static t_cpuStatus cpuAccessCSR(t_cpu *cpu)
 {
-  t_cpuSRegValue offs = (t_cpuSRegValue)ISA_INST_I_IMM12_SEXT(instr);
-  t_cpuRegID rd = ISA_INST_RD(instr);
-  t_cpuRegID rs1 = ISA_INST_RS1(instr);
-  if (ISA_INST_FUNCT3(instr) != 0)
+  t_cpuDecodedInst scratch;
+  t_memAddress pc = cpu->pc;
+  cpuRecordProgress(cpu, 0, NULL);
+  const t_cpuDecodedInst *inst = cpuFetch(cpu, &scratch);
+  if (inst == NULL)
+    return CPU_STATUS_MEMORY_FAULT;
+
+  /* CSRRS and CSRRC do not write the CSR if rs1 or the immediate is zero */
+  uint32_t funct3 = inst->rs2;
+  bool write = funct3 == ISA_INST_FUNCT3_CSRRW ||
+      funct3 == ISA_INST_FUNCT3_CSRRWI || inst->rs1 != 0;
+  uint64_t value;
+  if (write || !cpuReadCounter(cpu, inst->imm, &value))
     return CPU_STATUS_ILL_INST_FAULT;
-  cpuRegs[rd] = cpuPC + 4;
-  // clear bit zero as suggested by the spec
-  cpuPC = (cpuRegs[rs1] + (t_cpuURegValue)offs) & ~(t_cpuURegValue)1;
+
+  t_cpuRetireInfo info;
+  if (cpu->numObservers > 0)
+    cpuObserveInst(cpu, inst, &info);
+  cpu->regs[inst->rd] = (t_cpuURegValue)value;
+  cpu->pc += 4;
+  cpu->instret++;
+  if (cpu->numObservers > 0) {
+    info.nextPC = cpu->pc;
+    for (int j = 0; j < cpu->numObservers; j++)
+      cpu->observers[j](cpu->vm, &info);
+  }
+  if (cpu->statsEnabled)
+    cpuStatsStep(cpu, inst, pc, CPU_STATUS_OK);
   return CPU_STATUS_OK;
 }
 
-t_cpuStatus cpuExecuteJAL(uint32_t instr)
+/* Runs the loop until the end of the budget, stopping at each CSR access */
+static t_cpuStatus cpuRunAndAccessCSRs(t_cpu *cpu, uint32_t maxInstructions)
 {
-  t_cpuSRegValue offs = (t_cpuSRegValue)ISA_INST_J_IMM21_SEXT(instr);
-  t_cpuRegID rd = ISA_INST_RD(instr);
-  cpuRegs[rd] = cpuPC + 4;
-  cpuPC += (t_cpuURegValue)offs;
-  return CPU_STATUS_OK;
+  uint64_t start = cpu->instret;
+  t_cpuStatus status = cpuRunBlocks(cpu, maxInstructions);
+  while (status == CPU_STATUS_CSR_ACCESS) {
+    status = cpu->lastStatus = cpuAccessCSR(cpu);
+    uint64_t done = cpu->instret - start;
+    if (status != CPU_STATUS_OK || done >= maxInstructions)
+      break;
+    status = cpuRunBlocks(cpu, maxInstructions - (uint32_t)done);
+  }
+  return status;
+}
+
+
+t_cpuStatus cpuRun(t_vm *vm, uint32_t maxInstructions)
+{
+  t_cpu *cpu = vm->cpu;
+#ifdef MEM_FLAT_ADDRESS_SPACE
+  /* memory faults raise a signal which makes execution resume here */
+  sigjmp_buf recovery;
+  if (sigsetjmp(recovery, 0) != 0) {
+    memSetFaultRecovery(vm, NULL);
+    jitJournalEnd(vm);
+    /* the faulting instruction is at cpu->pc, like for the other backend */
+    cpu->instret += cpu->runRetired + (cpu->pc - cpu->runStart) / 4;
+    if (cpu->statsEnabled && cpu->runBlock)
+      cpuStatsBlockExit(cpu, cpu->runBlock, CPU_STATUS_MEMORY_FAULT);
+    cpuFreeRetiredBlocks(cpu);
+    cpu->lastStatus = CPU_STATUS_MEMORY_FAULT;
+    return cpu->lastStatus;
+  }
+  memSetFaultRecovery(vm, &recovery);
+  t_cpuStatus status = cpuRunAndAccessCSRs(cpu, maxInstructions);
+  memSetFaultRecovery(vm, NULL);
+  return status;
+#else
+  return cpuRunAndAccessCSRs(cpu, maxInstructions);
+#endif
 }
 
-t_cpuStatus cpuExecuteSYSTEM(uint32_t instr)
+t_cpuStatus cpuTick(t_vm *vm)
 {
-  if (ISA_INST_FUNCT3(instr) != 0)
-    return CPU_STATUS_ILL_INST_FAULT;
-  if (ISA_INST_I_IMM12(instr) == 0)
-    return CPU_STATUS_ECALL_TRAP;
-  if (ISA_INST_I_IMM12(instr) == 1)
-    return CPU_STATUS_EBREAK_TRAP;
-  return CPU_STATUS_ILL_INST_FAULT;
+  return cpuRun(vm, 1);
 }
@@ -1,7 +1,10 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "isa.h"
+#include "memory.h"
 
 typedef int t_cpuStatus;
 enum {
@@ -12,11 +15,123 @@ enum {
   CPU_STATUS_EBREAK_TRAP = -4
 };
 
-t_cpuURegValue cpuGetRegister(t_cpuRegID reg);
-void cpuSetRegister(t_cpuRegID reg, t_cpuURegValue value);
+typedef int t_cpuExecMode;
+enum {
+  CPU_EXEC_INTERPRETER,
+  CPU_EXEC_JIT,        /* compile hot blocks to native code */
+  CPU_EXEC_JIT_VERIFY  /* check every compiled block against the interpreter */
+};
+
+typedef struct {
+  uint64_t instructions; /* retired */
+  uint64_t alu;
+  uint64_t mulDiv;
+  uint64_t loads;
+  uint64_t stores;
+  uint64_t branchesTaken;
+  uint64_t branchesNotTaken;
+  uint64_t jumps;
+  uint64_t ecalls;
+  uint64_t ebreaks;
+} t_cpuStats;
+
+/* Execution counts of each instruction of the code area, indexed by
+ * (pc - base) >> 2 */
+typedef struct {
+  t_memAddress base;
+  uint32_t length;
+  const uint64_t *counts;
+  const uint64_t *taken; /* for branches only */
+} t_cpuProfile;
+
+typedef int t_cpuInstClass;
+enum {
+  CPU_CLASS_ALU,
+  CPU_CLASS_MUL,
+  CPU_CLASS_DIV, /* DIV, DIVU, REM, REMU */
+  CPU_CLASS_LOAD,
+  CPU_CLASS_STORE,
+  CPU_CLASS_BRANCH,
+  CPU_CLASS_JAL,
+  CPU_CLASS_JALR,
+  CPU_CLASS_SYSTEM
+};
+
+/* Instruction reported to the observers after its execution */
+typedef struct {
+  t_memAddress pc;
+  t_memAddress nextPC;
+  t_cpuInstClass instClass;
+  /* registers written and read, CPU_REG_ZERO if not used */
+  t_cpuRegID rd;
+  t_cpuRegID rs1;
+  t_cpuRegID rs2;
+  bool taken; /* for branches */
+  t_memAddress target; /* for branches and JAL, even if not taken */
+  t_memAddress memAddress; /* for loads and stores */
+  uint8_t memSize;
+} t_cpuRetireInfo;
+
+/* Architectural state, saved by checkpoints */
+typedef struct {
+  t_cpuURegValue regs[CPU_REG_X31 + 1]; /* regs[0] is ignored */
+  t_cpuURegValue pc;
+  t_cpuStatus lastStatus;
+  uint64_t instret;
+} t_cpuState;
+
+typedef void (*t_cpuObserver)(t_vm *vm, const t_cpuRetireInfo *info);
+
+typedef uint64_t (*t_cpuCounterSource)(t_vm *vm);
+
+/* Called by vmNew() and vmFree() */
+bool cpuCreate(t_vm *vm);
+void cpuDestroy(t_vm *vm);
+
+t_cpuURegValue cpuGetRegister(t_vm *vm, t_cpuRegID reg);
+void cpuSetRegister(t_vm *vm, t_cpuRegID reg, t_cpuURegValue value);
+
+void cpuReset(t_vm *vm, t_cpuURegValue pcValue);
+void cpuSetCodeArea(t_vm *vm, t_memAddress base, t_memSize size);
+void cpuGetCodeArea(t_vm *vm, t_memAddress *base, t_memSize *size);
+t_cpuStatus cpuTick(t_vm *vm);
+t_cpuStatus cpuRun(t_vm *vm, uint32_t maxInstructions);
+t_cpuStatus cpuClearLastFault(t_vm *vm);
+/* Number of instructions retired since the reset */
+uint64_t cpuGetInstret(t_vm *vm);
+void cpuGetState(t_vm *vm, t_cpuState *out);
+/* Must be called after cpuSetCodeArea */
+void cpuSetState(t_vm *vm, const t_cpuState *state);
+
+/* Returns false if the mode is not supported on this host */
+bool cpuSetExecMode(t_vm *vm, t_cpuExecMode mode);
+/* Discards the translations of the given memory range. Returns true if the
+ * range overlaps the code area. */
+bool cpuInvalidateCode(t_vm *vm, t_memAddress addr, t_memSize size);
+
+/* Reports every retired instruction to the observer. While observers are
+ * installed the CPU executes one instruction at a time, without translated
+ * blocks or native code. Returns false if there are too many observers. */
+bool cpuAddObserver(t_vm *vm, t_cpuObserver observer);
+
+void cpuSetStatsEnabled(t_vm *vm, bool enabled);
+void cpuGetStats(t_vm *vm, t_cpuStats *out);
+/* Must be called before cpuSetCodeArea. Enables the statistics as well. */
+void cpuSetProfileEnabled(t_vm *vm, bool enabled);
+/* Returns false if profiling was not enabled when the code area was set */
+bool cpuGetProfile(t_vm *vm, t_cpuProfile *out);
+/* Reports the retired instructions, calls and returns to the call graph
+ * profiler of the calling thread (see callgraph.h), so the VM must be run
+ * by that thread. Enables the statistics as well. Returns false if the
+ * profiler of the thread is already enabled on another VM. */
+bool cpuSetCallGraphEnabled(t_vm *vm, bool enabled);
 
-void cpuReset(t_cpuURegValue pcValue);
-t_cpuStatus cpuTick(void);
-t_cpuStatus cpuClearLastFault(void);
+/* Sets the value of the ISA_CSR_CYCLE or ISA_CSR_HPMCOUNTERn counter read by
+ * the program. By default the cycle counter is equal to the number of
+ * retired instructions and the hpmcounters are zero. Returns false if the
+ * counter cannot be set. */
+bool cpuSetCounterSource(t_vm *vm, uint32_t csr, t_cpuCounterSource source);
+/* Reads the full 64 bit value of a counter CSR, as seen by the program */
+bool cpuGetCounter(t_vm *vm, uint32_t csr, uint64_t *out);
 
 #endif
@@ -17,6 +17,8 @@ t_dbgBreakpoint *dbgBreakpointList = NULL;
 
 t_dbgBreakpointId dbgLastBreakpointID = 0;
 
+/* VM the debugger is attached to */
+t_vm *dbgVM = NULL;
 bool dbgEnabled = false;
 bool dbgUserRequestsEnter = false;
 bool dbgStepInEnabled = false;
@@ -24,9 +26,10 @@ bool dbgStepOverEnabled = false;
 t_memAddress dbgStepOverAddr;
 
 
-bool dbgEnable(void)
+bool dbgEnable(t_vm *vm)
 {
   bool oldEnable = dbgEnabled;
+  dbgVM = vm;
   dbgEnabled = true;
   return oldEnable;
 }
@@ -150,7 +153,7 @@ t_dbgTrigType dbgCheckTrigger(t_dbgBreakpointId *outId)
   if (dbgStepInEnabled)
     return DBG_TRIG_TYPE_STEPIN;
 
-  t_memAddress curPc = cpuGetRegister(CPU_REG_PC);
+  t_memAddress curPc = cpuGetRegister(dbgVM, CPU_REG_PC);
   if (dbgStepOverEnabled && dbgStepOverAddr == curPc)
     return DBG_TRIG_TYPE_STEPOVER;
 
@@ -263,8 +266,8 @@ void dbgCmdHelp(void)
 
 void dbgCmdStepOver(void)
 {
-  t_cpuURegValue pc = cpuGetRegister(CPU_REG_PC);
-  uint32_t inst = memDebugRead32(pc, NULL);
+  t_cpuURegValue pc = cpuGetRegister(dbgVM, CPU_REG_PC);
+  uint32_t inst = memDebugRead32(dbgVM, pc, NULL);
   if ((ISA_INST_OPCODE(inst) == ISA_INST_OPCODE_JAL ||
           (ISA_INST_OPCODE(inst) == ISA_INST_OPCODE_JALR &&
               ISA_INST_FUNCT3(inst) == 0)) &&
@@ -326,13 +329,13 @@ void dbgCmdPrintCpuStatus(void)
 {
   char buffer[80];
 
-  t_cpuURegValue pc = cpuGetRegister(CPU_REG_PC);
-  uint32_t inst = memDebugRead32(pc, NULL);
+  t_cpuURegValue pc = cpuGetRegister(dbgVM, CPU_REG_PC);
+  uint32_t inst = memDebugRead32(dbgVM, pc, NULL);
   isaDisassemble(inst, buffer, 80);
   fprintf(stderr, "PC : %08x: %08x %s\n", pc, inst, buffer);
 
   for (t_cpuRegID r = CPU_REG_X0; r <= CPU_REG_X31; r++) {
-    fprintf(stderr, "X%-2d: %08x", r, cpuGetRegister(r));
+    fprintf(stderr, "X%-2d: %08x", r, cpuGetRegister(dbgVM, r));
     if ((r + 1) % 4 == 0)
       fputc('\n', stderr);
     else
@@ -359,7 +362,7 @@ void dbgCmdDisassemble(char *args)
 
   for (int i = 0; i < len; i++) {
     t_memAddress curaddr = (t_memAddress)addr + (t_memAddress)(4 * i);
-    uint32_t instr = memDebugRead32(curaddr, NULL);
+    uint32_t instr = memDebugRead32(dbgVM, curaddr, NULL);
     isaDisassemble(instr, buffer, 80);
     fprintf(
         stderr, "%08" PRIx32 ":  %08" PRIx32 "  %s\n", curaddr, instr, buffer);
@@ -387,7 +390,7 @@ void dbgCmdMemDump(char *args)
     fprintf(stderr, "%08" PRIx32 ": ", (t_memAddress)addr);
     for (int i = 0; i < len; i++) {
       t_memAddress curaddr = (t_memAddress)addr + (t_memAddress)i;
-      uint8_t byte = memDebugRead8(curaddr, NULL);
+      uint8_t byte = memDebugRead8(dbgVM, curaddr, NULL);
       fprintf(stderr, "%02" PRIx8, byte);
       if ((i + 1) % 16 == 0 || (i + 1) == len)
         fputc('\n', stderr);
@@ -19,7 +19,8 @@ typedef void *t_dbgEnumBreakpointState;
 #define DBG_ENUM_BREAKPOINT_STOP ((t_dbgEnumBreakpointState)NULL)
 
 
-bool dbgEnable(void);
+/* The debugger can only be attached to one VM at a time */
+bool dbgEnable(t_vm *vm);
 bool dbgGetEnabled(void);
 bool dbgDisable(void);
 void dbgRequestEnter(void);
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "forkserver.h"
+#include "cpu.h"
+#include "supervisor.h"
+
+/* result, exit code, fault address, instret, output size */
+#define FSRV_REPLY_HEADER_SIZE 24
+
+
+static void fsrvPutU32(uint8_t *buf, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    buf[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t fsrvGetU32(const uint8_t *buf)
+{
+  return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+      ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static bool fsrvWriteAll(int fd, const void *buf, size_t size)
+{
+  const uint8_t *p = buf;
+  while (size > 0) {
+    ssize_t res = write(fd, p, size);
+    if (res <= 0)
+      return false;
+    p += res;
+    size -= (size_t)res;
+  }
+  return true;
+}
+
+
+static void fsrvChildMain(t_vm *vm, char *input, uint32_t size, int fd)
+{
+  char *output = NULL;
+  size_t outputSize = 0;
+  FILE *in, *out;
+  if (size > 0)
+    in = fmemopen(input, size, "r");
+  else
+    in = fopen("/dev/null", "r");
+  out = open_memstream(&output, &outputSize);
+  if (in == NULL || out == NULL)
+    _exit(1);
+  svSetIO(vm, in, out);
+
+  t_svStatus status = SV_STATUS_RUNNING;
+  while (status == SV_STATUS_RUNNING)
+    status = svVMTick(vm);
+  if (fclose(out) != 0 || outputSize > UINT32_MAX)
+    _exit(1);
+
+  t_fsrvResult result = FSRV_RESULT_EXITED;
+  t_memAddress addr = 0;
+  if (status == SV_STATUS_MEMORY_FAULT) {
+    result = FSRV_RESULT_MEMORY_FAULT;
+    addr = memGetLastFaultAddress(vm);
+  } else if (status == SV_STATUS_ILL_INST_FAULT) {
+    result = FSRV_RESULT_ILL_INST_FAULT;
+    addr = cpuGetRegister(vm, CPU_REG_PC);
+  } else if (status == SV_STATUS_INVALID_SYSCALL) {
+    result = FSRV_RESULT_INVALID_SYSCALL;
+    addr = cpuGetRegister(vm, CPU_REG_PC);
+  }
+  uint64_t instret = cpuGetInstret(vm);
+  if (status == SV_STATUS_INST_LIMIT || status == SV_STATUS_TIMEOUT) {
+    result = status == SV_STATUS_TIMEOUT ? FSRV_RESULT_TIMEOUT
+                                         : FSRV_RESULT_INST_LIMIT;
+    t_svHotPC hot;
+    if (svGetHotPCs(vm, &hot, 1, NULL) > 0)
+      addr = hot.pc;
+  }
+
+  uint8_t header[FSRV_REPLY_HEADER_SIZE];
+  fsrvPutU32(header, (uint32_t)result);
+  fsrvPutU32(header + 4, (uint32_t)svGetExitCode(vm));
+  fsrvPutU32(header + 8, addr);
+  fsrvPutU32(header + 12, (uint32_t)instret);
+  fsrvPutU32(header + 16, (uint32_t)(instret >> 32));
+  fsrvPutU32(header + 20, (uint32_t)outputSize);
+  if (!fsrvWriteAll(fd, header, sizeof(header)) ||
+      !fsrvWriteAll(fd, output, outputSize))
+    _exit(1);
+  /* the buffers of the parent must not be flushed twice */
+  _exit(0);
+}
+
+/* Reads the whole reply of the child. Returns NULL if the child did not
+ * send a complete reply. */
+static uint8_t *fsrvReadReply(int fd, size_t *outSize)
+{
+  size_t cap = 4096, size = 0;
+  uint8_t *buf = malloc(cap);
+  while (buf) {
+    if (size == cap) {
+      uint8_t *newBuf = realloc(buf, cap * 2);
+      if (newBuf == NULL)
+        break;
+      buf = newBuf;
+      cap *= 2;
+    }
+    ssize_t res = read(fd, buf + size, cap - size);
+    if (res <= 0) {
+      if (res == 0 && size >= FSRV_REPLY_HEADER_SIZE &&
+          size == FSRV_REPLY_HEADER_SIZE + (size_t)fsrvGetU32(buf + 20)) {
+        *outSize = size;
+        return buf;
+      }
+      break;
+    }
+    size += (size_t)res;
+  }
+  free(buf);
+  return NULL;
+}
+
+static t_fsrvError fsrvRun(t_vm *vm, char *input, uint32_t size, FILE *out)
+{
+  int fd[2];
+  if (pipe(fd) != 0)
+    return FSRV_FORK_ERROR;
+  fflush(out);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fd[0]);
+    fsrvChildMain(vm, input, size, fd[1]);
+  }
+  close(fd[1]);
+  if (pid < 0) {
+    close(fd[0]);
+    return FSRV_FORK_ERROR;
+  }
+
+  size_t replySize;
+  uint8_t *reply = fsrvReadReply(fd[0], &replySize);
+  close(fd[0]);
+  waitpid(pid, NULL, 0);
+
+  uint8_t crashed[FSRV_REPLY_HEADER_SIZE] = {0};
+  fsrvPutU32(crashed, FSRV_RESULT_CRASHED);
+  if (reply == NULL) {
+    reply = crashed;
+    replySize = sizeof(crashed);
+  }
+  bool ok = fwrite(reply, 1, replySize, out) == replySize;
+  ok = fflush(out) == 0 && ok;
+  if (reply != crashed)
+    free(reply);
+  return ok ? FSRV_NO_ERROR : FSRV_FILE_ERROR;
+}
+
+
+t_fsrvError fsrvServe(t_vm *vm, FILE *in, FILE *out)
+{
+  for (;;) {
+    uint8_t buf[4];
+    size_t res = fread(buf, 1, 4, in);
+    if (res == 0 && feof(in))
+      return FSRV_NO_ERROR;
+    if (res != 4)
+      return FSRV_FILE_ERROR;
+    uint32_t size = fsrvGetU32(buf);
+    if (size > FSRV_MAX_INPUT_SIZE)
+      return FSRV_INVALID_REQUEST;
+
+    char *input = malloc(size ? size : 1);
+    if (input == NULL)
+      return FSRV_OUT_OF_MEMORY;
+    if (size > 0 && fread(input, size, 1, in) != 1) {
+      free(input);
+      return FSRV_FILE_ERROR;
+    }
+    t_fsrvError err = fsrvRun(vm, input, size, out);
+    free(input);
+    if (err != FSRV_NO_ERROR)
+      return err;
+  }
+}
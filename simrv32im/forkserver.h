@@ -0,0 +1,43 @@
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+#include <stdio.h>
+#include "vm.h"
+
+/* Largest input accepted in a request */
+#define FSRV_MAX_INPUT_SIZE (64 * 1024 * 1024)
+
+typedef int t_fsrvError;
+enum {
+  FSRV_NO_ERROR = 0,
+  FSRV_FILE_ERROR = -1,
+  FSRV_OUT_OF_MEMORY = -2,
+  FSRV_FORK_ERROR = -3,
+  FSRV_INVALID_REQUEST = -4
+};
+
+/* How the run of a request ended */
+typedef int t_fsrvResult;
+enum {
+  FSRV_RESULT_EXITED = 0,
+  FSRV_RESULT_MEMORY_FAULT = 1,
+  FSRV_RESULT_ILL_INST_FAULT = 2,
+  FSRV_RESULT_INVALID_SYSCALL = 3,
+  FSRV_RESULT_CRASHED = 4, /* the simulator itself failed */
+  FSRV_RESULT_INST_LIMIT = 5,
+  FSRV_RESULT_TIMEOUT = 6
+};
+
+/* Runs the program loaded in the VM once for each request read from in, each
+ * time in a child process which gets a copy-on-write copy of the VM.
+ * A request is the size of the input of the program followed by the input.
+ * The child reports the result over a pipe, and it is written to out as:
+ *   result, exit code, fault address (or the pc for illegal instructions
+ *   and invalid system calls, or where the program stopped most often for
+ *   programs stopped by a limit, see svGetHotPCs()), retired instructions
+ *   (64 bit), size of the output, followed by the output of the program.
+ * All the fields are little-endian and 32 bit unless noted. Returns
+ * FSRV_NO_ERROR when in ends between two requests. */
+t_fsrvError fsrvServe(t_vm *vm, FILE *in, FILE *out);
+
+#endif
@@ -159,7 +159,20 @@ int isaDisassembleBRANCH(uint32_t instr, char *out, size_t bufsz)
 
 int isaDisassembleSYSTEM(uint32_t instr, char *out, size_t bufsz)
 {
-  if (ISA_INST_FUNCT3(instr) != 0)
+  static const char *csrMnem[8] = {
+      NULL, "CSRRW", "CSRRS", "CSRRC", NULL, "CSRRWI", "CSRRSI", "CSRRCI"};
+  uint32_t funct3 = ISA_INST_FUNCT3(instr);
+  int rd = (int)ISA_INST_RD(instr);
+  int rs1 = (int)ISA_INST_RS1(instr);
+  uint32_t csr = ISA_INST_I_IMM12(instr);
+
+  if (funct3 >= ISA_INST_FUNCT3_CSRRWI && csrMnem[funct3])
+    return snprintf(out, bufsz, "%s x%d, 0x%03" PRIx32 ", %d",
+        csrMnem[funct3], rd, csr, rs1);
+  if (csrMnem[funct3])
+    return snprintf(out, bufsz, "%s x%d, 0x%03" PRIx32 ", x%d",
+        csrMnem[funct3], rd, csr, rs1);
+  if (funct3 != 0)
     return isaDisassembleIllegal(instr, out, bufsz);
   if (ISA_INST_I_IMM12(instr) == 0)
     return snprintf(out, bufsz, "ECALL");
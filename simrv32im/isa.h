@@ -147,6 +147,26 @@ static inline uint32_t bits32(uint32_t x, int a, int b)
 #define ISA_INST_OPCODE_JAL ISA_INST_OPCODE_CODE(0x1B)
 #define ISA_INST_OPCODE_SYSTEM ISA_INST_OPCODE_CODE(0x1C)
 
+#define ISA_INST_FUNCT3_CSRRW 1
+#define ISA_INST_FUNCT3_CSRRS 2
+#define ISA_INST_FUNCT3_CSRRC 3
+#define ISA_INST_FUNCT3_CSRRWI 5
+#define ISA_INST_FUNCT3_CSRRSI 6
+#define ISA_INST_FUNCT3_CSRRCI 7
+
+/* Zicntr and Zihpm counters, and their machine mode aliases. The CSR at
+ * address + ISA_CSR_HIGH holds the upper 32 bits of each counter. */
+#define ISA_CSR_CYCLE 0xC00
+#define ISA_CSR_TIME 0xC01
+#define ISA_CSR_INSTRET 0xC02
+#define ISA_CSR_HPMCOUNTER3 0xC03
+#define ISA_CSR_HPMCOUNTER31 0xC1F
+#define ISA_CSR_MCYCLE 0xB00
+#define ISA_CSR_MINSTRET 0xB02
+#define ISA_CSR_MHPMCOUNTER3 0xB03
+#define ISA_CSR_MHPMCOUNTER31 0xB1F
+#define ISA_CSR_HIGH 0x80
+
 
 int isaDisassemble(uint32_t instr, char *out, size_t bufsz);
 
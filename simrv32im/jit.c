@@ -0,0 +1,970 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "cpu.h"
+#include "memory.h"
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+
+#define JIT_BUFFER_SIZE (16 * 1024 * 1024)
+/* Upper bound of the size of the code generated for a single instruction */
+#define JIT_MAX_INST_SIZE 160
+
+/* Journal of the memory writes performed by the compiled code, used to undo
+ * them when verifying compiled blocks against the interpreter */
+#define JIT_JOURNAL_SIZE 1024
+
+typedef struct {
+  t_memAddress addr;
+  uint8_t oldValue;
+  uint8_t newValue;
+} t_jitJournalEntry;
+
+typedef struct jit {
+  uint8_t *buffer;
+  size_t bufferUsed;
+  /* True if the buffer cannot be writable and executable at the same time */
+  bool bufferWX;
+  /* Code area of the CPU, stores to which invalidate translations */
+  t_memAddress codeBase;
+  t_memSize codeSize;
+  bool journalEnabled;
+  int journalLength;
+  t_jitJournalEntry journal[JIT_JOURNAL_SIZE];
+} t_jit;
+
+
+bool jitCreate(t_vm *vm)
+{
+  vm->jit = calloc(1, sizeof(t_jit));
+  return vm->jit != NULL;
+}
+
+void jitDestroy(t_vm *vm)
+{
+  if (vm->jit && vm->jit->buffer)
+    munmap(vm->jit->buffer, JIT_BUFFER_SIZE);
+  free(vm->jit);
+  vm->jit = NULL;
+}
+
+
+bool jitInit(t_vm *vm)
+{
+  t_jit *jit = vm->jit;
+  if (jit->buffer)
+    return true;
+
+  void *buf = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  jit->bufferWX = false;
+  if (buf == MAP_FAILED) {
+    buf = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+      return false;
+    jit->bufferWX = true;
+  }
+  jit->buffer = buf;
+  jit->bufferUsed = 0;
+  return true;
+}
+
+
+void jitReset(t_vm *vm)
+{
+  vm->jit->bufferUsed = 0;
+}
+
+
+void jitSetCodeArea(t_vm *vm, t_memAddress base, t_memSize size)
+{
+  vm->jit->codeBase = base;
+  vm->jit->codeSize = size;
+}
+
+
+/*
+ * Helpers called by the compiled code. The VM is passed after the other
+ * arguments, so that the registers holding them do not change.
+ */
+
+static void jitJournalWrite(
+    t_vm *vm, t_memAddress addr, uint32_t value, int size)
+{
+  t_jit *jit = vm->jit;
+  if (!jit->journalEnabled)
+    return;
+  for (int i = 0; i < size && jit->journalLength < JIT_JOURNAL_SIZE; i++) {
+    t_jitJournalEntry *entry = &jit->journal[jit->journalLength++];
+    entry->addr = addr + i;
+    entry->oldValue = memDebugRead8(vm, addr + i, NULL);
+    entry->newValue = (uint8_t)(value >> (i * 8));
+  }
+}
+
+static int64_t jitHelperLB(t_memAddress addr, t_vm *vm)
+{
+  uint8_t tmp;
+  if (memRead8(vm, addr, &tmp) != MEM_NO_ERROR)
+    return -1;
+  return (uint32_t)(int32_t)(int8_t)tmp;
+}
+
+static int64_t jitHelperLH(t_memAddress addr, t_vm *vm)
+{
+  uint16_t tmp;
+  if (memRead16(vm, addr, &tmp) != MEM_NO_ERROR)
+    return -1;
+  return (uint32_t)(int32_t)(int16_t)tmp;
+}
+
+static int64_t jitHelperLW(t_memAddress addr, t_vm *vm)
+{
+  uint32_t tmp;
+  if (memRead32(vm, addr, &tmp) != MEM_NO_ERROR)
+    return -1;
+  return tmp;
+}
+
+static int64_t jitHelperLBU(t_memAddress addr, t_vm *vm)
+{
+  uint8_t tmp;
+  if (memRead8(vm, addr, &tmp) != MEM_NO_ERROR)
+    return -1;
+  return tmp;
+}
+
+static int64_t jitHelperLHU(t_memAddress addr, t_vm *vm)
+{
+  uint16_t tmp;
+  if (memRead16(vm, addr, &tmp) != MEM_NO_ERROR)
+    return -1;
+  return tmp;
+}
+
+static int jitHelperSB(t_memAddress addr, uint32_t value, t_vm *vm)
+{
+  jitJournalWrite(vm, addr, value, 1);
+  if (memWrite8(vm, addr, value & 0xFF) != MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  if (cpuInvalidateCode(vm, addr, 1))
+    return JIT_STATUS_CODE_CHANGED;
+  return CPU_STATUS_OK;
+}
+
+static int jitHelperSH(t_memAddress addr, uint32_t value, t_vm *vm)
+{
+  jitJournalWrite(vm, addr, value, 2);
+  if (memWrite16(vm, addr, value & 0xFFFF) != MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  if (cpuInvalidateCode(vm, addr, 2))
+    return JIT_STATUS_CODE_CHANGED;
+  return CPU_STATUS_OK;
+}
+
+static int jitHelperSW(t_memAddress addr, uint32_t value, t_vm *vm)
+{
+  jitJournalWrite(vm, addr, value, 4);
+  if (memWrite32(vm, addr, value) != MEM_NO_ERROR)
+    return CPU_STATUS_MEMORY_FAULT;
+  if (cpuInvalidateCode(vm, addr, 4))
+    return JIT_STATUS_CODE_CHANGED;
+  return CPU_STATUS_OK;
+}
+
+static uint32_t jitHelperDIV(uint32_t a, uint32_t b)
+{
+  if (b == 0)
+    return 0xFFFFFFFF;
+  if (a == 0x80000000 && b == 0xFFFFFFFF)
+    return 0x80000000;
+  return (uint32_t)((int32_t)a / (int32_t)b);
+}
+
+static uint32_t jitHelperDIVU(uint32_t a, uint32_t b)
+{
+  if (b == 0)
+    return 0xFFFFFFFF;
+  return a / b;
+}
+
+static uint32_t jitHelperREM(uint32_t a, uint32_t b)
+{
+  if (b == 0)
+    return a;
+  if (a == 0x80000000 && b == 0xFFFFFFFF)
+    return 0;
+  return (uint32_t)((int32_t)a % (int32_t)b);
+}
+
+static uint32_t jitHelperREMU(uint32_t a, uint32_t b)
+{
+  if (b == 0)
+    return a;
+  return a % b;
+}
+
+
+/*
+ * x86-64 code emitter
+ *
+ * Register usage in the compiled code:
+ *   rbx  pointer to the guest register file
+ *   r12  pointer to the guest program counter
+ *   r13  host address of the guest address space (flat memory only)
+ *   r14  VM, passed to the helpers
+ *   rax, rcx, rdx, rsi, rdi  scratch
+ */
+
+typedef struct {
+  const t_jit *jit;
+  uint8_t *cur;
+  /* access guest memory directly through r13 instead of calling helpers */
+  bool inlineMemory;
+  /* offsets of the rel32 fields of the jumps to the epilogue */
+  uint8_t *epilogueFixups[JIT_MAX_BLOCK_LENGTH * 4 + 4];
+  int numFixups;
+} t_jitEmitter;
+
+#define X86_EAX 0
+#define X86_ECX 1
+#define X86_EDX 2
+#define X86_ESI 6
+#define X86_EDI 7
+
+#define X86_CC_B 0x2
+#define X86_CC_AE 0x3
+#define X86_CC_E 0x4
+#define X86_CC_NE 0x5
+#define X86_CC_L 0xC
+#define X86_CC_GE 0xD
+
+static void jitEmit8(t_jitEmitter *e, uint8_t b)
+{
+  *e->cur++ = b;
+}
+
+static void jitEmit32(t_jitEmitter *e, uint32_t w)
+{
+  memcpy(e->cur, &w, 4);
+  e->cur += 4;
+}
+
+static void jitEmit64(t_jitEmitter *e, uint64_t w)
+{
+  memcpy(e->cur, &w, 8);
+  e->cur += 8;
+}
+
+/* <opcode> reg32, dword [rbx + 4 * guestReg] (or the reverse direction) */
+static void jitEmitRegMem(
+    t_jitEmitter *e, uint8_t opcode, int hostReg, t_cpuRegID guestReg)
+{
+  jitEmit8(e, opcode);
+  jitEmit8(e, 0x83 | (uint8_t)(hostReg << 3));
+  jitEmit32(e, guestReg * 4);
+}
+
+static void jitEmitLoadReg(t_jitEmitter *e, int hostReg, t_cpuRegID guestReg)
+{
+  if (guestReg == CPU_REG_ZERO) {
+    /* xor reg, reg */
+    jitEmit8(e, 0x31);
+    jitEmit8(e, 0xC0 | (uint8_t)(hostReg << 3) | (uint8_t)hostReg);
+  } else {
+    jitEmitRegMem(e, 0x8B, hostReg, guestReg);
+  }
+}
+
+static void jitEmitStoreEAX(t_jitEmitter *e, t_cpuRegID guestReg)
+{
+  if (guestReg != CPU_REG_ZERO)
+    jitEmitRegMem(e, 0x89, X86_EAX, guestReg);
+}
+
+static void jitEmitStoreImm(t_jitEmitter *e, t_cpuRegID guestReg, uint32_t imm)
+{
+  if (guestReg == CPU_REG_ZERO)
+    return;
+  /* mov dword [rbx + disp32], imm32 */
+  jitEmit8(e, 0xC7);
+  jitEmit8(e, 0x83);
+  jitEmit32(e, guestReg * 4);
+  jitEmit32(e, imm);
+}
+
+static void jitEmitSetPC(t_jitEmitter *e, t_memAddress pc)
+{
+  /* mov dword [r12], imm32 */
+  jitEmit8(e, 0x41);
+  jitEmit8(e, 0xC7);
+  jitEmit8(e, 0x04);
+  jitEmit8(e, 0x24);
+  jitEmit32(e, pc);
+}
+
+static void jitEmitJumpToEpilogue(t_jitEmitter *e)
+{
+  /* jmp rel32, patched when the epilogue is emitted */
+  jitEmit8(e, 0xE9);
+  e->epilogueFixups[e->numFixups++] = e->cur;
+  jitEmit32(e, 0);
+}
+
+/* Emits a block exit with the given status and program counter */
+static void jitEmitExit(t_jitEmitter *e, t_memAddress pc, int status)
+{
+  jitEmitSetPC(e, pc);
+  jitEmit8(e, 0xB8); /* mov eax, imm32 */
+  jitEmit32(e, (uint32_t)status);
+  jitEmitJumpToEpilogue(e);
+}
+
+static void jitEmitCall(t_jitEmitter *e, void *func)
+{
+  /* mov rax, imm64; call rax */
+  jitEmit8(e, 0x48);
+  jitEmit8(e, 0xB8);
+  jitEmit64(e, (uint64_t)(uintptr_t)func);
+  jitEmit8(e, 0xFF);
+  jitEmit8(e, 0xD0);
+}
+
+/* mov rsi or rdx, r14: the VM argument of the helpers */
+static void jitEmitVMArg(t_jitEmitter *e, int hostReg)
+{
+  jitEmit8(e, 0x4C);
+  jitEmit8(e, 0x89);
+  jitEmit8(e, 0xF0 | (uint8_t)hostReg);
+}
+
+/* Computes rs1 + imm into edi */
+static void jitEmitAddress(t_jitEmitter *e, t_cpuRegID rs1, uint32_t imm)
+{
+  jitEmitLoadReg(e, X86_EDI, rs1);
+  if (imm != 0) {
+    /* add edi, imm32 */
+    jitEmit8(e, 0x81);
+    jitEmit8(e, 0xC7);
+    jitEmit32(e, imm);
+  }
+}
+
+/* With the flat memory backend faulting accesses do not return, so the PC
+ * has to be up to date before each access */
+static void jitEmitPrepareAccess(t_jitEmitter *e, t_memAddress pc)
+{
+#ifdef MEM_FLAT_ADDRESS_SPACE
+  jitEmitSetPC(e, pc);
+#endif
+}
+
+/* Emits <opcode> with [r13 + rdi] as the memory operand */
+static void jitEmitHostAccess(
+    t_jitEmitter *e, bool wordPrefix, uint16_t opcode, int hostReg)
+{
+  if (wordPrefix)
+    jitEmit8(e, 0x66);
+  jitEmit8(e, 0x41);
+  if (opcode > 0xFF)
+    jitEmit8(e, (uint8_t)(opcode >> 8));
+  jitEmit8(e, (uint8_t)opcode);
+  jitEmit8(e, 0x44 | (uint8_t)(hostReg << 3));
+  jitEmit8(e, 0x3D);
+  jitEmit8(e, 0x00);
+}
+
+static void jitEmitLoad(t_jitEmitter *e, void *helper, int funct3,
+    t_cpuRegID rd, t_cpuRegID rs1, uint32_t imm, t_memAddress pc)
+{
+  /* movsx, mov or movzx eax, [r13 + rdi] */
+  static const uint16_t hostOps[8] = {0x0FBE, 0x0FBF, 0x8B, 0, 0x0FB6, 0x0FB7};
+
+  jitEmitAddress(e, rs1, imm);
+  jitEmitPrepareAccess(e, pc);
+  if (e->inlineMemory) {
+    jitEmitHostAccess(e, false, hostOps[funct3], X86_EAX);
+    jitEmitStoreEAX(e, rd);
+    return;
+  }
+  jitEmitVMArg(e, X86_ESI);
+  jitEmitCall(e, helper);
+  /* test rax, rax; jns ok */
+  jitEmit8(e, 0x48);
+  jitEmit8(e, 0x85);
+  jitEmit8(e, 0xC0);
+  jitEmit8(e, 0x79);
+  uint8_t *skip = e->cur;
+  jitEmit8(e, 0);
+  jitEmitExit(e, pc, CPU_STATUS_MEMORY_FAULT);
+  *skip = (uint8_t)(e->cur - skip - 1);
+  jitEmitStoreEAX(e, rd);
+}
+
+static void jitEmitStore(t_jitEmitter *e, void *helper, int funct3,
+    t_cpuRegID rs1, t_cpuRegID rs2, uint32_t imm, t_memAddress pc)
+{
+  uint8_t *skipHelper = NULL;
+
+  jitEmitAddress(e, rs1, imm);
+  jitEmitLoadReg(e, X86_ESI, rs2);
+  jitEmitPrepareAccess(e, pc);
+  if (e->inlineMemory) {
+    /* stores to the code area go through the helper, which invalidates the
+     * translations of the modified code */
+    uint32_t size = 1U << funct3;
+    if (e->jit->codeSize > 0) {
+      /* mov ecx, edi; sub ecx, imm32; cmp ecx, imm32; jb helper */
+      jitEmit8(e, 0x89);
+      jitEmit8(e, 0xF9);
+      jitEmit8(e, 0x81);
+      jitEmit8(e, 0xE9);
+      jitEmit32(e, e->jit->codeBase - size + 1);
+      jitEmit8(e, 0x81);
+      jitEmit8(e, 0xF9);
+      jitEmit32(e, e->jit->codeSize + size - 1);
+      jitEmit8(e, 0x72);
+      jitEmit8(e, 8);
+    }
+    /* mov byte/word/dword [r13 + rdi], esi */
+    jitEmitHostAccess(e, funct3 == 1, funct3 == 0 ? 0x88 : 0x89, X86_ESI);
+    if (funct3 != 1)
+      jitEmit8(e, 0x90); /* nop, keeps the inline store 6 bytes long */
+    if (e->jit->codeSize == 0)
+      return;
+    jitEmit8(e, 0xEB); /* jmp rel8 */
+    skipHelper = e->cur;
+    jitEmit8(e, 0);
+  }
+  jitEmitVMArg(e, X86_EDX);
+  jitEmitCall(e, helper);
+  /* test eax, eax; jz ok */
+  jitEmit8(e, 0x85);
+  jitEmit8(e, 0xC0);
+  jitEmit8(e, 0x74);
+  uint8_t *skip = e->cur;
+  jitEmit8(e, 0);
+  /* memory faults leave the PC at the store */
+  jitEmitSetPC(e, pc);
+  /* test eax, eax; js epilogue */
+  jitEmit8(e, 0x85);
+  jitEmit8(e, 0xC0);
+  jitEmit8(e, 0x0F);
+  jitEmit8(e, 0x88);
+  e->epilogueFixups[e->numFixups++] = e->cur;
+  jitEmit32(e, 0);
+  jitEmitSetPC(e, pc + 4);
+  jitEmitJumpToEpilogue(e);
+  *skip = (uint8_t)(e->cur - skip - 1);
+  if (skipHelper)
+    *skipHelper = (uint8_t)(e->cur - skipHelper - 1);
+}
+
+/* eax = rs1 <op> rs2 with a two-operand ALU opcode */
+static void jitEmitALU(t_jitEmitter *e, uint8_t opcode, t_cpuRegID rd,
+    t_cpuRegID rs1, t_cpuRegID rs2)
+{
+  jitEmitLoadReg(e, X86_EAX, rs1);
+  if (rs2 == CPU_REG_ZERO) {
+    jitEmitLoadReg(e, X86_ECX, rs2);
+    jitEmit8(e, opcode);
+    jitEmit8(e, 0xC1); /* eax, ecx */
+  } else {
+    jitEmitRegMem(e, opcode, X86_EAX, rs2);
+  }
+  jitEmitStoreEAX(e, rd);
+}
+
+/* eax = rs1 <op> imm with an 81 /n ib-style ALU opcode extension */
+static void jitEmitALUImm(
+    t_jitEmitter *e, int ext, t_cpuRegID rd, t_cpuRegID rs1, uint32_t imm)
+{
+  jitEmitLoadReg(e, X86_EAX, rs1);
+  jitEmit8(e, 0x81);
+  jitEmit8(e, 0xC0 | (uint8_t)(ext << 3));
+  jitEmit32(e, imm);
+  jitEmitStoreEAX(e, rd);
+}
+
+static void jitEmitShift(
+    t_jitEmitter *e, int ext, t_cpuRegID rd, t_cpuRegID rs1, t_cpuRegID rs2)
+{
+  jitEmitLoadReg(e, X86_EAX, rs1);
+  jitEmitLoadReg(e, X86_ECX, rs2);
+  /* shl/shr/sar eax, cl (the count is masked to 5 bits by the hardware) */
+  jitEmit8(e, 0xD3);
+  jitEmit8(e, 0xC0 | (uint8_t)(ext << 3));
+  jitEmitStoreEAX(e, rd);
+}
+
+static void jitEmitShiftImm(
+    t_jitEmitter *e, int ext, t_cpuRegID rd, t_cpuRegID rs1, uint32_t shamt)
+{
+  jitEmitLoadReg(e, X86_EAX, rs1);
+  jitEmit8(e, 0xC1);
+  jitEmit8(e, 0xC0 | (uint8_t)(ext << 3));
+  jitEmit8(e, (uint8_t)shamt);
+  jitEmitStoreEAX(e, rd);
+}
+
+/* Emits the setcc/movzx sequence that follows a comparison */
+static void jitEmitSetCC(t_jitEmitter *e, int cc, t_cpuRegID rd)
+{
+  jitEmit8(e, 0x0F);
+  jitEmit8(e, 0x90 | (uint8_t)cc);
+  jitEmit8(e, 0xC0);
+  jitEmit8(e, 0x0F);
+  jitEmit8(e, 0xB6);
+  jitEmit8(e, 0xC0);
+  jitEmitStoreEAX(e, rd);
+}
+
+static void jitEmitCompare(t_jitEmitter *e, t_cpuRegID rs1, t_cpuRegID rs2)
+{
+  jitEmitLoadReg(e, X86_EAX, rs1);
+  jitEmitLoadReg(e, X86_ECX, rs2);
+  /* cmp eax, ecx */
+  jitEmit8(e, 0x39);
+  jitEmit8(e, 0xC8);
+}
+
+static void jitEmitMulHigh(t_jitEmitter *e, bool signed1, bool signed2,
+    t_cpuRegID rd, t_cpuRegID rs1, t_cpuRegID rs2)
+{
+  /* movsxd rax, [rs1] or mov eax, [rs1] */
+  if (signed1 && rs1 != CPU_REG_ZERO) {
+    jitEmit8(e, 0x48);
+    jitEmitRegMem(e, 0x63, X86_EAX, rs1);
+  } else {
+    jitEmitLoadReg(e, X86_EAX, rs1);
+  }
+  if (signed2 && rs2 != CPU_REG_ZERO) {
+    jitEmit8(e, 0x48);
+    jitEmitRegMem(e, 0x63, X86_ECX, rs2);
+  } else {
+    jitEmitLoadReg(e, X86_ECX, rs2);
+  }
+  /* imul rax, rcx */
+  jitEmit8(e, 0x48);
+  jitEmit8(e, 0x0F);
+  jitEmit8(e, 0xAF);
+  jitEmit8(e, 0xC1);
+  /* sar/shr rax, 32 */
+  jitEmit8(e, 0x48);
+  jitEmit8(e, 0xC1);
+  jitEmit8(e, (signed1 || signed2) ? 0xF8 : 0xE8);
+  jitEmit8(e, 32);
+  jitEmitStoreEAX(e, rd);
+}
+
+static void jitEmitCallBinary(t_jitEmitter *e, void *helper, t_cpuRegID rd,
+    t_cpuRegID rs1, t_cpuRegID rs2)
+{
+  jitEmitLoadReg(e, X86_EDI, rs1);
+  jitEmitLoadReg(e, X86_ESI, rs2);
+  jitEmitCall(e, helper);
+  jitEmitStoreEAX(e, rd);
+}
+
+static void jitEmitBranch(t_jitEmitter *e, int cc, t_cpuRegID rs1,
+    t_cpuRegID rs2, t_memAddress pc, uint32_t offset)
+{
+  jitEmitCompare(e, rs1, rs2);
+  /* jcc taken */
+  jitEmit8(e, 0x70 | (uint8_t)cc);
+  uint8_t *taken = e->cur;
+  jitEmit8(e, 0);
+  jitEmitExit(e, pc + 4, JIT_STATUS_BLOCK_END);
+  *taken = (uint8_t)(e->cur - taken - 1);
+  jitEmitExit(e, pc + offset, JIT_STATUS_BLOCK_END);
+}
+
+/* Compiles a single instruction. Returns false if the instruction ends the
+ * block. */
+static bool jitCompileInst(t_jitEmitter *e, uint32_t instr, t_memAddress pc)
+{
+  t_cpuRegID rd = ISA_INST_RD(instr);
+  t_cpuRegID rs1 = ISA_INST_RS1(instr);
+  t_cpuRegID rs2 = ISA_INST_RS2(instr);
+  uint32_t funct3 = ISA_INST_FUNCT3(instr);
+  uint32_t funct7 = ISA_INST_FUNCT7(instr);
+  uint32_t immI = ISA_INST_I_IMM12_SEXT(instr);
+
+  switch (ISA_INST_OPCODE(instr)) {
+    case ISA_INST_OPCODE_LOAD: {
+      static void *const helpers[8] = {jitHelperLB, jitHelperLH, jitHelperLW,
+          NULL, jitHelperLBU, jitHelperLHU, NULL, NULL};
+      if (!helpers[funct3])
+        break;
+      jitEmitLoad(e, helpers[funct3], funct3, rd, rs1, immI, pc);
+      return true;
+    }
+
+    case ISA_INST_OPCODE_OPIMM:
+      switch (funct3) {
+        case 0: /* ADDI */
+          jitEmitALUImm(e, 0, rd, rs1, immI);
+          return true;
+        case 1: /* SLLI */
+          if (funct7 != 0x00)
+            break;
+          jitEmitShiftImm(e, 4, rd, rs1, ISA_INST_I_IMM12(instr) & 0x1F);
+          return true;
+        case 2: /* SLTI */
+          jitEmitLoadReg(e, X86_EAX, rs1);
+          jitEmit8(e, 0x3D); /* cmp eax, imm32 */
+          jitEmit32(e, immI);
+          jitEmitSetCC(e, X86_CC_L, rd);
+          return true;
+        case 3: /* SLTIU */
+          jitEmitLoadReg(e, X86_EAX, rs1);
+          jitEmit8(e, 0x3D);
+          jitEmit32(e, ISA_INST_I_IMM12(instr));
+          jitEmitSetCC(e, X86_CC_B, rd);
+          return true;
+        case 4: /* XORI */
+          jitEmitALUImm(e, 6, rd, rs1, immI);
+          return true;
+        case 5: /* SRLI / SRAI */
+          if (funct7 == 0x00)
+            jitEmitShiftImm(e, 5, rd, rs1, ISA_INST_I_IMM12(instr) & 0x1F);
+          else if (funct7 == 0x20)
+            jitEmitShiftImm(e, 7, rd, rs1, ISA_INST_I_IMM12(instr) & 0x1F);
+          else
+            break;
+          return true;
+        case 6: /* ORI */
+          jitEmitALUImm(e, 1, rd, rs1, immI);
+          return true;
+        case 7: /* ANDI */
+          jitEmitALUImm(e, 4, rd, rs1, immI);
+          return true;
+      }
+      break;
+
+    case ISA_INST_OPCODE_AUIPC:
+      jitEmitStoreImm(e, rd, pc + (ISA_INST_U_IMM20(instr) << 12));
+      return true;
+
+    case ISA_INST_OPCODE_STORE: {
+      static void *const helpers[8] = {
+          jitHelperSB, jitHelperSH, jitHelperSW, NULL, NULL, NULL, NULL, NULL};
+      if (!helpers[funct3])
+        break;
+      jitEmitStore(e, helpers[funct3], funct3, rs1, rs2,
+          ISA_INST_S_IMM12_SEXT(instr), pc);
+      return true;
+    }
+
+    case ISA_INST_OPCODE_OP:
+      if (funct7 == 0x00) {
+        switch (funct3) {
+          case 0: /* ADD */
+            jitEmitALU(e, 0x03, rd, rs1, rs2);
+            return true;
+          case 1: /* SLL */
+            jitEmitShift(e, 4, rd, rs1, rs2);
+            return true;
+          case 2: /* SLT */
+            jitEmitCompare(e, rs1, rs2);
+            jitEmitSetCC(e, X86_CC_L, rd);
+            return true;
+          case 3: /* SLTU */
+            jitEmitCompare(e, rs1, rs2);
+            jitEmitSetCC(e, X86_CC_B, rd);
+            return true;
+          case 4: /* XOR */
+            jitEmitALU(e, 0x33, rd, rs1, rs2);
+            return true;
+          case 5: /* SRL */
+            jitEmitShift(e, 5, rd, rs1, rs2);
+            return true;
+          case 6: /* OR */
+            jitEmitALU(e, 0x0B, rd, rs1, rs2);
+            return true;
+          case 7: /* AND */
+            jitEmitALU(e, 0x23, rd, rs1, rs2);
+            return true;
+        }
+      } else if (funct7 == 0x20) {
+        if (funct3 == 0) { /* SUB */
+          jitEmitALU(e, 0x2B, rd, rs1, rs2);
+          return true;
+        } else if (funct3 == 5) { /* SRA */
+          jitEmitShift(e, 7, rd, rs1, rs2);
+          return true;
+        }
+      } else if (funct7 == 0x01) {
+        switch (funct3) {
+          case 0: /* MUL */
+            jitEmitLoadReg(e, X86_EAX, rs1);
+            jitEmitLoadReg(e, X86_ECX, rs2);
+            /* imul eax, ecx */
+            jitEmit8(e, 0x0F);
+            jitEmit8(e, 0xAF);
+            jitEmit8(e, 0xC1);
+            jitEmitStoreEAX(e, rd);
+            return true;
+          case 1: /* MULH */
+            jitEmitMulHigh(e, true, true, rd, rs1, rs2);
+            return true;
+          case 2: /* MULHSU */
+            jitEmitMulHigh(e, true, false, rd, rs1, rs2);
+            return true;
+          case 3: /* MULHU */
+            jitEmitMulHigh(e, false, false, rd, rs1, rs2);
+            return true;
+          case 4: /* DIV */
+            jitEmitCallBinary(e, jitHelperDIV, rd, rs1, rs2);
+            return true;
+          case 5: /* DIVU */
+            jitEmitCallBinary(e, jitHelperDIVU, rd, rs1, rs2);
+            return true;
+          case 6: /* REM */
+            jitEmitCallBinary(e, jitHelperREM, rd, rs1, rs2);
+            return true;
+          case 7: /* REMU */
+            jitEmitCallBinary(e, jitHelperREMU, rd, rs1, rs2);
+            return true;
+        }
+      }
+      break;
+
+    case ISA_INST_OPCODE_LUI:
+      jitEmitStoreImm(e, rd, ISA_INST_U_IMM20(instr) << 12);
+      return true;
+
+    case ISA_INST_OPCODE_BRANCH: {
+      static const int cc[8] = {
+          X86_CC_E, X86_CC_NE, -1, -1, X86_CC_L, X86_CC_GE, X86_CC_B, X86_CC_AE};
+      if (cc[funct3] < 0)
+        break;
+      jitEmitBranch(
+          e, cc[funct3], rs1, rs2, pc, ISA_INST_B_IMM13_SEXT(instr));
+      return false;
+    }
+
+    case ISA_INST_OPCODE_JALR:
+      if (funct3 != 0)
+        break;
+      /* same order as the interpreter: rd is written before reading rs1 */
+      jitEmitStoreImm(e, rd, pc + 4);
+      jitEmitLoadReg(e, X86_EAX, rs1);
+      jitEmit8(e, 0x05); /* add eax, imm32 */
+      jitEmit32(e, immI);
+      jitEmit8(e, 0x25); /* and eax, ~1 */
+      jitEmit32(e, ~(uint32_t)1);
+      /* mov [r12], eax */
+      jitEmit8(e, 0x41);
+      jitEmit8(e, 0x89);
+      jitEmit8(e, 0x04);
+      jitEmit8(e, 0x24);
+      jitEmit8(e, 0xB8);
+      jitEmit32(e, JIT_STATUS_BLOCK_END);
+      jitEmitJumpToEpilogue(e);
+      return false;
+
+    case ISA_INST_OPCODE_JAL:
+      jitEmitStoreImm(e, rd, pc + 4);
+      jitEmitExit(e, pc + ISA_INST_J_IMM21_SEXT(instr), JIT_STATUS_BLOCK_END);
+      return false;
+
+    case ISA_INST_OPCODE_SYSTEM:
+      /* counters are read by the CPU outside of the native code */
+      if (funct3 != 0 && funct3 != 4) {
+        jitEmitExit(e, pc, JIT_STATUS_CSR_ACCESS);
+        return false;
+      }
+      if (funct3 != 0)
+        break;
+      if (ISA_INST_I_IMM12(instr) == 0) {
+        jitEmitExit(e, pc, CPU_STATUS_ECALL_TRAP);
+        return false;
+      } else if (ISA_INST_I_IMM12(instr) == 1) {
+        jitEmitExit(e, pc, CPU_STATUS_EBREAK_TRAP);
+        return false;
+      }
+      break;
+  }
+
+  jitEmitExit(e, pc, CPU_STATUS_ILL_INST_FAULT);
+  return false;
+}
+
+
+t_jitBlock jitCompileBlock(
+    t_vm *vm, t_memAddress start, uint32_t length, bool verify)
+{
+  t_jit *jit = vm->jit;
+  if (!jit->buffer || length > JIT_MAX_BLOCK_LENGTH)
+    return NULL;
+  size_t maxSize = (length + 2) * JIT_MAX_INST_SIZE;
+  if (jit->bufferUsed + maxSize > JIT_BUFFER_SIZE)
+    return NULL;
+
+  if (jit->bufferWX)
+    mprotect(jit->buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE);
+
+  t_jitEmitter e;
+  uint8_t *code = jit->buffer + jit->bufferUsed;
+  e.jit = jit;
+  e.cur = code;
+  e.numFixups = 0;
+#ifdef MEM_FLAT_ADDRESS_SPACE
+  /* the journal needs to see all stores */
+  e.inlineMemory = !verify;
+#else
+  e.inlineMemory = false;
+#endif
+
+  /* push rbx; push r12 to r15 (r15 keeps the stack 16-byte aligned) */
+  jitEmit8(&e, 0x53);
+  for (uint8_t reg = 4; reg <= 7; reg++) {
+    jitEmit8(&e, 0x41);
+    jitEmit8(&e, 0x50 | reg);
+  }
+  /* mov rbx, rdi; mov r12, rsi; mov r14, rdx */
+  jitEmit8(&e, 0x48);
+  jitEmit8(&e, 0x89);
+  jitEmit8(&e, 0xFB);
+  jitEmit8(&e, 0x49);
+  jitEmit8(&e, 0x89);
+  jitEmit8(&e, 0xF4);
+  jitEmit8(&e, 0x49);
+  jitEmit8(&e, 0x89);
+  jitEmit8(&e, 0xD6);
+#ifdef MEM_FLAT_ADDRESS_SPACE
+  if (e.inlineMemory) {
+    /* mov r13, imm64 */
+    jitEmit8(&e, 0x49);
+    jitEmit8(&e, 0xBD);
+    jitEmit64(&e, (uint64_t)(uintptr_t)memGetHostBase(vm));
+  }
+#endif
+
+  bool cont = true;
+  t_memAddress pc = start;
+  for (uint32_t i = 0; i < length && cont; i++, pc += 4) {
+    uint32_t instr = memDebugRead32(vm, pc, NULL);
+    cont = jitCompileInst(&e, instr, pc);
+  }
+  if (cont)
+    jitEmitExit(&e, pc, JIT_STATUS_BLOCK_END);
+
+  /* epilogue: pop r15 to r12; pop rbx; ret */
+  uint8_t *epilogue = e.cur;
+  for (uint8_t reg = 7; reg >= 4; reg--) {
+    jitEmit8(&e, 0x41);
+    jitEmit8(&e, 0x58 | reg);
+  }
+  jitEmit8(&e, 0x5B);
+  jitEmit8(&e, 0xC3);
+  for (int i = 0; i < e.numFixups; i++) {
+    int32_t rel = (int32_t)(epilogue - (e.epilogueFixups[i] + 4));
+    memcpy(e.epilogueFixups[i], &rel, 4);
+  }
+
+  jit->bufferUsed += (size_t)(e.cur - code);
+  /* keep the entry points aligned */
+  jit->bufferUsed = (jit->bufferUsed + 15) & ~(size_t)15;
+
+  if (jit->bufferWX)
+    mprotect(jit->buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+  __builtin___clear_cache((char *)code, (char *)e.cur);
+  return (t_jitBlock)(void *)code;
+}
+
+
+/*
+ * Verification support
+ */
+
+void jitJournalBegin(t_vm *vm)
+{
+  vm->jit->journalLength = 0;
+  vm->jit->journalEnabled = true;
+}
+
+void jitJournalEnd(t_vm *vm)
+{
+  vm->jit->journalEnabled = false;
+}
+
+void jitJournalRollback(t_vm *vm)
+{
+  t_jit *jit = vm->jit;
+  for (int i = jit->journalLength - 1; i >= 0; i--)
+    memWrite8(vm, jit->journal[i].addr, jit->journal[i].oldValue);
+}
+
+bool jitJournalCheck(t_vm *vm, t_memAddress *outMismatchAddr)
+{
+  t_jit *jit = vm->jit;
+  for (int i = jit->journalLength - 1; i >= 0; i--) {
+    /* only the last write to each byte determines its final value */
+    bool overwritten = false;
+    for (int j = i + 1; j < jit->journalLength && !overwritten; j++)
+      overwritten = jit->journal[j].addr == jit->journal[i].addr;
+    if (overwritten)
+      continue;
+    if (memDebugRead8(vm, jit->journal[i].addr, NULL) !=
+        jit->journal[i].newValue) {
+      if (outMismatchAddr)
+        *outMismatchAddr = jit->journal[i].addr;
+      return false;
+    }
+  }
+  return true;
+}
+
+#else
+
+bool jitCreate(t_vm *vm)
+{
+  return true;
+}
+
+void jitDestroy(t_vm *vm)
+{
+}
+
+bool jitInit(t_vm *vm)
+{
+  return false;
+}
+
+t_jitBlock jitCompileBlock(
+    t_vm *vm, t_memAddress start, uint32_t length, bool verify)
+{
+  return NULL;
+}
+
+void jitReset(t_vm *vm)
+{
+}
+
+void jitSetCodeArea(t_vm *vm, t_memAddress base, t_memSize size)
+{
+}
+
+void jitJournalBegin(t_vm *vm)
+{
+}
+
+void jitJournalEnd(t_vm *vm)
+{
+}
+
+void jitJournalRollback(t_vm *vm)
+{
+}
+
+bool jitJournalCheck(t_vm *vm, t_memAddress *outMismatchAddr)
+{
+  return true;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "isa.h"
+#include "memory.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#endif
+
+/* Values returned by compiled blocks in addition to the CPU_STATUS_* codes */
+#define JIT_STATUS_BLOCK_END 1    /* *pc is the address of the next block */
+#define JIT_STATUS_CODE_CHANGED 2 /* a store modified the code area */
+#define JIT_STATUS_CSR_ACCESS 3   /* *pc is a CSR instruction to be executed */
+
+/* A compiled block executes the instructions starting at the address it was
+ * compiled from. On exit *pc is the address of the next instruction to be
+ * executed or, in case of a fault or a trap, the address of the faulting
+ * instruction. Register X0 is never written. */
+#define JIT_MAX_BLOCK_LENGTH 64
+
+typedef int (*t_jitBlock)(t_cpuURegValue *regs, t_cpuURegValue *pc, t_vm *vm);
+
+/* Called by vmNew() and vmFree() */
+bool jitCreate(t_vm *vm);
+void jitDestroy(t_vm *vm);
+
+bool jitInit(t_vm *vm);
+/* In verify mode all stores are recorded in the journal */
+t_jitBlock jitCompileBlock(
+    t_vm *vm, t_memAddress start, uint32_t length, bool verify);
+void jitReset(t_vm *vm);
+void jitSetCodeArea(t_vm *vm, t_memAddress base, t_memSize size);
+
+void jitJournalBegin(t_vm *vm);
+void jitJournalEnd(t_vm *vm);
+void jitJournalRollback(t_vm *vm);
+bool jitJournalCheck(t_vm *vm, t_memAddress *outMismatchAddr);
+
+#endif
@@ -1,45 +1,75 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cpu.h"
 #include "loader.h"
 #include "debugger.h"
 
 
+/* Line table loaded from the .acse.lines section, sorted by address */
+typedef struct {
+  t_memAddress address;
+  uint32_t file;
+  uint32_t line;
+} t_ldrLineEntry;
+
+typedef struct ldr {
+  char **sourceFiles;
+  uint32_t numSourceFiles;
+  t_ldrLineEntry *lines;
+  uint32_t numLines;
+} t_ldr;
+
+
+static void ldrFreeLineTable(t_ldr *ldr);
+
+bool ldrCreate(t_vm *vm)
+{
+  vm->ldr = calloc(1, sizeof(t_ldr));
+  return vm->ldr != NULL;
+}
+
+
+void ldrDestroy(t_vm *vm)
+{
+  if (vm->ldr)
+    ldrFreeLineTable(vm->ldr);
+  free(vm->ldr);
+  vm->ldr = NULL;
+}
+
+
 t_ldrError ldrLoadBinary(
-    const char *path, t_memAddress baseAddr, t_memAddress entry)
+    t_vm *vm, const char *path, t_memAddress baseAddr, t_memAddress entry)
 {
   dbgPrintf("Loading raw binary file \"%s\" at address %" PRIu32 "\n", path);
 
-  FILE *fp = fopen(path, "rb");
-  if (fp == NULL)
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
     return LDR_FILE_ERROR;
 
-  if (fseek(fp, 0, SEEK_END) < 0)
-    return LDR_FILE_ERROR;
-  off_t fpos = ftello(fp);
-  if (fpos < 0 || fpos > (size_t)0x8000000) {
-    fclose(fp);
-    return LDR_FILE_ERROR;
-  }
-  t_memSize size = (t_memSize)fpos;
-  if (fseek(fp, 0, SEEK_SET) < 0) {
-    fclose(fp);
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size > (off_t)0x8000000) {
+    close(fd);
     return LDR_FILE_ERROR;
   }
+  t_memSize size = (t_memSize)st.st_size;
 
-  uint8_t *buf;
-  if (memMapArea(baseAddr, size, &buf) != MEM_NO_ERROR) {
-    fclose(fp);
+  if (memMapFileArea(vm, baseAddr, size, fd, 0, size) != MEM_NO_ERROR) {
+    close(fd);
     return LDR_MEMORY_ERROR;
   }
-  if (fread(buf, size, 1, fp) < 1) {
-    fclose(fp);
-    return LDR_FILE_ERROR;
-  }
 
-  cpuReset(entry);
+  cpuReset(vm, entry);
+  cpuSetCodeArea(vm, baseAddr, size);
 
-  fclose(fp);
+  close(fd);
   return LDR_NO_ERROR;
 }
 
@@ -96,6 +126,27 @@ typedef struct __attribute__((packed)) Elf32_Ehdr {
 #define PT_LOAD 1 /* Loadable segment */
 #define PT_NOTE 4 /* Target-dependent auxiliary information */
 
+#define PF_X 0x1 /* Execute */
+#define PF_W 0x2 /* Write */
+#define PF_R 0x4 /* Read */
+
+#define SHN_UNDEF 0 /* Undefined section */
+
+typedef struct __attribute__((packed)) Elf32_Shdr {
+  Elf32_Word sh_name;
+  Elf32_Word sh_type;
+  Elf32_Word sh_flags;
+  Elf32_Addr sh_addr;
+  Elf32_Off sh_offset;
+  Elf32_Word sh_size;
+  Elf32_Word sh_link;
+  Elf32_Word sh_info;
+  Elf32_Word sh_addralign;
+  Elf32_Word sh_entsize;
+} Elf32_Shdr;
+
+#define LDR_LINES_SECTION_NAME ".acse.lines"
+
 typedef struct __attribute__((packed)) Elf32_Phdr {
   Elf32_Word p_type;
   Elf32_Off p_offset;
@@ -107,19 +158,173 @@ typedef struct __attribute__((packed)) Elf32_Phdr {
   Elf32_Word p_align;
 } Elf32_Phdr;
 
-t_ldrError ldrLoadELF(const char *path)
+static uint32_t ldrGetWord(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+      ((uint32_t)p[3] << 24);
+}
+
+static void ldrFreeLineTable(t_ldr *ldr)
+{
+  for (uint32_t i = 0; i < ldr->numSourceFiles; i++)
+    free(ldr->sourceFiles[i]);
+  free(ldr->sourceFiles);
+  free(ldr->lines);
+  ldr->sourceFiles = NULL;
+  ldr->lines = NULL;
+  ldr->numSourceFiles = ldr->numLines = 0;
+}
+
+/* Reads the line table produced by asrv32im (see output.c in asrv32im).
+ * A missing or malformed table is not an error. */
+static void ldrLoadLineTable(t_ldr *ldr, const uint8_t *file, size_t fileSize,
+    const Elf32_Ehdr *header)
+{
+  size_t shoff = header->e_shoff;
+  size_t shnum = header->e_shnum;
+  size_t shentsize = header->e_shentsize;
+  if (shoff == 0 || shentsize < sizeof(Elf32_Shdr) ||
+      header->e_shstrndx == SHN_UNDEF || header->e_shstrndx >= shnum ||
+      shoff + shnum * shentsize > fileSize)
+    return;
+
+  Elf32_Shdr strtab;
+  memcpy(&strtab, file + shoff + header->e_shstrndx * shentsize,
+      sizeof(Elf32_Shdr));
+  if ((size_t)strtab.sh_offset + strtab.sh_size > fileSize)
+    return;
+
+  const uint8_t *data = NULL;
+  size_t size = 0;
+  for (size_t shi = 0; shi < shnum; shi++) {
+    Elf32_Shdr section;
+    memcpy(&section, file + shoff + shi * shentsize, sizeof(Elf32_Shdr));
+    size_t nameLen = sizeof(LDR_LINES_SECTION_NAME);
+    if (section.sh_name + nameLen > strtab.sh_size ||
+        memcmp(file + strtab.sh_offset + section.sh_name,
+            LDR_LINES_SECTION_NAME, nameLen) != 0)
+      continue;
+    if ((size_t)section.sh_offset + section.sh_size > fileSize)
+      return;
+    data = file + section.sh_offset;
+    size = section.sh_size;
+    break;
+  }
+  if (data == NULL || size < 8)
+    return;
+
+  uint32_t numFiles = ldrGetWord(data);
+  uint32_t numLines = ldrGetWord(data + 4);
+  ldr->sourceFiles = calloc(numFiles ? numFiles : 1, sizeof(char *));
+  if (ldr->sourceFiles == NULL)
+    return;
+  ldr->numSourceFiles = numFiles;
+  size_t pos = 8;
+  for (uint32_t i = 0; i < numFiles; i++) {
+    const uint8_t *end = memchr(data + pos, '\0', size - pos);
+    if (end == NULL)
+      goto invalid;
+    ldr->sourceFiles[i] = strdup((const char *)data + pos);
+    if (ldr->sourceFiles[i] == NULL)
+      goto invalid;
+    pos = (size_t)(end - data) + 1;
+  }
+  pos = (pos + 3) & ~(size_t)3;
+  if (pos > size || (size - pos) / 12 < numLines)
+    goto invalid;
+
+  ldr->lines = malloc(sizeof(t_ldrLineEntry) * (numLines ? numLines : 1));
+  if (ldr->lines == NULL)
+    goto invalid;
+  ldr->numLines = numLines;
+  for (uint32_t i = 0; i < numLines; i++, pos += 12) {
+    ldr->lines[i].address = ldrGetWord(data + pos);
+    ldr->lines[i].file = ldrGetWord(data + pos + 4);
+    ldr->lines[i].line = ldrGetWord(data + pos + 8);
+    if (ldr->lines[i].file > numFiles ||
+        (i > 0 && ldr->lines[i].address <= ldr->lines[i - 1].address))
+      goto invalid;
+  }
+  return;
+
+invalid:
+  ldrFreeLineTable(ldr);
+}
+
+bool ldrGetSourceLine(t_vm *vm, t_memAddress pc, t_ldrSourceLine *out)
+{
+  t_ldr *ldr = vm->ldr;
+  /* last entry starting at or before pc */
+  uint32_t lo = 0, hi = ldr->numLines;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (ldr->lines[mid].address <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0 || ldr->lines[lo - 1].line == 0 || ldr->lines[lo - 1].file == 0)
+    return false;
+  out->file = ldr->sourceFiles[ldr->lines[lo - 1].file - 1];
+  out->line = ldr->lines[lo - 1].line;
+  return true;
+}
+
+
+typedef struct {
+  Elf32_Addr vaddr;
+  Elf32_Word memsz;
+  Elf32_Off offset;
+  Elf32_Word readsz;
+  bool exec;
+} t_ldrSegment;
+
+typedef struct ldrImage {
+  int fd;
+  /* mapping of the whole file, for the line table */
+  uint8_t *file;
+  size_t fileSize;
+  Elf32_Addr entry;
+  size_t numSegments;
+  t_ldrSegment *segments;
+} t_ldrImage;
+
+
+t_ldrError ldrOpenELF(const char *path, t_ldrImage **out)
 {
   t_ldrError res = LDR_NO_ERROR;
 
   dbgPrintf("Loading ELF file \"%s\"\n", path);
 
-  FILE *fp = fopen(path, "rb");
-  if (fp == NULL)
+  t_ldrImage *image = calloc(1, sizeof(t_ldrImage));
+  if (image == NULL)
+    return LDR_MEMORY_ERROR;
+  image->fd = open(path, O_RDONLY);
+  if (image->fd < 0) {
+    free(image);
     return LDR_FILE_ERROR;
+  }
+
+  /* the headers are read from a mapping of the file, and the segments are
+   * mapped copy-on-write into the guest memory when possible */
+  struct stat st;
+  if (fstat(image->fd, &st) < 0)
+    goto read_error;
+  image->fileSize = (size_t)st.st_size;
+  if (image->fileSize > 0)
+    image->file =
+        mmap(NULL, image->fileSize, PROT_READ, MAP_PRIVATE, image->fd, 0);
+  if (image->file == MAP_FAILED)
+    image->file = NULL;
+  if (image->file == NULL)
+    goto read_error;
+  const uint8_t *file = image->file;
+  size_t fileSize = image->fileSize;
 
   Elf32_Ehdr header;
-  if (fread(&header, sizeof(Elf32_Ehdr), 1, fp) < 1)
+  if (fileSize < sizeof(Elf32_Ehdr))
     goto read_error;
+  memcpy(&header, file, sizeof(Elf32_Ehdr));
   if (header.e_ident[EI_MAG0] != 0x7f || header.e_ident[EI_MAG1] != 'E' ||
       header.e_ident[EI_MAG2] != 'L' || header.e_ident[EI_MAG3] != 'F' ||
       header.e_ident[EI_CLASS] != ELFCLASS32 ||
@@ -129,15 +334,22 @@ t_ldrError ldrLoadELF(const char *path)
     goto invalid_file;
   if (header.e_machine != EM_RISCV)
     goto invalid_arch;
+  image->entry = header.e_entry;
 
-  off_t phnum = header.e_phnum;
-  off_t phoff = header.e_phoff;
-  off_t phentsize = header.e_phentsize;
-  for (off_t phi = 0; phi < phnum; phi++) {
+  size_t phnum = header.e_phnum;
+  size_t phoff = header.e_phoff;
+  size_t phentsize = header.e_phentsize;
+  if (phnum > 0 && phentsize < sizeof(Elf32_Phdr))
+    goto invalid_file;
+  image->segments = malloc(sizeof(t_ldrSegment) * (phnum ? phnum : 1));
+  if (image->segments == NULL)
+    goto mem_error;
+  for (size_t phi = 0; phi < phnum; phi++) {
     Elf32_Phdr segment;
-    fseeko(fp, phoff + phi * phentsize, SEEK_SET);
-    if (fread(&segment, sizeof(Elf32_Phdr), 1, fp) < 1)
+    size_t segOffset = phoff + phi * phentsize;
+    if (segOffset + sizeof(Elf32_Phdr) > fileSize)
       goto read_error;
+    memcpy(&segment, file + segOffset, sizeof(Elf32_Phdr));
 
     if (segment.p_type == PT_NULL || segment.p_type == PT_NOTE)
       continue;
@@ -148,22 +360,19 @@ t_ldrError ldrLoadELF(const char *path)
               ") to 0x%08" PRIx32 " (size=0x%08" PRIx32 ")\n",
         segment.p_offset, segment.p_filesz, segment.p_vaddr, segment.p_memsz);
     if (segment.p_memsz > 0) {
-      uint8_t *buf;
-      if (memMapArea(segment.p_vaddr, segment.p_memsz, &buf) != MEM_NO_ERROR)
-        goto mem_error;
-      if (segment.p_filesz > 0) {
-        fseeko(fp, (off_t)segment.p_offset, SEEK_SET);
-        size_t readsz = MIN(segment.p_memsz, segment.p_filesz);
-        if (fread(buf, readsz, 1, fp) < 1)
-          goto read_error;
-      }
+      t_ldrSegment *seg = &image->segments[image->numSegments++];
+      seg->vaddr = segment.p_vaddr;
+      seg->memsz = segment.p_memsz;
+      seg->offset = segment.p_offset;
+      seg->readsz = MIN(segment.p_memsz, segment.p_filesz);
+      seg->exec = (segment.p_flags & PF_X) != 0;
+      if ((size_t)seg->offset + seg->readsz > fileSize)
+        goto read_error;
     }
   }
 
-  dbgPrintf("Setting the entry point to 0x%" PRIx32 "\n", header.e_entry);
-  cpuReset(header.e_entry);
-
-  goto cleanup;
+  *out = image;
+  return LDR_NO_ERROR;
 mem_error:
   res = LDR_MEMORY_ERROR;
   goto cleanup;
@@ -176,7 +385,58 @@ invalid_file:
 invalid_arch:
   res = LDR_INVALID_ARCH;
 cleanup:
-  fclose(fp);
+  ldrCloseImage(image);
+  return res;
+}
+
+
+t_ldrError ldrLoadImage(t_vm *vm, const t_ldrImage *image)
+{
+  bool codeAreaSet = false;
+  for (size_t i = 0; i < image->numSegments; i++) {
+    const t_ldrSegment *seg = &image->segments[i];
+    if (memMapFileArea(vm, seg->vaddr, seg->memsz, image->fd,
+            (off_t)seg->offset, seg->readsz) != MEM_NO_ERROR)
+      return LDR_MEMORY_ERROR;
+    if (seg->exec && !codeAreaSet) {
+      cpuSetCodeArea(vm, seg->vaddr, seg->memsz);
+      codeAreaSet = true;
+    }
+  }
+
+  dbgPrintf("Setting the entry point to 0x%" PRIx32 "\n", image->entry);
+  cpuReset(vm, image->entry);
+  return LDR_NO_ERROR;
+}
+
+
+void ldrCloseImage(t_ldrImage *image)
+{
+  if (image == NULL)
+    return;
+  if (image->file)
+    munmap(image->file, image->fileSize);
+  close(image->fd);
+  free(image->segments);
+  free(image);
+}
+
+
+t_ldrError ldrLoadELF(t_vm *vm, const char *path)
+{
+  t_ldrImage *image;
+  t_ldrError res = ldrOpenELF(path, &image);
+  if (res != LDR_NO_ERROR)
+    return res;
+
+  res = ldrLoadImage(vm, image);
+  if (res == LDR_NO_ERROR) {
+    Elf32_Ehdr header;
+    memcpy(&header, image->file, sizeof(Elf32_Ehdr));
+    ldrFreeLineTable(vm->ldr);
+    ldrLoadLineTable(vm->ldr, image->file, image->fileSize, &header);
+  }
+  ldrCloseImage(image);
   return res;
 }
 
@@ -1,6 +1,7 @@
 #ifndef LOADER_H
 #define LOADER_H
 
+#include <stdbool.h>
 #include "memory.h"
 
 typedef int t_ldrError;
@@ -12,6 +13,11 @@ enum {
   LDR_INVALID_ARCH = -3
 };
 
+typedef struct {
+  const char *file;
+  uint32_t line;
+} t_ldrSourceLine;
+
 typedef int t_ldrFileType;
 enum {
   LDR_FORMAT_BINARY = 0,
@@ -20,10 +26,27 @@ enum {
 };
 
 
+/* Called by vmNew() and vmFree() */
+bool ldrCreate(t_vm *vm);
+void ldrDestroy(t_vm *vm);
+
 t_ldrError ldrLoadBinary(
-    const char *path, t_memAddress baseAddr, t_memAddress entry);
-t_ldrError ldrLoadELF(const char *path);
+    t_vm *vm, const char *path, t_memAddress baseAddr, t_memAddress entry);
+t_ldrError ldrLoadELF(t_vm *vm, const char *path);
+
+/* An ELF executable parsed once and loaded into any number of VMs. The file
+ * stays open until the image is closed. ldrLoadImage() does not load the
+ * line table. */
+typedef struct ldrImage t_ldrImage;
+
+t_ldrError ldrOpenELF(const char *path, t_ldrImage **out);
+t_ldrError ldrLoadImage(t_vm *vm, const t_ldrImage *image);
+void ldrCloseImage(t_ldrImage *image);
 
 t_ldrFileType ldrDetectExecType(const char *path);
 
+/* Looks up the source line of an instruction in the line table of the last
+ * ELF file loaded. Returns false if the line is unknown. */
+bool ldrGetSourceLine(t_vm *vm, t_memAddress pc, t_ldrSourceLine *out);
+
 #endif
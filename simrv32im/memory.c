@@ -1,194 +1,897 @@
 #include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "memory.h"
 
 typedef struct memArea {
   struct memArea *next;
   t_memAddress baseAddress;
   t_memSize extent;
-  uint8_t *buffer;
+  /* host memory backing the area, released with the VM */
+  uint8_t *data;
+  uint8_t *fileMap;
+  size_t fileMapSize;
 } t_memArea;
 
-t_memArea *memAreas = NULL;
 
-t_memAddress memLastFaultAddress = 0;
+/* Returns the offset of the first byte of the host buffer whose page is
+ * resident, or size if none is. The page holding the start of the buffer
+ * may be shared with other allocations, so it is not checked. */
+static size_t memFirstResident(const uint8_t *data, size_t size)
+{
+  uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t)data + pageSize - 1) & ~(pageSize - 1);
+  uintptr_t end = (uintptr_t)data + size;
+  unsigned char vec[256];
+  /* if residency is unknown, the whole buffer is assumed to be used */
+  if (start >= end)
+    return 0;
+  while (start < end) {
+    size_t n = (end - start + pageSize - 1) / pageSize;
+    if (n > sizeof(vec))
+      n = sizeof(vec);
+    if (mincore((void *)start, n * pageSize, vec) != 0)
+      return 0;
+    for (size_t i = 0; i < n; i++, start += pageSize) {
+      if (vec[i] & 1)
+        return start - (uintptr_t)data;
+    }
+  }
+  return size;
+}
+
+
+#ifdef MEM_FLAT_ADDRESS_SPACE
+
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#if !defined(__LP64__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the flat memory backend requires a 64-bit little-endian host"
+#endif
 
+/* The whole guest address space of each VM is reserved as a single host
+ * mapping, and mapped areas are made accessible with mprotect(). Accesses to
+ * unmapped memory raise SIGSEGV, which is turned back into a memory fault by
+ * jumping to the recovery point set by the CPU running on the faulting
+ * thread. Protection works at the granularity of host pages, so bytes
+ * sharing a page with a mapped area are accessible as well. */
+#define MEM_GUEST_SPACE_SIZE ((uint64_t)1 << 32)
+#define MEM_PAGE_BITS 12
 
-static t_memAddress memAreaEnd(t_memArea *area)
+typedef struct mem {
+  t_memAddress lastFaultAddress;
+  /* Total size of the mapped areas */
+  uint64_t mappedSize;
+  /* Mapped areas, sorted by address */
+  t_memArea *areas;
+  uint8_t *hostBase;
+  /* one bit per guest page, set if the page is accessible */
+  uint8_t *pageMapped;
+} t_mem;
+
+size_t memHostSpaceSize;
+size_t memHostPageSize;
+pthread_once_t memHandlerOnce = PTHREAD_ONCE_INIT;
+
+/* VM run by this thread, and where to resume when its accesses fault */
+_Thread_local t_mem *memFaultMem = NULL;
+_Thread_local sigjmp_buf *memFaultRecovery = NULL;
+
+
+static void memFaultHandler(int sig, siginfo_t *info, void *context)
 {
-  return area->baseAddress + area->extent;
+  uint8_t *addr = info->si_addr;
+  t_mem *mem = memFaultMem;
+  if (memFaultRecovery && addr >= mem->hostBase &&
+      addr < mem->hostBase + memHostSpaceSize) {
+    mem->lastFaultAddress = (t_memAddress)(addr - mem->hostBase);
+    siglongjmp(*memFaultRecovery, 1);
+  }
+  /* not a guest memory access: crash as usual */
+  signal(sig, SIG_DFL);
 }
 
+static void memInstallHandler(void)
+{
+  memHostPageSize = (size_t)sysconf(_SC_PAGESIZE);
+  /* accesses to the last bytes of the address space do not wrap around, so
+   * they need a guard page */
+  memHostSpaceSize = MEM_GUEST_SPACE_SIZE + memHostPageSize;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = memFaultHandler;
+  /* the handler never returns normally, so SIGSEGV must not stay blocked */
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, NULL);
+  sigaction(SIGBUS, &sa, NULL);
+}
 
-static t_memArea *memFindArea(t_memAddress addr, t_memSize extent, int isDbg)
+
+bool memCreate(t_vm *vm)
 {
-  t_memArea *curArea = memAreas;
-  while (curArea) {
-    if (curArea->baseAddress <= addr && addr < memAreaEnd(curArea)) {
-      if ((addr + extent) <= memAreaEnd(curArea))
-        return curArea;
-      else
-        goto fail;
-    }
-    curArea = curArea->next;
+  pthread_once(&memHandlerOnce, memInstallHandler);
+  t_mem *mem = calloc(1, sizeof(t_mem));
+  if (mem == NULL)
+    return false;
+  vm->mem = mem;
+  mem->pageMapped = calloc((MEM_GUEST_SPACE_SIZE >> MEM_PAGE_BITS) / 8, 1);
+  if (mem->pageMapped == NULL)
+    return false;
+  void *base = mmap(NULL, memHostSpaceSize, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+    return false;
+  mem->hostBase = base;
+  return true;
+}
+
+void memDestroy(t_vm *vm)
+{
+  t_mem *mem = vm->mem;
+  if (mem == NULL)
+    return;
+  if (mem->hostBase)
+    munmap(mem->hostBase, memHostSpaceSize);
+  free(mem->pageMapped);
+  while (mem->areas) {
+    t_memArea *next = mem->areas->next;
+    free(mem->areas);
+    mem->areas = next;
   }
+  free(mem);
+  vm->mem = NULL;
+}
 
-fail:
-  if (!isDbg)
-    memLastFaultAddress = addr;
-  return NULL;
+
+void memSetFaultRecovery(t_vm *vm, sigjmp_buf *recovery)
+{
+  memFaultMem = vm->mem;
+  memFaultRecovery = recovery;
 }
 
+uint8_t *memGetHostBase(t_vm *vm)
+{
+  return vm->mem->hostBase;
+}
 
-t_memError memMapArea(t_memAddress base, t_memSize extent, uint8_t **outBuffer)
+
+static bool memIsMapped(t_mem *mem, t_memAddress addr, t_memSize extent)
 {
-  t_memArea *prevArea = NULL;
-  t_memArea *nextArea = memAreas;
+  for (uint64_t a = addr; a < (uint64_t)addr + extent; a++) {
+    uint64_t page = (a & (MEM_GUEST_SPACE_SIZE - 1)) >> MEM_PAGE_BITS;
+    if (!(mem->pageMapped[page / 8] & (1 << (page % 8))))
+      return false;
+  }
+  return true;
+}
+
 
+t_memError memMapArea(t_vm *vm, t_memAddress base, t_memSize extent)
+{
+  t_mem *mem = vm->mem;
   if (extent == 0)
     return MEM_NO_ERROR;
+  uint64_t end = (uint64_t)base + extent;
+  if (end > MEM_GUEST_SPACE_SIZE)
+    return MEM_MAPPING_ERROR;
 
+  t_memArea *prevArea = NULL;
+  t_memArea *nextArea = mem->areas;
   while (nextArea) {
-    if ((base + extent) <= nextArea->baseAddress)
+    if (end <= nextArea->baseAddress)
       break;
     prevArea = nextArea;
     nextArea = nextArea->next;
   }
-  if (prevArea) {
-    if (!(base >= memAreaEnd(prevArea)))
-      return MEM_EXTENT_MAPPED;
-  }
+  if (prevArea &&
+      base < (uint64_t)prevArea->baseAddress + prevArea->extent)
+    return MEM_EXTENT_MAPPED;
 
-  t_memArea *newArea = calloc(1, sizeof(t_memArea) + (size_t)extent);
+  t_memArea *newArea = calloc(1, sizeof(t_memArea));
   if (!newArea)
     return MEM_OUT_OF_MEMORY;
+  uint64_t pageMask = memHostPageSize - 1;
+  uint64_t mapStart = base & ~pageMask;
+  uint64_t mapEnd = (end + pageMask) & ~pageMask;
+  if (mprotect(mem->hostBase + mapStart, mapEnd - mapStart,
+          PROT_READ | PROT_WRITE) != 0) {
+    free(newArea);
+    return MEM_OUT_OF_MEMORY;
+  }
+  for (uint64_t page = mapStart >> MEM_PAGE_BITS;
+       page < mapEnd >> MEM_PAGE_BITS; page++)
+    mem->pageMapped[page / 8] |= (uint8_t)(1 << (page % 8));
+
   newArea->baseAddress = base;
   newArea->extent = extent;
-  newArea->buffer = (uint8_t *)((void *)newArea) + sizeof(t_memArea);
-  if (outBuffer)
-    *outBuffer = newArea->buffer;
   newArea->next = nextArea;
   if (prevArea)
     prevArea->next = newArea;
   else
-    memAreas = newArea;
+    mem->areas = newArea;
+  mem->mappedSize += extent;
+  return MEM_NO_ERROR;
+}
+
+
+static t_memError memReadFile(
+    t_mem *mem, t_memAddress addr, t_memSize size, int fd, off_t offset)
+{
+  while (size > 0) {
+    ssize_t res = pread(fd, mem->hostBase + addr, size, offset);
+    if (res <= 0)
+      return MEM_MAPPING_ERROR;
+    addr += (t_memSize)res;
+    offset += res;
+    size -= (t_memSize)res;
+  }
+  return MEM_NO_ERROR;
+}
 
+t_memError memMapFileArea(t_vm *vm, t_memAddress base, t_memSize extent,
+    int fd, off_t offset, t_memSize fileSize)
+{
+  t_mem *mem = vm->mem;
+  t_memError err = memMapArea(vm, base, extent);
+  if (err != MEM_NO_ERROR)
+    return err;
+  if (fileSize > extent)
+    fileSize = extent;
+
+  /* the host pages entirely covered by the file contents are mapped from
+   * the file if the offsets allow it, the rest is copied */
+  uint64_t pageMask = memHostPageSize - 1;
+  uint64_t end = (uint64_t)base + fileSize;
+  uint64_t sharedStart = end, sharedEnd = end;
+  if ((((uint64_t)base - (uint64_t)offset) & pageMask) == 0) {
+    uint64_t start = ((uint64_t)base + pageMask) & ~pageMask;
+    uint64_t last = end & ~pageMask;
+    if (start < last &&
+        mmap(mem->hostBase + start, last - start, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_FIXED, fd,
+            offset + (off_t)(start - base)) != MAP_FAILED) {
+      sharedStart = start;
+      sharedEnd = last;
+    }
+  }
+
+  err = memReadFile(mem, base, (t_memSize)(sharedStart - base), fd, offset);
+  if (err != MEM_NO_ERROR)
+    return err;
+  return memReadFile(mem, (t_memAddress)sharedEnd,
+      (t_memSize)(end - sharedEnd), fd, offset + (off_t)(sharedEnd - base));
+}
+
+
+t_memError memRead8(t_vm *vm, t_memAddress addr, uint8_t *out)
+{
+  *out = vm->mem->hostBase[addr];
   return MEM_NO_ERROR;
 }
 
+t_memError memRead16(t_vm *vm, t_memAddress addr, uint16_t *out)
+{
+  memcpy(out, vm->mem->hostBase + addr, 2);
+  return MEM_NO_ERROR;
+}
 
-t_memError memRead8(t_memAddress addr, uint8_t *out)
+t_memError memRead32(t_vm *vm, t_memAddress addr, uint32_t *out)
 {
-  t_memArea *area = memFindArea(addr, 1, 0);
-  if (!area)
+  memcpy(out, vm->mem->hostBase + addr, 4);
+  return MEM_NO_ERROR;
+}
+
+
+uint8_t memDebugRead8(t_vm *vm, t_memAddress addr, int *mapped)
+{
+  if (!memIsMapped(vm->mem, addr, 1)) {
+    if (mapped)
+      *mapped = 0;
+    return 0xFF;
+  }
+  if (mapped)
+    *mapped = 1;
+  return vm->mem->hostBase[addr];
+}
+
+uint16_t memDebugRead16(t_vm *vm, t_memAddress addr, int *mapped)
+{
+  uint16_t res;
+  if (!memIsMapped(vm->mem, addr, 2)) {
+    if (mapped)
+      *mapped = 0;
+    return 0xFFFF;
+  }
+  if (mapped)
+    *mapped = 1;
+  memcpy(&res, vm->mem->hostBase + addr, 2);
+  return res;
+}
+
+uint32_t memDebugRead32(t_vm *vm, t_memAddress addr, int *mapped)
+{
+  uint32_t res;
+  if (!memIsMapped(vm->mem, addr, 4)) {
+    if (mapped)
+      *mapped = 0;
+    return 0xFFFFFFFF;
+  }
+  if (mapped)
+    *mapped = 1;
+  memcpy(&res, vm->mem->hostBase + addr, 4);
+  return res;
+}
+
+
+t_memError memWrite8(t_vm *vm, t_memAddress addr, uint8_t in)
+{
+  vm->mem->hostBase[addr] = in;
+  return MEM_NO_ERROR;
+}
+
+t_memError memWrite16(t_vm *vm, t_memAddress addr, uint16_t in)
+{
+  memcpy(vm->mem->hostBase + addr, &in, 2);
+  return MEM_NO_ERROR;
+}
+
+t_memError memWrite32(t_vm *vm, t_memAddress addr, uint32_t in)
+{
+  memcpy(vm->mem->hostBase + addr, &in, 4);
+  return MEM_NO_ERROR;
+}
+
+t_memError memDebugReadBlock(
+    t_vm *vm, t_memAddress addr, t_memSize size, void *out)
+{
+  if (!memIsMapped(vm->mem, addr, size))
     return MEM_MAPPING_ERROR;
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
-  *out = bufBasePtr[0];
+  memcpy(out, vm->mem->hostBase + addr, size);
   return MEM_NO_ERROR;
 }
 
-t_memError memRead16(t_memAddress addr, uint16_t *out)
+t_memError memDebugWriteBlock(
+    t_vm *vm, t_memAddress addr, t_memSize size, const void *in)
 {
-  t_memArea *area = memFindArea(addr, 2, 0);
-  if (!area)
+  if (!memIsMapped(vm->mem, addr, size))
     return MEM_MAPPING_ERROR;
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
-  *out = (uint16_t)bufBasePtr[0] + (uint16_t)((uint16_t)bufBasePtr[1] << 8);
+  memcpy(vm->mem->hostBase + addr, in, size);
   return MEM_NO_ERROR;
 }
 
-t_memError memRead32(t_memAddress addr, uint32_t *out)
+t_memAddress memGetFirstUsed(t_vm *vm, t_memAddress base, t_memSize extent)
+{
+  return base + (t_memSize)memFirstResident(vm->mem->hostBase + base, extent);
+}
+
+#else
+
+#include <string.h>
+
+/* The address space is mapped with a two-level page table. Mapped areas do
+ * not have to be page aligned, so pages which are only partially mapped
+ * keep a bitmap of the mapped bytes. */
+#define MEM_PAGE_BITS 12
+#define MEM_PAGE_SIZE ((t_memSize)1 << MEM_PAGE_BITS)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_TABLE_BITS 10
+#define MEM_TABLE_SIZE (1 << MEM_TABLE_BITS)
+#define MEM_DIR_SIZE (1 << (32 - MEM_PAGE_BITS - MEM_TABLE_BITS))
+
+typedef struct {
+  uint8_t *data;
+  /* one bit per byte of the page, NULL if the whole page is mapped */
+  uint8_t *mappedBytes;
+} t_memPage;
+
+typedef struct mem {
+  t_memAddress lastFaultAddress;
+  /* Total size of the mapped areas */
+  uint64_t mappedSize;
+  /* Mapped areas, sorted by address */
+  t_memArea *areas;
+  t_memPage *pageDir[MEM_DIR_SIZE];
+} t_mem;
+
+
+bool memCreate(t_vm *vm)
 {
-  t_memArea *area = memFindArea(addr, 4, 0);
+  vm->mem = calloc(1, sizeof(t_mem));
+  return vm->mem != NULL;
+}
+
+void memDestroy(t_vm *vm)
+{
+  t_mem *mem = vm->mem;
+  if (mem == NULL)
+    return;
+  for (int i = 0; i < MEM_DIR_SIZE; i++) {
+    if (!mem->pageDir[i])
+      continue;
+    for (int j = 0; j < MEM_TABLE_SIZE; j++)
+      free(mem->pageDir[i][j].mappedBytes);
+    free(mem->pageDir[i]);
+  }
+  while (mem->areas) {
+    t_memArea *next = mem->areas->next;
+    free(mem->areas->data);
+    if (mem->areas->fileMap)
+      munmap(mem->areas->fileMap, mem->areas->fileMapSize);
+    free(mem->areas);
+    mem->areas = next;
+  }
+  free(mem);
+  vm->mem = NULL;
+}
+
+
+static inline t_memPage *memGetPage(t_mem *mem, t_memAddress addr)
+{
+  t_memPage *table = mem->pageDir[addr >> (MEM_PAGE_BITS + MEM_TABLE_BITS)];
+  if (!table)
+    return NULL;
+  t_memPage *page = &table[(addr >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+  if (!page->data)
+    return NULL;
+  return page;
+}
+
+static inline bool memIsByteMapped(t_memPage *page, t_memAddress offs)
+{
+  return !page->mappedBytes ||
+      (page->mappedBytes[offs / 8] & (1 << (offs % 8))) != 0;
+}
+
+/* Returns the host address of the given guest byte, or NULL if it is not
+ * mapped */
+static uint8_t *memTranslateByte(t_mem *mem, t_memAddress addr)
+{
+  t_memPage *page = memGetPage(mem, addr);
+  if (!page || !memIsByteMapped(page, addr & MEM_PAGE_MASK))
+    return NULL;
+  return page->data + (addr & MEM_PAGE_MASK);
+}
+
+/* Returns the host address of a guest memory range which is entirely
+ * contained in a page, or NULL if the range crosses a page boundary or it is
+ * not mapped */
+static inline uint8_t *memTranslateFast(
+    t_mem *mem, t_memAddress addr, t_memSize extent)
+{
+  t_memPage *page = memGetPage(mem, addr);
+  t_memAddress offs = addr & MEM_PAGE_MASK;
+  if (!page || offs + extent > MEM_PAGE_SIZE)
+    return NULL;
+  if (page->mappedBytes) {
+    /* the bitmap has a padding byte, so two bytes can always be read */
+    const uint8_t *bits = &page->mappedBytes[offs / 8];
+    uint32_t mask = (1U << extent) - 1;
+    if ((((bits[0] | ((uint32_t)bits[1] << 8)) >> (offs % 8)) & mask) != mask)
+      return NULL;
+  }
+  return page->data + offs;
+}
+
+/* Finds the host addresses of all the bytes of a guest memory range, which
+ * may span multiple pages */
+static bool memTranslate(t_mem *mem, t_memAddress addr, t_memSize extent,
+    uint8_t *outPtrs[], int isDbg)
+{
+  for (t_memSize i = 0; i < extent; i++) {
+    outPtrs[i] = memTranslateByte(mem, addr + i);
+    if (!outPtrs[i]) {
+      if (!isDbg)
+        mem->lastFaultAddress = addr;
+      return false;
+    }
+  }
+  return true;
+}
+
+
+static t_memArea *memRecordArea(
+    t_mem *mem, t_memAddress base, t_memSize extent)
+{
+  t_memArea **prev = &mem->areas;
+  while (*prev && (*prev)->baseAddress < base)
+    prev = &(*prev)->next;
+  t_memArea *area = calloc(1, sizeof(t_memArea));
   if (!area)
+    return NULL;
+  area->baseAddress = base;
+  area->extent = extent;
+  area->next = *prev;
+  *prev = area;
+  return area;
+}
+
+
+static t_memPage *memAllocPage(
+    t_mem *mem, t_memAddress addr, uint8_t *data, bool full)
+{
+  t_memPage **table =
+      &mem->pageDir[addr >> (MEM_PAGE_BITS + MEM_TABLE_BITS)];
+  if (!*table) {
+    *table = calloc(MEM_TABLE_SIZE, sizeof(t_memPage));
+    if (!*table)
+      return NULL;
+  }
+  t_memPage *page = &(*table)[(addr >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+  if (!full) {
+    page->mappedBytes = calloc(1, MEM_PAGE_SIZE / 8 + 1);
+    if (!page->mappedBytes)
+      return NULL;
+  }
+  page->data = data;
+  return page;
+}
+
+/* Maps an area whose first fileSize bytes have the contents of fileData.
+ * Pages entirely contained in fileData use it directly. Returns the number
+ * of such pages in outShared, and the new area in outArea. */
+static t_memError memMapAreaWithData(t_mem *mem, t_memAddress base,
+    t_memSize extent, uint8_t *fileData, t_memSize fileSize,
+    uint64_t *outShared, t_memArea **outArea)
+{
+  *outShared = 0;
+  *outArea = NULL;
+  if (extent == 0)
+    return MEM_NO_ERROR;
+  uint64_t end = (uint64_t)base + extent;
+  if (end > ((uint64_t)1 << 32))
     return MEM_MAPPING_ERROR;
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
-  *out = (uint32_t)bufBasePtr[0] + (uint32_t)((uint32_t)bufBasePtr[1] << 8) +
-      (uint32_t)((uint32_t)bufBasePtr[2] << 16) +
-      (uint32_t)((uint32_t)bufBasePtr[3] << 24);
+  uint64_t fileEnd = (uint64_t)base + fileSize;
+
+  for (uint64_t addr = base; addr < end;) {
+    uint64_t pageEnd = (addr & ~(uint64_t)MEM_PAGE_MASK) + MEM_PAGE_SIZE;
+    uint64_t last = end < pageEnd ? end : pageEnd;
+    t_memPage *page = memGetPage(mem, (t_memAddress)addr);
+    for (; page && addr < last; addr++) {
+      if (memIsByteMapped(page, addr & MEM_PAGE_MASK))
+        return MEM_EXTENT_MAPPED;
+    }
+    addr = last;
+  }
+
+  /* All the pages of the area are backed by a single allocation, which for
+   * large areas the host zero-fills lazily. The pages shared with other
+   * areas are already allocated, and their space is wasted. */
+  uint64_t firstPage = base >> MEM_PAGE_BITS;
+  uint64_t lastPage = (end - 1) >> MEM_PAGE_BITS;
+  uint8_t *data = calloc(lastPage - firstPage + 1, MEM_PAGE_SIZE);
+  if (!data)
+    return MEM_OUT_OF_MEMORY;
+  t_memArea *area = memRecordArea(mem, base, (t_memSize)extent);
+  if (!area) {
+    free(data);
+    return MEM_OUT_OF_MEMORY;
+  }
+  area->data = data;
+  mem->mappedSize += extent;
+  *outArea = area;
+
+  for (uint64_t addr = base; addr < end;) {
+    uint64_t pageEnd = (addr & ~(uint64_t)MEM_PAGE_MASK) + MEM_PAGE_SIZE;
+    uint64_t last = end < pageEnd ? end : pageEnd;
+    t_memPage *page = memGetPage(mem, (t_memAddress)addr);
+    if (!page) {
+      bool full = (addr & MEM_PAGE_MASK) == 0 && last == pageEnd;
+      uint8_t *pageData;
+      if (full && pageEnd <= fileEnd) {
+        pageData = fileData + (addr - base);
+        (*outShared)++;
+      } else {
+        pageData =
+            data + ((addr >> MEM_PAGE_BITS) - firstPage) * MEM_PAGE_SIZE;
+      }
+      page = memAllocPage(mem, (t_memAddress)addr, pageData, full);
+      if (!page)
+        return MEM_OUT_OF_MEMORY;
+      if (full) {
+        addr = last;
+        continue;
+      }
+    }
+
+    for (; addr < last; addr++) {
+      t_memAddress offs = addr & MEM_PAGE_MASK;
+      page->mappedBytes[offs / 8] |= (uint8_t)(1 << (offs % 8));
+    }
+    bool full = true;
+    for (t_memSize i = 0; i < MEM_PAGE_SIZE / 8 && full; i++)
+      full = page->mappedBytes[i] == 0xFF;
+    if (full) {
+      free(page->mappedBytes);
+      page->mappedBytes = NULL;
+    }
+  }
+
+  /* copy the contents of the pages which do not use fileData */
+  for (uint64_t addr = base; addr < fileEnd;) {
+    uint64_t pageEnd = (addr & ~(uint64_t)MEM_PAGE_MASK) + MEM_PAGE_SIZE;
+    uint64_t last = fileEnd < pageEnd ? fileEnd : pageEnd;
+    uint8_t *src = fileData + (addr - base);
+    uint8_t *dest = memTranslateByte(mem, (t_memAddress)addr);
+    if (dest != src)
+      memcpy(dest, src, last - addr);
+    addr = last;
+  }
   return MEM_NO_ERROR;
 }
 
+t_memError memMapArea(t_vm *vm, t_memAddress base, t_memSize extent)
+{
+  uint64_t shared;
+  t_memArea *area;
+  return memMapAreaWithData(vm->mem, base, extent, NULL, 0, &shared, &area);
+}
 
-uint8_t memDebugRead8(t_memAddress addr, int *mapped)
+t_memError memMapFileArea(t_vm *vm, t_memAddress base, t_memSize extent,
+    int fd, off_t offset, t_memSize fileSize)
 {
-  t_memArea *area = memFindArea(addr, 1, 1);
-  if (!area) {
+  if (fileSize > extent)
+    fileSize = extent;
+  if (fileSize == 0)
+    return memMapArea(vm, base, extent);
+
+  off_t pageMask = (off_t)sysconf(_SC_PAGESIZE) - 1;
+  off_t mapOffset = offset & ~pageMask;
+  size_t mapSize = (size_t)(offset - mapOffset) + fileSize;
+  uint8_t *map = mmap(
+      NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, mapOffset);
+  if (map == MAP_FAILED)
+    return MEM_MAPPING_ERROR;
+
+  uint64_t shared;
+  t_memArea *area;
+  t_memError err = memMapAreaWithData(vm->mem, base, extent,
+      map + (offset - mapOffset), fileSize, &shared, &area);
+  if (area && shared > 0) {
+    area->fileMap = map;
+    area->fileMapSize = mapSize;
+  } else if (err != MEM_NO_ERROR || shared == 0) {
+    munmap(map, mapSize);
+  }
+  return err;
+}
+
+
+t_memError memRead8(t_vm *vm, t_memAddress addr, uint8_t *out)
+{
+  uint8_t *p[1];
+  uint8_t *fast = memTranslateFast(vm->mem, addr, 1);
+  if (fast) {
+    *out = fast[0];
+    return MEM_NO_ERROR;
+  }
+  if (!memTranslate(vm->mem, addr, 1, p, 0))
+    return MEM_MAPPING_ERROR;
+  *out = *p[0];
+  return MEM_NO_ERROR;
+}
+
+t_memError memRead16(t_vm *vm, t_memAddress addr, uint16_t *out)
+{
+  uint8_t *p[2];
+  uint8_t *fast = memTranslateFast(vm->mem, addr, 2);
+  if (fast) {
+    *out = (uint16_t)fast[0] + (uint16_t)((uint16_t)fast[1] << 8);
+    return MEM_NO_ERROR;
+  }
+  if (!memTranslate(vm->mem, addr, 2, p, 0))
+    return MEM_MAPPING_ERROR;
+  *out = (uint16_t)*p[0] + (uint16_t)((uint16_t)*p[1] << 8);
+  return MEM_NO_ERROR;
+}
+
+t_memError memRead32(t_vm *vm, t_memAddress addr, uint32_t *out)
+{
+  uint8_t *p[4];
+  uint8_t *fast = memTranslateFast(vm->mem, addr, 4);
+  if (fast) {
+    *out = (uint32_t)fast[0] + (uint32_t)((uint32_t)fast[1] << 8) +
+        (uint32_t)((uint32_t)fast[2] << 16) +
+        (uint32_t)((uint32_t)fast[3] << 24);
+    return MEM_NO_ERROR;
+  }
+  if (!memTranslate(vm->mem, addr, 4, p, 0))
+    return MEM_MAPPING_ERROR;
+  *out = (uint32_t)*p[0] + (uint32_t)((uint32_t)*p[1] << 8) +
+      (uint32_t)((uint32_t)*p[2] << 16) + (uint32_t)((uint32_t)*p[3] << 24);
+  return MEM_NO_ERROR;
+}
+
+
+uint8_t memDebugRead8(t_vm *vm, t_memAddress addr, int *mapped)
+{
+  uint8_t *p[1];
+  if (!memTranslate(vm->mem, addr, 1, p, 1)) {
     if (mapped)
       *mapped = 0;
     return 0xFF;
   }
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
   if (mapped)
     *mapped = 1;
-  return bufBasePtr[0];
+  return *p[0];
 }
 
-uint16_t memDebugRead16(t_memAddress addr, int *mapped)
+uint16_t memDebugRead16(t_vm *vm, t_memAddress addr, int *mapped)
 {
-  t_memArea *area = memFindArea(addr, 2, 1);
-  if (!area) {
+  uint8_t *p[2];
+  if (!memTranslate(vm->mem, addr, 2, p, 1)) {
     if (mapped)
       *mapped = 0;
     return 0xFFFF;
   }
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
   if (mapped)
     *mapped = 1;
-  return (uint16_t)bufBasePtr[0] + (uint16_t)((uint16_t)bufBasePtr[1] << 8);
+  return (uint16_t)*p[0] + (uint16_t)((uint16_t)*p[1] << 8);
 }
 
-uint32_t memDebugRead32(t_memAddress addr, int *mapped)
+uint32_t memDebugRead32(t_vm *vm, t_memAddress addr, int *mapped)
 {
-  t_memArea *area = memFindArea(addr, 4, 1);
-  if (!area) {
+  uint8_t *p[4];
+  if (!memTranslate(vm->mem, addr, 4, p, 1)) {
     if (mapped)
       *mapped = 0;
     return 0xFFFFFFFF;
   }
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
   if (mapped)
     *mapped = 1;
-  return (uint32_t)bufBasePtr[0] + ((uint32_t)bufBasePtr[1] << 8) +
-      ((uint32_t)bufBasePtr[2] << 16) + ((uint32_t)bufBasePtr[3] << 24);
+  return (uint32_t)*p[0] + ((uint32_t)*p[1] << 8) + ((uint32_t)*p[2] << 16) +
+      ((uint32_t)*p[3] << 24);
 }
 
 
-t_memError memWrite8(t_memAddress addr, uint8_t in)
+t_memError memWrite8(t_vm *vm, t_memAddress addr, uint8_t in)
 {
-  t_memArea *area = memFindArea(addr, 1, 0);
-  if (!area)
+  uint8_t *p[1];
+  uint8_t *fast = memTranslateFast(vm->mem, addr, 1);
+  if (fast) {
+    fast[0] = in;
+    return MEM_NO_ERROR;
+  }
+  if (!memTranslate(vm->mem, addr, 1, p, 0))
     return MEM_MAPPING_ERROR;
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
-  bufBasePtr[0] = in;
+  *p[0] = in;
   return MEM_NO_ERROR;
 }
 
-t_memError memWrite16(t_memAddress addr, uint16_t in)
+t_memError memWrite16(t_vm *vm, t_memAddress addr, uint16_t in)
 {
-  t_memArea *area = memFindArea(addr, 2, 0);
-  if (!area)
+  uint8_t *p[2];
+  uint8_t *fast = memTranslateFast(vm->mem, addr, 2);
+  if (fast) {
+    fast[0] = (uint8_t)(in & 0xFF);
+    fast[1] = (uint8_t)((in >> 8) & 0xFF);
+    return MEM_NO_ERROR;
+  }
+  if (!memTranslate(vm->mem, addr, 2, p, 0))
     return MEM_MAPPING_ERROR;
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
-  bufBasePtr[0] = (uint8_t)(in & 0xFF);
-  bufBasePtr[1] = (uint8_t)((in >> 8) & 0xFF);
+  *p[0] = (uint8_t)(in & 0xFF);
+  *p[1] = (uint8_t)((in >> 8) & 0xFF);
   return MEM_NO_ERROR;
 }
 
-t_memError memWrite32(t_memAddress addr, uint32_t in)
+t_memError memWrite32(t_vm *vm, t_memAddress addr, uint32_t in)
 {
-  t_memArea *area = memFindArea(addr, 4, 0);
-  if (!area)
+  uint8_t *p[4];
+  uint8_t *fast = memTranslateFast(vm->mem, addr, 4);
+  if (fast) {
+    fast[0] = (uint8_t)(in & 0xFF);
+    fast[1] = (uint8_t)((in >> 8) & 0xFF);
+    fast[2] = (uint8_t)((in >> 16) & 0xFF);
+    fast[3] = (uint8_t)((in >> 24) & 0xFF);
+    return MEM_NO_ERROR;
+  }
+  if (!memTranslate(vm->mem, addr, 4, p, 0))
     return MEM_MAPPING_ERROR;
-  uint8_t *bufBasePtr = area->buffer + (size_t)(addr - area->baseAddress);
-  bufBasePtr[0] = (uint8_t)(in & 0xFF);
-  bufBasePtr[1] = (uint8_t)((in >> 8) & 0xFF);
-  bufBasePtr[2] = (uint8_t)((in >> 16) & 0xFF);
-  bufBasePtr[3] = (uint8_t)((in >> 24) & 0xFF);
+  *p[0] = (uint8_t)(in & 0xFF);
+  *p[1] = (uint8_t)((in >> 8) & 0xFF);
+  *p[2] = (uint8_t)((in >> 16) & 0xFF);
+  *p[3] = (uint8_t)((in >> 24) & 0xFF);
+  return MEM_NO_ERROR;
+}
+
+/* Copies a range of guest memory from or to buf, page by page */
+static t_memError memCopyBlock(t_mem *mem, t_memAddress addr, t_memSize size,
+    uint8_t *buf, bool write)
+{
+  while (size > 0) {
+    t_memAddress offs = addr & MEM_PAGE_MASK;
+    t_memSize len = MEM_PAGE_SIZE - offs;
+    if (len > size)
+      len = size;
+    t_memPage *page = memGetPage(mem, addr);
+    if (!page)
+      return MEM_MAPPING_ERROR;
+    for (t_memSize i = 0; page->mappedBytes && i < len; i++) {
+      if (!memIsByteMapped(page, offs + i))
+        return MEM_MAPPING_ERROR;
+    }
+    if (write)
+      memcpy(page->data + offs, buf, len);
+    else
+      memcpy(buf, page->data + offs, len);
+    addr += len;
+    buf += len;
+    size -= len;
+  }
   return MEM_NO_ERROR;
 }
 
+t_memError memDebugReadBlock(
+    t_vm *vm, t_memAddress addr, t_memSize size, void *out)
+{
+  return memCopyBlock(vm->mem, addr, size, out, false);
+}
+
+t_memError memDebugWriteBlock(
+    t_vm *vm, t_memAddress addr, t_memSize size, const void *in)
+{
+  return memCopyBlock(vm->mem, addr, size, (uint8_t *)in, true);
+}
+
+t_memAddress memGetFirstUsed(t_vm *vm, t_memAddress base, t_memSize extent)
+{
+  t_mem *mem = vm->mem;
+  uint64_t end = (uint64_t)base + extent;
+  uint64_t addr = base;
+  while (addr < end) {
+    uint64_t next = (addr & ~(uint64_t)MEM_PAGE_MASK) + MEM_PAGE_SIZE;
+    t_memPage *page = memGetPage(mem, (t_memAddress)addr);
+    if (!page) {
+      addr = next;
+      continue;
+    }
+    /* consecutive pages are usually backed by consecutive host memory, and
+     * they are checked at once */
+    uint8_t *data = page->data + (addr & MEM_PAGE_MASK);
+    while (next < end) {
+      t_memPage *nextPage = memGetPage(mem, (t_memAddress)next);
+      if (!nextPage || nextPage->data != data + (next - addr))
+        break;
+      next += MEM_PAGE_SIZE;
+    }
+    if (next > end)
+      next = end;
+    size_t offs = memFirstResident(data, (size_t)(next - addr));
+    if (offs < next - addr)
+      return (t_memAddress)(addr + offs);
+    addr = next;
+  }
+  return (t_memAddress)end;
+}
+
+#endif
+
 
-t_memAddress memGetLastFaultAddress(void)
+t_memAddress memGetLastFaultAddress(t_vm *vm)
 {
-  return memLastFaultAddress;
+  return vm->mem->lastFaultAddress;
+}
+
+
+uint64_t memGetMappedSize(t_vm *vm)
+{
+  return vm->mem->mappedSize;
+}
+
+
+bool memGetArea(
+    t_vm *vm, unsigned index, t_memAddress *base, t_memSize *extent)
+{
+  t_memArea *area = vm->mem->areas;
+  for (unsigned i = 0; area && i < index; i++)
+    area = area->next;
+  if (!area)
+    return false;
+  *base = area->baseAddress;
+  *extent = area->extent;
+  return true;
 }
@@ -1,8 +1,11 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include "isa.h"
+#include "vm.h"
 
 typedef t_isaUXSize t_memAddress;
 typedef t_memAddress t_memSize;
@@ -15,20 +18,57 @@ enum {
   MEM_MAPPING_ERROR = -3,
 };
 
-t_memError memMapArea(t_memAddress base, t_memSize extent, uint8_t **outBuffer);
+/* Called by vmNew() and vmFree() */
+bool memCreate(t_vm *vm);
+void memDestroy(t_vm *vm);
 
-t_memError memRead8(t_memAddress addr, uint8_t *out);
-t_memError memRead16(t_memAddress addr, uint16_t *out);
-t_memError memRead32(t_memAddress addr, uint32_t *out);
+t_memError memMapArea(t_vm *vm, t_memAddress base, t_memSize extent);
+/* Maps an area initialized with fileSize bytes read from a file. Where
+ * possible the file is mapped copy-on-write instead of being copied. */
+t_memError memMapFileArea(t_vm *vm, t_memAddress base, t_memSize extent,
+    int fd, off_t offset, t_memSize fileSize);
 
-uint8_t memDebugRead8(t_memAddress addr, int *mapped);
-uint16_t memDebugRead16(t_memAddress addr, int *mapped);
-uint32_t memDebugRead32(t_memAddress addr, int *mapped);
+t_memError memRead8(t_vm *vm, t_memAddress addr, uint8_t *out);
+t_memError memRead16(t_vm *vm, t_memAddress addr, uint16_t *out);
+t_memError memRead32(t_vm *vm, t_memAddress addr, uint32_t *out);
 
-t_memError memWrite8(t_memAddress addr, uint8_t in);
-t_memError memWrite16(t_memAddress addr, uint16_t in);
-t_memError memWrite32(t_memAddress addr, uint32_t in);
+uint8_t memDebugRead8(t_vm *vm, t_memAddress addr, int *mapped);
+uint16_t memDebugRead16(t_vm *vm, t_memAddress addr, int *mapped);
+uint32_t memDebugRead32(t_vm *vm, t_memAddress addr, int *mapped);
+/* Copy a range of guest memory, which must be entirely mapped, without
+ * recording faults */
+t_memError memDebugReadBlock(
+    t_vm *vm, t_memAddress addr, t_memSize size, void *out);
+t_memError memDebugWriteBlock(
+    t_vm *vm, t_memAddress addr, t_memSize size, const void *in);
 
-t_memAddress memGetLastFaultAddress(void);
+/* Returns the lowest address of a mapped range whose host memory has been
+ * accessed, or base + extent if none was. The host allocates memory on the
+ * first access, so this tells which parts of large areas are used, at the
+ * granularity of host pages. This is only a hint: the pages which the host
+ * swapped out or evicted look unused. */
+t_memAddress memGetFirstUsed(t_vm *vm, t_memAddress base, t_memSize extent);
+
+t_memError memWrite8(t_vm *vm, t_memAddress addr, uint8_t in);
+t_memError memWrite16(t_vm *vm, t_memAddress addr, uint16_t in);
+t_memError memWrite32(t_vm *vm, t_memAddress addr, uint32_t in);
+
+t_memAddress memGetLastFaultAddress(t_vm *vm);
+uint64_t memGetMappedSize(t_vm *vm);
+/* Returns the index-th mapped area in address order, or false if there are
+ * fewer areas */
+bool memGetArea(
+    t_vm *vm, unsigned index, t_memAddress *base, t_memSize *extent);
+
+#ifdef MEM_FLAT_ADDRESS_SPACE
+#include <setjmp.h>
+
+/* Sets where to jump to when an access of the VM faults on the calling
+ * thread. Memory accesses made while no recovery point is set must not
+ * fault. */
+void memSetFaultRecovery(t_vm *vm, sigjmp_buf *recovery);
+/* Host address of guest address zero */
+uint8_t *memGetHostBase(t_vm *vm);
+#endif
 
 #endif
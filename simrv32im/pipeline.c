@@ -0,0 +1,230 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "pipeline.h"
+#include "cpu.h"
+#include "cache.h"
+#include "bpred.h"
+#include "isa.h"
+
+
+#define PIPE_TOP_PC_COUNT 20
+/* cycles before the first instruction reaches WB */
+#define PIPE_FILL_CYCLES 4
+
+typedef int t_pipeStall;
+enum {
+  PIPE_STALL_LOAD_USE,
+  PIPE_STALL_MUL_DIV,
+  PIPE_STALL_BRANCH,
+  PIPE_STALL_FETCH, /* instruction cache misses */
+  PIPE_STALL_DATA,  /* data cache misses */
+  PIPE_STALL_COUNT
+};
+
+static const char *pipeStallNames[PIPE_STALL_COUNT] = {
+    "load-use", "mul/div", "branch", "fetch", "data"};
+
+t_pipeConfig pipeConfig;
+uint64_t pipeCycles;
+uint64_t pipeInstructions;
+uint64_t pipeStalls[PIPE_STALL_COUNT];
+/* destination of the previous instruction if it was a load */
+t_cpuRegID pipeLoadDest = CPU_REG_ZERO;
+/* Per-instruction stall cycles of the code area, indexed by
+ * (pc - base) >> 2 */
+/* VM the model is attached to */
+t_vm *pipeVM;
+t_memAddress pipePCBase;
+uint32_t pipePCCount;
+uint64_t *pipePCStalls[PIPE_STALL_COUNT];
+
+
+void pipeDefaultConfig(t_pipeConfig *out)
+{
+  out->mulLatency = 3;
+  out->divLatency = 34;
+  out->branchPenalty = 2;
+  out->l2Latency = 10;
+  out->memLatency = 100;
+  out->predictor = false;
+}
+
+bool pipeParseConfig(const char *str, t_pipeConfig *out)
+{
+  static const struct {
+    const char *key;
+    size_t offset;
+  } keys[] = {
+      {"mul=", offsetof(t_pipeConfig, mulLatency)},
+      {"div=", offsetof(t_pipeConfig, divLatency)},
+      {"branch=", offsetof(t_pipeConfig, branchPenalty)},
+      {"l2=", offsetof(t_pipeConfig, l2Latency)},
+      {"mem=", offsetof(t_pipeConfig, memLatency)}};
+
+  while (*str != '\0') {
+    int k;
+    for (k = 0; k < 5; k++) {
+      if (strncmp(str, keys[k].key, strlen(keys[k].key)) == 0)
+        break;
+    }
+    if (k == 5)
+      return false;
+    str += strlen(keys[k].key);
+
+    char *end;
+    unsigned long value = strtoul(str, &end, 0);
+    if (end == str || value > 10000)
+      return false;
+    *(uint32_t *)((char *)out + keys[k].offset) = (uint32_t)value;
+    str = end;
+    if (*str == ',')
+      str++;
+    else if (*str != '\0')
+      return false;
+  }
+  return out->mulLatency > 0 && out->divLatency > 0;
+}
+
+
+static uint32_t pipeMemoryPenalty(t_cacheLevel level)
+{
+  if (level == CACHE_LEVEL_L2)
+    return pipeConfig.l2Latency;
+  if (level == CACHE_LEVEL_MEMORY)
+    return pipeConfig.memLatency;
+  return 0;
+}
+
+static void pipeModelRetire(t_vm *vm, const t_cpuRetireInfo *info)
+{
+  uint32_t stalls[PIPE_STALL_COUNT] = {0};
+  t_cacheLevel fetchLevel, dataLevel;
+  cacheModelGetLastLevels(&fetchLevel, &dataLevel);
+
+  stalls[PIPE_STALL_FETCH] = pipeMemoryPenalty(fetchLevel);
+  stalls[PIPE_STALL_DATA] = pipeMemoryPenalty(dataLevel);
+
+  /* loaded values are forwarded from the end of MEM */
+  if (pipeLoadDest != CPU_REG_ZERO &&
+      (info->rs1 == pipeLoadDest || info->rs2 == pipeLoadDest))
+    stalls[PIPE_STALL_LOAD_USE] = 1;
+  pipeLoadDest = info->instClass == CPU_CLASS_LOAD ? info->rd : CPU_REG_ZERO;
+
+  /* the multiplier and the divider are not pipelined */
+  if (info->instClass == CPU_CLASS_MUL)
+    stalls[PIPE_STALL_MUL_DIV] = pipeConfig.mulLatency - 1;
+  else if (info->instClass == CPU_CLASS_DIV)
+    stalls[PIPE_STALL_MUL_DIV] = pipeConfig.divLatency - 1;
+
+  /* without a predictor, fetch continues sequentially; JAL is redirected
+   * from ID and branches and JALR from EX */
+  if (pipeConfig.predictor) {
+    if (bpModelLastMispredicted())
+      stalls[PIPE_STALL_BRANCH] = pipeConfig.branchPenalty;
+  } else if (info->instClass == CPU_CLASS_JAL) {
+    stalls[PIPE_STALL_BRANCH] = 1;
+  } else if ((info->instClass == CPU_CLASS_BRANCH && info->taken) ||
+      info->instClass == CPU_CLASS_JALR) {
+    stalls[PIPE_STALL_BRANCH] = pipeConfig.branchPenalty;
+  }
+
+  uint32_t index = (info->pc - pipePCBase) >> 2;
+  bool inCode = info->pc - pipePCBase < pipePCCount * 4;
+  pipeInstructions++;
+  pipeCycles++;
+  for (int s = 0; s < PIPE_STALL_COUNT; s++) {
+    pipeCycles += stalls[s];
+    pipeStalls[s] += stalls[s];
+    if (inCode)
+      pipePCStalls[s][index] += stalls[s];
+  }
+}
+
+static uint64_t pipeGetCycles(t_vm *vm)
+{
+  return pipeCycles;
+}
+
+static uint64_t pipeGetStallCycles(t_vm *vm)
+{
+  return pipeCycles - pipeInstructions - PIPE_FILL_CYCLES;
+}
+
+bool pipeModelInit(t_vm *vm, const t_pipeConfig *config)
+{
+  if (pipeVM && pipeVM != vm)
+    return false;
+  pipeVM = vm;
+  pipeConfig = *config;
+  pipeCycles = PIPE_FILL_CYCLES;
+
+  t_memSize codeSize;
+  cpuGetCodeArea(pipeVM, &pipePCBase, &codeSize);
+  pipePCCount = codeSize / 4;
+  for (int s = 0; s < PIPE_STALL_COUNT; s++) {
+    pipePCStalls[s] = calloc(pipePCCount + 1, sizeof(uint64_t));
+    if (pipePCStalls[s] == NULL)
+      return false;
+  }
+  cpuSetCounterSource(pipeVM, ISA_CSR_CYCLE, pipeGetCycles);
+  cpuSetCounterSource(pipeVM, ISA_CSR_HPMCOUNTER3 + 4, pipeGetStallCycles);
+  return cpuAddObserver(pipeVM, pipeModelRetire);
+}
+
+
+static uint64_t pipeTotalStalls(uint32_t index)
+{
+  uint64_t res = 0;
+  for (int s = 0; s < PIPE_STALL_COUNT; s++)
+    res += pipePCStalls[s][index];
+  return res;
+}
+
+static int pipeComparePCs(const void *a, const void *b)
+{
+  uint32_t ia = *(const uint32_t *)a, ib = *(const uint32_t *)b;
+  uint64_t sa = pipeTotalStalls(ia), sb = pipeTotalStalls(ib);
+  if (sa != sb)
+    return sa < sb ? 1 : -1;
+  return ia < ib ? -1 : 1;
+}
+
+void pipeModelPrint(FILE *fp)
+{
+  fprintf(fp, "Pipeline timing:\n");
+  fprintf(fp, "  %-18s %14" PRIu64 "\n", "cycles", pipeCycles);
+  fprintf(fp, "  %-18s %14" PRIu64 "\n", "instructions", pipeInstructions);
+  fprintf(fp, "  %-18s %14.3f\n", "CPI",
+      pipeInstructions ? (double)pipeCycles / (double)pipeInstructions : 0.0);
+  fprintf(fp, "  stall cycles\n");
+  for (int s = 0; s < PIPE_STALL_COUNT; s++)
+    fprintf(fp, "    %-16s %14" PRIu64 "\n", pipeStallNames[s], pipeStalls[s]);
+
+  uint32_t *order = malloc(sizeof(uint32_t) * (pipePCCount + 1));
+  if (order == NULL)
+    return;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < pipePCCount; i++) {
+    if (pipeTotalStalls(i) > 0)
+      order[n++] = i;
+  }
+  qsort(order, n, sizeof(uint32_t), pipeComparePCs);
+
+  fprintf(fp, "  Instructions with the most stall cycles:\n    ");
+  for (int s = 0; s < PIPE_STALL_COUNT; s++)
+    fprintf(fp, "%10s ", pipeStallNames[s]);
+  fprintf(fp, " %-9s  %s\n", "address", "instruction");
+  for (uint32_t j = 0; j < n && j < PIPE_TOP_PC_COUNT; j++) {
+    char buffer[80];
+    uint32_t i = order[j];
+    t_memAddress pc = pipePCBase + i * 4;
+    isaDisassemble(memDebugRead32(pipeVM, pc, NULL), buffer, 80);
+    fprintf(fp, "    ");
+    for (int s = 0; s < PIPE_STALL_COUNT; s++)
+      fprintf(fp, "%10" PRIu64 " ", pipePCStalls[s][i]);
+    fprintf(fp, " %08" PRIx32 ":  %s\n", pc, buffer);
+  }
+  free(order);
+}
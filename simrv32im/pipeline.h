@@ -0,0 +1,31 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "vm.h"
+
+typedef struct {
+  uint32_t mulLatency; /* cycles spent in EX */
+  uint32_t divLatency;
+  uint32_t branchPenalty; /* cycles lost by a mispredicted branch */
+  uint32_t l2Latency; /* extra cycles of an access served by the L2 cache */
+  uint32_t memLatency; /* extra cycles of an access served by the memory */
+  bool predictor; /* a branch predictor model is attached */
+} t_pipeConfig;
+
+void pipeDefaultConfig(t_pipeConfig *out);
+/* Parses a comma separated list of KEY=VALUE pairs, where KEY is mul, div,
+ * branch, l2 or mem */
+bool pipeParseConfig(const char *str, t_pipeConfig *out);
+
+/* Attaches a five-stage in-order pipeline model to the CPU. It uses the
+ * outcome of the cache and branch predictor models, so it must be attached
+ * after them. The cycle counter read by the program becomes the cycles of
+ * the pipeline, and the stall cycles are exposed as hpmcounter7. Returns
+ * false if the model is attached to another VM. */
+bool pipeModelInit(t_vm *vm, const t_pipeConfig *config);
+void pipeModelPrint(FILE *fp);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "profile.h"
+#include "isa.h"
+#include "memory.h"
+#include "loader.h"
+
+/* The binary profile is a sequence of little-endian fields:
+ *   magic "RVPF", version, code area base, number of entries,
+ *   then for each executed instruction: pc (32 bit), count (64 bit),
+ *   taken (64 bit). */
+#define PROF_MAGIC "RVPF"
+#define PROF_VERSION 1
+
+
+static void profPutU32(FILE *fp, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    fputc((v >> (8 * i)) & 0xFF, fp);
+}
+
+static void profPutU64(FILE *fp, uint64_t v)
+{
+  for (int i = 0; i < 8; i++)
+    fputc((int)((v >> (8 * i)) & 0xFF), fp);
+}
+
+static t_profError profWriteData(const char *path, const t_cpuProfile *prof)
+{
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL)
+    return PROF_FILE_ERROR;
+
+  uint32_t entries = 0;
+  for (uint32_t i = 0; i < prof->length; i++) {
+    if (prof->counts[i] > 0)
+      entries++;
+  }
+  fputs(PROF_MAGIC, fp);
+  profPutU32(fp, PROF_VERSION);
+  profPutU32(fp, prof->base);
+  profPutU32(fp, entries);
+  for (uint32_t i = 0; i < prof->length; i++) {
+    if (prof->counts[i] == 0)
+      continue;
+    profPutU32(fp, prof->base + i * 4);
+    profPutU64(fp, prof->counts[i]);
+    profPutU64(fp, prof->taken[i]);
+  }
+
+  if (fclose(fp) != 0)
+    return PROF_FILE_ERROR;
+  return PROF_NO_ERROR;
+}
+
+
+static const t_cpuProfile *profSortKey;
+
+static int profCompareIndexes(const void *a, const void *b)
+{
+  uint64_t ca = profSortKey->counts[*(const uint32_t *)a];
+  uint64_t cb = profSortKey->counts[*(const uint32_t *)b];
+  if (ca != cb)
+    return ca < cb ? 1 : -1;
+  return *(const uint32_t *)a < *(const uint32_t *)b ? -1 : 1;
+}
+
+static void profPrintInst(t_vm *vm, FILE *fp, const t_cpuProfile *prof,
+    uint32_t i, uint64_t total, bool percentage)
+{
+  char buffer[80];
+  t_memAddress pc = prof->base + i * 4;
+  uint32_t inst = memDebugRead32(vm, pc, NULL);
+  isaDisassemble(inst, buffer, 80);
+
+  fprintf(fp, "%12" PRIu64, prof->counts[i]);
+  if (percentage)
+    fprintf(fp, " %6.2f%%",
+        total ? 100.0 * (double)prof->counts[i] / (double)total : 0.0);
+  uint32_t opcode = ISA_INST_OPCODE(inst);
+  if (opcode == ISA_INST_OPCODE_BRANCH && prof->counts[i] > 0)
+    fprintf(fp, " %12" PRIu64, prof->taken[i]);
+  else
+    fprintf(fp, " %12s", "");
+  fprintf(fp, "  %08" PRIx32 ":  %08" PRIx32 "  %s\n", pc, inst, buffer);
+}
+
+typedef struct {
+  t_ldrSourceLine source;
+  uint64_t count;
+} t_profLineCount;
+
+static int profCompareLines(const void *a, const void *b)
+{
+  const t_profLineCount *la = a, *lb = b;
+  int res = strcmp(la->source.file, lb->source.file);
+  if (res != 0)
+    return res;
+  if (la->source.line != lb->source.line)
+    return la->source.line < lb->source.line ? -1 : 1;
+  return 0;
+}
+
+static int profCompareLineCounts(const void *a, const void *b)
+{
+  const t_profLineCount *la = a, *lb = b;
+  if (la->count != lb->count)
+    return la->count < lb->count ? 1 : -1;
+  return profCompareLines(a, b);
+}
+
+/* Prints the instruction counts aggregated by source line, if the executable
+ * has a line table */
+static void profPrintSourceLines(
+    t_vm *vm, FILE *fp, const t_cpuProfile *prof, uint64_t total)
+{
+  t_profLineCount *lines = malloc(sizeof(t_profLineCount) * prof->length);
+  if (lines == NULL)
+    return;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < prof->length; i++) {
+    if (prof->counts[i] == 0 ||
+        !ldrGetSourceLine(vm, prof->base + i * 4, &lines[n].source))
+      continue;
+    lines[n++].count = prof->counts[i];
+  }
+
+  if (n > 0) {
+    qsort(lines, n, sizeof(t_profLineCount), profCompareLines);
+    uint32_t merged = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      if (merged > 0 && profCompareLines(&lines[merged - 1], &lines[i]) == 0)
+        lines[merged - 1].count += lines[i].count;
+      else
+        lines[merged++] = lines[i];
+    }
+    qsort(lines, merged, sizeof(t_profLineCount), profCompareLineCounts);
+
+    fprintf(fp, "\nSource lines:\n");
+    fprintf(fp, "%12s %7s  %s\n", "count", "%", "line");
+    for (uint32_t i = 0; i < merged; i++)
+      fprintf(fp, "%12" PRIu64 " %6.2f%%  %s:%" PRIu32 "\n", lines[i].count,
+          total ? 100.0 * (double)lines[i].count / (double)total : 0.0,
+          lines[i].source.file, lines[i].source.line);
+  }
+  free(lines);
+}
+
+static t_profError profWriteReport(t_vm *vm, const char *path,
+    const t_cpuProfile *prof, unsigned topCount)
+{
+  uint64_t total = 0;
+  uint32_t executed = 0;
+  for (uint32_t i = 0; i < prof->length; i++) {
+    total += prof->counts[i];
+    if (prof->counts[i] > 0)
+      executed++;
+  }
+
+  uint32_t *order = malloc(sizeof(uint32_t) * (executed ? executed : 1));
+  if (order == NULL)
+    return PROF_FILE_ERROR;
+  for (uint32_t i = 0, j = 0; i < prof->length; i++) {
+    if (prof->counts[i] > 0)
+      order[j++] = i;
+  }
+  profSortKey = prof;
+  qsort(order, executed, sizeof(uint32_t), profCompareIndexes);
+
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    free(order);
+    return PROF_FILE_ERROR;
+  }
+
+  fprintf(fp, "Profile of %" PRIu64 " instructions in the code area\n\n",
+      total);
+  fprintf(fp, "Hottest instructions:\n");
+  fprintf(fp, "%12s %7s %12s  %-9s  %-8s  %s\n", "count", "%", "taken",
+      "address", "word", "instruction");
+  for (uint32_t j = 0; j < executed && j < topCount; j++)
+    profPrintInst(vm, fp, prof, order[j], total, true);
+
+  profPrintSourceLines(vm, fp, prof, total);
+
+  fprintf(fp, "\nAnnotated listing:\n");
+  fprintf(fp, "%12s %12s  %-9s  %-8s  %s\n", "count", "taken", "address",
+      "word", "instruction");
+  t_ldrSourceLine lastLine = {NULL, 0};
+  for (uint32_t i = 0; i < prof->length; i++) {
+    t_ldrSourceLine line;
+    if (ldrGetSourceLine(vm, prof->base + i * 4, &line) &&
+        (line.file != lastLine.file || line.line != lastLine.line)) {
+      fprintf(fp, "%s:%" PRIu32 ":\n", line.file, line.line);
+      lastLine = line;
+    }
+    profPrintInst(vm, fp, prof, i, total, false);
+  }
+
+  free(order);
+  if (fclose(fp) != 0)
+    return PROF_FILE_ERROR;
+  return PROF_NO_ERROR;
+}
+
+
+t_profError profWrite(
+    t_vm *vm, const char *path, const char *reportPath, unsigned topCount)
+{
+  t_cpuProfile prof;
+  if (!cpuGetProfile(vm, &prof))
+    return PROF_NOT_ENABLED;
+
+  t_profError err = profWriteData(path, &prof);
+  if (err != PROF_NO_ERROR)
+    return err;
+  return profWriteReport(vm, reportPath, &prof, topCount);
+}
@@ -0,0 +1,22 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "cpu.h"
+
+#define PROF_DEFAULT_TOP_COUNT 20
+
+typedef int t_profError;
+enum {
+  PROF_NO_ERROR = 0,
+  PROF_NOT_ENABLED = -1,
+  PROF_FILE_ERROR = -2
+};
+
+/* Writes the per-instruction profile collected by the CPU to the binary file
+ * at path, and a text report with the topCount hottest instructions and an
+ * annotated listing of the code area to the file at reportPath. */
+t_profError profWrite(
+    t_vm *vm, const char *path, const char *reportPath, unsigned topCount);
+
+#endif
@@ -0,0 +1,551 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "simpoint.h"
+#include "cpu.h"
+#include "isa.h"
+
+/* The intervals are compared on their instruction frequency vectors, i.e.
+ * how many times each instruction of the code area was executed, normalized
+ * by the length of the interval. As in SimPoint the vectors are reduced to
+ * a few dimensions with a random projection, then grouped with k-means. */
+#define SP_DIMENSIONS 15
+#define SP_MAX_ITERATIONS 100
+#define SP_RESTARTS 5
+
+typedef struct {
+  double v[SP_DIMENSIONS];
+  double weight; /* instructions in the interval */
+  unsigned cluster;
+} t_spPoint;
+
+t_vm *spBBVVM;
+FILE *spBBVFile;
+uint64_t *spBBVLast;
+
+int spSampleFd = -1;
+t_spSample spSampleBase;
+
+
+/*
+ * Basic block vectors
+ */
+
+t_spError spBBVOpen(t_vm *vm, const char *path, uint64_t intervalSize)
+{
+  if (intervalSize == 0)
+    return SP_INVALID_FORMAT;
+  if (spBBVFile != NULL)
+    return SP_IN_USE;
+  spBBVFile = fopen(path, "w");
+  if (spBBVFile == NULL)
+    return SP_FILE_ERROR;
+  spBBVVM = vm;
+  cpuSetProfileEnabled(vm, true);
+  return SP_NO_ERROR;
+}
+
+void spBBVWriteInterval(void)
+{
+  t_cpuProfile prof;
+  if (spBBVFile == NULL || !cpuGetProfile(spBBVVM, &prof))
+    return;
+  if (spBBVLast == NULL) {
+    spBBVLast = calloc(prof.length + 1, sizeof(uint64_t));
+    if (spBBVLast == NULL)
+      return;
+  }
+
+  fputc('T', spBBVFile);
+  for (uint32_t i = 0; i < prof.length; i++) {
+    uint64_t count = prof.counts[i] - spBBVLast[i];
+    if (count == 0)
+      continue;
+    fprintf(spBBVFile, ":%" PRIu32 ":%" PRIu64 " ", i + 1, count);
+    spBBVLast[i] = prof.counts[i];
+  }
+  fputc('\n', spBBVFile);
+}
+
+t_spError spBBVClose(void)
+{
+  if (spBBVFile == NULL)
+    return SP_NO_ERROR;
+  int res = fclose(spBBVFile);
+  spBBVFile = NULL;
+  free(spBBVLast);
+  spBBVLast = NULL;
+  return res == 0 ? SP_NO_ERROR : SP_FILE_ERROR;
+}
+
+
+/*
+ * Clustering
+ */
+
+/* Element of the random projection matrix, uniformly distributed in
+ * [-1, 1] and computed from its coordinates so that it is not stored */
+static double spProjection(uint32_t id, int dim)
+{
+  uint32_t x = id * 0x9E3779B1u + (uint32_t)dim * 0x85EBCA77u;
+  x ^= x >> 15;
+  x *= 0x2C1B3C6Du;
+  x ^= x >> 12;
+  x *= 0x297A2D39u;
+  x ^= x >> 15;
+  return (double)x / (double)UINT32_MAX * 2.0 - 1.0;
+}
+
+static t_spError spReadBBV(const char *path, t_spPoint **out, unsigned *count)
+{
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+    return SP_FILE_ERROR;
+
+  t_spPoint *points = NULL;
+  unsigned n = 0, capacity = 0;
+  t_spError err = SP_NO_ERROR;
+  int c;
+  while (err == SP_NO_ERROR && (c = fgetc(fp)) != EOF) {
+    if (c == 'T') {
+      if (n == capacity) {
+        capacity = capacity ? capacity * 2 : 256;
+        t_spPoint *tmp = realloc(points, sizeof(t_spPoint) * capacity);
+        if (tmp == NULL) {
+          err = SP_OUT_OF_MEMORY;
+          break;
+        }
+        points = tmp;
+      }
+      memset(&points[n++], 0, sizeof(t_spPoint));
+    } else if (c == ':') {
+      uint32_t id;
+      uint64_t freq;
+      if (n == 0 || fscanf(fp, "%" SCNu32 ":%" SCNu64, &id, &freq) != 2) {
+        err = SP_INVALID_FORMAT;
+        break;
+      }
+      t_spPoint *p = &points[n - 1];
+      p->weight += (double)freq;
+      for (int d = 0; d < SP_DIMENSIONS; d++)
+        p->v[d] += (double)freq * spProjection(id, d);
+    } else if (c != ' ' && c != '\n' && c != '\r') {
+      err = SP_INVALID_FORMAT;
+    }
+  }
+  fclose(fp);
+  if (err != SP_NO_ERROR) {
+    free(points);
+    return err;
+  }
+
+  for (unsigned i = 0; i < n; i++) {
+    for (int d = 0; d < SP_DIMENSIONS && points[i].weight > 0; d++)
+      points[i].v[d] /= points[i].weight;
+  }
+  *out = points;
+  *count = n;
+  return SP_NO_ERROR;
+}
+
+static double spDistance2(const double *a, const double *b)
+{
+  double res = 0;
+  for (int d = 0; d < SP_DIMENSIONS; d++)
+    res += (a[d] - b[d]) * (a[d] - b[d]);
+  return res;
+}
+
+static double spRandom(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return (double)x / ((double)UINT32_MAX + 1.0);
+}
+
+/* Picks the initial centers with the k-means++ method, with the
+ * probabilities also proportional to the weights of the points */
+static void spInitCenters(const t_spPoint *points, unsigned n, unsigned k,
+    double *centers, double *dist, uint32_t *seed)
+{
+  for (unsigned c = 0; c < k; c++) {
+    double total = 0;
+    for (unsigned i = 0; i < n; i++)
+      total += points[i].weight * (c == 0 ? 1.0 : dist[i]);
+    double target = spRandom(seed) * total;
+    unsigned pick = 0;
+    for (unsigned i = 0; i < n; i++) {
+      double w = points[i].weight * (c == 0 ? 1.0 : dist[i]);
+      if (w > 0)
+        pick = i;
+      if (target < w)
+        break;
+      target -= w;
+    }
+    memcpy(&centers[c * SP_DIMENSIONS], points[pick].v, sizeof(points->v));
+    for (unsigned i = 0; i < n; i++) {
+      double d2 = spDistance2(points[i].v, &centers[c * SP_DIMENSIONS]);
+      if (c == 0 || d2 < dist[i])
+        dist[i] = d2;
+    }
+  }
+}
+
+/* Runs the k-means iterations and returns the weighted sum of the squared
+ * distances from the centers */
+static double spKMeans(t_spPoint *points, unsigned n, unsigned k,
+    double *centers, double *weights)
+{
+  double error = 0;
+  for (int iter = 0; iter < SP_MAX_ITERATIONS; iter++) {
+    bool changed = iter == 0;
+    error = 0;
+    for (unsigned i = 0; i < n; i++) {
+      unsigned best = 0;
+      double bestDist = INFINITY;
+      for (unsigned c = 0; c < k; c++) {
+        double d2 = spDistance2(points[i].v, &centers[c * SP_DIMENSIONS]);
+        if (d2 < bestDist) {
+          bestDist = d2;
+          best = c;
+        }
+      }
+      changed = changed || points[i].cluster != best;
+      points[i].cluster = best;
+      error += points[i].weight * bestDist;
+    }
+    if (!changed)
+      break;
+
+    memset(weights, 0, sizeof(double) * k);
+    for (unsigned i = 0; i < n; i++)
+      weights[points[i].cluster] += points[i].weight;
+    for (unsigned c = 0; c < k; c++) {
+      if (weights[c] > 0)
+        memset(&centers[c * SP_DIMENSIONS], 0, sizeof(points->v));
+    }
+    for (unsigned i = 0; i < n; i++) {
+      unsigned c = points[i].cluster;
+      for (int d = 0; d < SP_DIMENSIONS; d++)
+        centers[c * SP_DIMENSIONS + d] +=
+            points[i].v[d] * points[i].weight / weights[c];
+    }
+  }
+  return error;
+}
+
+static int spComparePoints(const void *a, const void *b)
+{
+  const t_spSimPoint *pa = a, *pb = b;
+  if (pa->interval != pb->interval)
+    return pa->interval < pb->interval ? -1 : 1;
+  return 0;
+}
+
+t_spError spCluster(const char *bbvPath, uint64_t intervalSize, unsigned k,
+    FILE *out)
+{
+  t_spPoint *all;
+  unsigned count;
+  t_spError err = spReadBBV(bbvPath, &all, &count);
+  if (err != SP_NO_ERROR)
+    return err;
+
+  /* empty intervals do not take part in the clustering, but keep their
+   * position in the numbering */
+  unsigned n = 0;
+  unsigned *index = malloc(sizeof(unsigned) * (count + 1));
+  t_spPoint *points = malloc(sizeof(t_spPoint) * (count + 1));
+  double *centers = malloc(sizeof(double) * SP_DIMENSIONS * (k + 1));
+  double *best = malloc(sizeof(double) * SP_DIMENSIONS * (k + 1));
+  double *weights = malloc(sizeof(double) * (k + 1));
+  double *dist = malloc(sizeof(double) * (count + 1));
+  t_spSimPoint *result = malloc(sizeof(t_spSimPoint) * (k + 1));
+  if (!index || !points || !centers || !best || !weights || !dist ||
+      !result) {
+    err = SP_OUT_OF_MEMORY;
+    goto end;
+  }
+  double total = 0;
+  for (unsigned i = 0; i < count; i++) {
+    if (all[i].weight <= 0)
+      continue;
+    index[n] = i;
+    points[n++] = all[i];
+    total += all[i].weight;
+  }
+  if (k > n)
+    k = n;
+
+  double bestError = INFINITY;
+  uint32_t seed = 0x12345678;
+  for (int r = 0; r < SP_RESTARTS && k > 0; r++) {
+    spInitCenters(points, n, k, centers, dist, &seed);
+    double error = spKMeans(points, n, k, centers, weights);
+    if (error < bestError) {
+      bestError = error;
+      memcpy(best, centers, sizeof(double) * SP_DIMENSIONS * k);
+    }
+  }
+
+  /* the representative of each cluster is its point nearest to the
+   * center */
+  unsigned found = 0;
+  for (unsigned c = 0; c < k; c++) {
+    double clusterWeight = 0, bestDist = INFINITY;
+    unsigned rep = 0;
+    for (unsigned i = 0; i < n; i++) {
+      double d2 = spDistance2(points[i].v, &best[c * SP_DIMENSIONS]);
+      unsigned nearest = 0;
+      double nearestDist = INFINITY;
+      for (unsigned j = 0; j < k; j++) {
+        double dj = spDistance2(points[i].v, &best[j * SP_DIMENSIONS]);
+        if (dj < nearestDist) {
+          nearestDist = dj;
+          nearest = j;
+        }
+      }
+      if (nearest != c)
+        continue;
+      clusterWeight += points[i].weight;
+      if (d2 < bestDist) {
+        bestDist = d2;
+        rep = i;
+      }
+    }
+    if (clusterWeight == 0)
+      continue;
+    result[found].interval = index[rep];
+    result[found++].weight = clusterWeight / total;
+  }
+  qsort(result, found, sizeof(t_spSimPoint), spComparePoints);
+
+  fprintf(out, "# interval %" PRIu64 "\n", intervalSize);
+  for (unsigned i = 0; i < found; i++)
+    fprintf(out, "%" PRIu64 " %.6f\n", result[i].interval, result[i].weight);
+
+end:
+  free(all);
+  free(index);
+  free(points);
+  free(centers);
+  free(best);
+  free(weights);
+  free(dist);
+  free(result);
+  return err;
+}
+
+
+t_spError spReadSimPoints(const char *path, t_spSimPoints *out)
+{
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+    return SP_FILE_ERROR;
+
+  unsigned capacity = 16;
+  out->count = 0;
+  out->points = malloc(sizeof(t_spSimPoint) * capacity);
+  if (out->points == NULL) {
+    fclose(fp);
+    return SP_OUT_OF_MEMORY;
+  }
+  t_spError err = SP_NO_ERROR;
+  if (fscanf(fp, "# interval %" SCNu64, &out->intervalSize) != 1 ||
+      out->intervalSize == 0)
+    err = SP_INVALID_FORMAT;
+
+  t_spSimPoint point;
+  while (err == SP_NO_ERROR) {
+    int res = fscanf(fp, "%" SCNu64 " %lf", &point.interval, &point.weight);
+    if (res == EOF)
+      break;
+    if (res != 2) {
+      err = SP_INVALID_FORMAT;
+      break;
+    }
+    if (out->count == capacity) {
+      capacity *= 2;
+      t_spSimPoint *tmp =
+          realloc(out->points, sizeof(t_spSimPoint) * capacity);
+      if (tmp == NULL) {
+        err = SP_OUT_OF_MEMORY;
+        break;
+      }
+      out->points = tmp;
+    }
+    out->points[out->count++] = point;
+  }
+  fclose(fp);
+  if (err == SP_NO_ERROR && out->count == 0)
+    err = SP_INVALID_FORMAT;
+  if (err != SP_NO_ERROR)
+    free(out->points);
+  return err;
+}
+
+char *spCheckpointName(const char *prefix, const t_spSimPoint *point)
+{
+  size_t size = strlen(prefix) + 22;
+  char *res = malloc(size);
+  if (res)
+    snprintf(res, size, "%s.%" PRIu64, prefix, point->interval);
+  return res;
+}
+
+
+/*
+ * Sampled simulation
+ */
+
+int spForkSamples(const t_spSimPoints *sp, unsigned jobs, t_spSample *out)
+{
+  pid_t *pids = calloc(sp->count, sizeof(pid_t));
+  int *fds = calloc(sp->count, sizeof(int));
+  unsigned next = 0, running = 0;
+
+  /* samples which fail are left empty */
+  memset(out, 0, sizeof(t_spSample) * sp->count);
+  if (!pids || !fds) {
+    free(pids);
+    free(fds);
+    return -1;
+  }
+  if (jobs == 0)
+    jobs = 1;
+
+  while (next < sp->count || running > 0) {
+    if (next < sp->count && running < jobs) {
+      int fd[2];
+      fflush(stdout);
+      fflush(stderr);
+      if (pipe(fd) != 0) {
+        next++;
+        continue;
+      }
+      pid_t pid = fork();
+      if (pid == 0) {
+        close(fd[0]);
+        free(pids);
+        free(fds);
+        spSampleFd = fd[1];
+        /* the output of the program is not interesting here */
+        if (freopen("/dev/null", "w", stdout) == NULL)
+          exit(1);
+        return (int)next;
+      }
+      close(fd[1]);
+      if (pid < 0) {
+        close(fd[0]);
+      } else {
+        pids[next] = pid;
+        fds[next] = fd[0];
+        running++;
+      }
+      next++;
+      continue;
+    }
+
+    pid_t pid = wait(NULL);
+    if (pid < 0)
+      break;
+    for (unsigned i = 0; i < next; i++) {
+      if (pids[i] != pid)
+        continue;
+      /* the sample fits in the pipe buffer, so it is already there */
+      if (read(fds[i], &out[i], sizeof(t_spSample)) != sizeof(t_spSample))
+        memset(&out[i], 0, sizeof(t_spSample));
+      close(fds[i]);
+      running--;
+    }
+  }
+
+  free(pids);
+  free(fds);
+  return -1;
+}
+
+
+static const uint32_t spCounterCSRs[SP_N_COUNTERS] = {ISA_CSR_INSTRET,
+    ISA_CSR_CYCLE, ISA_CSR_HPMCOUNTER3, ISA_CSR_HPMCOUNTER3 + 1,
+    ISA_CSR_HPMCOUNTER3 + 2, ISA_CSR_HPMCOUNTER3 + 3, ISA_CSR_HPMCOUNTER3 + 4};
+
+static void spReadCounters(t_vm *vm, t_spSample *out)
+{
+  for (int i = 0; i < SP_N_COUNTERS; i++) {
+    if (!cpuGetCounter(vm, spCounterCSRs[i], &out->counters[i]))
+      out->counters[i] = 0;
+  }
+}
+
+void spSampleBegin(t_vm *vm)
+{
+  spReadCounters(vm, &spSampleBase);
+}
+
+void spSampleEnd(t_vm *vm)
+{
+  t_spSample sample;
+  spReadCounters(vm, &sample);
+  for (int i = 0; i < SP_N_COUNTERS; i++)
+    sample.counters[i] -= spSampleBase.counters[i];
+  if (write(spSampleFd, &sample, sizeof(t_spSample)) != sizeof(t_spSample))
+    exit(1);
+  exit(0);
+}
+
+
+void spPrintEstimate(FILE *fp, const t_spSimPoints *sp,
+    const t_spSample *samples, const bool enabled[SP_N_COUNTERS])
+{
+  /* all the counters are reported per instruction, with a scale */
+  static const char *names[SP_N_COUNTERS] = {NULL, "CPI", "mispred/1k",
+      "L1I miss/1k", "L1D miss/1k", "L2 miss/1k", "stalls/inst"};
+  static const double scales[SP_N_COUNTERS] = {0, 1, 1000, 1000, 1000, 1000,
+      1};
+  double estimates[SP_N_COUNTERS] = {0};
+  double totalWeight = 0;
+
+  fprintf(fp, "Sampled simulation of %u simulation points of %" PRIu64
+      " instructions\n", sp->count, sp->intervalSize);
+  fprintf(fp, "  %12s %8s %12s", "interval", "weight", "instructions");
+  for (int c = 1; c < SP_N_COUNTERS; c++) {
+    if (enabled[c])
+      fprintf(fp, " %12s", names[c]);
+  }
+  fputc('\n', fp);
+
+  for (unsigned i = 0; i < sp->count; i++) {
+    const t_spSample *s = &samples[i];
+    uint64_t insts = s->counters[SP_COUNTER_INSTRET];
+    fprintf(fp, "  %12" PRIu64 " %8.4f %12" PRIu64, sp->points[i].interval,
+        sp->points[i].weight, insts);
+    if (insts == 0) {
+      fprintf(fp, "  (failed)\n");
+      continue;
+    }
+    totalWeight += sp->points[i].weight;
+    for (int c = 1; c < SP_N_COUNTERS; c++) {
+      if (!enabled[c])
+        continue;
+      double rate = (double)s->counters[c] / (double)insts * scales[c];
+      estimates[c] += sp->points[i].weight * rate;
+      fprintf(fp, " %12.4f", rate);
+    }
+    fputc('\n', fp);
+  }
+
+  fprintf(fp, "  %12s %8.4f %12s", "estimate", totalWeight, "");
+  for (int c = 1; c < SP_N_COUNTERS; c++) {
+    if (enabled[c])
+      fprintf(fp, " %12.4f",
+          totalWeight > 0 ? estimates[c] / totalWeight : 0.0);
+  }
+  fputc('\n', fp);
+}
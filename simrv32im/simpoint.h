@@ -0,0 +1,82 @@
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "vm.h"
+
+#define SP_DEFAULT_INTERVAL 1000000
+#define SP_DEFAULT_CLUSTERS 10
+
+typedef int t_spError;
+enum {
+  SP_NO_ERROR = 0,
+  SP_OUT_OF_MEMORY = -1,
+  SP_FILE_ERROR = -2,
+  SP_INVALID_FORMAT = -3,
+  SP_IN_USE = -4
+};
+
+/* Interval chosen to represent a cluster, and the fraction of the
+ * instructions of the program in the cluster */
+typedef struct {
+  uint64_t interval;
+  double weight;
+} t_spSimPoint;
+
+typedef struct {
+  uint64_t intervalSize;
+  unsigned count;
+  t_spSimPoint *points;
+} t_spSimPoints;
+
+/* Counters measured on each simulation point */
+enum {
+  SP_COUNTER_INSTRET,
+  SP_COUNTER_CYCLE,
+  SP_COUNTER_MISPREDICTIONS,
+  SP_COUNTER_L1I_MISSES,
+  SP_COUNTER_L1D_MISSES,
+  SP_COUNTER_L2_MISSES,
+  SP_COUNTER_STALLS,
+  SP_N_COUNTERS
+};
+
+typedef struct {
+  uint64_t counters[SP_N_COUNTERS];
+} t_spSample;
+
+/* Writes the instruction frequency vector of every interval of
+ * intervalSize instructions to the file, in the SimPoint .bb format. Must be
+ * called before the code area is set, as it enables the profile. Only one VM
+ * can write the vectors at a time. */
+t_spError spBBVOpen(t_vm *vm, const char *path, uint64_t intervalSize);
+/* Called at the end of each interval and at the end of the program */
+void spBBVWriteInterval(void);
+t_spError spBBVClose(void);
+
+/* Groups the intervals of a .bb file in at most k clusters and writes a
+ * simulation point for each cluster */
+t_spError spCluster(const char *bbvPath, uint64_t intervalSize, unsigned k,
+    FILE *out);
+
+t_spError spReadSimPoints(const char *path, t_spSimPoints *out);
+/* Name of the checkpoint of a simulation point. The result must be freed. */
+char *spCheckpointName(const char *prefix, const t_spSimPoint *point);
+
+/* Forks a process for each simulation point, running at most jobs of them
+ * at once. Returns the index of the point in each child, and -1 in the
+ * parent once all the children have reported their samples. */
+int spForkSamples(const t_spSimPoints *sp, unsigned jobs, t_spSample *out);
+/* Called by the child at the start and at the end of the measured interval.
+ * spSampleEnd() reports the sample to the parent and exits. */
+void spSampleBegin(t_vm *vm);
+void spSampleEnd(t_vm *vm);
+
+/* Prints the estimates obtained by weighting the samples. The counters with
+ * a false entry in enabled are not printed. */
+void spPrintEstimate(FILE *fp, const t_spSimPoints *sp,
+    const t_spSample *samples, const bool enabled[SP_N_COUNTERS]);
+
+#endif
@@ -3,12 +3,29 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
 #include "isa.h"
+#include "vm.h"
 #include "cpu.h"
 #include "memory.h"
 #include "loader.h"
 #include "supervisor.h"
 #include "debugger.h"
+#include "stats.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "cache.h"
+#include "bpred.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "sweep.h"
+#include "checkpoint.h"
+#include "simpoint.h"
+#include "batch.h"
+#include "forkserver.h"
 
 
 void usage(const char *name)
@@ -23,10 +40,141 @@ void usage(const char *name)
   puts("  -x, --prg-exit-code   Exits the simulator with the same exit code");
   puts("                          as the simulated program. In case of faults");
   puts("                          produces POSIX-style exit codes.");
+  puts("      --stack-size=SIZE Sets the maximum size of the stack in bytes.");
+  puts("                          K and M suffixes are accepted (default 8M)");
+  puts("      --max-instructions=N");
+  puts("                        Stops the program after N instructions");
+  puts("      --timeout=SECS    Stops the program after SECS seconds");
+  puts("                          Programs stopped by these limits exit with");
+  puts("                          code 102 (124 with -x), and the");
+  puts("                          instructions where they were looping");
+  puts("                          are printed");
+  puts("      --jit             Compiles frequently executed code to native");
+  puts("                          code (default when supported by the host)");
+  puts("      --no-jit          Only uses the interpreter");
+  puts("      --jit-verify      Checks the native code against the");
+  puts("                          interpreter while executing");
+  puts("      --stats[=FORMAT]  Prints execution statistics at exit. FORMAT");
+  puts("                          is text (default) or json");
+  puts("      --stats-file=FILE Writes the statistics to FILE instead of");
+  puts("                          the standard error");
+  puts("      --profile=FILE    Counts the executions of each instruction and");
+  puts("                          writes them to FILE, with a text report");
+  puts("                          in FILE.txt");
+  puts("      --profile-report=FILE");
+  puts("                        Writes the profile report to FILE");
+  puts("      --profile-top=N   Number of instructions in the hottest");
+  puts("                          instructions list of the report");
+  puts("      --call-graph=FILE Writes the instructions executed by each call");
+  puts("                          stack to FILE in collapsed-stack format,");
+  puts("                          and the counts per function to FILE.txt");
+  puts("      --l1i=CONFIG      Simulates a L1 instruction cache");
+  puts("      --l1d=CONFIG      Simulates a L1 data cache");
+  puts("      --l2=CONFIG       Simulates a unified L2 cache. CONFIG is");
+  puts("                          SIZE:LINE:WAYS[:REPL[:WRITE]] where REPL");
+  puts("                          is lru (default), plru or random and WRITE");
+  puts("                          is wb (default) or wt");
+  puts("      --bpred=KIND      Simulates a branch predictor of the given");
+  puts("                          KIND (btfn, bimodal, gshare or tage)");
+  puts("      --timing[=PARAMS] Computes the cycles taken by a five-stage");
+  puts("                          in-order pipeline. PARAMS is a comma");
+  puts("                          separated list of mul=N, div=N (latencies),");
+  puts("                          branch=N, l2=N and mem=N (penalties)");
+  puts("                          The program can read the cycles and the");
+  puts("                          events of the models with the hpmcounter3");
+  puts("                          (mispredictions) to hpmcounter7 (stalls)");
+  puts("                          CSRs");
+  puts("      --trace=FILE      Records every executed instruction, with the");
+  puts("                          values written to registers and memory,");
+  puts("                          to FILE in compressed binary format");
+  puts("      --trace-dump=FILE Prints the trace in FILE as text and exits");
+  puts("      --checkpoint-at=N Saves the state of the program after N");
+  puts("                          instructions, then continues the execution");
+  puts("      --checkpoint-file=FILE");
+  puts("                        Writes the checkpoint to FILE");
+  puts("      --restore=FILE    Resumes the execution from the checkpoint in");
+  puts("                          FILE instead of loading an executable");
+  puts("      --bbv=FILE        Writes the instruction frequency vector of");
+  puts("                          each interval to FILE (SimPoint format)");
+  puts("      --bbv-interval=N  Instructions per interval (default 1000000)");
+  puts("      --simpoint=FILE   Clusters the intervals in the vectors FILE,");
+  puts("                          prints a simulation point for each");
+  puts("                          cluster and exits");
+  puts("      --simpoint-k=K    Maximum number of clusters (default 10)");
+  puts("      --simpoint-checkpoints=FILE");
+  puts("                        Saves a checkpoint before each simulation");
+  puts("                          point in FILE, named after the");
+  puts("                          --checkpoint-file prefix");
+  puts("      --simpoint-warmup=N");
+  puts("                        Instructions run with the models enabled");
+  puts("                          before each simulation point");
+  puts("      --sampled=FILE    Runs the models on the simulation points in");
+  puts("                          FILE from their checkpoints, and prints");
+  puts("                          the weighted estimates");
+  puts("      --cache-sweep[=FILE]");
+  puts("                        Computes the miss ratio of many LRU caches");
+  puts("                          in a single pass over the accesses of the");
+  puts("                          program, or of the trace in FILE");
+  puts("      --sweep-config=CONFIG");
+  puts("                        Caches of the sweep. CONFIG is");
+  puts("                          LINE:WAYS:SETS[:STREAM] where WAYS and SETS");
+  puts("                          are the maximum ways and sets and STREAM");
+  puts("                          is d (data, default), i or u (unified)");
+  puts("      --batch=FILE      Runs the test cases listed in FILE in");
+  puts("                          parallel, and prints the cases whose");
+  puts("                          output or exit code is not the expected");
+  puts("                          one. Each line of FILE is a case in the");
+  puts("                          format EXECUTABLE INPUT EXPECTED [EXIT]");
+  puts("  -j, --jobs=N          Number of threads used by --batch and");
+  puts("                          processes used by --sampled (default: one");
+  puts("                          per core)");
+  puts("      --fork-server     Loads the executable once, then runs it in");
+  puts("                          a new process for each request read from");
+  puts("                          the standard input, and writes the");
+  puts("                          results to the standard output (see");
+  puts("                          forkserver.h). The analysis options are");
+  puts("                          ignored");
   puts("  -h, --help            Displays available options");
 }
 
 
+enum {
+  OPT_JIT = 0x100,
+  OPT_NO_JIT,
+  OPT_JIT_VERIFY,
+  OPT_STACK_SIZE,
+  OPT_STATS,
+  OPT_STATS_FILE,
+  OPT_PROFILE,
+  OPT_PROFILE_REPORT,
+  OPT_PROFILE_TOP,
+  OPT_CALL_GRAPH,
+  OPT_L1I,
+  OPT_L1D,
+  OPT_L2,
+  OPT_BPRED,
+  OPT_TIMING,
+  OPT_TRACE,
+  OPT_TRACE_DUMP,
+  OPT_CACHE_SWEEP,
+  OPT_SWEEP_CONFIG,
+  OPT_CHECKPOINT_AT,
+  OPT_CHECKPOINT_FILE,
+  OPT_RESTORE,
+  OPT_BBV,
+  OPT_BBV_INTERVAL,
+  OPT_SIMPOINT,
+  OPT_SIMPOINT_K,
+  OPT_SIMPOINT_CHECKPOINTS,
+  OPT_SIMPOINT_WARMUP,
+  OPT_SAMPLED,
+  OPT_BATCH,
+  OPT_FORK_SERVER,
+  OPT_MAX_INSTRUCTIONS,
+  OPT_TIMEOUT
+};
+
+
 typedef int t_exitCode;
 enum {
   SIM_EXIT_SUCCESS,
@@ -35,14 +183,15 @@ enum {
   SIM_EXIT_INVALID_FILE,
   SIM_EXIT_SIGSEGV,
   SIM_EXIT_SIGILL,
+  SIM_EXIT_LIMIT,
   COUNT_SIM_EXIT
 };
 
 int exitCode(t_exitCode code, bool toPosix)
 {
-  static const int normalCodes[COUNT_SIM_EXIT] = {0, 0, 1, 2, 100, 101};
+  static const int normalCodes[COUNT_SIM_EXIT] = {0, 0, 1, 2, 100, 101, 102};
   static const int posixCodes[COUNT_SIM_EXIT] = {
-      0, 126, 126, 126, 128 + 11, 128 + 4};
+      0, 126, 126, 126, 128 + 11, 128 + 4, 124};
   if (code < 0 || code >= COUNT_SIM_EXIT)
     return code;
   if (toPosix)
@@ -51,6 +200,29 @@ int exitCode(t_exitCode code, bool toPosix)
 }
 
 
+/* Shows where a program stopped by a limit was looping */
+void printHotPCs(t_vm *vm, FILE *fp)
+{
+  t_svHotPC hot[5];
+  unsigned runs;
+  unsigned n = svGetHotPCs(vm, hot, 5, &runs);
+  if (n == 0)
+    return;
+  fprintf(fp, "Most frequent stopping points (%u samples):\n", runs);
+  for (unsigned i = 0; i < n; i++) {
+    char buf[80];
+    isaDisassemble(memDebugRead32(vm, hot[i].pc, NULL), buf, sizeof(buf));
+    fprintf(fp, "  0x%08" PRIx32 " %6.2f%%  ", hot[i].pc,
+        100.0 * hot[i].count / runs);
+    t_ldrSourceLine line;
+    if (ldrGetSourceLine(vm, hot[i].pc, &line))
+      fprintf(fp, "%-24s  %s:%" PRIu32 "\n", buf, line.file, line.line);
+    else
+      fprintf(fp, "%s\n", buf);
+  }
+}
+
+
 int main(int argc, char *argv[])
 {
   int ch;
@@ -61,6 +233,42 @@ int main(int argc, char *argv[])
       {         "help",       no_argument, NULL, 'h'},
       {    "load-addr", required_argument, NULL, 'l'},
       {"prg-exit-code",       no_argument, NULL, 'x'},
+      {          "jit",       no_argument, NULL, OPT_JIT},
+      {       "no-jit",       no_argument, NULL, OPT_NO_JIT},
+      {   "jit-verify",       no_argument, NULL, OPT_JIT_VERIFY},
+      {   "stack-size", required_argument, NULL, OPT_STACK_SIZE},
+      {        "stats", optional_argument, NULL, OPT_STATS},
+      {   "stats-file", required_argument, NULL, OPT_STATS_FILE},
+      {      "profile", required_argument, NULL, OPT_PROFILE},
+      {"profile-report", required_argument, NULL, OPT_PROFILE_REPORT},
+      {  "profile-top", required_argument, NULL, OPT_PROFILE_TOP},
+      {   "call-graph", required_argument, NULL, OPT_CALL_GRAPH},
+      {          "l1i", required_argument, NULL, OPT_L1I},
+      {          "l1d", required_argument, NULL, OPT_L1D},
+      {           "l2", required_argument, NULL, OPT_L2},
+      {        "bpred", required_argument, NULL, OPT_BPRED},
+      {       "timing", optional_argument, NULL, OPT_TIMING},
+      {        "trace", required_argument, NULL, OPT_TRACE},
+      {   "trace-dump", required_argument, NULL, OPT_TRACE_DUMP},
+      {  "cache-sweep", optional_argument, NULL, OPT_CACHE_SWEEP},
+      { "sweep-config", required_argument, NULL, OPT_SWEEP_CONFIG},
+      {"checkpoint-at", required_argument, NULL, OPT_CHECKPOINT_AT},
+      {"checkpoint-file", required_argument, NULL, OPT_CHECKPOINT_FILE},
+      {      "restore", required_argument, NULL, OPT_RESTORE},
+      {          "bbv", required_argument, NULL, OPT_BBV},
+      { "bbv-interval", required_argument, NULL, OPT_BBV_INTERVAL},
+      {     "simpoint", required_argument, NULL, OPT_SIMPOINT},
+      {   "simpoint-k", required_argument, NULL, OPT_SIMPOINT_K},
+      {"simpoint-checkpoints", required_argument, NULL,
+       OPT_SIMPOINT_CHECKPOINTS},
+      {"simpoint-warmup", required_argument, NULL, OPT_SIMPOINT_WARMUP},
+      {      "sampled", required_argument, NULL, OPT_SAMPLED},
+      {        "batch", required_argument, NULL, OPT_BATCH},
+      {         "jobs", required_argument, NULL, 'j'},
+      {  "fork-server",       no_argument, NULL, OPT_FORK_SERVER},
+      {"max-instructions", required_argument, NULL, OPT_MAX_INSTRUCTIONS},
+      {      "timeout", required_argument, NULL, OPT_TIMEOUT},
+      {0}
   };
 
   char *name = argv[0];
@@ -69,8 +277,46 @@ int main(int argc, char *argv[])
   bool entryIsSet = false;
   t_memAddress load = 0;
   bool prgExitCode = false;
+  t_cpuExecMode execMode = CPU_EXEC_JIT;
+  bool execModeIsSet = false;
+  unsigned long stackSize = SV_DEFAULT_STACK_SIZE;
+  bool stats = false;
+  t_statsFormat statsFormat = STATS_FORMAT_TEXT;
+  const char *statsFile = NULL;
+  const char *profileFile = NULL;
+  char *profileReport = NULL;
+  unsigned long profileTop = PROF_DEFAULT_TOP_COUNT;
+  const char *callGraphFile = NULL;
+  t_cacheConfig cacheConfigs[3];
+  bool cacheEnabled[3] = {false, false, false};
+  t_bpKind bpKind;
+  bool bpEnabled = false;
+  t_pipeConfig pipeConfig;
+  bool timing = false;
+  const char *traceFile = NULL;
+  const char *traceDumpFile = NULL;
+  bool sweep = false;
+  const char *sweepTrace = NULL;
+  t_sweepConfig sweepConfig;
+  sweepDefaultConfig(&sweepConfig);
+  bool checkpoint = false;
+  unsigned long long checkpointAt = 0;
+  const char *checkpointFile = NULL;
+  const char *restoreFile = NULL;
+  const char *bbvFile = NULL;
+  unsigned long long bbvInterval = SP_DEFAULT_INTERVAL;
+  const char *simpointFile = NULL;
+  unsigned long simpointK = SP_DEFAULT_CLUSTERS;
+  const char *simpointCheckpoints = NULL;
+  unsigned long long simpointWarmup = 0;
+  const char *sampledFile = NULL;
+  const char *batchFile = NULL;
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  bool forkServer = false;
+  unsigned long long maxInstructions = 0;
+  double timeout = 0;
 
-  while ((ch = getopt_long(argc, argv, "de:hl:x", options, NULL)) != -1) {
+  while ((ch = getopt_long(argc, argv, "de:hj:l:x", options, NULL)) != -1) {
     switch (ch) {
       case 'd':
         debug = true;
@@ -93,6 +339,178 @@ int main(int argc, char *argv[])
       case 'x':
         prgExitCode = true;
         break;
+      case OPT_JIT:
+        execMode = CPU_EXEC_JIT;
+        execModeIsSet = true;
+        break;
+      case OPT_NO_JIT:
+        execMode = CPU_EXEC_INTERPRETER;
+        execModeIsSet = true;
+        break;
+      case OPT_JIT_VERIFY:
+        execMode = CPU_EXEC_JIT_VERIFY;
+        execModeIsSet = true;
+        break;
+      case OPT_STACK_SIZE:
+        stackSize = strtoul(optarg, &tmpStr, 0);
+        if (*tmpStr == 'k' || *tmpStr == 'K') {
+          stackSize *= 1024;
+          tmpStr++;
+        } else if (*tmpStr == 'm' || *tmpStr == 'M') {
+          stackSize *= 1024 * 1024;
+          tmpStr++;
+        }
+        if (tmpStr == optarg || *tmpStr != '\0' || stackSize == 0 ||
+            stackSize > 0x80000000) {
+          fprintf(stderr, "Invalid stack size\n");
+          return 1;
+        }
+        break;
+      case OPT_STATS:
+        stats = true;
+        if (optarg == NULL || strcmp(optarg, "text") == 0) {
+          statsFormat = STATS_FORMAT_TEXT;
+        } else if (strcmp(optarg, "json") == 0) {
+          statsFormat = STATS_FORMAT_JSON;
+        } else {
+          fprintf(stderr, "Invalid statistics format\n");
+          return 1;
+        }
+        break;
+      case OPT_STATS_FILE:
+        stats = true;
+        statsFile = optarg;
+        break;
+      case OPT_PROFILE:
+        profileFile = optarg;
+        break;
+      case OPT_PROFILE_REPORT:
+        profileReport = optarg;
+        break;
+      case OPT_PROFILE_TOP:
+        profileTop = strtoul(optarg, &tmpStr, 0);
+        if (tmpStr == optarg || *tmpStr != '\0') {
+          fprintf(stderr, "Invalid number of instructions\n");
+          return 1;
+        }
+        break;
+      case OPT_CALL_GRAPH:
+        callGraphFile = optarg;
+        break;
+      case OPT_L1I:
+      case OPT_L1D:
+      case OPT_L2:
+        if (!cacheParseConfig(optarg, &cacheConfigs[ch - OPT_L1I])) {
+          fprintf(stderr, "Invalid cache configuration\n");
+          return 1;
+        }
+        cacheEnabled[ch - OPT_L1I] = true;
+        break;
+      case OPT_BPRED:
+        if (!bpParseKind(optarg, &bpKind)) {
+          fprintf(stderr, "Invalid branch predictor\n");
+          return 1;
+        }
+        bpEnabled = true;
+        break;
+      case OPT_TIMING:
+        timing = true;
+        pipeDefaultConfig(&pipeConfig);
+        if (optarg && !pipeParseConfig(optarg, &pipeConfig)) {
+          fprintf(stderr, "Invalid timing parameters\n");
+          return 1;
+        }
+        break;
+      case OPT_TRACE:
+        traceFile = optarg;
+        break;
+      case OPT_TRACE_DUMP:
+        traceDumpFile = optarg;
+        break;
+      case OPT_CACHE_SWEEP:
+        sweep = true;
+        sweepTrace = optarg;
+        break;
+      case OPT_SWEEP_CONFIG:
+        if (!sweepParseConfig(optarg, &sweepConfig)) {
+          fprintf(stderr, "Invalid cache sweep configuration\n");
+          return 1;
+        }
+        break;
+      case OPT_CHECKPOINT_AT:
+        checkpointAt = strtoull(optarg, &tmpStr, 0);
+        if (*optarg == '\0' || *tmpStr != '\0') {
+          fprintf(stderr, "Invalid checkpoint instruction count\n");
+          return 1;
+        }
+        checkpoint = true;
+        break;
+      case OPT_CHECKPOINT_FILE:
+        checkpointFile = optarg;
+        break;
+      case OPT_RESTORE:
+        restoreFile = optarg;
+        break;
+      case OPT_BBV:
+        bbvFile = optarg;
+        break;
+      case OPT_BBV_INTERVAL:
+        bbvInterval = strtoull(optarg, &tmpStr, 0);
+        if (*tmpStr != '\0' || bbvInterval == 0) {
+          fprintf(stderr, "Invalid interval\n");
+          return 1;
+        }
+        break;
+      case OPT_SIMPOINT:
+        simpointFile = optarg;
+        break;
+      case OPT_SIMPOINT_K:
+        simpointK = strtoul(optarg, &tmpStr, 0);
+        if (*tmpStr != '\0' || simpointK == 0 || simpointK > 1000) {
+          fprintf(stderr, "Invalid number of clusters\n");
+          return 1;
+        }
+        break;
+      case OPT_SIMPOINT_CHECKPOINTS:
+        simpointCheckpoints = optarg;
+        break;
+      case OPT_SIMPOINT_WARMUP:
+        simpointWarmup = strtoull(optarg, &tmpStr, 0);
+        if (*optarg == '\0' || *tmpStr != '\0') {
+          fprintf(stderr, "Invalid warm-up length\n");
+          return 1;
+        }
+        break;
+      case OPT_SAMPLED:
+        sampledFile = optarg;
+        break;
+      case OPT_BATCH:
+        batchFile = optarg;
+        break;
+      case OPT_MAX_INSTRUCTIONS:
+        maxInstructions = strtoull(optarg, &tmpStr, 0);
+        if (*tmpStr != '\0' || maxInstructions == 0) {
+          fprintf(stderr, "Invalid instruction limit\n");
+          return 1;
+        }
+        break;
+      case OPT_TIMEOUT:
+        timeout = strtod(optarg, &tmpStr);
+        if (*tmpStr != '\0' || !(timeout > 0)) {
+          fprintf(stderr, "Invalid timeout\n");
+          return 1;
+        }
+        break;
+      case OPT_FORK_SERVER:
+        forkServer = true;
+        break;
+      case 'j':
+        jobs = strtol(optarg, &tmpStr, 0);
+        if (*tmpStr != '\0' || jobs <= 0 || jobs > 1024) {
+          fprintf(stderr, "Invalid number of jobs\n");
+          return 1;
+        }
+        break;
       case 'h':
         usage(name);
         return exitCode(SIM_EXIT_HELP, prgExitCode);
@@ -104,62 +522,372 @@ int main(int argc, char *argv[])
   argc -= optind;
   argv += optind;
 
-  if (argc < 1) {
+  if (traceDumpFile) {
+    t_traceError err = traceDump(traceDumpFile, stdout);
+    if (err == TRACE_FILE_ERROR) {
+      fprintf(stderr, "Could not open the trace, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    } else if (err != TRACE_NO_ERROR) {
+      fprintf(stderr, "Invalid trace file, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    }
+    return 0;
+  }
+  if (simpointFile) {
+    t_spError err =
+        spCluster(simpointFile, bbvInterval, (unsigned)simpointK, stdout);
+    if (err == SP_FILE_ERROR) {
+      fprintf(stderr, "Could not open the vectors, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    } else if (err != SP_NO_ERROR) {
+      fprintf(stderr, "Invalid vectors file, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    }
+    return 0;
+  }
+  if (sweepTrace) {
+    if (!sweepInit(&sweepConfig) || !sweepReadTrace(sweepTrace)) {
+      fprintf(stderr, "Could not read the trace, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    }
+    if (!sweepPrint(stdout)) {
+      fprintf(stderr, "Not enough memory for the cache sweep, exiting.\n");
+      return 1;
+    }
+    return 0;
+  }
+
+  if (batchFile) {
+    t_batchConfig batchConfig;
+    batchConfig.jobs = jobs > 0 ? (unsigned)jobs : 1;
+    batchConfig.execMode = execMode;
+    batchConfig.stackSize = (t_memSize)stackSize;
+    batchConfig.maxInstructions = maxInstructions;
+    batchConfig.timeout = timeout;
+    unsigned failed;
+    t_batchError err = batchRun(batchFile, &batchConfig, stdout, &failed);
+    if (err == BATCH_FILE_ERROR) {
+      fprintf(stderr, "Could not open the manifest, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    } else if (err == BATCH_INVALID_FORMAT) {
+      fprintf(stderr, "Invalid manifest, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    } else if (err != BATCH_NO_ERROR) {
+      fprintf(stderr, "Not enough memory for the batch, exiting.\n");
+      return 1;
+    }
+    return failed > 0 ? 1 : 0;
+  }
+
+  if (argc < 1 && !restoreFile && !sampledFile) {
     usage(name);
     return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
-  } else if (argc > 1) {
+  } else if (argc > 1 || (argc > 0 && (restoreFile || sampledFile))) {
     fprintf(stderr, "Cannot load more than one file, exiting.\n");
     return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
   }
+  bool checkpointUsed = checkpoint || simpointCheckpoints || sampledFile;
+  if (checkpointUsed != (checkpointFile != NULL)) {
+    fprintf(stderr, "--checkpoint-file must be used together with "
+                    "--checkpoint-at, --simpoint-checkpoints or "
+                    "--sampled, exiting.\n");
+    return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+  }
+  if (forkServer && (debug || restoreFile || sampledFile)) {
+    fprintf(stderr, "--fork-server cannot be used together with --debug, "
+                    "--restore or --sampled, exiting.\n");
+    return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+  }
+
+  /* Checkpoints to write, sorted by position */
+  unsigned ckptCount = 0, ckptNext = 0;
+  uint64_t *ckptPositions = NULL;
+  char **ckptNames = NULL;
+  t_spSimPoints simpoints;
+  if (simpointCheckpoints || sampledFile) {
+    t_spError err =
+        spReadSimPoints(sampledFile ? sampledFile : simpointCheckpoints,
+            &simpoints);
+    if (err != SP_NO_ERROR) {
+      fprintf(stderr, "Could not read the simulation points, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    }
+  }
+  if (checkpoint || simpointCheckpoints) {
+    ckptCount = checkpoint ? 1 : simpoints.count;
+    ckptPositions = malloc(sizeof(uint64_t) * ckptCount);
+    ckptNames = malloc(sizeof(char *) * ckptCount);
+    if (!ckptPositions || !ckptNames)
+      return 1;
+    if (checkpoint) {
+      ckptPositions[0] = checkpointAt;
+      ckptNames[0] = strdup(checkpointFile);
+    }
+    for (unsigned i = 0; !checkpoint && i < ckptCount; i++) {
+      uint64_t start = simpoints.points[i].interval * simpoints.intervalSize;
+      ckptPositions[i] = start > simpointWarmup ? start - simpointWarmup : 0;
+      ckptNames[i] = spCheckpointName(checkpointFile, &simpoints.points[i]);
+    }
+  }
 
+  /* Each simulation point is run by a child process, which restores its
+   * checkpoint and continues as a normal run until the end of the point */
+  int sample = -1;
+  uint64_t sampleStart = 0, sampleEnd = 0;
+  bool sampleStarted = false;
+  if (sampledFile) {
+    t_spSample *samples = malloc(sizeof(t_spSample) * simpoints.count);
+    if (samples == NULL)
+      return 1;
+    sample =
+        spForkSamples(&simpoints, jobs > 0 ? (unsigned)jobs : 1, samples);
+    if (sample < 0) {
+      bool enabled[SP_N_COUNTERS] = {true, timing, bpEnabled,
+          cacheEnabled[0], cacheEnabled[1], cacheEnabled[2], timing};
+      spPrintEstimate(stdout, &simpoints, samples, enabled);
+      return 0;
+    }
+    restoreFile = spCheckpointName(checkpointFile, &simpoints.points[sample]);
+    sampleStart = simpoints.points[sample].interval * simpoints.intervalSize;
+    sampleEnd = sampleStart + simpoints.intervalSize;
+  }
+
+  t_vm *vm = vmNew();
+  if (vm == NULL)
+    return 1;
   if (debug)
-    dbgEnable();
-
-  t_ldrError ldrErr;
-  t_ldrFileType excType = ldrDetectExecType(argv[0]);
-  if (excType == LDR_FORMAT_BINARY) {
-    if (!entryIsSet)
-      entry = load;
-    ldrErr = ldrLoadBinary(argv[0], load, entry);
-  } else if (excType == LDR_FORMAT_ELF) {
-    ldrErr = ldrLoadELF(argv[0]);
-    if (entryIsSet)
-      cpuSetRegister(CPU_REG_PC, entry);
+    dbgEnable(vm);
+  if (!cpuSetExecMode(vm, execMode)) {
+    if (execModeIsSet) {
+      fprintf(stderr, "Native code generation not supported, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+    }
+    cpuSetExecMode(vm, CPU_EXEC_INTERPRETER);
+  }
+  if (stats)
+    cpuSetStatsEnabled(vm, true);
+  if (bbvFile && spBBVOpen(vm, bbvFile, bbvInterval) != SP_NO_ERROR) {
+    fprintf(stderr, "Could not open the vectors file, exiting.\n");
+    return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+  }
+  if (profileFile) {
+    cpuSetProfileEnabled(vm, true);
+    if (profileReport == NULL) {
+      profileReport = malloc(strlen(profileFile) + 5);
+      if (profileReport == NULL)
+        return 1;
+      strcpy(profileReport, profileFile);
+      strcat(profileReport, ".txt");
+    }
+  }
+
+  if (restoreFile) {
+    t_ckptError err = ckptRestore(vm, restoreFile);
+    if (err == CKPT_FILE_ERROR) {
+      fprintf(stderr, "Could not read the checkpoint, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    } else if (err != CKPT_NO_ERROR) {
+      fprintf(stderr, "Invalid checkpoint, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    }
   } else {
-    fprintf(stderr, "Could not open executable, exiting.\n");
-    return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    t_ldrError ldrErr;
+    t_ldrFileType excType = ldrDetectExecType(argv[0]);
+    if (excType == LDR_FORMAT_BINARY) {
+      if (!entryIsSet)
+        entry = load;
+      ldrErr = ldrLoadBinary(vm, argv[0], load, entry);
+    } else if (excType == LDR_FORMAT_ELF) {
+      ldrErr = ldrLoadELF(vm, argv[0]);
+      if (entryIsSet)
+        cpuSetRegister(vm, CPU_REG_PC, entry);
+    } else {
+      fprintf(stderr, "Could not open executable, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    }
+
+    if (ldrErr == LDR_INVALID_ARCH) {
+      fprintf(stderr, "Not a valid RISC-V executable, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    } else if (ldrErr == LDR_INVALID_FORMAT) {
+      fprintf(stderr, "Unsupported executable, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    } else if (ldrErr != LDR_NO_ERROR) {
+      fprintf(stderr, "Error during executable loading, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+    }
+
+    if (initSupervisor(vm, (t_memSize)stackSize) != SV_NO_ERROR) {
+      fprintf(stderr, "Could not allocate the stack, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+    }
+  }
+  svSetInstructionLimit(vm, maxInstructions);
+  svSetTimeout(vm, timeout);
+
+  if (forkServer) {
+    t_fsrvError err = fsrvServe(vm, stdin, stdout);
+    if (err == FSRV_INVALID_REQUEST) {
+      fprintf(stderr, "Invalid fork server request, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+    } else if (err != FSRV_NO_ERROR) {
+      fprintf(stderr, "Fork server error, exiting.\n");
+      return 1;
+    }
+    return 0;
+  }
+  t_svStatus status = SV_STATUS_RUNNING;
+
+  if (callGraphFile) {
+    if (cgInit(cpuGetRegister(vm, CPU_REG_PC)) != CG_NO_ERROR ||
+        !cpuSetCallGraphEnabled(vm, true)) {
+      fprintf(stderr, "Could not allocate the call graph, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+    }
+  }
+  bool caches = cacheEnabled[0] || cacheEnabled[1] || cacheEnabled[2];
+  if (caches &&
+      !cacheModelInit(vm, cacheEnabled[0] ? &cacheConfigs[0] : NULL,
+          cacheEnabled[1] ? &cacheConfigs[1] : NULL,
+          cacheEnabled[2] ? &cacheConfigs[2] : NULL)) {
+    fprintf(stderr, "Could not allocate the caches, exiting.\n");
+    return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+  }
+  if (bpEnabled && !bpModelInit(vm, bpKind)) {
+    fprintf(stderr, "Could not allocate the branch predictor, exiting.\n");
+    return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+  }
+  if (timing) {
+    pipeConfig.predictor = bpEnabled;
+    if (!pipeModelInit(vm, &pipeConfig)) {
+      fprintf(stderr, "Could not allocate the timing model, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+    }
   }
 
-  if (ldrErr == LDR_INVALID_ARCH) {
-    fprintf(stderr, "Not a valid RISC-V executable, exiting.\n");
-    return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
-  } else if (ldrErr == LDR_INVALID_FORMAT) {
-    fprintf(stderr, "Unsupported executable, exiting.\n");
-    return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
-  } else if (ldrErr != LDR_NO_ERROR) {
-    fprintf(stderr, "Error during executable loading, exiting.\n");
-    return exitCode(SIM_EXIT_INVALID_FILE, prgExitCode);
+  if (traceFile) {
+    t_traceError err = traceOpen(vm, traceFile);
+    if (err == TRACE_FILE_ERROR) {
+      fprintf(stderr, "Could not open the trace file, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+    } else if (err != TRACE_NO_ERROR) {
+      fprintf(stderr, "Could not start the trace, exiting.\n");
+      return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+    }
   }
 
-  t_svStatus status = initSupervisor();
+  if (sweep && (!sweepInit(&sweepConfig) || !sweepAttachCPU(vm))) {
+    fprintf(stderr, "Could not allocate the cache sweep, exiting.\n");
+    return exitCode(SIM_EXIT_INVALID_ARGS, prgExitCode);
+  }
 
   if (debug)
     dbgRequestEnter();
 
+  struct timespec startTime, endTime;
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  uint64_t bbvNext = bbvInterval;
   while (status == SV_STATUS_RUNNING) {
-    status = svVMTick();
+    /* runs in batches which end at the next event */
+    uint64_t retired = cpuGetInstret(vm);
+    uint64_t next = retired + SV_RUN_BATCH_SIZE;
+    for (; ckptNext < ckptCount && ckptPositions[ckptNext] <= retired;
+         ckptNext++) {
+      if (ckptWrite(vm, ckptNames[ckptNext]) != CKPT_NO_ERROR)
+        fprintf(stderr, "Could not write the checkpoint %s\n",
+            ckptNames[ckptNext]);
+    }
+    if (ckptNext < ckptCount && ckptPositions[ckptNext] < next)
+      next = ckptPositions[ckptNext];
+    if (bbvFile) {
+      if (retired >= bbvNext) {
+        spBBVWriteInterval();
+        bbvNext += bbvInterval;
+      }
+      if (bbvNext < next)
+        next = bbvNext;
+    }
+    if (sample >= 0) {
+      if (!sampleStarted && retired >= sampleStart) {
+        spSampleBegin(vm);
+        sampleStarted = true;
+      }
+      if (retired >= sampleEnd)
+        spSampleEnd(vm);
+      uint64_t stop = sampleStarted ? sampleEnd : sampleStart;
+      if (stop < next)
+        next = stop;
+    }
+    status = svVMRun(vm, (uint32_t)(next - retired));
+  }
+  if (ckptNext < ckptCount)
+    fprintf(stderr, "The program ended before the checkpoint\n");
+  if (sample >= 0) {
+    if (!sampleStarted)
+      spSampleBegin(vm);
+    spSampleEnd(vm);
+  }
+  if (bbvFile) {
+    if (cpuGetInstret(vm) > bbvNext - bbvInterval)
+      spBBVWriteInterval();
+    if (spBBVClose() != SP_NO_ERROR)
+      fprintf(stderr, "Could not write the vectors\n");
+  }
+  clock_gettime(CLOCK_MONOTONIC, &endTime);
+  if (traceFile && traceClose() != TRACE_NO_ERROR)
+    fprintf(stderr, "Could not write the trace\n");
+
+  if (stats) {
+    double wallTime = (double)(endTime.tv_sec - startTime.tv_sec) +
+        (double)(endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+    FILE *fp = stderr;
+    if (statsFile && !(fp = fopen(statsFile, "w"))) {
+      fprintf(stderr, "Could not open the statistics file\n");
+      fp = stderr;
+    }
+    statsPrint(vm, fp, statsFormat, wallTime);
+    if (fp != stderr)
+      fclose(fp);
+  }
+  if (profileFile &&
+      profWrite(vm, profileFile, profileReport, (unsigned)profileTop) !=
+          PROF_NO_ERROR)
+    fprintf(stderr, "Could not write the profile\n");
+  if (callGraphFile) {
+    char *reportFile = malloc(strlen(callGraphFile) + 5);
+    if (reportFile == NULL)
+      return 1;
+    strcpy(reportFile, callGraphFile);
+    strcat(reportFile, ".txt");
+    if (cgWrite(callGraphFile, reportFile) != CG_NO_ERROR)
+      fprintf(stderr, "Could not write the call graph\n");
+    free(reportFile);
   }
+  if (caches)
+    cacheModelPrint(stderr);
+  if (bpEnabled)
+    bpModelPrint(stderr);
+  if (timing)
+    pipeModelPrint(stderr);
+  if (sweep && !sweepPrint(stderr))
+    fprintf(stderr, "Not enough memory for the cache sweep\n");
 
   if (status == SV_STATUS_MEMORY_FAULT) {
     fprintf(stderr, "Memory fault at address 0x%08x, execution stopped.\n",
-        memGetLastFaultAddress());
+        memGetLastFaultAddress(vm));
     return exitCode(SIM_EXIT_SIGSEGV, prgExitCode);
   } else if (status == SV_STATUS_ILL_INST_FAULT) {
     fprintf(stderr, "Illegal instruction at address 0x%08x\n",
-        cpuGetRegister(CPU_REG_PC));
+        cpuGetRegister(vm, CPU_REG_PC));
     return exitCode(SIM_EXIT_SIGILL, prgExitCode);
+  } else if (status == SV_STATUS_INST_LIMIT || status == SV_STATUS_TIMEOUT) {
+    fprintf(stderr, "%s after %" PRIu64 " instructions, execution stopped.\n",
+        status == SV_STATUS_TIMEOUT ? "Timeout" : "Instruction limit reached",
+        cpuGetInstret(vm));
+    printHotPCs(vm, stderr);
+    return exitCode(SIM_EXIT_LIMIT, prgExitCode);
   }
   if (prgExitCode)
-    return svGetExitCode();
+    return svGetExitCode(vm);
   return 0;
 }
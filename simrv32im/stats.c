@@ -0,0 +1,94 @@
+#include <inttypes.h>
+#include "stats.h"
+#include "cpu.h"
+#include "memory.h"
+#include "supervisor.h"
+
+
+static const char *statsClassNames[] = {"alu", "mul_div", "loads", "stores",
+    "branches_taken", "branches_not_taken", "jumps", "ecalls", "ebreaks"};
+
+static void statsGetClasses(const t_cpuStats *stats, uint64_t *out)
+{
+  out[0] = stats->alu;
+  out[1] = stats->mulDiv;
+  out[2] = stats->loads;
+  out[3] = stats->stores;
+  out[4] = stats->branchesTaken;
+  out[5] = stats->branchesNotTaken;
+  out[6] = stats->jumps;
+  out[7] = stats->ecalls;
+  out[8] = stats->ebreaks;
+}
+
+#define STATS_N_CLASSES (sizeof(statsClassNames) / sizeof(statsClassNames[0]))
+
+
+static void statsPrintText(t_vm *vm, FILE *fp, const t_cpuStats *cpuStats,
+    const uint64_t *classes, double wallTime, double mips)
+{
+  fprintf(fp, "Execution statistics:\n");
+  fprintf(fp, "  %-24s %" PRIu64 "\n", "instructions", cpuStats->instructions);
+  for (size_t i = 0; i < STATS_N_CLASSES; i++)
+    fprintf(fp, "    %-22s %" PRIu64 "\n", statsClassNames[i], classes[i]);
+  fprintf(fp, "  syscalls\n");
+  for (t_cpuURegValue id = 0; id <= SV_STATS_MAX_SYSCALL_ID + 1; id++) {
+    uint64_t count = svGetSyscallCount(vm, id);
+    if (count == 0)
+      continue;
+    if (id > SV_STATS_MAX_SYSCALL_ID)
+      fprintf(fp, "    %-22s %" PRIu64 "\n", "other", count);
+    else
+      fprintf(fp, "    %-22" PRIu32 " %" PRIu64 "\n", id, count);
+  }
+  fprintf(fp, "  %-24s %.6f s\n", "wall time", wallTime);
+  fprintf(fp, "  %-24s %.2f\n", "host MIPS", mips);
+  fprintf(fp, "  %-24s %" PRIu64 " bytes\n", "mapped memory",
+      memGetMappedSize(vm));
+  fprintf(fp, "  %-24s %" PRIu32 " bytes\n", "stack depth",
+      svGetStackDepth(vm));
+}
+
+static void statsPrintJSON(t_vm *vm, FILE *fp, const t_cpuStats *cpuStats,
+    const uint64_t *classes, double wallTime, double mips)
+{
+  fprintf(fp, "{\"instructions\": %" PRIu64 ", \"classes\": {",
+      cpuStats->instructions);
+  for (size_t i = 0; i < STATS_N_CLASSES; i++)
+    fprintf(fp, "%s\"%s\": %" PRIu64, i > 0 ? ", " : "", statsClassNames[i],
+        classes[i]);
+  fprintf(fp, "}, \"syscalls\": {");
+  const char *sep = "";
+  for (t_cpuURegValue id = 0; id <= SV_STATS_MAX_SYSCALL_ID + 1; id++) {
+    uint64_t count = svGetSyscallCount(vm, id);
+    if (count == 0)
+      continue;
+    if (id > SV_STATS_MAX_SYSCALL_ID)
+      fprintf(fp, "%s\"other\": %" PRIu64, sep, count);
+    else
+      fprintf(fp, "%s\"%" PRIu32 "\": %" PRIu64, sep, id, count);
+    sep = ", ";
+  }
+  fprintf(fp,
+      "}, \"wall_time\": %.6f, \"mips\": %.2f, \"mapped_memory\": %" PRIu64
+      ", \"stack_depth\": %" PRIu32 "}\n",
+      wallTime, mips, memGetMappedSize(vm), svGetStackDepth(vm));
+}
+
+
+void statsPrint(t_vm *vm, FILE *fp, t_statsFormat format, double wallTime)
+{
+  t_cpuStats cpuStats;
+  uint64_t classes[STATS_N_CLASSES];
+
+  cpuGetStats(vm, &cpuStats);
+  statsGetClasses(&cpuStats, classes);
+  double mips = 0;
+  if (wallTime > 0)
+    mips = (double)cpuStats.instructions / wallTime / 1e6;
+
+  if (format == STATS_FORMAT_JSON)
+    statsPrintJSON(vm, fp, &cpuStats, classes, wallTime, mips);
+  else
+    statsPrintText(vm, fp, &cpuStats, classes, wallTime, mips);
+}
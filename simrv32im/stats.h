@@ -0,0 +1,17 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "vm.h"
+
+typedef int t_statsFormat;
+enum {
+  STATS_FORMAT_TEXT,
+  STATS_FORMAT_JSON
+};
+
+/* Prints the execution statistics collected by the CPU, the supervisor and
+ * the memory. wallTime is the duration of the execution in seconds. */
+void statsPrint(t_vm *vm, FILE *fp, t_statsFormat format, double wallTime);
+
+#endif
@@ -1,33 +1,119 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
 #include "supervisor.h"
 #include "memory.h"
 #include "debugger.h"
 
 const t_memAddress svStackTop = 0x80000000;
-t_memAddress svStackBottom;
-t_isaInt svExitCode;
 
+typedef struct sv {
+  t_memAddress stackBottom;
+  /* lowest stack address known to be used, tracked by svVMRun() once the
+   * host pages no longer tell which parts of the stack were used */
+  t_memAddress stackLowest;
+  bool stackRead;
+  t_isaInt exitCode;
+  uint64_t stdinOffset;
+  FILE *in;
+  FILE *out;
+  /* position of the input when it was set, -1 if it is not seekable */
+  off_t inStart;
+  uint64_t maxInstructions;
+  double timeout;
+  bool deadlineSet;
+  struct timespec deadline;
+  /* pc where each of the last calls to svVMRun() stopped */
+  t_memAddress hotPCs[SV_HOT_PC_RUNS];
+  unsigned hotPCNext, hotPCCount;
+  /* state of the generator of the batch sizes */
+  uint32_t batchSeed;
+  /* the last entry counts the calls with larger IDs */
+  uint64_t syscallCounts[SV_STATS_MAX_SYSCALL_ID + 2];
+} t_sv;
 
-t_svError initSupervisor(void)
+
+bool svCreate(t_vm *vm)
+{
+  vm->sv = calloc(1, sizeof(t_sv));
+  if (vm->sv == NULL)
+    return false;
+  vm->sv->stackLowest = svStackTop;
+  vm->sv->batchSeed = 0x2545F491;
+  vm->sv->in = stdin;
+  vm->sv->out = stdout;
+  vm->sv->inStart = ftello(stdin);
+  return true;
+}
+
+
+void svDestroy(t_vm *vm)
+{
+  free(vm->sv);
+  vm->sv = NULL;
+}
+
+
+void svSetIO(t_vm *vm, FILE *in, FILE *out)
+{
+  vm->sv->in = in;
+  vm->sv->out = out;
+  vm->sv->inStart = ftello(in);
+}
+
+
+FILE *svGetInput(t_vm *vm)
+{
+  return vm->sv->in;
+}
+
+
+off_t svGetInputStart(t_vm *vm)
+{
+  return vm->sv->inStart;
+}
+
+
+t_svError initSupervisor(t_vm *vm, t_memSize stackSize)
 {
-  svStackBottom = svStackTop - SV_STACK_PAGE_SIZE;
-  t_memError merr = memMapArea(svStackBottom, SV_STACK_PAGE_SIZE, NULL);
+  t_sv *sv = vm->sv;
+  /* The whole stack is mapped at once; the host only allocates the parts
+   * that are actually used. */
+  if (stackSize == 0 || stackSize > svStackTop)
+    return SV_MEMORY_ERROR;
+  stackSize = (stackSize + SV_STACK_PAGE_SIZE - 1) & ~(SV_STACK_PAGE_SIZE - 1);
+  sv->stackBottom = svStackTop - stackSize;
+  t_memError merr = memMapArea(vm, sv->stackBottom, stackSize);
   if (merr != MEM_NO_ERROR)
     return SV_MEMORY_ERROR;
-  cpuSetRegister(CPU_REG_SP, svStackTop - 4);
+  cpuSetRegister(vm, CPU_REG_SP, svStackTop - 4);
   return SV_NO_ERROR;
 }
 
 
-void svExpandStack(void)
+static bool svTimeoutExpired(t_sv *sv)
 {
-  t_memAddress faultAddr = memGetLastFaultAddress();
-  if (faultAddr < svStackBottom &&
-      faultAddr >= (svStackBottom - SV_STACK_PAGE_SIZE)) {
-    svStackBottom -= SV_STACK_PAGE_SIZE;
-    memMapArea(svStackBottom, SV_STACK_PAGE_SIZE, NULL);
-  }
+  if (!sv->deadlineSet)
+    return false;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec > sv->deadline.tv_sec ||
+      (now.tv_sec == sv->deadline.tv_sec &&
+          now.tv_nsec >= sv->deadline.tv_nsec);
+}
+
+/* SIGALRM interrupts the reads when the timeout expires, which stops the
+ * program instead of returning an error */
+static bool svReadInterrupted(t_sv *sv)
+{
+  if (!ferror(sv->in) || !svTimeoutExpired(sv))
+    return false;
+  clearerr(sv->in);
+  return true;
 }
 
 
@@ -40,32 +126,47 @@ enum {
   SV_SYSCALL_EXIT = 93
 };
 
-t_svStatus svHandleEnvCall(void)
+t_svStatus svHandleEnvCall(t_vm *vm)
 {
-  t_cpuURegValue syscallId = cpuGetRegister(CPU_REG_A7);
+  t_sv *sv = vm->sv;
+  t_cpuURegValue syscallId = cpuGetRegister(vm, CPU_REG_A7);
   int32_t ret;
+  int consumed;
+
+  if (syscallId <= SV_STATS_MAX_SYSCALL_ID)
+    sv->syscallCounts[syscallId]++;
+  else
+    sv->syscallCounts[SV_STATS_MAX_SYSCALL_ID + 1]++;
 
   switch (syscallId) {
     case SV_SYSCALL_PRINT_INT:
-      fprintf(stdout, "%d", cpuGetRegister(CPU_REG_A0));
+      fprintf(sv->out, "%d", cpuGetRegister(vm, CPU_REG_A0));
       break;
     case SV_SYSCALL_READ_INT:
-      fputs("int value? >", stdout);
-      fscanf(stdin, "%" PRId32, &ret);
-      cpuSetRegister(CPU_REG_A0, (t_cpuURegValue)ret);
+      fputs("int value? >", sv->out);
+      consumed = 0;
+      fscanf(sv->in, "%" PRId32 "%n", &ret, &consumed);
+      if (svReadInterrupted(sv))
+        return SV_STATUS_TIMEOUT;
+      sv->stdinOffset += (uint64_t)consumed;
+      cpuSetRegister(vm, CPU_REG_A0, (t_cpuURegValue)ret);
       break;
     case SV_SYSCALL_EXIT_0:
-      svExitCode = 0;
+      sv->exitCode = 0;
       return SV_STATUS_TERMINATED;
     case SV_SYSCALL_PRINT_CHAR:
-      putchar((int)cpuGetRegister(CPU_REG_A0));
+      putc((int)cpuGetRegister(vm, CPU_REG_A0), sv->out);
       break;
     case SV_SYSCALL_READ_CHAR:
-      ret = getchar();
-      cpuSetRegister(CPU_REG_A0, (t_cpuURegValue)ret);
+      ret = getc(sv->in);
+      if (svReadInterrupted(sv))
+        return SV_STATUS_TIMEOUT;
+      if (ret != EOF)
+        sv->stdinOffset++;
+      cpuSetRegister(vm, CPU_REG_A0, (t_cpuURegValue)ret);
       break;
     case SV_SYSCALL_EXIT:
-      svExitCode = (int)cpuGetRegister(CPU_REG_A0);
+      sv->exitCode = (int)cpuGetRegister(vm, CPU_REG_A0);
       return SV_STATUS_TERMINATED;
     default:
       return SV_STATUS_INVALID_SYSCALL;
@@ -75,40 +176,232 @@ t_svStatus svHandleEnvCall(void)
 }
 
 
-t_isaInt svGetExitCode(void)
+t_isaInt svGetExitCode(t_vm *vm)
 {
-  return svExitCode;
+  return vm->sv->exitCode;
 }
 
 
-t_svStatus svVMTick(void)
+void svSetInstructionLimit(t_vm *vm, uint64_t maxInstructions)
 {
-  t_svStatus status = SV_STATUS_RUNNING;
+  vm->sv->maxInstructions = maxInstructions;
+}
+
+
+void svSetTimeout(t_vm *vm, double seconds)
+{
+  vm->sv->timeout = seconds;
+  vm->sv->deadlineSet = false;
+}
 
-  t_dbgResult dbgRes = dbgTick();
-  if (dbgRes == DBG_RESULT_EXIT) {
-    status = SV_STATUS_KILLED;
-  } else {
-    t_cpuStatus cpuStatus = cpuTick();
-    if (cpuStatus == CPU_STATUS_MEMORY_FAULT) {
-      svExpandStack();
-      cpuClearLastFault();
-      cpuStatus = cpuTick();
-    }
 
-    if (cpuStatus == CPU_STATUS_ECALL_TRAP) {
-      status = svHandleEnvCall();
-      if (status == SV_STATUS_RUNNING)
-        cpuClearLastFault();
-    } else if (cpuStatus == CPU_STATUS_EBREAK_TRAP) {
-      if (dbgGetEnabled())
-        dbgRequestEnter();
-      cpuClearLastFault();
-    } else if (cpuStatus == CPU_STATUS_ILL_INST_FAULT)
-      status = SV_STATUS_ILL_INST_FAULT;
-    else if (cpuStatus == CPU_STATUS_MEMORY_FAULT)
-      status = SV_STATUS_MEMORY_FAULT;
+static void svAlarmHandler(int sig)
+{
+  /* the signal only needs to interrupt the read, the caller checks the
+   * deadline afterwards */
+  (void)sig;
+}
+
+static void svStartTimeout(t_sv *sv)
+{
+  time_t sec = (time_t)sv->timeout;
+  long nsec = (long)((sv->timeout - (double)sec) * 1e9);
+  clock_gettime(CLOCK_MONOTONIC, &sv->deadline);
+  sv->deadline.tv_sec += sec;
+  sv->deadline.tv_nsec += nsec;
+  if (sv->deadline.tv_nsec >= 1000000000) {
+    sv->deadline.tv_sec++;
+    sv->deadline.tv_nsec -= 1000000000;
   }
+  sv->deadlineSet = true;
+  /* other streams, like the ones of batches and fork servers, never block,
+   * and a process-wide timer would not work for multiple VMs */
+  if (sv->in != stdin)
+    return;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = svAlarmHandler;
+  sigemptyset(&sa.sa_mask);
+  /* without SA_RESTART a program waiting for input is interrupted too */
+  sigaction(SIGALRM, &sa, NULL);
+
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = sec;
+  timer.it_value.tv_usec = (suseconds_t)(nsec / 1000);
+  if (timer.it_value.tv_sec == 0 && timer.it_value.tv_usec == 0)
+    timer.it_value.tv_usec = 1;
+  setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+
+static int svCompareHotPCs(const void *a, const void *b)
+{
+  const t_svHotPC *x = a, *y = b;
+  if (x->count != y->count)
+    return x->count > y->count ? -1 : 1;
+  return x->pc < y->pc ? -1 : (x->pc > y->pc);
+}
+
+unsigned svGetHotPCs(
+    t_vm *vm, t_svHotPC *out, unsigned max, unsigned *runs)
+{
+  t_sv *sv = vm->sv;
+  t_svHotPC pcs[SV_HOT_PC_RUNS];
+  unsigned n = 0;
+  for (unsigned i = 0; i < sv->hotPCCount; i++) {
+    t_memAddress pc = sv->hotPCs[i];
+    unsigned j = 0;
+    while (j < n && pcs[j].pc != pc)
+      j++;
+    if (j == n) {
+      pcs[n].pc = pc;
+      pcs[n++].count = 0;
+    }
+    pcs[j].count++;
+  }
+  if (runs)
+    *runs = sv->hotPCCount;
+  qsort(pcs, n, sizeof(t_svHotPC), svCompareHotPCs);
+  if (n > max)
+    n = max;
+  memcpy(out, pcs, sizeof(t_svHotPC) * n);
+  return n;
+}
+
+
+void svGetState(t_vm *vm, t_svState *out)
+{
+  t_sv *sv = vm->sv;
+  out->stackBottom = sv->stackBottom;
+  out->exitCode = sv->exitCode;
+  out->stdinOffset = sv->stdinOffset;
+}
+
+
+void svSetState(t_vm *vm, const t_svState *state)
+{
+  t_sv *sv = vm->sv;
+  sv->stackBottom = state->stackBottom;
+  sv->exitCode = state->exitCode;
+  sv->stdinOffset = state->stdinOffset;
+}
+
+
+uint64_t svGetSyscallCount(t_vm *vm, t_cpuURegValue id)
+{
+  t_sv *sv = vm->sv;
+  if (id > SV_STATS_MAX_SYSCALL_ID)
+    return sv->syscallCounts[SV_STATS_MAX_SYSCALL_ID + 1];
+  return sv->syscallCounts[id];
+}
+
+
+t_memSize svGetStackDepth(t_vm *vm)
+{
+  t_sv *sv = vm->sv;
+  /* The host only allocates the stack pages which were accessed, so the
+   * deepest point reached is within the lowest of them */
+  t_memAddress addr = sv->stackLowest;
+  if (!sv->stackRead)
+    addr = memGetFirstUsed(vm, sv->stackBottom, svStackTop - sv->stackBottom);
+  t_memAddress sp = cpuGetRegister(vm, CPU_REG_SP);
+  if (sp >= sv->stackBottom && sp < addr)
+    addr = sp;
+  return svStackTop - addr;
+}
+
+void svSaveStackDepth(t_vm *vm)
+{
+  t_sv *sv = vm->sv;
+  if (sv->stackRead)
+    return;
+  sv->stackLowest = svStackTop - svGetStackDepth(vm);
+  sv->stackRead = true;
+}
+
+
+static t_svStatus svHandleCpuStatus(t_vm *vm, t_cpuStatus cpuStatus)
+{
+  t_svStatus status = SV_STATUS_RUNNING;
+
+  if (cpuStatus == CPU_STATUS_ECALL_TRAP) {
+    status = svHandleEnvCall(vm);
+    if (status == SV_STATUS_RUNNING)
+      cpuClearLastFault(vm);
+  } else if (cpuStatus == CPU_STATUS_EBREAK_TRAP) {
+    if (dbgGetEnabled())
+      dbgRequestEnter();
+    cpuClearLastFault(vm);
+  } else if (cpuStatus == CPU_STATUS_ILL_INST_FAULT)
+    status = SV_STATUS_ILL_INST_FAULT;
+  else if (cpuStatus == CPU_STATUS_MEMORY_FAULT)
+    status = SV_STATUS_MEMORY_FAULT;
 
   return status;
 }
+
+
+t_svStatus svVMTick(t_vm *vm)
+{
+  return svVMRun(vm, SV_RUN_BATCH_SIZE);
+}
+
+
+/* Returns a pseudo-random batch size, SV_LIMITED_BATCH_SIZE on average.
+ * Batches of a fixed size would always stop at the same pc of a loop whose
+ * length divides it, and svGetHotPCs() would not sample where the program
+ * spends its time. The sequence is the same for every run. */
+static uint32_t svNextBatchSize(t_sv *sv)
+{
+  uint32_t x = sv->batchSeed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  sv->batchSeed = x;
+  return SV_LIMITED_BATCH_SIZE / 2 + x % SV_LIMITED_BATCH_SIZE;
+}
+
+t_svStatus svVMRun(t_vm *vm, uint32_t maxInstructions)
+{
+  t_sv *sv = vm->sv;
+  if (sv->timeout > 0) {
+    if (!sv->deadlineSet)
+      svStartTimeout(sv);
+    else if (svTimeoutExpired(sv))
+      return SV_STATUS_TIMEOUT;
+  }
+  if (sv->timeout > 0 || sv->maxInstructions > 0) {
+    uint32_t size = svNextBatchSize(sv);
+    if (maxInstructions > size)
+      maxInstructions = size;
+  }
+  if (sv->maxInstructions > 0) {
+    /* the CPU stops exactly when the budget is exhausted */
+    uint64_t retired = cpuGetInstret(vm);
+    if (retired >= sv->maxInstructions)
+      return SV_STATUS_INST_LIMIT;
+    if (sv->maxInstructions - retired < maxInstructions)
+      maxInstructions = (uint32_t)(sv->maxInstructions - retired);
+  }
+
+  t_cpuStatus cpuStatus;
+  if (!dbgGetEnabled()) {
+    cpuStatus = cpuRun(vm, maxInstructions);
+  } else {
+    if (dbgTick() == DBG_RESULT_EXIT)
+      return SV_STATUS_KILLED;
+    cpuStatus = cpuTick(vm);
+  }
+  sv->hotPCs[sv->hotPCNext] = cpuGetRegister(vm, CPU_REG_PC);
+  sv->hotPCNext = (sv->hotPCNext + 1) % SV_HOT_PC_RUNS;
+  if (sv->hotPCCount < SV_HOT_PC_RUNS)
+    sv->hotPCCount++;
+  if (sv->stackRead) {
+    t_memAddress sp = cpuGetRegister(vm, CPU_REG_SP);
+    if (sp >= sv->stackBottom && sp < sv->stackLowest)
+      sv->stackLowest = sp;
+  }
+  return svHandleCpuStatus(vm, cpuStatus);
+}
@@ -1,10 +1,25 @@
 #ifndef SUPERVISOR_H
 #define SUPERVISOR_H
 
+#include <stdio.h>
+#include <sys/types.h>
 #include "isa.h"
 #include "cpu.h"
 
 #define SV_STACK_PAGE_SIZE 4096
+#define SV_DEFAULT_STACK_SIZE (8 * 1024 * 1024)
+/* Calls to syscalls with larger IDs are counted together */
+#define SV_STATS_MAX_SYSCALL_ID 127
+/* Maximum number of instructions executed by svVMTick() when the debugger
+ * is disabled */
+#define SV_RUN_BATCH_SIZE 65536
+/* Average of the same for programs with an instruction limit or a timeout,
+ * which stop more often so that the timeout is checked and svGetHotPCs()
+ * has more samples. The actual sizes vary so that the samples do not
+ * depend on the length of the loops. */
+#define SV_LIMITED_BATCH_SIZE 4096
+/* Number of calls to svVMRun() remembered by svGetHotPCs() */
+#define SV_HOT_PC_RUNS 64
 
 typedef int t_svError;
 enum {
@@ -17,14 +32,69 @@ enum {
   SV_STATUS_RUNNING = 0,
   SV_STATUS_TERMINATED = 1,
   SV_STATUS_KILLED = 2,
+  SV_STATUS_INST_LIMIT = 3,
+  SV_STATUS_TIMEOUT = 4,
   SV_STATUS_MEMORY_FAULT = CPU_STATUS_MEMORY_FAULT,
   SV_STATUS_ILL_INST_FAULT = CPU_STATUS_ILL_INST_FAULT,
   SV_STATUS_INVALID_SYSCALL = -1000
 };
 
+/* Instruction where the recent calls to svVMRun() stopped most often */
+typedef struct {
+  t_memAddress pc;
+  uint32_t count;
+} t_svHotPC;
 
-t_svError initSupervisor(void);
-t_svStatus svVMTick(void);
-t_isaInt svGetExitCode(void);
+/* State saved by checkpoints */
+typedef struct {
+  t_memAddress stackBottom;
+  t_isaInt exitCode;
+  uint64_t stdinOffset; /* bytes read by the program from stdin */
+} t_svState;
+
+
+/* Called by vmNew() and vmFree() */
+bool svCreate(t_vm *vm);
+void svDestroy(t_vm *vm);
+
+/* Sets the streams used by the program for input and output, by default
+ * the standard input and output */
+void svSetIO(t_vm *vm, FILE *in, FILE *out);
+FILE *svGetInput(t_vm *vm);
+/* Position of the input stream when it was set, or -1 if the stream cannot
+ * seek */
+off_t svGetInputStart(t_vm *vm);
+t_svError initSupervisor(t_vm *vm, t_memSize stackSize);
+t_svStatus svVMTick(t_vm *vm);
+/* Like svVMTick(), but executes at most maxInstructions instructions */
+t_svStatus svVMRun(t_vm *vm, uint32_t maxInstructions);
+t_isaInt svGetExitCode(t_vm *vm);
+
+/* Stops the program with SV_STATUS_INST_LIMIT once it retired
+ * maxInstructions instructions, or 0 for no limit */
+void svSetInstructionLimit(t_vm *vm, uint64_t maxInstructions);
+/* Stops the program with SV_STATUS_TIMEOUT after the given wall-clock time,
+ * or 0 for no limit. The time starts at the next call to svVMRun(), and it
+ * is checked by each call. When the program reads the standard input,
+ * SIGALRM interrupts the reads which would block past the timeout. */
+void svSetTimeout(t_vm *vm, double seconds);
+/* Returns the max pcs at which the last SV_HOT_PC_RUNS calls to svVMRun()
+ * stopped most often, sorted by count, and the number of calls in runs if it
+ * is not NULL. With an instruction limit or a timeout the calls stop after
+ * a varying number of instructions, so the pcs are a sample of where a
+ * stopped program was spending its time. */
+unsigned svGetHotPCs(
+    t_vm *vm, t_svHotPC *out, unsigned max, unsigned *runs);
+
+void svGetState(t_vm *vm, t_svState *out);
+void svSetState(t_vm *vm, const t_svState *state);
+/* Use SV_STATS_MAX_SYSCALL_ID + 1 for the calls with larger IDs */
+uint64_t svGetSyscallCount(t_vm *vm, t_cpuURegValue id);
+t_memSize svGetStackDepth(t_vm *vm);
+/* Records the depth of the stack before all of its memory is read, e.g. to
+ * save a checkpoint, which makes the host allocate the unused pages too.
+ * From then on, the depth only grows with the stack pointer seen at the
+ * end of each call to svVMRun(). */
+void svSaveStackDepth(t_vm *vm);
 
 #endif
@@ -0,0 +1,302 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "sweep.h"
+#include "cpu.h"
+#include "trace.h"
+
+/* All the LRU caches with the same line size and number of sets can be
+ * simulated at once: an access hits in a cache with N ways if and only if
+ * its line is among the N most recently used lines of its set (Mattson's
+ * stack algorithm). The accesses are stored as line numbers, then each
+ * thread computes the stack distances of its own subset of the sets. */
+#define SWEEP_MAX_WAYS 64
+#define SWEEP_MAX_SETS 65536
+#define SWEEP_MAX_THREADS 64
+#define SWEEP_NO_LINE UINT32_MAX
+
+
+typedef struct {
+  uint32_t thread;
+  /* stack distance histogram of each number of sets, indexed by
+   * level * (maxWays + 1) + distance. The last column counts the accesses
+   * that miss in every cache. */
+  uint64_t *hist;
+  bool ok;
+} t_sweepWorker;
+
+t_sweepConfig sweepConfig;
+uint32_t sweepLineShift;
+uint32_t sweepLevels; /* log2(maxSets) + 1 */
+uint32_t *sweepLines;
+uint64_t sweepCount;
+uint64_t sweepCapacity;
+bool sweepOutOfMemory;
+/* VM whose accesses are added by sweepAttachCPU() */
+t_vm *sweepVM;
+uint32_t sweepThreads;
+uint32_t sweepThreadShift;
+
+
+static bool sweepIsPowerOf2(uint32_t x)
+{
+  return x != 0 && (x & (x - 1)) == 0;
+}
+
+static uint32_t sweepLog2(uint32_t x)
+{
+  uint32_t res = 0;
+  while (x > 1) {
+    x >>= 1;
+    res++;
+  }
+  return res;
+}
+
+
+void sweepDefaultConfig(t_sweepConfig *out)
+{
+  out->lineSize = 32;
+  out->maxWays = 16;
+  out->maxSets = 1024;
+  out->stream = SWEEP_STREAM_DATA;
+}
+
+bool sweepParseConfig(const char *str, t_sweepConfig *out)
+{
+  char *end;
+  unsigned long values[3];
+
+  for (int i = 0; i < 3; i++) {
+    values[i] = strtoul(str, &end, 0);
+    if (end == str || !sweepIsPowerOf2((uint32_t)values[i]))
+      return false;
+    if (i < 2 && *end++ != ':')
+      return false;
+    str = end;
+  }
+  if (values[0] < 4 || values[0] > 4096 || values[1] > SWEEP_MAX_WAYS ||
+      values[2] > SWEEP_MAX_SETS)
+    return false;
+  out->lineSize = (uint32_t)values[0];
+  out->maxWays = (uint32_t)values[1];
+  out->maxSets = (uint32_t)values[2];
+  out->stream = SWEEP_STREAM_DATA;
+
+  if (*str == ':') {
+    str++;
+    if (strcmp(str, "d") == 0)
+      out->stream = SWEEP_STREAM_DATA;
+    else if (strcmp(str, "i") == 0)
+      out->stream = SWEEP_STREAM_INST;
+    else if (strcmp(str, "u") == 0)
+      out->stream = SWEEP_STREAM_UNIFIED;
+    else
+      return false;
+    str++;
+  }
+  return *str == '\0';
+}
+
+
+bool sweepInit(const t_sweepConfig *config)
+{
+  sweepConfig = *config;
+  sweepLineShift = sweepLog2(config->lineSize);
+  sweepLevels = sweepLog2(config->maxSets) + 1;
+  sweepCapacity = 1 << 20;
+  sweepLines = malloc(sizeof(uint32_t) * sweepCapacity);
+  return sweepLines != NULL;
+}
+
+static void sweepAdd(t_memAddress addr)
+{
+  if (sweepCount == sweepCapacity) {
+    uint32_t *lines =
+        realloc(sweepLines, sizeof(uint32_t) * sweepCapacity * 2);
+    if (lines == NULL) {
+      sweepOutOfMemory = true;
+      return;
+    }
+    sweepLines = lines;
+    sweepCapacity *= 2;
+  }
+  sweepLines[sweepCount++] = addr >> sweepLineShift;
+}
+
+static void sweepRetire(t_vm *vm, const t_cpuRetireInfo *info)
+{
+  if (sweepConfig.stream != SWEEP_STREAM_DATA)
+    sweepAdd(info->pc);
+  if (sweepConfig.stream != SWEEP_STREAM_INST && info->memSize > 0)
+    sweepAdd(info->memAddress);
+}
+
+bool sweepAttachCPU(t_vm *vm)
+{
+  if (sweepVM && sweepVM != vm)
+    return false;
+  sweepVM = vm;
+  return cpuAddObserver(vm, sweepRetire);
+}
+
+static void sweepTraceRecord(const t_traceRecord *rec)
+{
+  if (sweepConfig.stream != SWEEP_STREAM_DATA)
+    sweepAdd(rec->pc);
+  if (sweepConfig.stream != SWEEP_STREAM_INST && rec->memSize > 0)
+    sweepAdd(rec->memAddress);
+}
+
+bool sweepReadTrace(const char *path)
+{
+  return traceRead(path, sweepTraceRecord) == TRACE_NO_ERROR;
+}
+
+
+/* The set s of the caches with 2^k sets belongs to the thread
+ * (s + k) mod threads. With at least as many sets as threads every thread
+ * gets the same number of sets; the smaller caches are spread over
+ * different threads. */
+static void *sweepWorkerMain(void *arg)
+{
+  t_sweepWorker *worker = arg;
+  uint32_t ways = sweepConfig.maxWays;
+  uint32_t mask = sweepThreads - 1;
+  uint32_t *stacks[32];
+
+  for (uint32_t k = 0; k < sweepLevels; k++) {
+    uint32_t sets = (1u << k) >> sweepThreadShift;
+    size_t size = sizeof(uint32_t) * (sets ? sets : 1) * ways;
+    stacks[k] = malloc(size);
+    if (stacks[k] == NULL) {
+      for (uint32_t j = 0; j < k; j++)
+        free(stacks[j]);
+      return NULL;
+    }
+    memset(stacks[k], 0xFF, size);
+  }
+
+  for (uint64_t i = 0; i < sweepCount; i++) {
+    uint32_t line = sweepLines[i];
+    for (uint32_t k = 0; k < sweepLevels; k++) {
+      uint32_t set = line & ((1u << k) - 1);
+      if (((set + k) & mask) != worker->thread)
+        continue;
+      uint32_t *stack = stacks[k] + (size_t)(set >> sweepThreadShift) * ways;
+      uint32_t dist = 0;
+      while (dist < ways && stack[dist] != line)
+        dist++;
+      worker->hist[k * (ways + 1) + dist]++;
+      if (dist == ways)
+        dist = ways - 1;
+      memmove(stack + 1, stack, sizeof(uint32_t) * dist);
+      stack[0] = line;
+    }
+  }
+
+  for (uint32_t k = 0; k < sweepLevels; k++)
+    free(stacks[k]);
+  worker->ok = true;
+  return NULL;
+}
+
+static uint64_t *sweepComputeHistogram(void)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  sweepThreads = 1;
+  while (sweepThreads * 2 <= (uint32_t)cores &&
+      sweepThreads * 2 <= SWEEP_MAX_THREADS)
+    sweepThreads *= 2;
+  sweepThreadShift = sweepLog2(sweepThreads);
+
+  size_t histSize = (size_t)sweepLevels * (sweepConfig.maxWays + 1);
+  uint64_t *hist = calloc(histSize * (sweepThreads + 1), sizeof(uint64_t));
+  t_sweepWorker workers[SWEEP_MAX_THREADS];
+  pthread_t threads[SWEEP_MAX_THREADS];
+  if (hist == NULL)
+    return NULL;
+
+  bool ok = true;
+  uint32_t started = 0;
+  for (uint32_t t = 0; t < sweepThreads; t++) {
+    workers[t].thread = t;
+    workers[t].hist = hist + histSize * (t + 1);
+    workers[t].ok = false;
+    if (pthread_create(&threads[t], NULL, sweepWorkerMain, &workers[t]) != 0)
+      break;
+    started++;
+  }
+  for (uint32_t t = 0; t < started; t++) {
+    pthread_join(threads[t], NULL);
+    ok = ok && workers[t].ok;
+  }
+  if (!ok || started < sweepThreads) {
+    free(hist);
+    return NULL;
+  }
+
+  for (uint32_t t = 0; t < sweepThreads; t++) {
+    for (size_t i = 0; i < histSize; i++)
+      hist[i] += workers[t].hist[i];
+  }
+  return hist;
+}
+
+static void sweepPrintSize(FILE *fp, uint64_t size)
+{
+  if (size >= 1024 * 1024 && size % (1024 * 1024) == 0)
+    fprintf(fp, "%9" PRIu64 "M", size / (1024 * 1024));
+  else if (size >= 1024 && size % 1024 == 0)
+    fprintf(fp, "%9" PRIu64 "K", size / 1024);
+  else
+    fprintf(fp, "%10" PRIu64, size);
+}
+
+bool sweepPrint(FILE *fp)
+{
+  static const char *streamNames[] = {"data", "instruction", "unified"};
+  if (sweepOutOfMemory)
+    return false;
+  uint64_t *hist = sweepComputeHistogram();
+  if (hist == NULL)
+    return false;
+
+  uint32_t ways = sweepConfig.maxWays;
+  fprintf(fp, "Cache sweep of %" PRIu64 " %s accesses\n", sweepCount,
+      streamNames[sweepConfig.stream]);
+  fprintf(fp, "  %" PRIu32 " byte lines, LRU replacement, %" PRIu32
+      " thread%s\n", sweepConfig.lineSize, sweepThreads,
+      sweepThreads > 1 ? "s" : "");
+  fprintf(fp, "  Miss ratio by cache size and number of ways:\n");
+  fprintf(fp, "  %10s", "size");
+  for (uint32_t w = 1; w <= ways; w *= 2)
+    fprintf(fp, " %7" PRIu32 "w", w);
+  fputc('\n', fp);
+
+  uint32_t maxLog = sweepLevels - 1 + sweepLog2(ways);
+  for (uint32_t s = 0; s <= maxLog; s++) {
+    fprintf(fp, "  ");
+    sweepPrintSize(fp, (uint64_t)sweepConfig.lineSize << s);
+    for (uint32_t w = 1, wLog = 0; w <= ways; w *= 2, wLog++) {
+      if (wLog > s || s - wLog >= sweepLevels) {
+        fprintf(fp, " %8s", "-");
+        continue;
+      }
+      const uint64_t *row = hist + (s - wLog) * (ways + 1);
+      uint64_t hits = 0;
+      for (uint32_t d = 0; d < w; d++)
+        hits += row[d];
+      fprintf(fp, " %7.2f%%",
+          sweepCount ? 100.0 * (double)(sweepCount - hits) /
+                  (double)sweepCount
+                     : 0.0);
+    }
+    fputc('\n', fp);
+  }
+
+  free(hist);
+  return true;
+}
@@ -0,0 +1,39 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "memory.h"
+
+typedef int t_sweepStream;
+enum {
+  SWEEP_STREAM_DATA,
+  SWEEP_STREAM_INST,
+  SWEEP_STREAM_UNIFIED
+};
+
+/* Computes the LRU miss ratio of every cache with the given line size, a
+ * power of two number of sets up to maxSets and up to maxWays ways */
+typedef struct {
+  uint32_t lineSize;
+  uint32_t maxWays;
+  uint32_t maxSets;
+  t_sweepStream stream;
+} t_sweepConfig;
+
+void sweepDefaultConfig(t_sweepConfig *out);
+/* Parses a configuration in the LINE:WAYS:SETS[:d|i|u] format */
+bool sweepParseConfig(const char *str, t_sweepConfig *out);
+
+bool sweepInit(const t_sweepConfig *config);
+/* Adds the accesses of every retired instruction to the sweep. Returns
+ * false if the sweep is attached to another VM. */
+bool sweepAttachCPU(t_vm *vm);
+/* Adds the accesses recorded in a trace file (see trace.h) to the sweep */
+bool sweepReadTrace(const char *path);
+/* Analyzes the accesses with one thread per host core and prints the miss
+ * ratios */
+bool sweepPrint(FILE *fp);
+
+#endif
@@ -0,0 +1,44 @@
+# Test initialized data spanning several pages
+
+.text
+
+_start: la t0,first
+        lw a0,0(t0)
+        li t1,0x12345678
+        bne a0,t1,fail
+        la t0,last
+        lw a0,0(t0)
+        li t1,0x9abcdef0
+        bne a0,t1,fail
+        # the data must be writable
+        li t1,7
+        sw t1,0(t0)
+        lw a0,0(t0)
+        bne a0,t1,fail
+        la t0,middle
+        lw a0,0(t0)
+        bnez a0,fail
+pass:   la s0,pass_string
+1:      lb a0,0(s0)
+        beqz a0,2f
+        li a7,11
+        ecall
+        addi s0,s0,1
+        j 1b
+2:      li a7,93
+        li a0,0
+        ecall
+fail:   li a7,93
+        li a0,1
+        ecall
+
+.data
+
+pass_string:
+        .ascii "PASS!\n\0"
+        .align 2
+first:  .word 0x12345678
+        .space 20000
+middle: .word 0
+        .space 20000
+last:   .word 0x9abcdef0
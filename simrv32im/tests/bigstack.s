@@ -0,0 +1,33 @@
+# Test that large stack allocations do not need to touch every page
+
+.text
+
+_start: li t0,65536
+        sub sp,sp,t0
+        li t1,42
+        sw t1,0(sp)
+        li t2,-42
+        sw t2,-4(sp)
+        lw a0,0(sp)
+        bne a0,t1,fail
+        lw a0,-4(sp)
+        bne a0,t2,fail
+        add sp,sp,t0
+pass:   la s0,pass_string
+1:      lb a0,0(s0)
+        beqz a0,2f
+        li a7,11
+        ecall
+        addi s0,s0,1
+        j 1b
+2:      li a7,93
+        li a0,0
+        ecall
+fail:   li a7,93
+        li a0,1
+        ecall
+
+.data
+
+pass_string:
+        .ascii "PASS!\n\0"
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runs a manifest with passing and failing cases, then checks the report
+# and the exit code of the simulator
+dir=$(cd "$(dirname "$0")" && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fail() {
+  echo "batch: $*" >&2
+  exit 1
+}
+
+printf '7 hello\n' > "$tmp/in"
+printf 'int value? > hello\n' > "$tmp/good"
+printf 'int value? > bye\n' > "$tmp/bad"
+cat > "$tmp/manifest" <<END
+# passing cases
+$dir/echo.o in good 7
+$dir/echo.o in - 7
+# failing cases
+$dir/echo.o in bad 7
+$dir/echo.o in good 0
+$dir/spin.o - -
+$dir/fault.o - -
+END
+
+$SIM --batch="$tmp/manifest" --max-instructions=10000 > "$tmp/out"
+[ $? -eq 1 ] || fail "wrong exit code with failed cases"
+grep -q '^2 of 6 cases passed, 3 executables' "$tmp/out" ||
+  fail "wrong summary"
+[ "$(grep -c '^FAIL' "$tmp/out")" -eq 4 ] || fail "wrong failed cases"
+grep -q '^FAIL line 5: .*: wrong output' "$tmp/out" || fail "no wrong output"
+grep -q '^FAIL line 6: .*: wrong exit code (7, expected 0)' "$tmp/out" ||
+  fail "no wrong exit code"
+grep -q '^FAIL line 7: .*spin.o < -: instruction limit reached' "$tmp/out" ||
+  fail "no instruction limit"
+grep -q '^FAIL line 8: .*fault.o < -: memory fault at address 0x00000010' \
+    "$tmp/out" || fail "no memory fault"
+
+head -n 3 "$tmp/manifest" > "$tmp/pass"
+$SIM --batch="$tmp/pass" > "$tmp/out"
+[ $? -eq 0 ] || fail "wrong exit code without failed cases"
+grep -q '^2 of 2 cases passed' "$tmp/out" || fail "wrong summary when passing"
+echo "batch: PASS!"
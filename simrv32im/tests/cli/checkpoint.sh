@@ -0,0 +1,38 @@
+#!/bin/sh
+# Saves a checkpoint after the program read part of its input, then checks
+# that the restored program skips the input it already read
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fail() {
+  echo "checkpoint: $*" >&2
+  exit 1
+}
+
+printf '7 hello\nworld\n' > "$tmp/in"
+printf 'int value? > hello\nworld\n' > "$tmp/full"
+printf 'llo\nworld\n' > "$tmp/rest"
+
+$SIM -x --checkpoint-at=20 --checkpoint-file="$tmp/ckpt" "$dir/echo.o" \
+    < "$tmp/in" > "$tmp/out"
+[ $? -eq 7 ] || fail "wrong exit code while saving"
+cmp -s "$tmp/out" "$tmp/full" || fail "wrong output while saving"
+
+$SIM -x --restore="$tmp/ckpt" < "$tmp/in" > "$tmp/out"
+[ $? -eq 7 ] || fail "wrong exit code after restoring"
+cmp -s "$tmp/out" "$tmp/rest" || fail "wrong output after restoring"
+
+# the input is skipped from where it was when the simulator started
+printf 'xx7 hello\nworld\n' > "$tmp/in2"
+{
+  dd bs=1 count=2 > /dev/null 2>&1
+  $SIM -x --restore="$tmp/ckpt" > "$tmp/out"
+} < "$tmp/in2"
+[ $? -eq 7 ] || fail "wrong exit code after restoring from an offset"
+cmp -s "$tmp/out" "$tmp/rest" ||
+  fail "wrong output after restoring from an offset"
+
+cat "$tmp/in" | $SIM -x --restore="$tmp/ckpt" > "$tmp/out"
+[ $? -eq 7 ] || fail "wrong exit code after restoring from a pipe"
+cmp -s "$tmp/out" "$tmp/rest" || fail "wrong output after restoring from a pipe"
+echo "checkpoint: PASS!"
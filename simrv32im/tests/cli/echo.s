@@ -0,0 +1,19 @@
+# Reads an integer, then copies the rest of the input to the output and
+# exits with the integer as the exit code
+  .text
+  .global _start
+_start:
+  li a7, 5
+  ecall
+  addi s0, a0, 0
+again:
+  li a7, 12
+  ecall
+  blt a0, zero, finish
+  li a7, 11
+  ecall
+  j again
+finish:
+  addi a0, s0, 0
+  li a7, 93
+  ecall
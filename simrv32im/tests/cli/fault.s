@@ -0,0 +1,6 @@
+# Loads from an address which is not mapped
+  .text
+  .global _start
+_start:
+  li t0, 16
+  lw a0, 0(t0)
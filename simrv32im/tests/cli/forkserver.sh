@@ -0,0 +1,43 @@
+#!/bin/sh
+# Sends requests to the fork server and checks the header and the output
+# of each reply
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fail() {
+  echo "forkserver: $*" >&2
+  exit 1
+}
+
+# prints the header fields of the reply at the given offset: result, exit
+# code, address, instret (low and high), output size
+header() {
+  od -An -tu4 -j "$2" -N24 "$1"
+}
+
+# two requests, made of the size of the input followed by the input
+printf '\016\000\000\000' > "$tmp/req"
+printf '7 hello\nworld\n' >> "$tmp/req"
+printf '\003\000\000\000' >> "$tmp/req"
+printf '3 x' >> "$tmp/req"
+$SIM --fork-server "$dir/echo.o" < "$tmp/req" > "$tmp/reply"
+[ $? -eq 0 ] || fail "wrong exit code of the server"
+
+set -- $(header "$tmp/reply" 0)
+[ "$1 $2 $3 $6" = "0 7 0 25" ] || fail "wrong first header: $*"
+tail -c +25 "$tmp/reply" | head -c 25 > "$tmp/out"
+printf 'int value? > hello\nworld\n' | cmp -s - "$tmp/out" ||
+  fail "wrong first output"
+set -- $(header "$tmp/reply" 49)
+[ "$1 $2 $3 $6" = "0 3 0 14" ] || fail "wrong second header: $*"
+tail -c +74 "$tmp/reply" > "$tmp/out"
+printf 'int value? > x' | cmp -s - "$tmp/out" || fail "wrong second output"
+
+# the instruction limit applies to each request
+printf '\000\000\000\000' > "$tmp/req"
+$SIM --fork-server --max-instructions=777 "$dir/spin.o" < "$tmp/req" \
+    > "$tmp/reply"
+set -- $(header "$tmp/reply" 0)
+[ "$1 $4 $5 $6" = "5 777 0 0" ] || fail "wrong header at the limit: $*"
+[ "$(wc -c < "$tmp/reply")" -eq 24 ] || fail "wrong size at the limit"
+echo "forkserver: PASS!"
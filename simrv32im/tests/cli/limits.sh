@@ -0,0 +1,38 @@
+#!/bin/sh
+# Stops programs with the instruction limit and the timeout, and checks
+# the exit codes of the simulator
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fail() {
+  echo "limits: $*" >&2
+  exit 1
+}
+
+$SIM --max-instructions=1000 "$dir/spin.o" 2> "$tmp/err"
+[ $? -eq 102 ] || fail "wrong exit code for the instruction limit"
+grep -q 'limit reached after 1000 instructions' "$tmp/err" ||
+  fail "wrong message for the instruction limit"
+grep -q 'Most frequent stopping points' "$tmp/err" ||
+  fail "no stopping points for the instruction limit"
+
+# the stopping points are spread over the whole loop
+$SIM --max-instructions=100000 "$dir/spin.o" 2> "$tmp/err"
+[ "$(grep -c '^  0x' "$tmp/err")" -eq 4 ] ||
+  fail "wrong number of stopping points"
+
+$SIM -x --max-instructions=1000 "$dir/spin.o" 2> /dev/null
+[ $? -eq 124 ] || fail "wrong exit code for the instruction limit with -x"
+
+$SIM -x --timeout=0.2 "$dir/spin.o" 2> "$tmp/err"
+[ $? -eq 124 ] || fail "wrong exit code for the timeout with -x"
+grep -q '^Timeout after' "$tmp/err" || fail "wrong message for the timeout"
+
+# the timeout interrupts a program waiting for input
+sleep 1 | $SIM --timeout=0.2 "$dir/echo.o" > /dev/null 2>&1
+[ $? -eq 102 ] || fail "wrong exit code for the timeout while reading"
+
+echo '3 x' | $SIM -x --max-instructions=1000 --timeout=10 "$dir/echo.o" \
+    > /dev/null
+[ $? -eq 3 ] || fail "wrong exit code within the limits"
+echo "limits: PASS!"
@@ -0,0 +1,11 @@
+# Loops forever, in a loop whose length divides the batch size of the
+# supervisor
+  .text
+  .global _start
+_start:
+  li t0, 0
+spin:
+  addi t0, t0, 1
+  addi t1, t0, 1
+  addi t2, t0, 2
+  j spin
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Records the trace of a program, then checks that the dump has one line
+# for each instruction executed
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+fail() {
+  echo "trace: $*" >&2
+  exit 1
+}
+
+printf '7 hello\nworld\n' > "$tmp/in"
+$SIM -x --stats --trace="$tmp/trace" "$dir/echo.o" < "$tmp/in" \
+    > "$tmp/out" 2> "$tmp/stats"
+[ $? -eq 7 ] || fail "wrong exit code while tracing"
+printf 'int value? > hello\nworld\n' | cmp -s - "$tmp/out" ||
+  fail "wrong output while tracing"
+
+$SIM --trace-dump="$tmp/trace" > "$tmp/dump"
+[ $? -eq 0 ] || fail "wrong exit code of the dump"
+count=$(awk '$1 == "instructions" { print $2 }' "$tmp/stats")
+[ "$(wc -l < "$tmp/dump")" -eq "$count" ] || fail "wrong number of lines"
+head -n 1 "$tmp/dump" |
+  grep -q '^00001000: 00500893  ADDI x17, x0, 5 .*x17 = 00000005$' ||
+  fail "wrong first instruction"
+tail -n 1 "$tmp/dump" | grep -q '^0000102c: 00000073  ECALL' ||
+  fail "wrong last instruction"
+
+# the trace of a program stopped by a limit ends at the limit
+$SIM --max-instructions=50 --trace="$tmp/trace" "$dir/spin.o" 2> /dev/null
+[ $? -eq 102 ] || fail "wrong exit code at the limit"
+[ "$($SIM --trace-dump="$tmp/trace" | wc -l)" -eq 50 ] ||
+  fail "wrong number of lines at the limit"
+echo "trace: PASS!"
@@ -0,0 +1,62 @@
+# Test the counter CSRs
+
+.text
+
+_start: rdinstret s0
+        addi t0,zero,1
+        addi t0,t0,1
+        rdinstret s1
+        sub s1,s1,s0
+        li t1,3
+        bne s1,t1,fail
+        # count a loop long enough to be translated and compiled
+        li t2,1000
+        rdinstret s0
+1:      addi t2,t2,-1
+        bnez t2,1b
+        rdinstret s1
+        sub s1,s1,s0
+        li t1,2001
+        bne s1,t1,fail
+        # read the counters inside the loop
+        li t2,100
+        rdinstret s0
+1:      rdinstret s1
+        addi t2,t2,-1
+        bnez t2,1b
+        sub s1,s1,s0
+        li t1,298
+        bne s1,t1,fail
+        # without a timing model cycles are instructions
+        rdcycle s0
+        csrr s1,minstret
+        sub s1,s1,s0
+        li t1,1
+        bne s1,t1,fail
+        rdcycleh s0
+        bnez s0,fail
+        rdinstreth s0
+        bnez s0,fail
+        csrr s0,hpmcounter3
+        bnez s0,fail
+        rdtime s0
+        rdtime s1
+        bltu s1,s0,fail
+pass:   la s0,pass_string
+1:      lb a0,0(s0)
+        beqz a0,2f
+        li a7,11
+        ecall
+        addi s0,s0,1
+        j 1b
+2:      li a7,93
+        li a0,0
+        ecall
+fail:   li a7,93
+        li a0,1
+        ecall
+
+.data
+
+pass_string:
+        .ascii "PASS!\n\0"
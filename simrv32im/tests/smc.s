@@ -0,0 +1,42 @@
+# Test that stores to already executed code are picked up by the CPU
+
+.text
+
+_start: li s1,0
+1:      addi a0,zero,1
+        bnez s1,2f
+        la t0,1b
+        la t1,new_inst
+        lw t2,0(t1)
+        sw t2,0(t0)
+        li s1,1
+        j 1b
+2:      li t0,2
+        bne a0,t0,fail
+        # patch the instruction right after the store
+        la t0,3f
+        li a0,0
+        sw t2,0(t0)
+3:      addi a0,zero,1
+        li t0,2
+        bne a0,t0,fail
+pass:   la s0,pass_string
+1:      lb a0,0(s0)
+        beqz a0,2f
+        li a7,11
+        ecall
+        addi s0,s0,1
+        j 1b
+2:      li a7,93
+        li a0,0
+        ecall
+fail:   li a7,93
+        li a0,1
+        ecall
+
+.data
+
+new_inst:
+        .word 0x00200513        # addi a0,zero,2
+pass_string:
+        .ascii "PASS!\n\0"
@@ -0,0 +1,40 @@
+# Test that the stack grows on demand during deep recursion
+
+.text
+
+_start: li a0,65536
+        jal sum
+        li t0,65536
+        bne a0,t0,fail
+pass:   la s0,pass_string
+1:      lb a0,0(s0)
+        beqz a0,2f
+        li a7,11
+        ecall
+        addi s0,s0,1
+        j 1b
+2:      li a7,93
+        li a0,0
+        ecall
+fail:   li a7,93
+        li a0,1
+        ecall
+
+# returns the number of nested calls, one per unit of a0
+sum:    addi sp,sp,-16
+        sw ra,12(sp)
+        sw a0,8(sp)
+        li a0,0
+        lw t0,8(sp)
+        beqz t0,1f
+        addi a0,t0,-1
+        jal sum
+        addi a0,a0,1
+1:      lw ra,12(sp)
+        addi sp,sp,16
+        jalr zero,ra,0
+
+.data
+
+pass_string:
+        .ascii "PASS!\n\0"
@@ -0,0 +1,471 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "trace.h"
+#include "cpu.h"
+#include "isa.h"
+#include "memory.h"
+
+/* The trace file starts with the magic "RVTR" and a version, followed by
+ * chunks made of the size of the records (32 bit), the size of the
+ * compressed data (32 bit) and the compressed data. All fields are
+ * little-endian. Each chunk can be decoded on its own.
+ *
+ * Each record starts with a flags byte, followed by:
+ *   if TRACE_FLAG_JUMP: the pc, as a delta from the address following the
+ *     previous record (zigzag varint)
+ *   the instruction word (32 bit)
+ *   if TRACE_FLAG_RD: the value written to rd, as a delta from the previous
+ *     value of the same register (zigzag varint)
+ *   if TRACE_FLAG_MEM: the address, as a delta from the previous address
+ *     (zigzag varint), and for stores the value stored (varint). The value
+ *     of a load is the value of rd. */
+#define TRACE_MAGIC "RVTR"
+#define TRACE_VERSION 1
+
+#define TRACE_FLAG_JUMP 0x01
+#define TRACE_FLAG_RD 0x02
+#define TRACE_FLAG_MEM 0x04
+#define TRACE_FLAG_STORE 0x08
+#define TRACE_FLAG_SIZE_SHIFT 4 /* log2 of the access size, 2 bits */
+
+#define TRACE_CHUNK_SIZE (1 << 20)
+#define TRACE_MAX_RECORD_SIZE 32
+#define TRACE_COMPRESS_BOUND(n) ((n) + (n) / 64 + 16)
+
+#define TRACE_HASH_BITS 14
+#define TRACE_MIN_MATCH 4
+#define TRACE_MAX_OFFSET 65535
+
+
+/* State of the delta encoding, reset at the beginning of every chunk */
+typedef struct {
+  t_memAddress nextPC;
+  t_memAddress memAddress;
+  uint32_t regs[32];
+} t_traceDeltaState;
+
+FILE *traceFile;
+bool traceWriteError;
+/* The simulator fills one buffer while the writer thread compresses and
+ * writes the other one */
+uint8_t *traceBuffers[2];
+int traceActive;
+size_t traceUsed;
+t_traceDeltaState traceState;
+
+pthread_t traceWriter;
+pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t traceCond = PTHREAD_COND_INITIALIZER;
+/* buffer handed to the writer thread, -1 if none */
+int tracePending = -1;
+size_t tracePendingSize;
+bool traceStopping;
+
+
+/*
+ * Encoding helpers
+ */
+
+static uint32_t traceZigzag(uint32_t delta)
+{
+  return (delta << 1) ^ (uint32_t)-(int32_t)(delta >> 31);
+}
+
+static uint32_t traceUnzigzag(uint32_t value)
+{
+  return (value >> 1) ^ (uint32_t)-(int32_t)(value & 1);
+}
+
+static uint8_t *tracePutVarint(uint8_t *p, uint32_t value)
+{
+  while (value >= 0x80) {
+    *p++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (uint8_t)value;
+  return p;
+}
+
+/* Returns false if the varint does not end before end */
+static bool traceGetVarint(const uint8_t **p, const uint8_t *end, uint32_t *out)
+{
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+    uint8_t byte = *(*p)++;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *out = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void tracePutU32(uint8_t *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t traceGetU32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+      ((uint32_t)p[3] << 24);
+}
+
+
+/*
+ * Compression
+ */
+
+/* Byte-oriented LZ77. The output is a sequence of literal runs, each one
+ * followed by a match except for the last:
+ *   number of literals (varint), literals,
+ *   match length - TRACE_MIN_MATCH (varint), match offset (varint) */
+static size_t traceCompress(const uint8_t *in, size_t size, uint8_t *out)
+{
+  static uint32_t table[1 << TRACE_HASH_BITS];
+  uint8_t *p = out;
+  size_t anchor = 0, i = 0;
+
+  memset(table, 0, sizeof(table));
+  while (i + TRACE_MIN_MATCH <= size) {
+    uint32_t word = traceGetU32(in + i);
+    uint32_t hash = (word * 2654435761u) >> (32 - TRACE_HASH_BITS);
+    size_t cand = table[hash];
+    table[hash] = (uint32_t)i + 1;
+    if (cand == 0 || i + 1 - cand > TRACE_MAX_OFFSET ||
+        traceGetU32(in + cand - 1) != word) {
+      /* skip faster through data that does not compress */
+      i += 1 + ((i - anchor) >> 6);
+      continue;
+    }
+    cand--;
+
+    size_t length = TRACE_MIN_MATCH;
+    while (i + length < size && in[cand + length] == in[i + length])
+      length++;
+    p = tracePutVarint(p, (uint32_t)(i - anchor));
+    memcpy(p, in + anchor, i - anchor);
+    p += i - anchor;
+    p = tracePutVarint(p, (uint32_t)(length - TRACE_MIN_MATCH));
+    p = tracePutVarint(p, (uint32_t)(i - cand));
+    i += length;
+    anchor = i;
+  }
+
+  p = tracePutVarint(p, (uint32_t)(size - anchor));
+  memcpy(p, in + anchor, size - anchor);
+  p += size - anchor;
+  return (size_t)(p - out);
+}
+
+/* Returns the size of the decompressed data, or SIZE_MAX if invalid */
+static size_t traceDecompress(
+    const uint8_t *in, size_t size, uint8_t *out, size_t maxSize)
+{
+  const uint8_t *end = in + size;
+  size_t n = 0;
+
+  while (in < end) {
+    uint32_t literals, length, offset;
+    if (!traceGetVarint(&in, end, &literals) ||
+        literals > (size_t)(end - in) || literals > maxSize - n)
+      return SIZE_MAX;
+    memcpy(out + n, in, literals);
+    in += literals;
+    n += literals;
+    if (in == end)
+      break;
+
+    if (!traceGetVarint(&in, end, &length) ||
+        !traceGetVarint(&in, end, &offset))
+      return SIZE_MAX;
+    length += TRACE_MIN_MATCH;
+    if (offset == 0 || offset > n || length > maxSize - n)
+      return SIZE_MAX;
+    /* the match can overlap the bytes it produces */
+    for (uint32_t i = 0; i < length; i++, n++)
+      out[n] = out[n - offset];
+  }
+  return n;
+}
+
+
+/*
+ * Writer thread
+ */
+
+static void *traceWriterMain(void *arg)
+{
+  uint8_t *compressed = malloc(TRACE_COMPRESS_BOUND(TRACE_CHUNK_SIZE));
+
+  pthread_mutex_lock(&traceLock);
+  for (;;) {
+    while (tracePending < 0 && !traceStopping)
+      pthread_cond_wait(&traceCond, &traceLock);
+    if (tracePending < 0)
+      break;
+    const uint8_t *chunk = traceBuffers[tracePending];
+    size_t size = tracePendingSize;
+    pthread_mutex_unlock(&traceLock);
+
+    bool ok = compressed != NULL;
+    if (ok) {
+      uint8_t header[8];
+      size_t compSize = traceCompress(chunk, size, compressed);
+      tracePutU32(header, (uint32_t)size);
+      tracePutU32(header + 4, (uint32_t)compSize);
+      ok = fwrite(header, 8, 1, traceFile) == 1 &&
+          fwrite(compressed, compSize, 1, traceFile) == 1;
+    }
+
+    pthread_mutex_lock(&traceLock);
+    if (!ok)
+      traceWriteError = true;
+    tracePending = -1;
+    pthread_cond_broadcast(&traceCond);
+  }
+  pthread_mutex_unlock(&traceLock);
+
+  free(compressed);
+  return NULL;
+}
+
+/* Hands the active buffer to the writer thread. Waits only if the writer
+ * has not finished the previous chunk yet. */
+static void traceFlushChunk(void)
+{
+  pthread_mutex_lock(&traceLock);
+  while (tracePending >= 0)
+    pthread_cond_wait(&traceCond, &traceLock);
+  tracePending = traceActive;
+  tracePendingSize = traceUsed;
+  pthread_cond_broadcast(&traceCond);
+  pthread_mutex_unlock(&traceLock);
+
+  traceActive ^= 1;
+  traceUsed = 0;
+  memset(&traceState, 0, sizeof(traceState));
+}
+
+
+/*
+ * Recording
+ */
+
+static void traceRetire(t_vm *vm, const t_cpuRetireInfo *info)
+{
+  uint8_t *start = traceBuffers[traceActive] + traceUsed;
+  uint8_t *p = start + 1;
+  uint8_t flags = 0;
+
+  if (info->pc != traceState.nextPC) {
+    flags |= TRACE_FLAG_JUMP;
+    p = tracePutVarint(p, traceZigzag(info->pc - traceState.nextPC));
+  }
+  tracePutU32(p, memDebugRead32(vm, info->pc, NULL));
+  p += 4;
+
+  if (info->rd != CPU_REG_ZERO) {
+    uint32_t value = cpuGetRegister(vm, info->rd);
+    flags |= TRACE_FLAG_RD;
+    p = tracePutVarint(p, traceZigzag(value - traceState.regs[info->rd]));
+    traceState.regs[info->rd] = value;
+  }
+
+  if (info->memSize > 0) {
+    int sizeLog2 = info->memSize == 4 ? 2 : info->memSize == 2 ? 1 : 0;
+    flags |= TRACE_FLAG_MEM | (uint8_t)(sizeLog2 << TRACE_FLAG_SIZE_SHIFT);
+    p = tracePutVarint(
+        p, traceZigzag(info->memAddress - traceState.memAddress));
+    traceState.memAddress = info->memAddress;
+    if (info->instClass == CPU_CLASS_STORE) {
+      uint32_t value = cpuGetRegister(vm, info->rs2);
+      if (info->memSize < 4)
+        value &= ((uint32_t)1 << (info->memSize * 8)) - 1;
+      flags |= TRACE_FLAG_STORE;
+      p = tracePutVarint(p, value);
+    }
+  }
+
+  *start = flags;
+  traceState.nextPC = info->pc + 4;
+  traceUsed = (size_t)(p - traceBuffers[traceActive]);
+  if (traceUsed > TRACE_CHUNK_SIZE - TRACE_MAX_RECORD_SIZE)
+    traceFlushChunk();
+}
+
+t_traceError traceOpen(t_vm *vm, const char *path)
+{
+  if (traceFile != NULL)
+    return TRACE_IN_USE;
+  traceBuffers[0] = malloc(TRACE_CHUNK_SIZE);
+  traceBuffers[1] = malloc(TRACE_CHUNK_SIZE);
+  if (!traceBuffers[0] || !traceBuffers[1])
+    return TRACE_OUT_OF_MEMORY;
+
+  traceFile = fopen(path, "wb");
+  if (traceFile == NULL)
+    return TRACE_FILE_ERROR;
+  uint8_t version[4];
+  tracePutU32(version, TRACE_VERSION);
+  fputs(TRACE_MAGIC, traceFile);
+  fwrite(version, 4, 1, traceFile);
+
+  if (pthread_create(&traceWriter, NULL, traceWriterMain, NULL) != 0) {
+    fclose(traceFile);
+    traceFile = NULL;
+    return TRACE_OUT_OF_MEMORY;
+  }
+  if (!cpuAddObserver(vm, traceRetire))
+    return TRACE_OUT_OF_MEMORY;
+  return TRACE_NO_ERROR;
+}
+
+t_traceError traceClose(void)
+{
+  if (traceFile == NULL)
+    return TRACE_NO_ERROR;
+  if (traceUsed > 0)
+    traceFlushChunk();
+
+  pthread_mutex_lock(&traceLock);
+  traceStopping = true;
+  pthread_cond_broadcast(&traceCond);
+  pthread_mutex_unlock(&traceLock);
+  pthread_join(traceWriter, NULL);
+
+  bool error = traceWriteError;
+  if (fclose(traceFile) != 0)
+    error = true;
+  traceFile = NULL;
+  free(traceBuffers[0]);
+  free(traceBuffers[1]);
+  return error ? TRACE_FILE_ERROR : TRACE_NO_ERROR;
+}
+
+
+/*
+ * Decoding
+ */
+
+static t_traceError traceReadChunk(
+    const uint8_t *p, size_t size, t_traceRecordFn fn)
+{
+  const uint8_t *end = p + size;
+  t_traceDeltaState state;
+  memset(&state, 0, sizeof(state));
+
+  while (p < end) {
+    t_traceRecord rec;
+    uint8_t flags = *p++;
+    uint32_t value;
+
+    rec.pc = state.nextPC;
+    if (flags & TRACE_FLAG_JUMP) {
+      if (!traceGetVarint(&p, end, &value))
+        return TRACE_INVALID_FORMAT;
+      rec.pc += traceUnzigzag(value);
+    }
+    if (end - p < 4)
+      return TRACE_INVALID_FORMAT;
+    rec.inst = traceGetU32(p);
+    p += 4;
+
+    rec.rd = CPU_REG_ZERO;
+    rec.rdValue = 0;
+    if (flags & TRACE_FLAG_RD) {
+      rec.rd = (t_cpuRegID)ISA_INST_RD(rec.inst);
+      if (!traceGetVarint(&p, end, &value))
+        return TRACE_INVALID_FORMAT;
+      rec.rdValue = state.regs[rec.rd] += traceUnzigzag(value);
+    }
+
+    rec.memSize = 0;
+    rec.store = false;
+    if (flags & TRACE_FLAG_MEM) {
+      rec.memSize = (uint8_t)(1 << ((flags >> TRACE_FLAG_SIZE_SHIFT) & 3));
+      if (!traceGetVarint(&p, end, &value))
+        return TRACE_INVALID_FORMAT;
+      rec.memAddress = state.memAddress += traceUnzigzag(value);
+      if (flags & TRACE_FLAG_STORE) {
+        rec.store = true;
+        if (!traceGetVarint(&p, end, &rec.memValue))
+          return TRACE_INVALID_FORMAT;
+      } else {
+        rec.memValue = rec.rdValue;
+      }
+    }
+
+    fn(&rec);
+    state.nextPC = rec.pc + 4;
+  }
+  return TRACE_NO_ERROR;
+}
+
+t_traceError traceRead(const char *path, t_traceRecordFn fn)
+{
+  t_traceError res = TRACE_NO_ERROR;
+  uint8_t header[8];
+
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return TRACE_FILE_ERROR;
+  if (fread(header, 8, 1, fp) != 1 || memcmp(header, TRACE_MAGIC, 4) != 0 ||
+      traceGetU32(header + 4) != TRACE_VERSION) {
+    fclose(fp);
+    return TRACE_INVALID_FORMAT;
+  }
+
+  uint8_t *compressed = malloc(TRACE_COMPRESS_BOUND(TRACE_CHUNK_SIZE));
+  uint8_t *chunk = malloc(TRACE_CHUNK_SIZE);
+  if (!compressed || !chunk)
+    res = TRACE_OUT_OF_MEMORY;
+  while (res == TRACE_NO_ERROR && fread(header, 8, 1, fp) == 1) {
+    uint32_t size = traceGetU32(header);
+    uint32_t compSize = traceGetU32(header + 4);
+    if (size > TRACE_CHUNK_SIZE ||
+        compSize > TRACE_COMPRESS_BOUND(TRACE_CHUNK_SIZE) ||
+        fread(compressed, 1, compSize, fp) != compSize ||
+        traceDecompress(compressed, compSize, chunk, size) != size) {
+      res = TRACE_INVALID_FORMAT;
+      break;
+    }
+    res = traceReadChunk(chunk, size, fn);
+  }
+
+  free(compressed);
+  free(chunk);
+  fclose(fp);
+  return res;
+}
+
+
+static FILE *traceDumpOut;
+
+static void traceDumpRecord(const t_traceRecord *rec)
+{
+  FILE *out = traceDumpOut;
+  char buffer[80];
+
+  isaDisassemble(rec->inst, buffer, 80);
+  fprintf(out, "%08" PRIx32 ": %08" PRIx32 "  %-26s", rec->pc, rec->inst,
+      buffer);
+  if (rec->rd != CPU_REG_ZERO)
+    fprintf(out, "  x%-2d = %08" PRIx32, rec->rd, rec->rdValue);
+  if (rec->memSize > 0)
+    fprintf(out, "  [%08" PRIx32 "] %s %0*" PRIx32, rec->memAddress,
+        rec->store ? "<-" : "->", rec->memSize * 2, rec->memValue);
+  fputc('\n', out);
+}
+
+t_traceError traceDump(const char *path, FILE *out)
+{
+  traceDumpOut = out;
+  return traceRead(path, traceDumpRecord);
+}
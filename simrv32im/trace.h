@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "cpu.h"
+
+typedef int t_traceError;
+enum {
+  TRACE_NO_ERROR = 0,
+  TRACE_OUT_OF_MEMORY,
+  TRACE_FILE_ERROR,
+  TRACE_INVALID_FORMAT,
+  TRACE_IN_USE
+};
+
+typedef struct {
+  t_memAddress pc;
+  uint32_t inst;
+  t_cpuRegID rd; /* CPU_REG_ZERO if no register was written */
+  uint32_t rdValue;
+  uint8_t memSize; /* 0 if there was no memory access */
+  bool store;
+  t_memAddress memAddress;
+  uint32_t memValue;
+} t_traceRecord;
+
+typedef void (*t_traceRecordFn)(const t_traceRecord *rec);
+
+/* Records every retired instruction to the file, together with the value
+ * written to the destination register and the address and value of memory
+ * accesses. Records are compressed and written by a background thread.
+ * Only one VM can be traced at a time. */
+t_traceError traceOpen(t_vm *vm, const char *path);
+/* Writes the pending records and closes the file */
+t_traceError traceClose(void);
+
+/* Calls the function for each record of the trace file, in order */
+t_traceError traceRead(const char *path, t_traceRecordFn fn);
+/* Prints the contents of a trace file as text */
+t_traceError traceDump(const char *path, FILE *out);
+
+#endif
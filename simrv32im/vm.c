@@ -0,0 +1,34 @@
+#include <stdlib.h>
+#include "vm.h"
+#include "cpu.h"
+#include "memory.h"
+#include "jit.h"
+#include "supervisor.h"
+#include "loader.h"
+
+
+t_vm *vmNew(void)
+{
+  t_vm *vm = calloc(1, sizeof(t_vm));
+  if (vm == NULL)
+    return NULL;
+  if (!memCreate(vm) || !jitCreate(vm) || !cpuCreate(vm) || !svCreate(vm) ||
+      !ldrCreate(vm)) {
+    vmFree(vm);
+    return NULL;
+  }
+  return vm;
+}
+
+
+void vmFree(t_vm *vm)
+{
+  if (vm == NULL)
+    return;
+  ldrDestroy(vm);
+  svDestroy(vm);
+  cpuDestroy(vm);
+  jitDestroy(vm);
+  memDestroy(vm);
+  free(vm);
+}
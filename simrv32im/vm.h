@@ -0,0 +1,23 @@
+#ifndef VM_H
+#define VM_H
+
+/* A simulated machine: the CPU, its memory, the supervisor and the program
+ * loaded into it. The VMs are independent from each other, and different
+ * VMs can be run at the same time by different threads. The analysis models
+ * (caches, branch predictor, pipeline, basic block vectors, traces, cache
+ * sweeps and the debugger) are per-process: attaching them to a second VM
+ * fails, except for the debugger which moves to the new VM. The call graph
+ * is per-thread instead. */
+typedef struct vm {
+  struct cpu *cpu;
+  struct mem *mem;
+  struct jit *jit;
+  struct sv *sv;
+  struct ldr *ldr;
+} t_vm;
+
+/* Returns NULL if there is not enough memory */
+t_vm *vmNew(void);
+void vmFree(t_vm *vm);
+
+#endif